@@ -58,15 +58,18 @@
 #define MBEDTLS_ASN1_PARSE_C
 #define MBEDTLS_ASN1_WRITE_C
 #define MBEDTLS_BIGNUM_C
+#define MBEDTLS_CHACHA20_C
+#define MBEDTLS_CHACHAPOLY_C
 #define MBEDTLS_CIPHER_C
 #define MBEDTLS_CTR_DRBG_C
 #define MBEDTLS_ECDH_C
 #define MBEDTLS_ECDSA_C
 #define MBEDTLS_ECP_C
 #define MBEDTLS_ENTROPY_C
-//#define MBEDTLS_GCM_C
+#define MBEDTLS_GCM_C
 #define MBEDTLS_CCM_C
 #define MBEDTLS_MD_C
+#define MBEDTLS_POLY1305_C
 //#define MBEDTLS_NET_C
 #define MBEDTLS_OID_C
 #define MBEDTLS_PEM_WRITE_C
@@ -90,6 +93,18 @@
 #define MBEDTLS_DEBUG_C
 #define MBEDTLS_ERROR_C
 #define MBEDTLS_SSL_DTLS_ANTI_REPLAY
+/* Handshake signatures can be made by worker threads */
+#define MBEDTLS_SSL_ASYNC_PRIVATE
+/* Clients can negotiate smaller records, and the record buffers of a
+ * connection are shrunk to the negotiated size after the handshake */
+#define MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+#define MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+/* Idle connections are saved and their contexts freed until they are
+ * used again */
+#define MBEDTLS_SSL_CONTEXT_SERIALIZATION
+/* The client knows if it has AES instructions, the server uses its
+ * order of ciphersuites */
+#define MBEDTLS_SSL_SRV_RESPECT_CLIENT_PREFERENCE
 
 /* For test certificates */
 #define MBEDTLS_BASE64_C
@@ -119,6 +134,8 @@
 
 /* Save ROM and a few bytes of RAM by specifying our own ciphersuite list */
 #define MBEDTLS_SSL_CIPHERSUITES                        \
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,      \
+  MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256, \
   MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM
 
 /*
@@ -67,6 +67,237 @@ nabto_device_connection_is_local(NabtoDevice* device,
 NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
 nabto_device_limit_stream_segments(NabtoDevice* device, size_t limit);
 
+/**
+ * Open the main and the local UDP ports with several sockets each.
+ *
+ * The sockets share the port using SO_REUSEPORT and the kernel
+ * distributes the remote endpoints between them, such that the
+ * receive work for many connections is spread over more than one
+ * socket. It is only available on platforms which supports shared
+ * ports, on other platforms the device uses one socket per port.
+ *
+ * This must be called before nabto_device_start.
+ *
+ * @param device  The device.
+ * @param shards  Number of sockets per port, from 1 (the default) to 8.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_INVALID_ARGUMENT if shards is out of range
+ *         NABTO_DEVICE_EC_INVALID_STATE if the device is started.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_udp_socket_shards(NabtoDevice* device, size_t shards);
+
+/**
+ * Set the max number of concurrent client connections, the default
+ * is 10.
+ *
+ * The connection table is allocated up front and the DTLS connections
+ * and their buffers are allocated in a pool of this size when the
+ * first client connects, so a large limit costs memory even when few
+ * clients are connected. New connections are rejected when the limit
+ * is reached.
+ *
+ * This must be called before nabto_device_start.
+ *
+ * @param device  The device.
+ * @param limit  The max number of client connections, must be at least 1.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_INVALID_ARGUMENT if limit is 0
+ *         NABTO_DEVICE_EC_INVALID_STATE if the device is started
+ *         NABTO_DEVICE_EC_OUT_OF_MEMORY if the connection table could not be allocated.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_limit_connections(NabtoDevice* device, size_t limit);
+
+/**
+ * Get the number of bytes which is preallocated for each client
+ * connection. The memory used for the connections is approximately
+ * the connection limit times this cost.
+ *
+ * @param device  The device.
+ * @param cost  The number of bytes per connection.
+ * @return NABTO_DEVICE_EC_OK on success
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_connection_memory_cost(NabtoDevice* device, size_t* cost);
+
+/**
+ * Get the number of bytes currently retained by a client
+ * connection. Once the handshake is done it can be lower than the
+ * connection memory cost, since the handshake state is released and
+ * the DTLS record buffers are shrunk if the client has negotiated a
+ * max fragment length.
+ *
+ * @param device  The device.
+ * @param ref  The connection reference.
+ * @param usage  The number of bytes retained by the connection.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_INVALID_CONNECTION if the connection does not exist.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_connection_get_memory_usage(NabtoDevice* device, NabtoDeviceConnectionRef ref, size_t* usage);
+
+/**
+ * Set the max number of ready events the internal event queue
+ * executes each time it takes the mutex which protects the core of
+ * the device. Under load a batch saves lock traffic, a smaller batch
+ * lets calls to the api in sooner. The default is 32. A batch also
+ * ends after a few milliseconds.
+ *
+ * @param device  The device.
+ * @param batchSize  The max number of events in a batch, at least 1.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_INVALID_ARGUMENT if batchSize is 0
+ *         NABTO_DEVICE_EC_NOT_IMPLEMENTED if the event queue of the platform executes one event at a time.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_event_batch_size(NabtoDevice* device, size_t batchSize);
+
+/**
+ * Get the number of events the internal event queue has allocated
+ * memory for. The events of the core are embedded in the connections,
+ * streams and other objects which owns them, so the count stays 0
+ * unless a platform integration allocates events.
+ *
+ * @param device  The device.
+ * @param allocations  The number of allocated events.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_NOT_IMPLEMENTED if the event queue of the platform does not count allocations.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_event_allocations(NabtoDevice* device, size_t* allocations);
+
+/**
+ * Get statistics for the events the internal event queue has
+ * executed, such that it can be seen which parts of the device holds
+ * the mutex which protects the core of the device. The stats are
+ * returned as json:
+ *
+ * {
+ *   "depth": <histogram>,      ready events waiting when an event is taken.
+ *   "latencyUs": <histogram>,  microseconds from an event is posted, or a
+ *                              timed event expires, until it is executed.
+ *   "durationUs": <histogram>, microseconds the event callbacks take.
+ *   "callbacks": [ { "callback": "<address>", "durationUs": <histogram> }, ... ],
+ *   "otherCallbacksDurationUs": <histogram>
+ * }
+ *
+ * A histogram is { "count": n, "sum": n, "max": n, "buckets": [ ... ] }
+ * where bucket 0 counts the value 0, bucket i counts values in
+ * [2^(i-1), 2^i) and the last bucket also counts larger values. The
+ * callbacks are sorted by the total time they have taken. If the
+ * platform has dladdr a callback also has the "object" file and the
+ * "objectOffset" of the callback, which addr2line can resolve, and
+ * the nearest exported "symbol". Callbacks which does not fit in the
+ * table of callbacks are counted in otherCallbacksDurationUs.
+ *
+ * @param device  The device.
+ * @param stats  The json stats, free it with nabto_device_string_free.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_OUT_OF_MEMORY if the stats could not be allocated.
+ *         NABTO_DEVICE_EC_NOT_IMPLEMENTED if the event queue of the platform does not keep statistics,
+ *         e.g. if it is built with NP_EVENT_QUEUE_STATS defined as 0.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_event_queue_stats(NabtoDevice* device, char** stats);
+
+/**
+ * Hibernate client connections which has had no open streams, no
+ * unfinished CoAP requests and no traffic except keep alives for
+ * idleTimeoutMs milliseconds. A hibernated connection releases its
+ * DTLS record buffers and only keeps its keys and connection id, the
+ * keep alive of hibernated connections is handled by a single timer
+ * for all connections. The next packet from the client wakes the
+ * connection up again. Hibernation is disabled by default.
+ *
+ * @param device  The device.
+ * @param idleTimeoutMs  The idle time before a connection is hibernated, 0 disables hibernation.
+ * @return NABTO_DEVICE_EC_OK on success
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_connection_idle_timeout(NabtoDevice* device, uint32_t idleTimeoutMs);
+
+/**
+ * Limit the number of DTLS handshakes which can be in progress at the
+ * same time, the default is 4. ClientHellos for new connections are
+ * ignored while the limit is reached, the clients retransmit them.
+ *
+ * @param device  The device.
+ * @param limit  The max number of concurrent handshakes, 0 is unlimited.
+ * @return NABTO_DEVICE_EC_OK on success
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_max_concurrent_handshakes(NabtoDevice* device, size_t limit);
+
+/**
+ * Limit the rate of new DTLS handshakes from each source. Sources are
+ * grouped by the given address prefix lengths, such that e.g. a /64
+ * ipv6 network is one source. The default is 5 handshakes per second
+ * with a burst of 10 per ipv4 address and ipv6 /64 prefix.
+ *
+ * @param device  The device.
+ * @param rate  New handshakes per second per source, 0 disables the limit.
+ * @param burst  Handshakes a source can make in a burst.
+ * @param ipv4Prefix  Prefix length of ipv4 sources, 0-32.
+ * @param ipv6Prefix  Prefix length of ipv6 sources, 0-128.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_INVALID_ARGUMENT if the burst or a prefix length is invalid.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_handshake_rate_limit(NabtoDevice* device, uint32_t rate, uint32_t burst,
+                                      uint8_t ipv4Prefix, uint8_t ipv6Prefix);
+
+/**
+ * Get the number of new DTLS handshakes which have been accepted,
+ * deferred because too many handshakes were in progress, and dropped
+ * because the source exceeded its rate.
+ *
+ * @param device  The device.
+ * @param accepted  Number of accepted handshakes.
+ * @param deferred  Number of deferred handshakes.
+ * @param dropped  Number of dropped handshakes.
+ * @return NABTO_DEVICE_EC_OK on success
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_handshake_counters(NabtoDevice* device, uint64_t* accepted, uint64_t* deferred, uint64_t* dropped);
+
+/**
+ * Make the private key signatures of DTLS handshakes in a pool of
+ * worker threads instead of the thread which runs the device, such
+ * that the established connections are not stalled while new
+ * connections are made. By default the signatures are made by the
+ * device thread.
+ *
+ * This must be called before nabto_device_start.
+ *
+ * @param device  The device.
+ * @param threads  Number of worker threads, 0 disables the pool.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_INVALID_ARGUMENT if threads is above 16
+ *         NABTO_DEVICE_EC_INVALID_STATE if the device is started
+ *         NABTO_DEVICE_EC_NOT_IMPLEMENTED if the DTLS implementation cannot sign asynchronously.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_handshake_worker_threads(NabtoDevice* device, size_t threads);
+
+/**
+ * Copy the full fingerprint of the client of a connection into a
+ * buffer as a NULL terminated hex string. Unlike
+ * nabto_device_connection_get_client_fingerprint_full_hex nothing is
+ * allocated, such that it can be used for each access check.
+ *
+ * @param device  The device.
+ * @param ref  The connection reference.
+ * @param fp  Buffer for the fingerprint.
+ * @param fpSize  Size of the buffer, at least 65 bytes.
+ * @return NABTO_DEVICE_EC_OK on success
+ *         NABTO_DEVICE_EC_INVALID_ARGUMENT if the buffer is too small
+ *         NABTO_DEVICE_EC_INVALID_CONNECTION if the connection does not exist.
+ */
+NABTO_DEVICE_DECL_PREFIX NabtoDeviceError NABTO_DEVICE_API
+nabto_device_connection_copy_client_fingerprint_full_hex(NabtoDevice* device, NabtoDeviceConnectionRef ref,
+                                                         char* fp, size_t fpSize);
+
 
 
 
@@ -27,6 +27,8 @@ set(ne_mbedtls_random_src
 set(ne_eventqueue_dir ${ne_dir}/src/modules/event_queue)
 set(ne_event_queue_src
   ${ne_eventqueue_dir}/nm_event_queue.c
+  ${ne_eventqueue_dir}/nm_mpsc_queue.c
+  ${ne_eventqueue_dir}/nm_event_queue_stats.c
   )
 
 set(ne_thread_event_queue_src
@@ -83,6 +85,26 @@ set(ne_select_unix_src
   ${ne_select_unix_dir}/nm_select_unix.c
   ${ne_select_unix_dir}/nm_select_unix_udp.c
   ${ne_select_unix_dir}/nm_select_unix_tcp.c
+  ${ne_unix_dir}/nm_unix_udp.c
+)
+
+# Nabto epoll unix impl.
+set(ne_epoll_unix_dir ${ne_dir}/src/modules/epoll_unix)
+set(ne_epoll_unix_src
+  ${ne_epoll_unix_dir}/nm_epoll_unix.c
+  ${ne_epoll_unix_dir}/nm_epoll_unix_udp.c
+  ${ne_epoll_unix_dir}/nm_epoll_unix_tcp.c
+  ${ne_epoll_unix_dir}/nm_epoll_unix_mdns_udp_bind.c
+  ${ne_unix_dir}/nm_unix_udp.c
+)
+
+# Nabto io_uring impl.
+set(ne_io_uring_dir ${ne_dir}/src/modules/io_uring)
+set(ne_io_uring_src
+  ${ne_io_uring_dir}/nm_io_uring.c
+  ${ne_io_uring_dir}/nm_io_uring_udp.c
+  ${ne_io_uring_dir}/nm_io_uring_tcp.c
+  ${ne_io_uring_dir}/nm_io_uring_mdns_udp_bind.c
 )
 
 # Nabto tcp tunnel impl.
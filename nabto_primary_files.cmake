@@ -58,6 +58,7 @@ set(ne_core_src
   ${root_dir}/src/core/nc_coap_packet_printer.c
   ${root_dir}/src/core/nc_attacher_attach_start.c
   ${root_dir}/src/core/nc_client_connection_dispatch.c
+  ${root_dir}/src/core/nc_handshake_admission.c
   ${root_dir}/src/core/nc_udp_dispatch.c
   ${root_dir}/src/core/nc_coap.c
   ${root_dir}/src/core/nc_coap_server.c
@@ -90,6 +91,7 @@ set(ne_api_src
   ${root_dir}/src/api/nabto_device_authorization_events.c
   ${root_dir}/src/api/nabto_device_logging.c
   ${root_dir}/src/api/nabto_device_experimental.c
+  ${root_dir}/src/api/nabto_device_event_queue_stats.c
   ${root_dir}/src/api/nabto_device_util.c
   ${root_dir}/src/api/nabto_device_event_handler.c
   ${root_dir}/src/api/nabto_device_connection_events.c
@@ -14,6 +14,7 @@
 #include <platform/np_error_code.h>
 
 #include <platform/np_logging.h>
+#include <platform/np_util.h>
 #include <platform/np_error_code.h>
 #include <core/nc_version.h>
 #include <core/nc_client_connection.h>
@@ -22,6 +23,7 @@
 #include <modules/mbedtls/nm_mbedtls_cli.h>
 #include <modules/mbedtls/nm_mbedtls_srv.h>
 #include <modules/mbedtls/nm_mbedtls_random.h>
+#include <modules/mbedtls/nm_mbedtls_async_pk.h>
 
 #include <modules/communication_buffer/nm_communication_buffer.h>
 
@@ -149,6 +151,7 @@ void NABTO_DEVICE_API nabto_device_free(NabtoDevice* device)
     //nabto_device_event_queue_stop(&dev->pl);
 
     nc_device_deinit(&dev->core);
+    nm_mbedtls_async_pk_pool_destroy(dev->asyncPkPool);
 
 
     nabto_device_platform_deinit(dev);
@@ -235,6 +238,7 @@ NabtoDeviceError NABTO_DEVICE_API nabto_device_set_private_key(NabtoDevice* devi
     np_error_code ec = NABTO_DEVICE_EC_OK;
     nabto_device_threads_mutex_lock(dev->eventMutex);
     free(dev->privateKey);
+    dev->hasDeviceFingerprint = false;
 
     dev->privateKey = strdup(str);
     if (dev->privateKey == NULL) {
@@ -247,6 +251,14 @@ NabtoDeviceError NABTO_DEVICE_API nabto_device_set_private_key(NabtoDevice* devi
             dev->publicKey = NULL;
         }
         dev->publicKey = crt;
+        if (ec == NABTO_EC_OK) {
+            ec = nm_dtls_get_fingerprint_from_private_key(dev->privateKey, dev->deviceFingerprint);
+        }
+        if (ec == NABTO_EC_OK) {
+            np_data_to_hex(dev->deviceFingerprint, 32, dev->deviceFingerprintHex);
+            dev->deviceFingerprintHex[64] = 0;
+            dev->hasDeviceFingerprint = true;
+        }
     }
 
     nabto_device_threads_mutex_unlock(dev->eventMutex);
@@ -354,19 +366,18 @@ NabtoDeviceError NABTO_DEVICE_API nabto_device_start(NabtoDevice* device)
     return nabto_device_error_core_to_api(ec);
 }
 
-static char* toHex(uint8_t* data, size_t dataLength)
+/**
+ * Copy the first hexLength characters of a cached hex fingerprint to
+ * a string which the user frees.
+ */
+static char* copyHex(const char* hex, size_t hexLength)
 {
-    size_t outputLength = dataLength*2 + 1;
-    char* output = (char*)malloc(outputLength);
+    char* output = (char*)malloc(hexLength + 1);
     if (output == NULL) {
         return output;
     }
-    memset(output,0,outputLength);
-    size_t i;
-    for (i = 0; i < dataLength; i++) {
-        size_t outputOffset = i*2;
-        sprintf(output+outputOffset, "%02x", data[i]);
-    }
+    memcpy(output, hex, hexLength);
+    output[hexLength] = 0;
     return output;
 }
 
@@ -376,13 +387,15 @@ NabtoDeviceError NABTO_DEVICE_API nabto_device_get_device_fingerprint_hex(NabtoD
     struct nabto_device_context* dev = (struct nabto_device_context*)device;
     np_error_code ec;
     nabto_device_threads_mutex_lock(dev->eventMutex);
-    if (dev->privateKey == NULL) {
-        ec = NABTO_DEVICE_EC_INVALID_STATE;
-    }
-    uint8_t hash[32];
-    ec = nm_dtls_get_fingerprint_from_private_key(dev->privateKey, hash);
-    if (ec == NABTO_EC_OK) {
-        *fingerprint = toHex(hash, 16);
+    if (!dev->hasDeviceFingerprint) {
+        ec = NABTO_EC_INVALID_STATE;
+    } else {
+        *fingerprint = copyHex(dev->deviceFingerprintHex, 32);
+        if (*fingerprint == NULL) {
+            ec = NABTO_EC_OUT_OF_MEMORY;
+        } else {
+            ec = NABTO_EC_OK;
+        }
     }
 
     nabto_device_threads_mutex_unlock(dev->eventMutex);
@@ -395,13 +408,15 @@ NabtoDeviceError NABTO_DEVICE_API nabto_device_get_device_fingerprint_full_hex(N
     struct nabto_device_context* dev = (struct nabto_device_context*)device;
     np_error_code ec;
     nabto_device_threads_mutex_lock(dev->eventMutex);
-    if (dev->privateKey == NULL) {
-        ec = NABTO_DEVICE_EC_INVALID_STATE;
-    }
-    uint8_t hash[32];
-    ec = nm_dtls_get_fingerprint_from_private_key(dev->privateKey, hash);
-    if (ec == NABTO_EC_OK) {
-        *fingerprint = toHex(hash, 32);
+    if (!dev->hasDeviceFingerprint) {
+        ec = NABTO_EC_INVALID_STATE;
+    } else {
+        *fingerprint = copyHex(dev->deviceFingerprintHex, 64);
+        if (*fingerprint == NULL) {
+            ec = NABTO_EC_OUT_OF_MEMORY;
+        } else {
+            ec = NABTO_EC_OK;
+        }
     }
 
     nabto_device_threads_mutex_unlock(dev->eventMutex);
@@ -416,14 +431,19 @@ nabto_device_connection_get_client_fingerprint_hex(NabtoDevice* device, NabtoDev
     NabtoDeviceError ec = NABTO_DEVICE_EC_OK;
     nabto_device_threads_mutex_lock(dev->eventMutex);
 
-    uint8_t clientFingerprint[32];
-
     struct nc_client_connection* connection = nc_device_connection_from_ref(&dev->core, connectionRef);
+    const char* clientFingerprintHex = NULL;
+    if (connection != NULL) {
+        clientFingerprintHex = nc_client_connection_get_client_fingerprint_hex(connection);
+    }
 
-    if (connection == NULL || nc_client_connection_get_client_fingerprint(connection, clientFingerprint) != NABTO_EC_OK) {
+    if (clientFingerprintHex == NULL) {
         ec = NABTO_EC_INVALID_CONNECTION;
     } else {
-        *fp = toHex(clientFingerprint, 16);
+        *fp = copyHex(clientFingerprintHex, 32);
+        if (*fp == NULL) {
+            ec = NABTO_DEVICE_EC_OUT_OF_MEMORY;
+        }
     }
 
     nabto_device_threads_mutex_unlock(dev->eventMutex);
@@ -438,14 +458,19 @@ nabto_device_connection_get_client_fingerprint_full_hex(NabtoDevice* device, Nab
     NabtoDeviceError ec = NABTO_DEVICE_EC_OK;
     nabto_device_threads_mutex_lock(dev->eventMutex);
 
-    uint8_t clientFingerprint[32];
-
     struct nc_client_connection* connection = nc_device_connection_from_ref(&dev->core, connectionRef);
+    const char* clientFingerprintHex = NULL;
+    if (connection != NULL) {
+        clientFingerprintHex = nc_client_connection_get_client_fingerprint_hex(connection);
+    }
 
-    if (connection == NULL || nc_client_connection_get_client_fingerprint(connection, clientFingerprint) != NABTO_EC_OK) {
+    if (clientFingerprintHex == NULL) {
         ec = NABTO_EC_INVALID_CONNECTION;
     } else {
-        *fp = toHex(clientFingerprint, 32);
+        *fp = copyHex(clientFingerprintHex, 64);
+        if (*fp == NULL) {
+            ec = NABTO_DEVICE_EC_OUT_OF_MEMORY;
+        }
     }
 
     nabto_device_threads_mutex_unlock(dev->eventMutex);
@@ -32,6 +32,9 @@ static void handle_verdict(void* userData);
 struct np_authorization_request* create_request(struct np_platform* pl, uint64_t connectionRef, const char* action)
 {
     struct nabto_device_authorization_request* request = calloc(1, sizeof(struct nabto_device_authorization_request));
+    if (request == NULL) {
+        return NULL;
+    }
     request->connectionReference = connectionRef;
     request->action = action;
     request->attributes = NULL;
@@ -40,13 +43,7 @@ struct np_authorization_request* create_request(struct np_platform* pl, uint64_t
     request->verdictDone = false;
     request->module = pl->authorizationData;
 
-    np_error_code ec;
-    ec = np_event_queue_create_event(&pl->eq, handle_verdict, request, &request->verdictEvent);
-    if (ec != NABTO_EC_OK) {
-        free(request);
-        return NULL;
-    }
-
+    np_event_queue_init_event(&pl->eq, &request->verdictEvent, handle_verdict, request);
 
     return (struct np_authorization_request*)request;
 }
@@ -107,7 +104,7 @@ void do_verdict(struct nabto_device_authorization_request* authReq, bool verdict
         struct np_platform* pl = authReq->module->pl;
         authReq->verdict = verdict;
         authReq->verdictDone = true;
-        np_event_queue_post(&pl->eq, authReq->verdictEvent);
+        np_event_queue_post(&pl->eq, &authReq->verdictEvent);
     }
 }
 
@@ -295,7 +292,7 @@ static void free_request_when_unused(struct nabto_device_authorization_request*
     }
     struct np_platform* pl = authReq->module->pl;
     struct np_event_queue* eq = &pl->eq;
-    np_event_queue_destroy_event(eq, authReq->verdictEvent);
+    np_event_queue_deinit_event(eq, &authReq->verdictEvent);
     free(authReq);
 }
 
@@ -14,6 +14,7 @@
 #define LOG NABTO_LOG_MODULE_API
 
 np_error_code nabto_device_coap_listener_callback(const np_error_code ec, struct nabto_device_future* future, void* eventData, void* listenerData);
+static void nabto_device_coap_request_end(struct nabto_device_coap_request* req);
 
 NabtoDeviceError nabto_device_coap_error_module_to_api(nabto_coap_error ec) {
     switch(ec) {
@@ -94,6 +95,7 @@ void NABTO_DEVICE_API nabto_device_coap_request_free(NabtoDeviceCoapRequest* req
     struct nabto_device_coap_request* req = (struct nabto_device_coap_request*)request;
     struct nabto_device_context* dev = req->dev;
     nabto_device_threads_mutex_lock(dev->eventMutex);
+    nabto_device_coap_request_end(req);
     nabto_coap_server_request_free(req->req);
     free(req);
     nabto_device_threads_mutex_unlock(dev->eventMutex);
@@ -225,6 +227,7 @@ np_error_code nabto_device_coap_listener_callback(const np_error_code ec, struct
             retEc = NABTO_EC_UNKNOWN;
             // If this fails we should just keep cleaning up
             nabto_coap_server_send_error_response(req->req, NABTO_COAP_CODE(5,03), "Handler unavailable");
+            nabto_device_coap_request_end(req);
             free(req);
         }
         // using the coap request structure as event structure means it will be freed when user sends the response
@@ -237,6 +240,7 @@ np_error_code nabto_device_coap_listener_callback(const np_error_code ec, struct
         struct nabto_device_coap_request* req = (struct nabto_device_coap_request*)eventData;
         // if this fails we should just keep cleaning up
         nabto_coap_server_send_error_response(req->req, NABTO_COAP_CODE(5,03), "Handler unavailable");
+        nabto_device_coap_request_end(req);
         free(req);
         retEc = ec;
     }
@@ -269,6 +273,20 @@ void nabto_device_coap_resource_handler(struct nabto_coap_server_request* reques
             nabto_coap_server_send_error_response(request, NABTO_COAP_CODE(5,00), "Insufficient resources");
             nabto_coap_server_request_free(request);
             free(req);
+        } else if (connection != NULL) {
+            nc_client_connection_coap_request_begin(connection);
         }
     }
 }
+
+/**
+ * The connection can have been closed while the application handled
+ * the request.
+ */
+void nabto_device_coap_request_end(struct nabto_device_coap_request* req)
+{
+    struct nc_client_connection* connection = nc_device_connection_from_ref(&req->dev->core, req->connectionRef);
+    if (connection != NULL) {
+        nc_client_connection_coap_request_end(connection);
+    }
+}
@@ -39,6 +39,11 @@ struct nabto_device_context {
     char* privateKey;
     uint16_t port;
 
+    // The fingerprint of the private key, computed when the key is set.
+    bool hasDeviceFingerprint;
+    uint8_t deviceFingerprint[32];
+    char deviceFingerprintHex[65];
+
     struct nabto_device_future* closeFut;
 
     struct nm_tcp_tunnels tcpTunnels;
@@ -46,6 +51,10 @@ struct nabto_device_context {
     struct nabto_device_future_queue futureQueue;
     struct nabto_device_authorization_module authorization;
 
+    // worker threads for handshake signatures, NULL if they are made
+    // on the core thread.
+    struct nm_mbedtls_async_pk_pool* asyncPkPool;
+
     void* platformAdapter;
 };
 
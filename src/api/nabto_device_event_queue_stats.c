@@ -0,0 +1,201 @@
+#if defined(HAVE_DLADDR) && !defined(_GNU_SOURCE)
+// dladdr is a GNU extension
+#define _GNU_SOURCE
+#endif
+
+#include <nabto/nabto_device_experimental.h>
+#include "nabto_device_defines.h"
+
+#include "nabto_device_error.h"
+
+#include <platform/np_event_queue_wrapper.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_DLADDR)
+#include <dlfcn.h>
+#endif
+
+/**
+ * The event queue stats are formatted as json, see
+ * nabto_device_get_event_queue_stats.
+ */
+
+struct json_buffer {
+    char* data;
+    size_t size;
+    size_t used;
+    bool failed;
+};
+
+static void json_append(struct json_buffer* buffer, const char* format, ...);
+static void json_string(struct json_buffer* buffer, const char* str);
+static void json_histogram(struct json_buffer* buffer, const struct np_event_queue_histogram* histogram);
+static void json_callback(struct json_buffer* buffer, const struct np_event_queue_callback_stats* callback);
+static int compare_callbacks(const void* a, const void* b);
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_event_queue_stats(NabtoDevice* device, char** stats)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    struct np_event_queue_stats* s = calloc(1, sizeof(struct np_event_queue_stats));
+    if (s == NULL) {
+        return NABTO_DEVICE_EC_OUT_OF_MEMORY;
+    }
+
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+    np_error_code ec = np_event_queue_get_stats(&dev->pl.eq, s);
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    if (ec != NABTO_EC_OK) {
+        free(s);
+        return nabto_device_error_core_to_api(ec);
+    }
+
+    // list the callbacks which has taken the most time first.
+    const struct np_event_queue_callback_stats* callbacks[NP_EVENT_QUEUE_STATS_CALLBACKS];
+    size_t callbacksSize = 0;
+    for (size_t i = 0; i < NP_EVENT_QUEUE_STATS_CALLBACKS; i++) {
+        if (s->callbacks[i].cb != NULL) {
+            callbacks[callbacksSize++] = &s->callbacks[i];
+        }
+    }
+    qsort(callbacks, callbacksSize, sizeof(callbacks[0]), &compare_callbacks);
+
+    struct json_buffer buffer;
+    memset(&buffer, 0, sizeof(struct json_buffer));
+    buffer.size = 4096;
+    buffer.data = malloc(buffer.size);
+    buffer.failed = (buffer.data == NULL);
+    json_append(&buffer, "{\"depth\":");
+    json_histogram(&buffer, &s->depth);
+    json_append(&buffer, ",\"latencyUs\":");
+    json_histogram(&buffer, &s->latency);
+    json_append(&buffer, ",\"durationUs\":");
+    json_histogram(&buffer, &s->duration);
+    json_append(&buffer, ",\"callbacks\":[");
+    for (size_t i = 0; i < callbacksSize; i++) {
+        if (i > 0) {
+            json_append(&buffer, ",");
+        }
+        json_callback(&buffer, callbacks[i]);
+    }
+    json_append(&buffer, "],\"otherCallbacksDurationUs\":");
+    json_histogram(&buffer, &s->otherCallbacks);
+    json_append(&buffer, "}");
+    free(s);
+
+    if (buffer.failed) {
+        free(buffer.data);
+        return NABTO_DEVICE_EC_OUT_OF_MEMORY;
+    }
+    *stats = buffer.data;
+    return NABTO_DEVICE_EC_OK;
+}
+
+void json_append(struct json_buffer* buffer, const char* format, ...)
+{
+    if (buffer->failed) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(buffer->data + buffer->used, buffer->size - buffer->used, format, args);
+    va_end(args);
+    if (length < 0) {
+        buffer->failed = true;
+        return;
+    }
+    if (buffer->used + (size_t)length >= buffer->size) {
+        size_t size = buffer->size * 2;
+        if (size < buffer->used + (size_t)length + 1) {
+            size = buffer->used + (size_t)length + 1024;
+        }
+        char* data = realloc(buffer->data, size);
+        if (data == NULL) {
+            buffer->failed = true;
+            return;
+        }
+        buffer->data = data;
+        buffer->size = size;
+        va_start(args, format);
+        vsnprintf(buffer->data + buffer->used, buffer->size - buffer->used, format, args);
+        va_end(args);
+    }
+    buffer->used += (size_t)length;
+}
+
+/**
+ * Append the characters of a json string, the quotes are not added.
+ */
+void json_string(struct json_buffer* buffer, const char* str)
+{
+    for (const char* c = str; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            json_append(buffer, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            json_append(buffer, "\\u%04x", (unsigned int)(unsigned char)*c);
+        } else {
+            json_append(buffer, "%c", *c);
+        }
+    }
+}
+
+void json_histogram(struct json_buffer* buffer, const struct np_event_queue_histogram* histogram)
+{
+    json_append(buffer, "{\"count\":%llu,\"sum\":%llu,\"max\":%lu,\"buckets\":[",
+                (unsigned long long)histogram->count, (unsigned long long)histogram->sum,
+                (unsigned long)histogram->max);
+    for (size_t i = 0; i < NP_EVENT_QUEUE_HISTOGRAM_BUCKETS; i++) {
+        json_append(buffer, (i == 0) ? "%llu" : ",%llu", (unsigned long long)histogram->buckets[i]);
+    }
+    json_append(buffer, "]}");
+}
+
+/**
+ * A callback is identified by its address. If the platform has dladdr
+ * the nearest exported symbol and the offset in the object file is
+ * added, a static function is then found with addr2line on the
+ * object.
+ */
+void json_callback(struct json_buffer* buffer, const struct np_event_queue_callback_stats* callback)
+{
+    void* address = (void*)(uintptr_t)callback->cb;
+    json_append(buffer, "{\"callback\":\"%p\"", address);
+#if defined(HAVE_DLADDR)
+    Dl_info info;
+    if (dladdr(address, &info) != 0) {
+        if (info.dli_fname != NULL) {
+            json_append(buffer, ",\"object\":\"");
+            json_string(buffer, info.dli_fname);
+            json_append(buffer, "\",\"objectOffset\":\"0x%lx\"",
+                        (unsigned long)((const char*)address - (const char*)info.dli_fbase));
+        }
+        if (info.dli_sname != NULL) {
+            json_append(buffer, ",\"symbol\":\"");
+            json_string(buffer, info.dli_sname);
+            json_append(buffer, "+0x%lx\"",
+                        (unsigned long)((const char*)address - (const char*)info.dli_saddr));
+        }
+    }
+#endif
+    json_append(buffer, ",\"durationUs\":");
+    json_histogram(buffer, &callback->duration);
+    json_append(buffer, "}");
+}
+
+int compare_callbacks(const void* a, const void* b)
+{
+    const struct np_event_queue_callback_stats* ca = *(const struct np_event_queue_callback_stats* const*)a;
+    const struct np_event_queue_callback_stats* cb = *(const struct np_event_queue_callback_stats* const*)b;
+    if (ca->duration.sum > cb->duration.sum) {
+        return -1;
+    }
+    if (ca->duration.sum < cb->duration.sum) {
+        return 1;
+    }
+    return 0;
+}
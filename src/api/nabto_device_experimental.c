@@ -1,9 +1,20 @@
 #include <nabto/nabto_device_experimental.h>
 #include "nabto_device_defines.h"
 
+#include "nabto_device_error.h"
+#include "nabto_device_threads.h"
+
 #include <core/nc_stream_manager.h>
+#include <core/nc_client_connection.h>
+#include <core/nc_device.h>
+
+#include <platform/np_event_queue_wrapper.h>
+
+#include <modules/mbedtls/nm_mbedtls_srv.h>
+#include <modules/mbedtls/nm_mbedtls_async_pk.h>
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <mbedtls/ecp.h>
 #include <mbedtls/bignum.h>
@@ -100,3 +111,287 @@ nabto_device_limit_stream_segments(NabtoDevice* device, size_t limit)
 
     return NABTO_DEVICE_EC_OK;
 }
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_udp_socket_shards(NabtoDevice* device, size_t shards)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    np_error_code ec = nc_device_set_udp_shards(&dev->core, shards);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return nabto_device_error_core_to_api(ec);
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_limit_connections(NabtoDevice* device, size_t limit)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    np_error_code ec = nc_device_set_max_client_connections(&dev->core, limit);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return nabto_device_error_core_to_api(ec);
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_connection_memory_cost(NabtoDevice* device, size_t* cost)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    *cost = nc_device_get_connection_memory_cost(&dev->core);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return NABTO_DEVICE_EC_OK;
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_connection_get_memory_usage(NabtoDevice* device, NabtoDeviceConnectionRef ref, size_t* usage)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    np_error_code ec = nc_device_get_connection_memory_usage(&dev->core, ref, usage);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return nabto_device_error_core_to_api(ec);
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_event_batch_size(NabtoDevice* device, size_t batchSize)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    np_error_code ec = np_event_queue_set_batch_size(&dev->pl.eq, batchSize);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return nabto_device_error_core_to_api(ec);
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_event_allocations(NabtoDevice* device, size_t* allocations)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    np_error_code ec = np_event_queue_get_event_allocations(&dev->pl.eq, allocations);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return nabto_device_error_core_to_api(ec);
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_connection_idle_timeout(NabtoDevice* device, uint32_t idleTimeoutMs)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    nc_device_set_connection_idle_timeout(&dev->core, idleTimeoutMs);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return NABTO_DEVICE_EC_OK;
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_max_concurrent_handshakes(NabtoDevice* device, size_t limit)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    nc_device_set_max_concurrent_handshakes(&dev->core, limit);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return NABTO_DEVICE_EC_OK;
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_handshake_rate_limit(NabtoDevice* device, uint32_t rate, uint32_t burst,
+                                      uint8_t ipv4Prefix, uint8_t ipv6Prefix)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    np_error_code ec = nc_device_set_handshake_rate_limit(&dev->core, rate, burst, ipv4Prefix, ipv6Prefix);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return nabto_device_error_core_to_api(ec);
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_get_handshake_counters(NabtoDevice* device, uint64_t* accepted, uint64_t* deferred, uint64_t* dropped)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    struct nc_handshake_admission_counters counters;
+    nc_device_get_handshake_counters(&dev->core, &counters);
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    *accepted = counters.accepted;
+    *deferred = counters.deferred;
+    *dropped = counters.dropped;
+    return NABTO_DEVICE_EC_OK;
+}
+
+static np_error_code async_pk_create_thread(void* (*routine)(void*), void* data,
+                                            struct nm_mbedtls_async_pk_thread** thread);
+static void async_pk_join_thread(struct nm_mbedtls_async_pk_thread* thread);
+static struct nm_mbedtls_async_pk_mutex* async_pk_create_mutex(void);
+static void async_pk_free_mutex(struct nm_mbedtls_async_pk_mutex* mutex);
+static void async_pk_mutex_lock(struct nm_mbedtls_async_pk_mutex* mutex);
+static void async_pk_mutex_unlock(struct nm_mbedtls_async_pk_mutex* mutex);
+static struct nm_mbedtls_async_pk_condition* async_pk_create_condition(void);
+static void async_pk_free_condition(struct nm_mbedtls_async_pk_condition* condition);
+static void async_pk_cond_signal(struct nm_mbedtls_async_pk_condition* condition);
+static void async_pk_cond_wait(struct nm_mbedtls_async_pk_condition* condition,
+                               struct nm_mbedtls_async_pk_mutex* mutex);
+
+// The async pk pool uses the threads of the device.
+static const struct nm_mbedtls_async_pk_threads asyncPkThreads = {
+    .create_thread = &async_pk_create_thread,
+    .join_thread = &async_pk_join_thread,
+    .create_mutex = &async_pk_create_mutex,
+    .free_mutex = &async_pk_free_mutex,
+    .mutex_lock = &async_pk_mutex_lock,
+    .mutex_unlock = &async_pk_mutex_unlock,
+    .create_condition = &async_pk_create_condition,
+    .free_condition = &async_pk_free_condition,
+    .cond_signal = &async_pk_cond_signal,
+    .cond_wait = &async_pk_cond_wait
+};
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_set_handshake_worker_threads(NabtoDevice* device, size_t threads)
+{
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    np_error_code ec = NABTO_EC_OK;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    if (dev->core.state != NC_DEVICE_STATE_SETUP) {
+        ec = NABTO_EC_INVALID_STATE;
+    } else {
+        nm_mbedtls_srv_set_async_pk(dev->core.dtlsServer, NULL);
+        nm_mbedtls_async_pk_pool_destroy(dev->asyncPkPool);
+        dev->asyncPkPool = NULL;
+        if (threads > 0) {
+            ec = nm_mbedtls_async_pk_pool_create(&dev->pl, &asyncPkThreads, threads, &dev->asyncPkPool);
+            if (ec == NABTO_EC_OK) {
+                struct nm_mbedtls_async_pk asyncPk = nm_mbedtls_async_pk_pool_get_impl(dev->asyncPkPool);
+                ec = nm_mbedtls_srv_set_async_pk(dev->core.dtlsServer, &asyncPk);
+                if (ec != NABTO_EC_OK) {
+                    nm_mbedtls_async_pk_pool_destroy(dev->asyncPkPool);
+                    dev->asyncPkPool = NULL;
+                }
+            }
+        }
+    }
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+
+    return nabto_device_error_core_to_api(ec);
+}
+
+np_error_code async_pk_create_thread(void* (*routine)(void*), void* data,
+                                     struct nm_mbedtls_async_pk_thread** thread)
+{
+    struct nabto_device_thread* t = nabto_device_threads_create_thread();
+    if (t == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    np_error_code ec = nabto_device_threads_run(t, routine, data);
+    if (ec != NABTO_EC_OK) {
+        nabto_device_threads_free_thread(t);
+        return ec;
+    }
+    *thread = (struct nm_mbedtls_async_pk_thread*)t;
+    return NABTO_EC_OK;
+}
+
+void async_pk_join_thread(struct nm_mbedtls_async_pk_thread* thread)
+{
+    struct nabto_device_thread* t = (struct nabto_device_thread*)thread;
+    nabto_device_threads_join(t);
+    nabto_device_threads_free_thread(t);
+}
+
+struct nm_mbedtls_async_pk_mutex* async_pk_create_mutex(void)
+{
+    return (struct nm_mbedtls_async_pk_mutex*)nabto_device_threads_create_mutex();
+}
+
+void async_pk_free_mutex(struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    nabto_device_threads_free_mutex((struct nabto_device_mutex*)mutex);
+}
+
+void async_pk_mutex_lock(struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    nabto_device_threads_mutex_lock((struct nabto_device_mutex*)mutex);
+}
+
+void async_pk_mutex_unlock(struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    nabto_device_threads_mutex_unlock((struct nabto_device_mutex*)mutex);
+}
+
+struct nm_mbedtls_async_pk_condition* async_pk_create_condition(void)
+{
+    return (struct nm_mbedtls_async_pk_condition*)nabto_device_threads_create_condition();
+}
+
+void async_pk_free_condition(struct nm_mbedtls_async_pk_condition* condition)
+{
+    nabto_device_threads_free_cond((struct nabto_device_condition*)condition);
+}
+
+void async_pk_cond_signal(struct nm_mbedtls_async_pk_condition* condition)
+{
+    nabto_device_threads_cond_signal((struct nabto_device_condition*)condition);
+}
+
+void async_pk_cond_wait(struct nm_mbedtls_async_pk_condition* condition,
+                        struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    nabto_device_threads_cond_wait((struct nabto_device_condition*)condition,
+                                   (struct nabto_device_mutex*)mutex);
+}
+
+NabtoDeviceError NABTO_DEVICE_API
+nabto_device_connection_copy_client_fingerprint_full_hex(NabtoDevice* device, NabtoDeviceConnectionRef ref,
+                                                         char* fp, size_t fpSize)
+{
+    if (fpSize < NC_CLIENT_CONNECTION_FINGERPRINT_SIZE*2 + 1) {
+        return NABTO_DEVICE_EC_INVALID_ARGUMENT;
+    }
+    struct nabto_device_context* dev = (struct nabto_device_context*)device;
+    np_error_code ec = NABTO_EC_OK;
+    nabto_device_threads_mutex_lock(dev->eventMutex);
+
+    struct nc_client_connection* connection = nc_device_connection_from_ref(&dev->core, ref);
+    const char* clientFingerprintHex = NULL;
+    if (connection != NULL) {
+        clientFingerprintHex = nc_client_connection_get_client_fingerprint_hex(connection);
+    }
+    if (clientFingerprintHex == NULL) {
+        ec = NABTO_EC_INVALID_CONNECTION;
+    } else {
+        memcpy(fp, clientFingerprintHex, NC_CLIENT_CONNECTION_FINGERPRINT_SIZE*2 + 1);
+    }
+
+    nabto_device_threads_mutex_unlock(dev->eventMutex);
+    return nabto_device_error_core_to_api(ec);
+}
@@ -21,8 +21,8 @@ struct event_queue_test {
     struct nabto_device_future* fut;
     struct np_event_queue eq;
     struct np_timestamp timestamp;
-    struct np_event* event;
-    struct np_event* timedEvent;
+    struct np_event event;
+    struct np_event timedEvent;
     uint32_t startTimestamp;
     int test;
 };
@@ -30,8 +30,8 @@ struct event_queue_test {
 static void resolve_and_free_test(struct event_queue_test* t, np_error_code ec)
 {
     nabto_device_future_resolve(t->fut, nabto_device_error_core_to_api(ec));
-    np_event_queue_destroy_event(&t->eq, t->event);
-    np_event_queue_destroy_event(&t->eq, t->timedEvent);
+    np_event_queue_deinit_event(&t->eq, &t->event);
+    np_event_queue_deinit_event(&t->eq, &t->timedEvent);
     free(t);
 }
 
@@ -62,7 +62,7 @@ static void handle_event_callback(void* data)
 
     t->startTimestamp = np_timestamp_now_ms(&t->timestamp);
 
-    np_event_queue_post_timed_event(&t->eq, t->timedEvent, 100 /* milliseconds to defer callback with */);
+    np_event_queue_post_timed_event(&t->eq, &t->timedEvent, 100 /* milliseconds to defer callback with */);
 }
 
 void NABTO_DEVICE_API
@@ -75,14 +75,8 @@ nabto_device_test_event_queue(NabtoDevice* device, NabtoDeviceFuture* future)
     struct np_event_queue* eq = &dev->pl.eq;
     t->eq = dev->pl.eq;
     t->timestamp = dev->pl.timestamp;
-    np_error_code ec = np_event_queue_create_event(eq, handle_event_callback, t, &t->event);
-    if (ec != NABTO_EC_OK) {
-        return resolve_and_free_test(t, ec);
-    }
-    ec = np_event_queue_create_event(eq, handle_timed_event_callback, t, &t->timedEvent);
-    if (ec != NABTO_EC_OK) {
-        return resolve_and_free_test(t, ec);
-    }
+    np_event_queue_init_event(eq, &t->event, handle_event_callback, t);
+    np_event_queue_init_event(eq, &t->timedEvent, handle_timed_event_callback, t);
 
-    np_event_queue_post(eq, t->event);
+    np_event_queue_post(eq, &t->event);
 }
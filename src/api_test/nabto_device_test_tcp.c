@@ -22,7 +22,7 @@ struct tcp_test {
     struct np_tcp_socket* sock;
     struct np_completion_event completionEvent;
     struct np_ip_address ip;
-    struct np_event* timeoutEvent;
+    struct np_event timeoutEvent;
     uint8_t readBuffer[4];
     size_t readLength;
     size_t bytesRead;
@@ -35,7 +35,7 @@ static void resolve_and_free_test(struct tcp_test* t, np_error_code ec)
     nabto_device_future_resolve(t->fut, nabto_device_error_core_to_api(ec));
 
     np_completion_event_deinit(&t->completionEvent);
-    np_event_queue_destroy_event(&t->eq, t->timeoutEvent);
+    np_event_queue_deinit_event(&t->eq, &t->timeoutEvent);
     np_tcp_destroy(&t->tcp, t->sock);
     free(t);
 }
@@ -119,6 +119,7 @@ nabto_device_test_tcp(NabtoDevice* device, const char* ip, uint16_t port, NabtoD
     t->fut = fut;
     t->tcp = dev->pl.tcp;
     t->eq = dev->pl.eq;
+    np_event_queue_init_event(&t->eq, &t->timeoutEvent, timeout, t);
 
     np_error_code ec;
     ec = np_tcp_create(&t->tcp, &t->sock);
@@ -131,13 +132,8 @@ nabto_device_test_tcp(NabtoDevice* device, const char* ip, uint16_t port, NabtoD
         return resolve_and_free_test(t, ec);
     }
 
-    ec = np_event_queue_create_event(&t->eq, timeout, t, &t->timeoutEvent);
-    if (ec != NABTO_EC_OK) {
-        return resolve_and_free_test(t, ec);
-    }
-
     np_tcp_async_connect(&t->tcp, t->sock, &t->ip, port, &t->completionEvent);
 
     // set a 5 seconds timeout on the test.
-    np_event_queue_post_timed_event(&t->eq, t->timeoutEvent, 5000);
+    np_event_queue_post_timed_event(&t->eq, &t->timeoutEvent, 5000);
 }
@@ -22,7 +22,7 @@ struct udp_test {
     struct np_udp_socket* sock;
     struct np_completion_event completionEvent;
     struct np_udp_endpoint ep;
-    struct np_event* timeoutEvent;
+    struct np_event timeoutEvent;
     uint8_t recvBuffer[1500];
 };
 
@@ -31,7 +31,7 @@ static void resolve_and_free_test(struct udp_test* t, np_error_code ec)
     nabto_device_future_resolve(t->fut, nabto_device_error_core_to_api(ec));
 
     np_completion_event_deinit(&t->completionEvent);
-    np_event_queue_destroy_event(&t->eq, t->timeoutEvent);
+    np_event_queue_deinit_event(&t->eq, &t->timeoutEvent);
     np_udp_destroy(&t->udp, t->sock);
     free(t);
 }
@@ -113,6 +113,7 @@ nabto_device_test_udp(NabtoDevice* device, const char* ip, uint16_t port, NabtoD
     t->fut = fut;
     t->udp = dev->pl.udp;
     t->eq = dev->pl.eq;
+    np_event_queue_init_event(&t->eq, &t->timeoutEvent, timeout, t);
 
     np_error_code ec;
     ec = np_udp_create(&t->udp, &t->sock);
@@ -125,13 +126,8 @@ nabto_device_test_udp(NabtoDevice* device, const char* ip, uint16_t port, NabtoD
         return resolve_and_free_test(t, ec);
     }
 
-    ec = np_event_queue_create_event(&t->eq, timeout, t, &t->timeoutEvent);
-    if (ec != NABTO_EC_OK) {
-        return resolve_and_free_test(t, ec);
-    }
-
     np_udp_async_bind_port(&t->udp, t->sock, 0, &t->completionEvent);
 
     // set a 5 seconds timeout on the test.
-    np_event_queue_post_timed_event(&t->eq, t->timeoutEvent, 5000);
+    np_event_queue_post_timed_event(&t->eq, &t->timeoutEvent, 5000);
 }
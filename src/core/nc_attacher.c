@@ -7,6 +7,7 @@
 #include <core/nc_version.h>
 #include <core/nc_device.h>
 #include <platform/np_event_queue_wrapper.h>
+#include <platform/np_timestamp_wrapper.h>
 
 #include <string.h>
 #include <stdlib.h>
@@ -19,12 +20,15 @@
 static const uint32_t ACCESS_DENIED_WAIT_TIME = 3600000; // one hour
 static const uint32_t RETRY_WAIT_TIME = 10000; // 10 seconds
 static const uint8_t MAX_REDIRECT_FOLLOW = 5;
+static const uint32_t ATTACHED_EPS_MAX_AGE = 3600000; // one hour
 
 /******************************
  * local function definitions *
  ******************************/
 static void do_close(struct nc_attach_context* ctx);
 static void reattach(void* data);
+static bool reattach_to_attached_eps(struct nc_attach_context* ctx);
+static void save_attached_eps(struct nc_attach_context* ctx);
 static void resolve_close(void* data);
 
 static void handle_state_change(struct nc_attach_context* ctx);
@@ -94,14 +98,8 @@ np_error_code nc_attacher_init(struct nc_attach_context* ctx, struct np_platform
 
     struct np_event_queue* eq = &pl->eq;
 
-    ec = np_event_queue_create_event(eq, &reattach, ctx, &ctx->reattachTimer);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
-    ec = np_event_queue_create_event(eq, &resolve_close, ctx, &ctx->closeEv);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
+    np_event_queue_init_event(eq, &ctx->reattachTimer, &reattach, ctx);
+    np_event_queue_init_event(eq, &ctx->closeEv, &resolve_close, ctx);
 
     sct_init(ctx);
 
@@ -110,7 +108,7 @@ np_error_code nc_attacher_init(struct nc_attach_context* ctx, struct np_platform
         return ec;
     }
     // Init keep alive with default values,
-    ec = nc_keep_alive_init(&ctx->keepAlive, pl, keep_alive_event, ctx);
+    ec = nc_keep_alive_init(&ctx->keepAlive, &device->keepAliveSweep, keep_alive_event, ctx);
     if (ec != NABTO_EC_OK) {
         return ec;
     }
@@ -151,8 +149,8 @@ void nc_attacher_deinit(struct nc_attach_context* ctx)
         sct_deinit(ctx);
 
         struct np_event_queue* eq = &ctx->pl->eq;
-        np_event_queue_destroy_event(eq, ctx->reattachTimer);
-        np_event_queue_destroy_event(eq, ctx->closeEv);
+        np_event_queue_deinit_event(eq, &ctx->reattachTimer);
+        np_event_queue_deinit_event(eq, &ctx->closeEv);
 
         np_completion_event_deinit(&ctx->senderCompletionEvent);
         np_completion_event_deinit(&ctx->resolveCompletionEvent);
@@ -279,19 +277,19 @@ np_error_code nc_attacher_is_server_connect_tokens_synchronized(struct nc_attach
 void do_close(struct nc_attach_context* ctx)
 {
     if (ctx->moduleState == NC_ATTACHER_MODULE_SETUP) {
-        np_event_queue_post(&ctx->pl->eq, ctx->closeEv);
+        np_event_queue_post(&ctx->pl->eq, &ctx->closeEv);
         return;
     }
     ctx->moduleState = NC_ATTACHER_MODULE_CLOSED;
     switch(ctx->state) {
         case NC_ATTACHER_STATE_RETRY_WAIT:
         case NC_ATTACHER_STATE_ACCESS_DENIED_WAIT:
-            np_event_queue_cancel_event(&ctx->pl->eq, ctx->reattachTimer);
+            np_event_queue_cancel_event(&ctx->pl->eq, &ctx->reattachTimer);
             ctx->state = NC_ATTACHER_STATE_CLOSED;
             handle_state_change(ctx);
             break;
         case NC_ATTACHER_STATE_CLOSED:
-            np_event_queue_post(&ctx->pl->eq, ctx->closeEv);
+            np_event_queue_post(&ctx->pl->eq, &ctx->closeEv);
             break;
         case NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST:
         case NC_ATTACHER_STATE_ATTACHED:
@@ -310,8 +308,8 @@ void do_close(struct nc_attach_context* ctx)
 void resolve_close(void* data)
 {
     struct nc_attach_context* ctx = (struct nc_attach_context*)data;
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->reattachTimer);
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->closeEv);
+    np_event_queue_cancel_event(&ctx->pl->eq, &ctx->reattachTimer);
+    np_event_queue_cancel_event(&ctx->pl->eq, &ctx->closeEv);
     if (ctx->closedCb) {
         nc_attacher_closed_callback cb = ctx->closedCb;
         ctx->closedCb = NULL;
@@ -348,15 +346,15 @@ void handle_state_change(struct nc_attach_context* ctx)
             dns_start_resolve(ctx);
             break;
         case NC_ATTACHER_STATE_CLOSED:
-            np_event_queue_post(&ctx->pl->eq, ctx->closeEv);
+            np_event_queue_post(&ctx->pl->eq, &ctx->closeEv);
             break;
         case NC_ATTACHER_STATE_REDIRECT:
             break;
         case NC_ATTACHER_STATE_RETRY_WAIT:
-            np_event_queue_post_timed_event(&ctx->pl->eq, ctx->reattachTimer, ctx->retryWaitTime);
+            np_event_queue_post_timed_event(&ctx->pl->eq, &ctx->reattachTimer, ctx->retryWaitTime);
             break;
         case NC_ATTACHER_STATE_ACCESS_DENIED_WAIT:
-            np_event_queue_post_timed_event(&ctx->pl->eq, ctx->reattachTimer, ctx->accessDeniedWaitTime);
+            np_event_queue_post_timed_event(&ctx->pl->eq, &ctx->reattachTimer, ctx->accessDeniedWaitTime);
             break;
         case NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST:
             ctx->pl->dtlsC.set_sni(ctx->dtls, ctx->hostname);
@@ -409,6 +407,7 @@ void dns_resolved_callback(const np_error_code ec, void* data)
     }
 
     ctx->hasActiveEp = false;
+    ctx->usingAttachedEps = false;
 
     ctx->state = NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST;
     handle_state_change(ctx);
@@ -419,6 +418,9 @@ void reattach(void* data)
     struct nc_attach_context* ctx = (struct nc_attach_context*)data;
     if (ctx->moduleState == NC_ATTACHER_MODULE_CLOSED) {
         ctx->state = NC_ATTACHER_STATE_CLOSED;
+    } else if (reattach_to_attached_eps(ctx)) {
+        ctx->redirectAttempts = 0;
+        ctx->state = NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST;
     } else {
         memcpy(ctx->dns, ctx->hostname, strlen(ctx->hostname)+1);
         ctx->currentPort = ctx->defaultPort;
@@ -428,6 +430,65 @@ void reattach(void* data)
     handle_state_change(ctx);
 }
 
+/**
+ * Use the endpoints of the basestation the device was last attached
+ * to for the next attach attempt. The DTLS client offers the session
+ * from that basestation, so the attach is a single round trip when
+ * the basestation still knows the session.
+ */
+bool reattach_to_attached_eps(struct nc_attach_context* ctx)
+{
+    if (ctx->attachedEpsSize == 0) {
+        return false;
+    }
+    uint32_t now = np_timestamp_now_ms(&ctx->pl->timestamp);
+    int32_t age = np_timestamp_difference(now, ctx->attachedEpsTimestamp);
+    if (age < 0 || (uint32_t)age > ATTACHED_EPS_MAX_AGE) {
+        ctx->attachedEpsSize = 0;
+        return false;
+    }
+    NABTO_LOG_TRACE(LOG, "Reattaching to the basestation from the last attach");
+    memcpy(ctx->initialPacket.endpoints, ctx->attachedEps, sizeof(ctx->attachedEps));
+    ctx->initialPacket.endpointsSize = ctx->attachedEpsSize;
+    ctx->initialPacket.endpointsIndex = 0;
+    ctx->hasActiveEp = false;
+    ctx->usingAttachedEps = true;
+    return true;
+}
+
+static bool endpoint_equal(const struct np_udp_endpoint* a, const struct np_udp_endpoint* b)
+{
+    if (a->port != b->port || a->ip.type != b->ip.type) {
+        return false;
+    }
+    if (a->ip.type == NABTO_IPV4) {
+        return memcmp(a->ip.ip.v4, b->ip.ip.v4, sizeof(a->ip.ip.v4)) == 0;
+    }
+    return memcmp(a->ip.ip.v6, b->ip.ip.v6, sizeof(a->ip.ip.v6)) == 0;
+}
+
+/**
+ * Remember the endpoints of the basestation the device attached to,
+ * the endpoint which answered is tried first.
+ */
+void save_attached_eps(struct nc_attach_context* ctx)
+{
+    size_t size = 0;
+    if (ctx->hasActiveEp) {
+        ctx->attachedEps[size++] = ctx->activeEp;
+    }
+    size_t i;
+    for (i = 0; i < ctx->initialPacket.endpointsSize && size < NC_ATTACHER_MAX_ENDPOINTS; i++) {
+        const struct np_udp_endpoint* ep = &ctx->initialPacket.endpoints[i];
+        if (!ctx->hasActiveEp || !endpoint_equal(ep, &ctx->activeEp)) {
+            ctx->attachedEps[size++] = *ep;
+        }
+    }
+    ctx->attachedEpsSize = size;
+    ctx->usingAttachedEps = false;
+    ctx->attachedEpsTimestamp = np_timestamp_now_ms(&ctx->pl->timestamp);
+}
+
 void dtls_event_handler(enum np_dtls_cli_event event, void* data)
 {
     struct nc_attach_context* ctx = (struct nc_attach_context*)data;
@@ -462,6 +523,18 @@ void handle_dtls_closed(struct nc_attach_context* ctx)
     // dtls_event_handler() only calls this after moduleState has been check so we dont need to here
     switch(ctx->state) {
         case NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST:
+            if (ctx->usingAttachedEps) {
+                // The basestation from the last attach did not accept
+                // the device, resolve the attach host again right away.
+                NABTO_LOG_TRACE(LOG, "Reattach to the last basestation failed, resolving %s", ctx->hostname);
+                ctx->attachedEpsSize = 0;
+                ctx->usingAttachedEps = false;
+                memcpy(ctx->dns, ctx->hostname, strlen(ctx->hostname)+1);
+                ctx->currentPort = ctx->defaultPort;
+                ctx->state = NC_ATTACHER_STATE_DNS;
+                handle_state_change(ctx);
+                break;
+            }
             // DTLS connect failed and dtls was closed, wait to retry
             // Coap request payload could not be set maybe OOM
             // DTLS was closed while waiting for coap response, most likely closed by peer, wait to retry
@@ -521,6 +594,8 @@ void handle_dtls_access_denied(struct nc_attach_context* ctx)
         nabto_coap_client_request_free(ctx->request);
         ctx->request = NULL;
     }
+    ctx->attachedEpsSize = 0;
+    ctx->usingAttachedEps = false;
     ctx->state = NC_ATTACHER_STATE_ACCESS_DENIED_WAIT;
     handle_state_change(ctx);
 }
@@ -629,6 +704,7 @@ void coap_attach_end_handler(np_error_code ec, void* data)
 
     // start keep alive with default values if above failed
     nc_keep_alive_wait(&ctx->keepAlive);
+    save_attached_eps(ctx);
     ctx->state = NC_ATTACHER_STATE_ATTACHED;
     handle_state_change(ctx);
     if (ctx->listener) {
@@ -122,8 +122,17 @@ struct nc_attach_context {
     struct np_completion_event resolveCompletionEvent;
 
     uint8_t redirectAttempts;
-    struct np_event* reattachTimer;
-    struct np_event* closeEv;
+
+    // Endpoints of the basestation the device was last attached to, a
+    // reattach goes directly to them without DNS and redirects.
+    struct np_udp_endpoint attachedEps[NC_ATTACHER_MAX_ENDPOINTS];
+    size_t attachedEpsSize;
+    uint32_t attachedEpsTimestamp;
+    // true if the current attach attempt uses attachedEps.
+    bool usingAttachedEps;
+
+    struct np_event reattachTimer;
+    struct np_event closeEv;
 
     nc_attacher_attach_start_callback startCallback;
     void* startCallbackUserData;
@@ -6,14 +6,19 @@
 
 #include <platform/np_error_code.h>
 #include <platform/np_logging.h>
+#include <platform/np_communication_buffer.h>
+#include <platform/np_util.h>
+#include <platform/np_timestamp_wrapper.h>
 
 #include <string.h>
 
 #define LOG NABTO_LOG_MODULE_CLIENT_CONNECTION
 
-np_error_code nc_client_connection_async_send_to_udp(uint8_t channelId,
-                                                     uint8_t* buffer, uint16_t bufferSize,
-                                                     np_dtls_srv_send_callback cb, void* data, void* listenerData);
+// The connection header is written into the headroom of the DTLS records.
+#if NP_COMMUNICATION_BUFFER_HEADROOM < 16
+#error "NP_COMMUNICATION_BUFFER_HEADROOM must have room for the 16 byte connection header"
+#endif
+
 void nc_client_connection_mtu_discovered(const np_error_code ec, uint16_t mtu, void* data);
 
 void nc_client_connection_handle_event(enum np_dtls_srv_event event, void* data);
@@ -24,11 +29,18 @@ void nc_client_connection_handle_keep_alive(struct nc_client_connection* conn, u
 void nc_client_connection_keep_alive_start(struct nc_client_connection* conn);
 void nc_client_connection_keep_alive_wait(struct nc_client_connection* conn);
 void nc_client_connection_keep_alive_event(void* data);
+static bool nc_client_connection_keep_alive_check(struct nc_client_connection* conn);
 void nc_client_connection_keep_alive_send_req(struct nc_client_connection* ctx);
 void nc_client_connection_keep_alive_send_response(struct nc_client_connection* connection, uint8_t channelId, uint8_t* buffer, size_t length);
 void nc_client_connection_keep_alive_packet_sent(const np_error_code ec, void* data);
 
 static void nc_client_connection_send_to_udp_cb(const np_error_code ec, void* data);
+static void nc_client_connection_send_next_entry(struct nc_client_connection_send_slot* slot);
+static np_error_code nc_client_connection_init_send_slots(struct nc_client_connection* conn);
+static void nc_client_connection_deinit_send_slots(struct nc_client_connection* conn);
+static void nc_client_connection_handshake_ended(struct nc_client_connection* conn);
+static void nc_client_connection_save_client_fingerprint(struct nc_client_connection* conn);
+static void nc_client_connection_wake(struct nc_client_connection* conn);
 
 np_error_code nc_client_connection_open(struct np_platform* pl, struct nc_client_connection* conn,
                                         struct nc_client_connection_dispatch_context* dispatch,
@@ -37,7 +49,6 @@ np_error_code nc_client_connection_open(struct np_platform* pl, struct nc_client
                                         uint8_t* buffer, uint16_t bufferSize)
 {
     np_error_code ec;
-    uint8_t* start = buffer;
     memset(conn, 0, sizeof(struct nc_client_connection));
     memcpy(conn->id.id, buffer, 16);
     conn->currentChannel.sock = sock;
@@ -54,13 +65,15 @@ np_error_code nc_client_connection_open(struct np_platform* pl, struct nc_client
     }
     conn->device = device;
 
-    ec = nc_keep_alive_init(&conn->keepAlive, conn->pl, &nc_client_connection_keep_alive_event, conn);
+    ec = nc_keep_alive_init(&conn->keepAlive, &device->keepAliveSweep, &nc_client_connection_keep_alive_event, conn);
     if (ec != NABTO_EC_OK) {
         return ec;
     }
 
-    ec = np_completion_event_init(&pl->eq, &conn->sendCompletionEvent, &nc_client_connection_send_to_udp_cb, conn);
+    ec = nc_client_connection_init_send_slots(conn);
     if (ec != NABTO_EC_OK) {
+        nc_client_connection_deinit_send_slots(conn);
+        nc_keep_alive_deinit(&conn->keepAlive);
         return ec;
     }
 
@@ -70,14 +83,31 @@ np_error_code nc_client_connection_open(struct np_platform* pl, struct nc_client
                                      &nc_client_connection_handle_data,
                                      &nc_client_connection_handle_event, conn);
     if (ec != NABTO_EC_OK) {
-        NABTO_LOG_ERROR(LOG, "Failed to create DTLS server connection");
+        if (ec == NABTO_EC_OUT_OF_CONNECTIONS) {
+            NABTO_LOG_INFO(LOG, "Rejecting client connection, the connection limit is reached");
+        } else {
+            NABTO_LOG_ERROR(LOG, "Failed to create DTLS server connection");
+        }
+        nc_client_connection_deinit_send_slots(conn);
+        nc_keep_alive_deinit(&conn->keepAlive);
         return ec;
     }
 
-    // Remove connection ID before passing packet to DTLS
-    memmove(start, start+16, bufferSize-16);
-    bufferSize = bufferSize-16;
-    ec = pl->dtlsS.handle_packet(pl, conn->dtls, conn->currentChannel.channelId, buffer, bufferSize);
+    if (pl->dtlsS.set_client_id != NULL) {
+        // the id the cookie of the ClientHello was verified with.
+        uint8_t clientId[NC_CLIENT_CONNECTION_DISPATCH_CLIENT_ID_SIZE];
+        size_t clientIdSize = nc_client_connection_dispatch_client_id(ep, buffer, clientId);
+        ec = pl->dtlsS.set_client_id(conn->dtls, clientId, clientIdSize);
+        if (ec != NABTO_EC_OK) {
+            pl->dtlsS.destroy_connection(conn->dtls);
+            nc_client_connection_deinit_send_slots(conn);
+            nc_keep_alive_deinit(&conn->keepAlive);
+            return ec;
+        }
+    }
+
+    // Skip the connection ID before passing packet to DTLS
+    ec = pl->dtlsS.handle_packet(pl, conn->dtls, conn->currentChannel.channelId, buffer+16, bufferSize-16);
     NABTO_LOG_INFO(LOG, "Client <-> Device connection: %" PRIu64 " created.", conn->connectionRef);
     return ec;
 }
@@ -117,10 +147,8 @@ np_error_code nc_client_connection_handle_packet(struct np_platform* pl, struct
         conn->currentChannel.sock = sock;
     }
 
-    // Remove connection ID before passing packet to DTLS
-    memmove(start, start+16, bufferSize-16);
-    bufferSize = bufferSize-16;
-    ec = pl->dtlsS.handle_packet(pl, conn->dtls, channelId, buffer, bufferSize);
+    // Skip the connection ID before passing packet to DTLS
+    ec = pl->dtlsS.handle_packet(pl, conn->dtls, channelId, start+16, bufferSize-16);
     return ec;
 }
 
@@ -137,9 +165,10 @@ void nc_client_connection_destroy_connection(struct nc_client_connection* conn)
     nc_keep_alive_deinit(&conn->keepAlive);
     nc_coap_server_remove_connection(&conn->device->coapServer, conn);
     nc_stream_manager_remove_connection(conn->streamManager, conn);
+    nc_client_connection_handshake_ended(conn);
     nc_client_connection_dispatch_close_connection(conn->dispatch, conn);
     pl->dtlsS.destroy_connection(conn->dtls);
-    np_completion_event_deinit(&conn->sendCompletionEvent);
+    nc_client_connection_deinit_send_slots(conn);
 
     memset(conn, 0, sizeof(struct nc_client_connection));
 }
@@ -150,6 +179,7 @@ void nc_client_connection_handle_event(enum np_dtls_srv_event event, void* data)
     if (event == NP_DTLS_SRV_EVENT_CLOSED) {
         nc_client_connection_dtls_closed_cb(NABTO_EC_OK, data);
     } else if (event == NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE) {
+        nc_client_connection_handshake_ended(conn);
         // test fingerprint and alpn
         // if ok try to assign user to connection.
         // if fail, reject the connection.
@@ -161,6 +191,8 @@ void nc_client_connection_handle_event(enum np_dtls_srv_event event, void* data)
             return;
         }
 
+        nc_client_connection_save_client_fingerprint(conn);
+        conn->lastActivity = np_timestamp_now_ms(&conn->pl->timestamp);
         nc_client_connection_keep_alive_start(conn);
         nc_client_connection_event_listener_notify(conn, NC_CONNECTION_EVENT_OPENED);
     }
@@ -181,6 +213,7 @@ void nc_client_connection_handle_data(uint8_t channelId, uint64_t sequence,
     // different from the current channel in use.
 
     if (applicationType != AT_KEEP_ALIVE) {
+        nc_client_connection_wake(conn);
         if (sequence > conn->currentMaxSequence) {
             conn->currentMaxSequence = sequence;
             if (conn->currentChannel.channelId != channelId && conn->alternativeChannel.channelId == channelId) {
@@ -227,6 +260,16 @@ void nc_client_connection_keep_alive_start(struct nc_client_connection* ctx)
 void nc_client_connection_keep_alive_event(void* data)
 {
     struct nc_client_connection* ctx = (struct nc_client_connection*)data;
+    if (nc_client_connection_keep_alive_check(ctx)) {
+        nc_keep_alive_wait(&ctx->keepAlive);
+    }
+}
+
+/**
+ * @return false if the connection is closed because of a keep alive timeout.
+ */
+bool nc_client_connection_keep_alive_check(struct nc_client_connection* ctx)
+{
     struct np_platform* pl = ctx->pl;
 
     uint32_t recvCount;
@@ -236,17 +279,76 @@ void nc_client_connection_keep_alive_event(void* data)
     enum nc_keep_alive_action action = nc_keep_alive_should_send(&ctx->keepAlive, recvCount, sentCount);
     switch(action) {
         case DO_NOTHING:
-            nc_keep_alive_wait(&ctx->keepAlive);
             break;
         case SEND_KA:
             nc_client_connection_keep_alive_send_req(ctx);
-            nc_keep_alive_wait(&ctx->keepAlive);
             break;
         case KA_TIMEOUT:
             NABTO_LOG_INFO(LOG, "Closed connection because of keep alive timeout.");
             nc_client_connection_close_connection(ctx);
-            break;
+            return false;
+    }
+    return true;
+}
+
+void nc_client_connection_idle_sweep(struct nc_client_connection* conn, uint32_t idleTimeout)
+{
+    struct np_platform* pl = conn->pl;
+    if (conn->hibernated) {
+        // A keep alive wakes the DTLS connection but not the client
+        // connection, put it back to sleep when the keep alive has
+        // been sent.
+        if (!conn->keepAlive.isSending) {
+            pl->dtlsS.hibernate(conn->dtls);
+        }
+        return;
+    }
+
+    if (!conn->hasClientFingerprint || pl->dtlsS.hibernate == NULL) {
+        // the handshake has not completed.
+        return;
     }
+    uint32_t now = np_timestamp_now_ms(&pl->timestamp);
+    if (now - conn->lastActivity < idleTimeout ||
+        conn->coapRequests > 0 ||
+        conn->keepAlive.isSending ||
+        nc_stream_manager_connection_has_streams(conn->streamManager, conn))
+    {
+        return;
+    }
+    if (pl->dtlsS.hibernate(conn->dtls) != NABTO_EC_OK) {
+        return;
+    }
+    NABTO_LOG_TRACE(LOG, "Client <-> Device connection: %" PRIu64 " hibernated.", conn->connectionRef);
+    conn->hibernated = true;
+}
+
+void nc_client_connection_wake(struct nc_client_connection* conn)
+{
+    conn->lastActivity = np_timestamp_now_ms(&conn->pl->timestamp);
+    if (conn->hibernated) {
+        // The DTLS connection has woken itself to decrypt the packet.
+        NABTO_LOG_TRACE(LOG, "Client <-> Device connection: %" PRIu64 " woken.", conn->connectionRef);
+        conn->hibernated = false;
+    }
+}
+
+void nc_client_connection_idle_stop(struct nc_client_connection* conn)
+{
+    conn->hibernated = false;
+}
+
+void nc_client_connection_coap_request_begin(struct nc_client_connection* conn)
+{
+    conn->coapRequests++;
+}
+
+void nc_client_connection_coap_request_end(struct nc_client_connection* conn)
+{
+    if (conn->coapRequests > 0) {
+        conn->coapRequests--;
+    }
+    conn->lastActivity = np_timestamp_now_ms(&conn->pl->timestamp);
 }
 
 void nc_client_connection_keep_alive_send_req(struct nc_client_connection* ctx)
@@ -286,42 +388,111 @@ struct np_dtls_srv_connection* nc_client_connection_get_dtls_connection(struct n
 
 void nc_client_connection_send_to_udp_cb(const np_error_code ec, void* data)
 {
-    struct nc_client_connection* conn = (struct nc_client_connection*)data;
-    if (conn->sentCb == NULL) {
+    struct nc_client_connection_send_slot* slot = data;
+    if (!slot->inUse) {
+        return;
+    }
+    if (ec == NABTO_EC_OK && slot->entriesSent < slot->entriesSize) {
+        nc_client_connection_send_next_entry(slot);
         return;
     }
-    np_dtls_srv_send_callback cb = conn->sentCb;
-    conn->sentCb = NULL;
-    cb(ec, conn->sentData);
+    np_dtls_srv_send_callback cb = slot->cb;
+    void* cbData = slot->cbData;
+    slot->inUse = false;
+    slot->cb = NULL;
+    cb(ec, cbData);
+}
+
+void nc_client_connection_send_next_entry(struct nc_client_connection_send_slot* slot)
+{
+    struct np_udp_send_entry* entry = &slot->entries[slot->entriesSent];
+    slot->entriesSent++;
+    nc_udp_dispatch_async_send_to(slot->sock, &entry->ep,
+                                  entry->buffer, entry->bufferSize,
+                                  &slot->completionEvent);
+}
+
+np_error_code nc_client_connection_init_send_slots(struct nc_client_connection* conn)
+{
+    size_t i;
+    for (i = 0; i < NC_CLIENT_CONNECTION_SEND_QUEUE_DEPTH; i++) {
+        struct nc_client_connection_send_slot* slot = &conn->sendSlots[i];
+        slot->conn = conn;
+        np_error_code ec = np_completion_event_init(&conn->pl->eq, &slot->completionEvent, &nc_client_connection_send_to_udp_cb, slot);
+        if (ec != NABTO_EC_OK) {
+            return ec;
+        }
+        conn->sendSlotsInitialized++;
+    }
+    return NABTO_EC_OK;
+}
+
+void nc_client_connection_deinit_send_slots(struct nc_client_connection* conn)
+{
+    size_t i;
+    for (i = 0; i < conn->sendSlotsInitialized; i++) {
+        np_completion_event_deinit(&conn->sendSlots[i].completionEvent);
+    }
+    conn->sendSlotsInitialized = 0;
 }
 
 np_error_code nc_client_connection_async_send_to_udp(uint8_t channel,
-                                                     uint8_t* buffer, uint16_t bufferSize,
+                                                     struct np_dtls_srv_record* records, size_t recordsSize,
                                                      np_dtls_srv_send_callback cb, void* data, void* listenerData)
 {
     struct nc_client_connection* conn = (struct nc_client_connection*)listenerData;
 
-    if (conn->sentCb != NULL) {
-        return NABTO_EC_OPERATION_IN_PROGRESS;
+    if (recordsSize == 0 || recordsSize > NC_CLIENT_CONNECTION_MAX_SEND_BATCH) {
+        return NABTO_EC_INVALID_ARGUMENT;
     }
-    conn->sentCb = cb;
-    conn->sentData = data;
 
-    uint8_t* start = buffer;
-    memmove(start+16, start, bufferSize);
-    memcpy(start, conn->id.id, 15);
-    bufferSize = bufferSize + 16;
+    struct nc_client_connection_send_slot* slot = NULL;
+    size_t i;
+    for (i = 0; i < NC_CLIENT_CONNECTION_SEND_QUEUE_DEPTH; i++) {
+        if (!conn->sendSlots[i].inUse) {
+            slot = &conn->sendSlots[i];
+            break;
+        }
+    }
+    if (slot == NULL) {
+        return NABTO_EC_OPERATION_IN_PROGRESS;
+    }
 
+    struct nc_connection_channel* sendChannel;
     if (channel == conn->currentChannel.channelId || channel == NP_DTLS_SRV_DEFAULT_CHANNEL_ID) {
-        *(start+15) = conn->currentChannel.channelId;
-        nc_udp_dispatch_async_send_to(conn->currentChannel.sock, &conn->currentChannel.ep,
-                                      start, bufferSize,
-                                      &conn->sendCompletionEvent);
+        sendChannel = &conn->currentChannel;
     } else if (channel == conn->alternativeChannel.channelId) {
-        *(start+15) = conn->alternativeChannel.channelId;
-        nc_udp_dispatch_async_send_to(conn->alternativeChannel.sock, &conn->alternativeChannel.ep,
-                                      start, bufferSize,
-                                      &conn->sendCompletionEvent);
+        sendChannel = &conn->alternativeChannel;
+    } else {
+        return NABTO_EC_INVALID_CHANNEL;
+    }
+
+    slot->inUse = true;
+    slot->cb = cb;
+    slot->cbData = data;
+
+    for (i = 0; i < recordsSize; i++) {
+        // The connection header is written into the headroom in
+        // front of the record.
+        uint8_t* start = records[i].buffer - 16;
+        uint16_t bufferSize = records[i].bufferSize;
+        memcpy(start, conn->id.id, 15);
+        *(start+15) = sendChannel->channelId;
+
+        slot->entries[i].ep = sendChannel->ep;
+        slot->entries[i].buffer = start;
+        slot->entries[i].bufferSize = bufferSize + 16;
+    }
+    slot->entriesSize = recordsSize;
+    slot->entriesSent = 0;
+    slot->sock = sendChannel->sock;
+
+    if (recordsSize > 1 && nc_udp_dispatch_has_send_batch(sendChannel->sock)) {
+        slot->entriesSent = recordsSize;
+        nc_udp_dispatch_async_send_batch(sendChannel->sock, slot->entries, recordsSize,
+                                         &slot->completionEvent);
+    } else {
+        nc_client_connection_send_next_entry(slot);
     }
     return NABTO_EC_OK;
 }
@@ -337,9 +508,31 @@ void nc_client_connection_mtu_discovered(const np_error_code ec, uint16_t mtu, v
 
 np_error_code nc_client_connection_get_client_fingerprint(struct nc_client_connection* conn, uint8_t* fp)
 {
+    if (conn->hasClientFingerprint) {
+        memcpy(fp, conn->clientFingerprint, NC_CLIENT_CONNECTION_FINGERPRINT_SIZE);
+        return NABTO_EC_OK;
+    }
     return conn->pl->dtlsS.get_fingerprint(conn->pl, conn->dtls, fp);
 }
 
+const char* nc_client_connection_get_client_fingerprint_hex(struct nc_client_connection* conn)
+{
+    if (!conn->hasClientFingerprint) {
+        return NULL;
+    }
+    return conn->clientFingerprintHex;
+}
+
+void nc_client_connection_save_client_fingerprint(struct nc_client_connection* conn)
+{
+    if (conn->pl->dtlsS.get_fingerprint(conn->pl, conn->dtls, conn->clientFingerprint) != NABTO_EC_OK) {
+        return;
+    }
+    np_data_to_hex(conn->clientFingerprint, NC_CLIENT_CONNECTION_FINGERPRINT_SIZE, conn->clientFingerprintHex);
+    conn->clientFingerprintHex[NC_CLIENT_CONNECTION_FINGERPRINT_SIZE*2] = 0;
+    conn->hasClientFingerprint = true;
+}
+
 np_error_code nc_client_connection_get_device_fingerprint(struct nc_client_connection* conn, uint8_t* fp)
 {
     return conn->pl->dtlsS.get_server_fingerprint(conn->device->dtlsServer, fp);
@@ -349,7 +542,12 @@ np_error_code nc_client_connection_get_device_fingerprint(struct nc_client_conne
 
 bool nc_client_connection_is_local(struct nc_client_connection* conn)
 {
-    return (&conn->device->localUdp == conn->currentChannel.sock);
+    struct nc_udp_dispatch_context* sock = conn->currentChannel.sock;
+    if (sock == NULL) {
+        return false;
+    }
+    // shards of the local socket are also local.
+    return (&conn->device->localUdp == sock || &conn->device->localUdp == sock->primary);
 }
 
 bool nc_client_connection_is_password_authenticated(struct nc_client_connection* conn)
@@ -362,3 +560,11 @@ void nc_client_connection_event_listener_notify(struct nc_client_connection* con
     nc_device_connection_events_listener_notify(conn->device, conn->connectionRef, event);
 
 }
+
+void nc_client_connection_handshake_ended(struct nc_client_connection* conn)
+{
+    if (conn->handshakeInProgress) {
+        conn->handshakeInProgress = false;
+        nc_handshake_admission_end(&conn->dispatch->admission);
+    }
+}
@@ -9,11 +9,47 @@
 #include <core/nc_keep_alive.h>
 #include <core/nc_connection_event.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define NC_CLIENT_CONNECTION_MAX_CHANNELS 16
 
+#define NC_CLIENT_CONNECTION_FINGERPRINT_SIZE 32
+
+// Max number of records in a burst from the DTLS layer.
+#ifndef NC_CLIENT_CONNECTION_MAX_SEND_BATCH
+#define NC_CLIENT_CONNECTION_MAX_SEND_BATCH 16
+#endif
+
+// Max number of bursts from the DTLS layer which can be in flight on
+// the network at the same time. It should not be lower than the
+// number of bursts the DTLS module hands over before the first one
+// completes.
+#ifndef NC_CLIENT_CONNECTION_SEND_QUEUE_DEPTH
+#define NC_CLIENT_CONNECTION_SEND_QUEUE_DEPTH 4
+#endif
+
 struct nc_stream_manager_context;
 struct nc_udp_dispatch_context;
 struct nc_device_context;
+struct nc_client_connection;
+
+/**
+ * A burst of packets being sent, if the platform cannot send batches
+ * they are sent one at a time.
+ */
+struct nc_client_connection_send_slot {
+    struct nc_client_connection* conn;
+    bool inUse;
+    np_dtls_srv_send_callback cb;
+    void* cbData;
+    struct np_completion_event completionEvent;
+    struct np_udp_send_entry entries[NC_CLIENT_CONNECTION_MAX_SEND_BATCH];
+    size_t entriesSize;
+    size_t entriesSent;
+    struct nc_udp_dispatch_context* sock;
+};
 
 typedef void (*nc_client_connection_send_callback)(const np_error_code ec, void* data);
 
@@ -48,10 +84,12 @@ struct nc_client_connection {
     uint64_t currentMaxSequence;
     struct nc_device_context* device;
 
-    np_dtls_srv_send_callback sentCb;
-    void* sentData;
     uint64_t connectionRef;
-    struct np_completion_event sendCompletionEvent;
+    // The bursts can complete in any order, a free slot is found by
+    // scanning the slots.
+    struct nc_client_connection_send_slot sendSlots[NC_CLIENT_CONNECTION_SEND_QUEUE_DEPTH];
+    // number of send slot completion events which has been initialized.
+    size_t sendSlotsInitialized;
 
     struct nc_keep_alive_context keepAlive;
     struct np_dtls_srv_send_context keepAliveSendCtx;
@@ -60,6 +98,25 @@ struct nc_client_connection {
     uint8_t spake2Key[32];
     bool passwordAuthenticated; // true iff some password authentication request has succeeded on the connection.
     size_t passwordAuthenticationRequests;
+
+    // true while the connection counts as a handshake in progress in
+    // the handshake admission of the dispatch.
+    bool handshakeInProgress;
+
+    // The client fingerprint is saved when the handshake completes
+    // such that access checks does not need to ask the DTLS module.
+    bool hasClientFingerprint;
+    uint8_t clientFingerprint[NC_CLIENT_CONNECTION_FINGERPRINT_SIZE];
+    char clientFingerprintHex[NC_CLIENT_CONNECTION_FINGERPRINT_SIZE*2 + 1];
+
+    // An idle connection is hibernated by the dispatch, see
+    // nc_client_connection_idle_sweep. Its keep alive keeps waiting
+    // in the keep alive sweep of the device.
+    bool hibernated;
+    // timestamp of the last packet which was not a keep alive.
+    uint32_t lastActivity;
+    // number of CoAP requests which the application has not freed.
+    size_t coapRequests;
 };
 
 /**
@@ -110,6 +167,16 @@ void nc_client_connection_dtls_recv_callback(const np_error_code ec, uint8_t cha
 // Internal only called from self
 void nc_client_connection_dtls_closed_cb(const np_error_code ec, void* data);
 
+/**
+ * The sender of the DTLS connection. The records are sent as one
+ * burst in a free send slot.
+ *
+ * @return NABTO_EC_OPERATION_IN_PROGRESS if all the send slots are in use.
+ */
+np_error_code nc_client_connection_async_send_to_udp(uint8_t channelId,
+                                                     struct np_dtls_srv_record* records, size_t recordsSize,
+                                                     np_dtls_srv_send_callback cb, void* data, void* listenerData);
+
 /**
  * Get underlying DTLS connection from connection reference. Used by
  * nc_stream_manager.
@@ -121,6 +188,13 @@ struct np_dtls_srv_connection* nc_client_connection_get_dtls_connection(struct n
  */
 np_error_code nc_client_connection_get_client_fingerprint(struct nc_client_connection* conn, uint8_t* fp);
 
+/**
+ * Get the client fingerprint as a NULL terminated hex string.
+ *
+ * @return NULL if the handshake has not completed.
+ */
+const char* nc_client_connection_get_client_fingerprint_hex(struct nc_client_connection* conn);
+
 /**
  * Get device fingerprint from DTLS server.
  */
@@ -136,9 +210,35 @@ bool nc_client_connection_is_local(struct nc_client_connection* conn);
  */
 bool nc_client_connection_is_password_authenticated(struct nc_client_connection* conn);
 
+/**
+ * Called periodically by nc_client_connection_dispatch when idle
+ * connections are hibernated. An established connection without
+ * streams and CoAP requests which has not been used for idleTimeout
+ * ms is hibernated, the next packet which is not a keep alive wakes
+ * it up.
+ */
+void nc_client_connection_idle_sweep(struct nc_client_connection* conn, uint32_t idleTimeout);
+
+/**
+ * Called when hibernation is disabled. The DTLS connection of a
+ * hibernated connection is woken by the next packet.
+ */
+void nc_client_connection_idle_stop(struct nc_client_connection* conn);
+
+/**
+ * Count the CoAP requests the application is handling on the
+ * connection, a connection is not hibernated while it has requests.
+ */
+void nc_client_connection_coap_request_begin(struct nc_client_connection* conn);
+void nc_client_connection_coap_request_end(struct nc_client_connection* conn);
+
 /**
  * internal only called from self. Notifies nc_device of events.
  */
 void nc_client_connection_event_listener_notify(struct nc_client_connection* conn, enum nc_connection_event event);
 
+#ifdef __cplusplus
+} // extern c
+#endif
+
 #endif //_NC_CLIENT_CONNECTION_H_
@@ -1,48 +1,128 @@
 #include "nc_client_connection_dispatch.h"
+#include "nc_device.h"
+#include <core/nc_udp_dispatch.h>
 
 #include <platform/np_logging.h>
+#include <platform/np_event_queue_wrapper.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
 
 #define LOG NABTO_LOG_MODULE_CLIENT_CONNECTION_DISPATCH
 
-void nc_client_connection_dispatch_init(struct nc_client_connection_dispatch_context* ctx,
-                                        struct np_platform* pl,
-                                        struct nc_device_context* dev)
+// The id part of the connection header, excluding the protocol prefix and the channel id.
+#define CONNECTION_ID_OFFSET 1
+#define CONNECTION_ID_LENGTH 14
+
+static np_error_code allocate_table(struct nc_client_connection_dispatch_context* ctx, size_t maxConnections);
+static void free_table(struct nc_client_connection_dispatch_context* ctx);
+static uint64_t id_hash(struct nc_client_connection_dispatch_context* ctx, const uint8_t* id);
+static uint64_t ref_hash(uint64_t ref);
+static size_t find_by_id(struct nc_client_connection_dispatch_context* ctx, const uint8_t* id);
+static size_t find_by_ref(struct nc_client_connection_dispatch_context* ctx, uint64_t ref);
+static void index_insert(struct nc_client_connection_dispatch_context* ctx, size_t* index, uint64_t hash, size_t slot);
+static void index_remove(struct nc_client_connection_dispatch_context* ctx, size_t* index, uint64_t hash, size_t slot, bool isIdIndex);
+static void add_connection(struct nc_client_connection_dispatch_context* ctx, size_t slot);
+static void remove_connection(struct nc_client_connection_dispatch_context* ctx, size_t slot);
+static bool verify_client_hello(struct nc_client_connection_dispatch_context* ctx,
+                                struct nc_udp_dispatch_context* sock, struct np_udp_endpoint* ep,
+                                uint8_t* buffer, uint16_t bufferSize);
+static void hello_verify_sent(const np_error_code ec, void* data);
+static void idle_sweep(void* data);
+
+np_error_code nc_client_connection_dispatch_init(struct nc_client_connection_dispatch_context* ctx,
+                                                 struct np_platform* pl,
+                                                 struct nc_device_context* dev)
 {
-    int i = 0;
-    for (i = 0; i < NABTO_MAX_CLIENT_CONNECTIONS; i++) {
-        memset(&ctx->elms[i].conn, 0, sizeof(struct nc_client_connection));
-        ctx->elms[i].active = false;
-    }
+    memset(ctx, 0, sizeof(struct nc_client_connection_dispatch_context));
     ctx->device = dev;
     ctx->pl = pl;
     ctx->closing = false;
+    if (pl->random.random(pl, &ctx->idHashKey, sizeof(ctx->idHashKey)) != NABTO_EC_OK) {
+        NABTO_LOG_ERROR(LOG, "Could not create a random key for the connection id hash");
+    }
+    nc_handshake_admission_init(&ctx->admission, pl);
+    np_event_queue_init_event(&pl->eq, &ctx->idleSweepEvent, &idle_sweep, ctx);
+    np_error_code ec = np_completion_event_init(&pl->eq, &ctx->helloVerifyCompletionEvent, &hello_verify_sent, ctx);
+    if (ec != NABTO_EC_OK) {
+        return ec;
+    }
+    return allocate_table(ctx, NABTO_MAX_CLIENT_CONNECTIONS);
 }
 
 void nc_client_connection_dispatch_deinit(struct nc_client_connection_dispatch_context* ctx)
 {
     if (ctx->pl != NULL) { // if init called
-        int i = 0;
-        for (i = 0; i < NABTO_MAX_CLIENT_CONNECTIONS; i++) {
+        size_t i = 0;
+        for (i = 0; i < ctx->maxConnections; i++) {
             if (ctx->elms[i].active) {
                 nc_client_connection_destroy_connection(&ctx->elms[i].conn);
                 ctx->elms[i].active = false;
             }
         }
+        free_table(ctx);
+        np_event_queue_deinit_event(&ctx->pl->eq, &ctx->idleSweepEvent);
+        np_completion_event_deinit(&ctx->helloVerifyCompletionEvent);
     }
 }
 
-void nc_client_connection_dispatch_try_close(struct nc_client_connection_dispatch_context* ctx)
+np_error_code nc_client_connection_dispatch_set_max_connections(struct nc_client_connection_dispatch_context* ctx, size_t maxConnections)
+{
+    if (maxConnections == 0) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    if (ctx->activeConnections > 0) {
+        return NABTO_EC_INVALID_STATE;
+    }
+    free_table(ctx);
+    return allocate_table(ctx, maxConnections);
+}
+
+void nc_client_connection_dispatch_set_idle_timeout(struct nc_client_connection_dispatch_context* ctx, uint32_t idleTimeout)
 {
-    bool allClosed = true;
-    int i = 0;
-    for (i = 0; i < NABTO_MAX_CLIENT_CONNECTIONS; i++) {
+    bool running = ctx->idleTimeout > 0;
+    ctx->idleTimeout = idleTimeout;
+    if (idleTimeout > 0 && !running) {
+        np_event_queue_post_timed_event(&ctx->pl->eq, &ctx->idleSweepEvent, NC_CLIENT_CONNECTION_DISPATCH_IDLE_SWEEP_INTERVAL);
+    } else if (idleTimeout == 0 && running) {
+        np_event_queue_cancel_event(&ctx->pl->eq, &ctx->idleSweepEvent);
+        size_t i;
+        for (i = 0; i < ctx->maxConnections; i++) {
+            if (ctx->elms[i].active) {
+                nc_client_connection_idle_stop(&ctx->elms[i].conn);
+            }
+        }
+    }
+}
+
+void idle_sweep(void* data)
+{
+    struct nc_client_connection_dispatch_context* ctx = data;
+    if (ctx->closing || ctx->idleTimeout == 0) {
+        return;
+    }
+    size_t i;
+    for (i = 0; i < ctx->maxConnections; i++) {
         if (ctx->elms[i].active) {
-            allClosed = false;
-            break;
+            nc_client_connection_idle_sweep(&ctx->elms[i].conn, ctx->idleTimeout);
         }
     }
-    if (allClosed && ctx->closeCb) {
+    np_event_queue_post_timed_event(&ctx->pl->eq, &ctx->idleSweepEvent, NC_CLIENT_CONNECTION_DISPATCH_IDLE_SWEEP_INTERVAL);
+}
+
+size_t nc_client_connection_dispatch_connection_memory_cost(struct nc_client_connection_dispatch_context* ctx)
+{
+    size_t cost = sizeof(struct nc_client_connection_dispatch_element) + sizeof(size_t);
+    if (ctx->maxConnections > 0) {
+        // the id and ref index entries for the connection.
+        cost += (2 * ctx->indexCapacity * sizeof(size_t)) / ctx->maxConnections;
+    }
+    return cost;
+}
+
+void nc_client_connection_dispatch_try_close(struct nc_client_connection_dispatch_context* ctx)
+{
+    if (ctx->activeConnections == 0 && ctx->closeCb) {
         ctx->closeCb(ctx->closeData);
     }
 }
@@ -51,8 +131,8 @@ np_error_code nc_client_connection_dispatch_async_close(struct nc_client_connect
 {
     ctx->closing = true;
     bool hasActive = false;
-    int i = 0;
-    for (i = 0; i < NABTO_MAX_CLIENT_CONNECTIONS; i++) {
+    size_t i = 0;
+    for (i = 0; i < ctx->maxConnections; i++) {
         if (ctx->elms[i].active) {
             nc_client_connection_close_connection(&ctx->elms[i].conn);
             hasActive = true;
@@ -67,41 +147,49 @@ np_error_code nc_client_connection_dispatch_async_close(struct nc_client_connect
     }
 }
 
-/*//void nc_client_connect_dispatch_handle_packet(const np_error_code ec, struct np_udp_endpoint ep,
-//                                              np_communication_buffer* buffer, uint16_t bufferSize,
-//                                              void* data)*/
 void nc_client_connection_dispatch_handle_packet(struct nc_client_connection_dispatch_context* ctx,
                                                  struct nc_udp_dispatch_context* sock, struct np_udp_endpoint* ep,
                                                  uint8_t* buffer, uint16_t bufferSize)
 {
-    int i;
-    uint8_t* id;
-    id = buffer;
-    for (i = 0; i < NABTO_MAX_CLIENT_CONNECTIONS; i++) {
-        // compare middle 14 bytes, ignoring the channel ID and protocol prefix
-        if (ctx->elms[i].active && memcmp(id+1, ctx->elms[i].conn.id.id+1, 14) == 0) {
-            np_error_code ec;
-            ec = nc_client_connection_handle_packet(ctx->pl, &ctx->elms[i].conn, sock, ep, buffer, bufferSize);
-            if (ec != NABTO_EC_OK) {
-                //nc_client_connection_close_connection(&ctx->elms[i].conn);
-            }
-            return;
+    if (bufferSize < 17) {
+        NABTO_LOG_TRACE(LOG, "Packet too short for a client connection");
+        return;
+    }
+    // compare middle 14 bytes, ignoring the channel ID and protocol prefix
+    size_t slot = find_by_id(ctx, buffer + CONNECTION_ID_OFFSET);
+    if (slot != SIZE_MAX) {
+        np_error_code ec;
+        ec = nc_client_connection_handle_packet(ctx->pl, &ctx->elms[slot].conn, sock, ep, buffer, bufferSize);
+        if (ec != NABTO_EC_OK) {
+            //nc_client_connection_close_connection(&ctx->elms[i].conn);
         }
+        return;
     }
     // if the packet is a dtls handshake packet it can be for a new connection.
     // 22 = handshake
     // 1 = client hello on position x maybe ~14
     // the first 16 bytes is the connection header
     if (buffer[16] == 22) {
-        for (i = 0; i < NABTO_MAX_CLIENT_CONNECTIONS; i++) {
-            if(!ctx->elms[i].active) {
-                NABTO_LOG_TRACE(LOG, "Open new connection");
-                np_error_code ec = nc_client_connection_open(ctx->pl, &ctx->elms[i].conn, ctx, ctx->device, sock, ep, buffer, bufferSize);
-                if (ec == NABTO_EC_OK) {
-                    ctx->elms[i].active = true;
-                }
-                return;
-            }
+        if (ctx->freeSlotsSize == 0) {
+            NABTO_LOG_TRACE(LOG, "No free client connection slots");
+            return;
+        }
+        if (!verify_client_hello(ctx, sock, ep, buffer, bufferSize)) {
+            return;
+        }
+        // The admission is decided after the cookie is verified such
+        // that spoofed packets cannot use the rate of other sources.
+        if (nc_handshake_admission_begin(&ctx->admission, ep) != NC_HANDSHAKE_ADMISSION_ACCEPT) {
+            return;
+        }
+        slot = ctx->freeSlots[ctx->freeSlotsSize - 1];
+        NABTO_LOG_TRACE(LOG, "Open new connection");
+        np_error_code ec = nc_client_connection_open(ctx->pl, &ctx->elms[slot].conn, ctx, ctx->device, sock, ep, buffer, bufferSize);
+        if (ec == NABTO_EC_OK) {
+            ctx->elms[slot].conn.handshakeInProgress = true;
+            add_connection(ctx, slot);
+        } else {
+            nc_handshake_admission_end(&ctx->admission);
         }
     }
 }
@@ -109,10 +197,10 @@ void nc_client_connection_dispatch_handle_packet(struct nc_client_connection_dis
 np_error_code nc_client_connection_dispatch_close_connection(struct nc_client_connection_dispatch_context* ctx,
                                                              struct nc_client_connection* conn)
 {
-    int i;
-    for (i = 0; i<NABTO_MAX_CLIENT_CONNECTIONS; i++) {
-        if (conn == &ctx->elms[i].conn) {
-            ctx->elms[i].active = false;
+    if (ctx->elms != NULL && conn >= &ctx->elms[0].conn && conn <= &ctx->elms[ctx->maxConnections - 1].conn) {
+        size_t slot = (struct nc_client_connection_dispatch_element*)conn - ctx->elms;
+        if (ctx->elms[slot].active) {
+            remove_connection(ctx, slot);
         }
     }
     if (ctx->closing) {
@@ -122,13 +210,255 @@ np_error_code nc_client_connection_dispatch_close_connection(struct nc_client_co
 }
 
 
+size_t nc_client_connection_dispatch_client_id(const struct np_udp_endpoint* ep, const uint8_t* buffer, uint8_t* clientId)
+{
+    size_t size = 0;
+    if (ep->ip.type == NABTO_IPV4) {
+        memcpy(clientId, ep->ip.ip.v4, 4);
+        size += 4;
+    } else {
+        memcpy(clientId, ep->ip.ip.v6, 16);
+        size += 16;
+    }
+    clientId[size] = (uint8_t)(ep->port >> 8);
+    clientId[size + 1] = (uint8_t)ep->port;
+    size += 2;
+    memcpy(clientId + size, buffer + CONNECTION_ID_OFFSET, CONNECTION_ID_LENGTH);
+    size += CONNECTION_ID_LENGTH;
+    return size;
+}
+
 struct nc_client_connection* nc_client_connection_dispatch_connection_from_ref(struct nc_client_connection_dispatch_context* ctx, uint64_t ref)
 {
-    int i;
-    for (i = 0; i<NABTO_MAX_CLIENT_CONNECTIONS; i++) {
-        if (ctx->elms[i].active && ctx->elms[i].conn.connectionRef == ref) {
-            return &ctx->elms[i].conn;
-        }
+    size_t slot = find_by_ref(ctx, ref);
+    if (slot != SIZE_MAX) {
+        return &ctx->elms[slot].conn;
     }
     return NULL;
 }
+
+/**
+ * Helper functions
+ */
+
+np_error_code allocate_table(struct nc_client_connection_dispatch_context* ctx, size_t maxConnections)
+{
+    size_t capacity = 2;
+    while (capacity < 2 * maxConnections) {
+        capacity *= 2;
+    }
+    ctx->elms = calloc(maxConnections, sizeof(struct nc_client_connection_dispatch_element));
+    ctx->freeSlots = calloc(maxConnections, sizeof(size_t));
+    ctx->idIndex = calloc(capacity, sizeof(size_t));
+    ctx->refIndex = calloc(capacity, sizeof(size_t));
+    if (ctx->elms == NULL || ctx->freeSlots == NULL || ctx->idIndex == NULL || ctx->refIndex == NULL) {
+        free_table(ctx);
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    ctx->maxConnections = maxConnections;
+    ctx->indexCapacity = capacity;
+    ctx->activeConnections = 0;
+    // take the lowest slots first.
+    size_t i;
+    for (i = 0; i < maxConnections; i++) {
+        ctx->freeSlots[i] = maxConnections - 1 - i;
+    }
+    ctx->freeSlotsSize = maxConnections;
+    return NABTO_EC_OK;
+}
+
+void free_table(struct nc_client_connection_dispatch_context* ctx)
+{
+    free(ctx->elms);
+    free(ctx->freeSlots);
+    free(ctx->idIndex);
+    free(ctx->refIndex);
+    ctx->elms = NULL;
+    ctx->freeSlots = NULL;
+    ctx->idIndex = NULL;
+    ctx->refIndex = NULL;
+    ctx->maxConnections = 0;
+    ctx->freeSlotsSize = 0;
+    ctx->indexCapacity = 0;
+}
+
+/**
+ * FNV-1a with a random offset basis such that clients cannot choose
+ * ids which all end up in the same bucket of a given device.
+ */
+uint64_t id_hash(struct nc_client_connection_dispatch_context* ctx, const uint8_t* id)
+{
+    uint64_t hash = 14695981039346656037ULL ^ ctx->idHashKey;
+    size_t i;
+    for (i = 0; i < CONNECTION_ID_LENGTH; i++) {
+        hash ^= id[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Connection refs are sequential, fibonacci hashing spreads them over
+ * the table.
+ */
+uint64_t ref_hash(uint64_t ref)
+{
+    return ref * 11400714819323198485ULL;
+}
+
+size_t find_by_id(struct nc_client_connection_dispatch_context* ctx, const uint8_t* id)
+{
+    if (ctx->indexCapacity == 0) {
+        return SIZE_MAX;
+    }
+    size_t mask = ctx->indexCapacity - 1;
+    size_t pos = (size_t)id_hash(ctx, id) & mask;
+    while (ctx->idIndex[pos] != 0) {
+        size_t slot = ctx->idIndex[pos] - 1;
+        if (memcmp(id, ctx->elms[slot].conn.id.id + CONNECTION_ID_OFFSET, CONNECTION_ID_LENGTH) == 0) {
+            return slot;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return SIZE_MAX;
+}
+
+size_t find_by_ref(struct nc_client_connection_dispatch_context* ctx, uint64_t ref)
+{
+    if (ctx->indexCapacity == 0) {
+        return SIZE_MAX;
+    }
+    size_t mask = ctx->indexCapacity - 1;
+    size_t pos = (size_t)ref_hash(ref) & mask;
+    while (ctx->refIndex[pos] != 0) {
+        size_t slot = ctx->refIndex[pos] - 1;
+        if (ctx->elms[slot].conn.connectionRef == ref) {
+            return slot;
+        }
+        pos = (pos + 1) & mask;
+    }
+    return SIZE_MAX;
+}
+
+void index_insert(struct nc_client_connection_dispatch_context* ctx, size_t* index, uint64_t hash, size_t slot)
+{
+    size_t mask = ctx->indexCapacity - 1;
+    size_t pos = (size_t)hash & mask;
+    // The table is at most half full so there is always an empty entry.
+    while (index[pos] != 0) {
+        pos = (pos + 1) & mask;
+    }
+    index[pos] = slot + 1;
+}
+
+/**
+ * Remove the entry for slot and shift the following entries of the
+ * probe sequence back such that lookups does not need tombstones.
+ */
+void index_remove(struct nc_client_connection_dispatch_context* ctx, size_t* index, uint64_t hash, size_t slot, bool isIdIndex)
+{
+    size_t mask = ctx->indexCapacity - 1;
+    size_t pos = (size_t)hash & mask;
+    while (index[pos] != slot + 1) {
+        if (index[pos] == 0) {
+            return;
+        }
+        pos = (pos + 1) & mask;
+    }
+    index[pos] = 0;
+
+    size_t next = (pos + 1) & mask;
+    while (index[next] != 0) {
+        struct nc_client_connection* conn = &ctx->elms[index[next] - 1].conn;
+        uint64_t h;
+        if (isIdIndex) {
+            h = id_hash(ctx, conn->id.id + CONNECTION_ID_OFFSET);
+        } else {
+            h = ref_hash(conn->connectionRef);
+        }
+        size_t home = (size_t)h & mask;
+        // move the entry if its home is not in the cyclic range (pos, next]
+        bool inRange;
+        if (pos <= next) {
+            inRange = (home > pos && home <= next);
+        } else {
+            inRange = (home > pos || home <= next);
+        }
+        if (!inRange) {
+            index[pos] = index[next];
+            index[next] = 0;
+            pos = next;
+        }
+        next = (next + 1) & mask;
+    }
+}
+
+void add_connection(struct nc_client_connection_dispatch_context* ctx, size_t slot)
+{
+    struct nc_client_connection* conn = &ctx->elms[slot].conn;
+    ctx->elms[slot].active = true;
+    ctx->freeSlotsSize--;
+    ctx->activeConnections++;
+    index_insert(ctx, ctx->idIndex, id_hash(ctx, conn->id.id + CONNECTION_ID_OFFSET), slot);
+    index_insert(ctx, ctx->refIndex, ref_hash(conn->connectionRef), slot);
+}
+
+void remove_connection(struct nc_client_connection_dispatch_context* ctx, size_t slot)
+{
+    struct nc_client_connection* conn = &ctx->elms[slot].conn;
+    index_remove(ctx, ctx->idIndex, id_hash(ctx, conn->id.id + CONNECTION_ID_OFFSET), slot, true);
+    index_remove(ctx, ctx->refIndex, ref_hash(conn->connectionRef), slot, false);
+    ctx->elms[slot].active = false;
+    ctx->freeSlots[ctx->freeSlotsSize] = slot;
+    ctx->freeSlotsSize++;
+    ctx->activeConnections--;
+}
+
+/**
+ * A connection is only created for a ClientHello with a valid cookie,
+ * else a HelloVerifyRequest is sent to the client without allocating
+ * any state for it.
+ *
+ * @return true if a connection should be created for the packet.
+ */
+bool verify_client_hello(struct nc_client_connection_dispatch_context* ctx,
+                         struct nc_udp_dispatch_context* sock, struct np_udp_endpoint* ep,
+                         uint8_t* buffer, uint16_t bufferSize)
+{
+    struct np_platform* pl = ctx->pl;
+    if (pl->dtlsS.verify_client_hello == NULL) {
+        return true;
+    }
+    if (ctx->helloVerifySending) {
+        NABTO_LOG_TRACE(LOG, "Dropping ClientHello, a HelloVerifyRequest is being sent");
+        return false;
+    }
+    uint8_t clientId[NC_CLIENT_CONNECTION_DISPATCH_CLIENT_ID_SIZE];
+    size_t clientIdSize = nc_client_connection_dispatch_client_id(ep, buffer, clientId);
+
+    // the HelloVerifyRequest is sent with the connection header of the ClientHello.
+    size_t responseSize = sizeof(ctx->helloVerifyBuffer) - 16;
+    np_error_code ec = pl->dtlsS.verify_client_hello(ctx->device->dtlsServer, clientId, clientIdSize,
+                                                     buffer + 16, bufferSize - 16,
+                                                     ctx->helloVerifyBuffer + 16, &responseSize);
+    if (ec == NABTO_EC_OK) {
+        return true;
+    } else if (ec == NABTO_EC_AGAIN) {
+        memcpy(ctx->helloVerifyBuffer, buffer, 16);
+        ctx->helloVerifySending = true;
+        nc_udp_dispatch_async_send_to(sock, ep, ctx->helloVerifyBuffer, (uint16_t)(responseSize + 16),
+                                      &ctx->helloVerifyCompletionEvent);
+    } else {
+        NABTO_LOG_TRACE(LOG, "Dropping invalid ClientHello (%s)", np_error_code_to_string(ec));
+    }
+    return false;
+}
+
+void hello_verify_sent(const np_error_code ec, void* data)
+{
+    struct nc_client_connection_dispatch_context* ctx = data;
+    if (ec != NABTO_EC_OK) {
+        NABTO_LOG_TRACE(LOG, "Could not send HelloVerifyRequest (%s)", np_error_code_to_string(ec));
+    }
+    ctx->helloVerifySending = false;
+}
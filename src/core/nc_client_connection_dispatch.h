@@ -2,11 +2,40 @@
 #define NC_CLIENT_CONNECTION_DISPATCH_H
 
 #include <core/nc_client_connection.h>
+#include <core/nc_handshake_admission.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Default number of concurrent client connections. It can be changed
+ * at runtime with nc_client_connection_dispatch_set_max_connections.
+ */
 #ifndef NABTO_MAX_CLIENT_CONNECTIONS
 #define NABTO_MAX_CLIENT_CONNECTIONS 10
 #endif
 
+/**
+ * Size of the id a ClientHello cookie is bound to. It is the ip
+ * address, the port and the connection id of the client.
+ */
+#define NC_CLIENT_CONNECTION_DISPATCH_CLIENT_ID_SIZE (16 + 2 + 14)
+
+/**
+ * Size of the buffer HelloVerifyRequests are sent from, including the
+ * connection header.
+ */
+#define NC_CLIENT_CONNECTION_DISPATCH_HELLO_VERIFY_SIZE 128
+
+/**
+ * Interval in ms between the checks for idle connections when
+ * hibernation is enabled.
+ */
+#ifndef NC_CLIENT_CONNECTION_DISPATCH_IDLE_SWEEP_INTERVAL
+#define NC_CLIENT_CONNECTION_DISPATCH_IDLE_SWEEP_INTERVAL 1000
+#endif
+
 struct nc_udp_dispatch_context;
 
 typedef void (*nc_client_connection_dispatch_close_callback)(void* data);
@@ -19,19 +48,77 @@ struct nc_client_connection_dispatch_element {
 struct nc_client_connection_dispatch_context {
     struct np_platform* pl;
     struct nc_device_context* device;
-    struct nc_client_connection_dispatch_element elms[NABTO_MAX_CLIENT_CONNECTIONS];
+
+    // maxConnections connection slots. A connection does not move
+    // while it is active.
+    struct nc_client_connection_dispatch_element* elms;
+    size_t maxConnections;
+    size_t activeConnections;
+
+    // indexes of the free slots in elms.
+    size_t* freeSlots;
+    size_t freeSlotsSize;
+
+    // Open addressing hash tables with linear probing which maps the
+    // connection id and the connection ref to a slot. An entry is the
+    // slot index + 1, 0 is an empty entry. The capacity is a power of
+    // 2 and at least twice maxConnections.
+    size_t* idIndex;
+    size_t* refIndex;
+    size_t indexCapacity;
+    // random key for the connection id hash, the ids are chosen by
+    // the clients.
+    uint64_t idHashKey;
+
+    // A HelloVerifyRequest which is being sent. Only one is sent at a
+    // time, ClientHellos which arrives meanwhile are dropped and
+    // retransmitted by the clients.
+    uint8_t helloVerifyBuffer[NC_CLIENT_CONNECTION_DISPATCH_HELLO_VERIFY_SIZE];
+    struct np_completion_event helloVerifyCompletionEvent;
+    bool helloVerifySending;
+
+    struct nc_handshake_admission_context admission;
+
+    // Connections which has been idle for idleTimeout ms are
+    // hibernated, 0 disables hibernation.
+    uint32_t idleTimeout;
+    struct np_event idleSweepEvent;
+
     nc_client_connection_dispatch_close_callback closeCb;
     void* closeData;
     bool closing;
 };
 
-void nc_client_connection_dispatch_init(struct nc_client_connection_dispatch_context* ctx,
-                                        struct np_platform* pl,
-                                        struct nc_device_context* device);
+np_error_code nc_client_connection_dispatch_init(struct nc_client_connection_dispatch_context* ctx,
+                                                 struct np_platform* pl,
+                                                 struct nc_device_context* device);
 
 
 void nc_client_connection_dispatch_deinit(struct nc_client_connection_dispatch_context* ctx);
 
+/**
+ * Change the max number of concurrent client connections.
+ *
+ * @return NABTO_EC_OK if the connection table was resized
+ *         NABTO_EC_INVALID_ARGUMENT if maxConnections is 0
+ *         NABTO_EC_INVALID_STATE if there are open connections
+ *         NABTO_EC_OUT_OF_MEMORY if the table could not be allocated.
+ */
+np_error_code nc_client_connection_dispatch_set_max_connections(struct nc_client_connection_dispatch_context* ctx, size_t maxConnections);
+
+/**
+ * Hibernate connections which has had no streams, no CoAP requests
+ * and no traffic except keep alives for idleTimeout ms. A hibernated
+ * connection only keeps its DTLS keys and its connection id until the
+ * next packet arrives. 0 disables hibernation.
+ */
+void nc_client_connection_dispatch_set_idle_timeout(struct nc_client_connection_dispatch_context* ctx, uint32_t idleTimeout);
+
+/**
+ * Get the number of bytes the connection table uses per connection.
+ */
+size_t nc_client_connection_dispatch_connection_memory_cost(struct nc_client_connection_dispatch_context* ctx);
+
 /**
  * Returns NABTO_EC_OK if closing
  *         NABTO_EC_STOPPED if no connections needed to be closed
@@ -45,6 +132,18 @@ void nc_client_connection_dispatch_handle_packet(struct nc_client_connection_dis
 np_error_code nc_client_connection_dispatch_close_connection(struct nc_client_connection_dispatch_context* ctx,
                                                           struct nc_client_connection* conn);
 
+/**
+ * Write the id of the client which sent a packet to clientId, which
+ * has room for NC_CLIENT_CONNECTION_DISPATCH_CLIENT_ID_SIZE bytes.
+ *
+ * @return the size of the client id.
+ */
+size_t nc_client_connection_dispatch_client_id(const struct np_udp_endpoint* ep, const uint8_t* buffer, uint8_t* clientId);
+
 struct nc_client_connection* nc_client_connection_dispatch_connection_from_ref(struct nc_client_connection_dispatch_context* ctx, uint64_t ref);
 
+#ifdef __cplusplus
+} // extern c
+#endif
+
 #endif
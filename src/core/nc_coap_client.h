@@ -16,8 +16,8 @@ struct nc_coap_client_context {
     struct np_platform* pl;
     struct nabto_coap_client client;
     uint32_t currentExpiry;
-    struct np_event* ev;
-    struct np_event* timer;
+    struct np_event ev;
+    struct np_event timer;
     struct np_dtls_cli_send_context sendCtx;
     struct np_communication_buffer* sendBuffer;
     bool isSending;
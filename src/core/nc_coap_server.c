@@ -36,16 +36,8 @@ np_error_code nc_coap_server_init(struct np_platform* pl, struct nc_coap_server_
     }
     ctx->pl = pl;
     nc_coap_server_set_infinite_stamp(ctx);
-    np_error_code ec;
-    ec = np_event_queue_create_event(&pl->eq, &nc_coap_server_notify_event_callback, ctx, &ctx->ev);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
-
-    ec = np_event_queue_create_event(&pl->eq, &nc_coap_server_handle_timeout, ctx, &ctx->timer);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
+    np_event_queue_init_event(&pl->eq, &ctx->ev, &nc_coap_server_notify_event_callback, ctx);
+    np_event_queue_init_event(&pl->eq, &ctx->timer, &nc_coap_server_handle_timeout, ctx);
 
     return NABTO_EC_OK;
 }
@@ -57,8 +49,8 @@ void nc_coap_server_deinit(struct nc_coap_server_context* ctx)
         ctx->pl->buf.free(ctx->sendBuffer);
 
         struct np_event_queue* eq = &ctx->pl->eq;
-        np_event_queue_destroy_event(eq, ctx->ev);
-        np_event_queue_destroy_event(eq, ctx->timer);
+        np_event_queue_deinit_event(eq, &ctx->ev);
+        np_event_queue_deinit_event(eq, &ctx->timer);
     }
 }
 
@@ -137,7 +129,7 @@ void nc_coap_server_handle_wait(struct nc_coap_server_context* ctx)
         if (diff < 0) {
             diff = 0;
         }
-        np_event_queue_post_timed_event(&ctx->pl->eq, ctx->timer, diff);
+        np_event_queue_post_timed_event(&ctx->pl->eq, &ctx->timer, diff);
     }
 }
 
@@ -194,7 +186,7 @@ void nc_coap_server_notify_event_callback(void* userData)
 void nc_coap_server_notify_event(void* userData)
 {
     struct nc_coap_server_context* ctx = (struct nc_coap_server_context*)userData;
-    np_event_queue_post_maybe_double(&ctx->pl->eq, ctx->ev);
+    np_event_queue_post_maybe_double(&ctx->pl->eq, &ctx->ev);
 }
 
 void nc_coap_server_set_infinite_stamp(struct nc_coap_server_context* ctx)
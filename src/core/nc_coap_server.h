@@ -8,12 +8,16 @@
 
 #include <coap/nabto_coap_server.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 struct nc_coap_server_context {
     struct np_platform* pl;
     struct nabto_coap_server server;
     uint32_t currentExpiry;
-    struct np_event* ev;
-    struct np_event* timer;
+    struct np_event ev;
+    struct np_event timer;
     struct np_communication_buffer* sendBuffer;
     struct np_dtls_srv_send_context sendCtx;
     bool isSending;
@@ -36,4 +40,8 @@ struct nc_client_connection* nc_coap_server_get_connection(struct nc_coap_server
 
 void nc_coap_server_remove_connection(struct nc_coap_server_context* ctx, struct nc_client_connection* connection);
 
+#ifdef __cplusplus
+} // extern c
+#endif
+
 #endif // NC_COAP_SERVER_H
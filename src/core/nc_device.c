@@ -9,6 +9,17 @@ void nc_device_attached_cb(const np_error_code ec, void* data);
 uint32_t nc_device_get_reattach_time(struct nc_device_context* ctx);
 static void nc_device_udp_bound_cb(const np_error_code ec, void* data);
 static void nc_device_secondary_udp_bound_cb(const np_error_code ec, void* data);
+static void nc_device_udp_shard_bound_cb(const np_error_code ec, void* data);
+static void nc_device_local_udp_shard_bound_cb(const np_error_code ec, void* data);
+static void nc_device_bind_local_udp(struct nc_device_context* dev);
+static void nc_device_bind_secondary_udp(struct nc_device_context* dev);
+static np_error_code nc_device_init_udp_shards(struct nc_device_context* dev);
+static bool nc_device_bind_next_udp_shard(struct nc_device_context* dev, struct nc_udp_dispatch_context* primary,
+                                          struct nc_udp_dispatch_context* shards, size_t bound,
+                                          np_completion_event_callback cb);
+static bool nc_device_udp_shard_bound(const np_error_code ec, struct nc_udp_dispatch_context* primary,
+                                      struct nc_udp_dispatch_context* shards, size_t* bound);
+static void nc_device_abort_udp_shards(struct nc_device_context* dev, struct nc_udp_dispatch_context* shards);
 
 np_error_code nc_device_init(struct nc_device_context* device, struct np_platform* pl)
 {
@@ -16,6 +27,11 @@ np_error_code nc_device_init(struct nc_device_context* device, struct np_platfor
     device->pl = pl;
     device->state = NC_DEVICE_STATE_SETUP;
     np_error_code ec;
+    ec = nc_keep_alive_sweep_init(&device->keepAliveSweep, pl);
+    if (ec != NABTO_EC_OK) {
+        nc_device_deinit(device);
+        return ec;
+    }
     ec = nc_udp_dispatch_init(&device->udp, pl);
     if (ec != NABTO_EC_OK) {
         nc_device_deinit(device);
@@ -37,6 +53,15 @@ np_error_code nc_device_init(struct nc_device_context* device, struct np_platfor
         nc_device_deinit(device);
         return ec;
     }
+    if (pl->dtlsS.set_max_connections != NULL) {
+        // keep the dtls connection pool the same size as the client
+        // connection table.
+        ec = pl->dtlsS.set_max_connections(device->dtlsServer, NABTO_MAX_CLIENT_CONNECTIONS);
+        if (ec != NABTO_EC_OK) {
+            nc_device_deinit(device);
+            return ec;
+        }
+    }
 
     ec = nc_coap_server_init(pl, &device->coapServer);
     if (ec != NABTO_EC_OK) {
@@ -88,13 +113,18 @@ np_error_code nc_device_init(struct nc_device_context* device, struct np_platfor
     }
 
 
-    nc_client_connection_dispatch_init(&device->clientConnect, pl, device);
+    ec = nc_client_connection_dispatch_init(&device->clientConnect, pl, device);
+    if (ec != NABTO_EC_OK) {
+        nc_device_deinit(device);
+        return ec;
+    }
     nc_stream_manager_init(&device->streamManager, pl);
 
     nn_llist_init(&device->eventsListeners);
     nn_llist_init(&device->deviceEvents);
 
     device->serverPort = 443;
+    device->udpShards = 1;
 
     ec = np_completion_event_init(&pl->eq, &device->socketBoundCompletionEvent, &nc_device_udp_bound_cb, device);
     if (ec != NABTO_EC_OK) {
@@ -126,7 +156,13 @@ void nc_device_deinit(struct nc_device_context* device) {
     nc_udp_dispatch_deinit(&device->udp);
     nc_udp_dispatch_deinit(&device->localUdp);
     nc_udp_dispatch_deinit(&device->secondaryUdp);
+    size_t i;
+    for (i = 0; i < NC_DEVICE_MAX_UDP_SHARDS - 1; i++) {
+        nc_udp_dispatch_deinit(&device->udpShardSockets[i]);
+        nc_udp_dispatch_deinit(&device->localUdpShardSockets[i]);
+    }
     np_completion_event_deinit(&device->socketBoundCompletionEvent);
+    nc_keep_alive_sweep_deinit(&device->keepAliveSweep);
 }
 
 void nc_device_set_keys(struct nc_device_context* device, const unsigned char* publicKeyL, size_t publicKeySize, const unsigned char* privateKeyL, size_t privateKeySize)
@@ -178,6 +214,26 @@ void nc_device_local_udp_bound_cb(const np_error_code ec, void* data)
     nc_udp_dispatch_set_client_connection_context(&dev->localUdp, &dev->clientConnect);
     nc_udp_dispatch_start_recv(&dev->localUdp);
 
+    if (!nc_device_bind_next_udp_shard(dev, &dev->localUdp, dev->localUdpShardSockets, dev->localUdpShardsBound, &nc_device_local_udp_shard_bound_cb)) {
+        nc_device_bind_secondary_udp(dev);
+    }
+}
+
+void nc_device_local_udp_shard_bound_cb(const np_error_code ec, void* data)
+{
+    struct nc_device_context* dev = (struct nc_device_context*)data;
+    if (dev->state == NC_DEVICE_STATE_STOPPED) {
+        return;
+    }
+    if (!nc_device_udp_shard_bound(ec, &dev->localUdp, dev->localUdpShardSockets, &dev->localUdpShardsBound) ||
+        !nc_device_bind_next_udp_shard(dev, &dev->localUdp, dev->localUdpShardSockets, dev->localUdpShardsBound, &nc_device_local_udp_shard_bound_cb))
+    {
+        nc_device_bind_secondary_udp(dev);
+    }
+}
+
+void nc_device_bind_secondary_udp(struct nc_device_context* dev)
+{
     np_completion_event_reinit(&dev->socketBoundCompletionEvent, &nc_device_secondary_udp_bound_cb, dev);
     nc_udp_dispatch_async_bind(&dev->secondaryUdp, dev->pl, 0, &dev->socketBoundCompletionEvent);
 }
@@ -189,6 +245,13 @@ void nc_device_udp_bound_cb(const np_error_code ec, void* data)
         // nothing is running just abort
         return;
     }
+    if (ec == NABTO_EC_NOT_SUPPORTED && dev->udpShards > 1) {
+        NABTO_LOG_WARN(LOG, "The platform cannot share UDP ports, continuing with one socket per port");
+        dev->udpShards = 1;
+        np_completion_event_reinit(&dev->socketBoundCompletionEvent, &nc_device_udp_bound_cb, dev);
+        nc_udp_dispatch_async_bind(&dev->udp, dev->pl, 0, &dev->socketBoundCompletionEvent);
+        return;
+    }
     if (ec != NABTO_EC_OK) {
         NABTO_LOG_ERROR(LOG, "nc_device failed to bind primary UDP socket, Nabto device not started!");
         dev->state = NC_DEVICE_STATE_STOPPED;
@@ -201,8 +264,169 @@ void nc_device_udp_bound_cb(const np_error_code ec, void* data)
 
     nc_udp_dispatch_start_recv(&dev->udp);
 
+    if (!nc_device_bind_next_udp_shard(dev, &dev->udp, dev->udpShardSockets, dev->udpShardsBound, &nc_device_udp_shard_bound_cb)) {
+        nc_device_bind_local_udp(dev);
+    }
+}
+
+void nc_device_udp_shard_bound_cb(const np_error_code ec, void* data)
+{
+    struct nc_device_context* dev = (struct nc_device_context*)data;
+    if (dev->state == NC_DEVICE_STATE_STOPPED) {
+        return;
+    }
+    if (!nc_device_udp_shard_bound(ec, &dev->udp, dev->udpShardSockets, &dev->udpShardsBound) ||
+        !nc_device_bind_next_udp_shard(dev, &dev->udp, dev->udpShardSockets, dev->udpShardsBound, &nc_device_udp_shard_bound_cb))
+    {
+        nc_device_bind_local_udp(dev);
+    }
+}
+
+void nc_device_bind_local_udp(struct nc_device_context* dev)
+{
     np_completion_event_reinit(&dev->socketBoundCompletionEvent, &nc_device_local_udp_bound_cb, dev);
-    nc_udp_dispatch_async_bind(&dev->localUdp, dev->pl, dev->localPort, &dev->socketBoundCompletionEvent);
+    if (dev->udpShards > 1) {
+        nc_udp_dispatch_async_bind_shared(&dev->localUdp, dev->pl, dev->localPort, &dev->socketBoundCompletionEvent);
+    } else {
+        nc_udp_dispatch_async_bind(&dev->localUdp, dev->pl, dev->localPort, &dev->socketBoundCompletionEvent);
+    }
+}
+
+/**
+ * Bind the next shard to the port of the primary socket. Returns
+ * false if all the shards are bound.
+ */
+bool nc_device_bind_next_udp_shard(struct nc_device_context* dev, struct nc_udp_dispatch_context* primary,
+                                   struct nc_udp_dispatch_context* shards, size_t bound,
+                                   np_completion_event_callback cb)
+{
+    if (bound + 1 >= dev->udpShards) {
+        return false;
+    }
+    uint16_t port = nc_udp_dispatch_get_local_port(primary);
+    np_completion_event_reinit(&dev->socketBoundCompletionEvent, cb, dev);
+    nc_udp_dispatch_async_bind_shared(&shards[bound], dev->pl, port, &dev->socketBoundCompletionEvent);
+    return true;
+}
+
+/**
+ * Start the shard which has just been bound. Returns false if the
+ * bind failed, then the port continues with the shards bound so far.
+ */
+bool nc_device_udp_shard_bound(const np_error_code ec, struct nc_udp_dispatch_context* primary,
+                               struct nc_udp_dispatch_context* shards, size_t* bound)
+{
+    if (ec != NABTO_EC_OK) {
+        NABTO_LOG_ERROR(LOG, "Failed to bind UDP socket shard. Port %d continues with %d socket(s). Error: %s",
+                        nc_udp_dispatch_get_local_port(primary), (int)(*bound + 1), np_error_code_to_string(ec));
+        return false;
+    }
+    struct nc_udp_dispatch_context* shard = &shards[*bound];
+    nc_udp_dispatch_set_primary(shard, primary);
+    nc_udp_dispatch_start_recv(shard);
+    *bound += 1;
+    return true;
+}
+
+np_error_code nc_device_init_udp_shards(struct nc_device_context* dev)
+{
+    size_t i;
+    for (i = 0; i + 1 < dev->udpShards; i++) {
+        np_error_code ec = nc_udp_dispatch_init(&dev->udpShardSockets[i], dev->pl);
+        if (ec != NABTO_EC_OK) {
+            return ec;
+        }
+        ec = nc_udp_dispatch_init(&dev->localUdpShardSockets[i], dev->pl);
+        if (ec != NABTO_EC_OK) {
+            return ec;
+        }
+    }
+    return NABTO_EC_OK;
+}
+
+void nc_device_abort_udp_shards(struct nc_device_context* dev, struct nc_udp_dispatch_context* shards)
+{
+    size_t i;
+    for (i = 0; i + 1 < dev->udpShards; i++) {
+        if (shards[i].pl != NULL) {
+            nc_udp_dispatch_abort(&shards[i]);
+        }
+    }
+}
+
+np_error_code nc_device_set_udp_shards(struct nc_device_context* dev, size_t shards)
+{
+    if (dev->state != NC_DEVICE_STATE_SETUP) {
+        return NABTO_EC_INVALID_STATE;
+    }
+    if (shards < 1 || shards > NC_DEVICE_MAX_UDP_SHARDS) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    dev->udpShards = shards;
+    return NABTO_EC_OK;
+}
+
+np_error_code nc_device_set_max_client_connections(struct nc_device_context* dev, size_t maxConnections)
+{
+    if (dev->state != NC_DEVICE_STATE_SETUP) {
+        return NABTO_EC_INVALID_STATE;
+    }
+    np_error_code ec = nc_client_connection_dispatch_set_max_connections(&dev->clientConnect, maxConnections);
+    if (ec != NABTO_EC_OK) {
+        return ec;
+    }
+    struct np_platform* pl = dev->pl;
+    if (pl->dtlsS.set_max_connections != NULL) {
+        ec = pl->dtlsS.set_max_connections(dev->dtlsServer, maxConnections);
+    }
+    return ec;
+}
+
+size_t nc_device_get_connection_memory_cost(struct nc_device_context* dev)
+{
+    struct np_platform* pl = dev->pl;
+    size_t cost = nc_client_connection_dispatch_connection_memory_cost(&dev->clientConnect);
+    if (pl->dtlsS.get_connection_memory_cost != NULL) {
+        cost += pl->dtlsS.get_connection_memory_cost(dev->dtlsServer);
+    }
+    return cost;
+}
+
+np_error_code nc_device_get_connection_memory_usage(struct nc_device_context* dev, uint64_t ref, size_t* usage)
+{
+    struct np_platform* pl = dev->pl;
+    struct nc_client_connection* connection = nc_device_connection_from_ref(dev, ref);
+    if (connection == NULL) {
+        return NABTO_EC_INVALID_CONNECTION;
+    }
+    *usage = nc_client_connection_dispatch_connection_memory_cost(&dev->clientConnect);
+    if (pl->dtlsS.get_connection_memory_usage != NULL) {
+        *usage += pl->dtlsS.get_connection_memory_usage(connection->dtls);
+    } else if (pl->dtlsS.get_connection_memory_cost != NULL) {
+        *usage += pl->dtlsS.get_connection_memory_cost(dev->dtlsServer);
+    }
+    return NABTO_EC_OK;
+}
+
+void nc_device_set_connection_idle_timeout(struct nc_device_context* dev, uint32_t idleTimeout)
+{
+    nc_client_connection_dispatch_set_idle_timeout(&dev->clientConnect, idleTimeout);
+}
+
+void nc_device_set_max_concurrent_handshakes(struct nc_device_context* dev, size_t maxConcurrent)
+{
+    nc_handshake_admission_set_max_concurrent(&dev->clientConnect.admission, maxConcurrent);
+}
+
+np_error_code nc_device_set_handshake_rate_limit(struct nc_device_context* dev, uint32_t rate, uint32_t burst,
+                                                 uint8_t ipv4Prefix, uint8_t ipv6Prefix)
+{
+    return nc_handshake_admission_set_rate_limit(&dev->clientConnect.admission, rate, burst, ipv4Prefix, ipv6Prefix);
+}
+
+void nc_device_get_handshake_counters(struct nc_device_context* dev, struct nc_handshake_admission_counters* counters)
+{
+    *counters = dev->clientConnect.admission.counters;
 }
 
 np_error_code nc_device_start(struct nc_device_context* dev,
@@ -223,7 +447,26 @@ np_error_code nc_device_start(struct nc_device_context* dev,
     nc_attacher_set_app_info(&dev->attacher, appName, appVersion);
     nc_attacher_set_device_info(&dev->attacher, productId, deviceId);
 
-    nc_udp_dispatch_async_bind(&dev->udp, pl, 0, &dev->socketBoundCompletionEvent);
+    dev->udpShardsBound = 0;
+    dev->localUdpShardsBound = 0;
+    if (dev->udpShards > 1) {
+        if (!nc_udp_dispatch_has_bind_shared(&dev->udp)) {
+            NABTO_LOG_WARN(LOG, "The platform cannot share UDP ports, continuing with one socket per port");
+            dev->udpShards = 1;
+        } else {
+            np_error_code ec = nc_device_init_udp_shards(dev);
+            if (ec != NABTO_EC_OK) {
+                dev->state = NC_DEVICE_STATE_STOPPED;
+                return ec;
+            }
+        }
+    }
+
+    if (dev->udpShards > 1) {
+        nc_udp_dispatch_async_bind_shared(&dev->udp, pl, 0, &dev->socketBoundCompletionEvent);
+    } else {
+        nc_udp_dispatch_async_bind(&dev->udp, pl, 0, &dev->socketBoundCompletionEvent);
+    }
     return NABTO_EC_OK;
 }
 
@@ -232,6 +475,8 @@ void nc_device_attach_closed_cb(void* data) {
     nc_udp_dispatch_abort(&dev->udp);
     nc_udp_dispatch_abort(&dev->localUdp);
     nc_udp_dispatch_abort(&dev->secondaryUdp);
+    nc_device_abort_udp_shards(dev, dev->udpShardSockets);
+    nc_device_abort_udp_shards(dev, dev->localUdpShardSockets);
     if (dev->closeCb) {
         nc_device_close_callback cb = dev->closeCb;
         dev->closeCb = NULL;
@@ -251,6 +496,7 @@ void nc_device_stop(struct nc_device_context* dev)
     dev->state = NC_DEVICE_STATE_STOPPED;
     nc_udp_dispatch_abort(&dev->udp);
     nc_udp_dispatch_abort(&dev->secondaryUdp);
+    nc_device_abort_udp_shards(dev, dev->udpShardSockets);
     nc_rendezvous_remove_udp_dispatch(&dev->rendezvous);
     nc_stun_remove_sockets(&dev->stun);
     nc_attacher_stop(&dev->attacher);
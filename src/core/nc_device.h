@@ -14,6 +14,18 @@
 
 #include <platform/np_error_code.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Max number of sockets the main and the local port can each be
+ * sharded into.
+ */
+#ifndef NC_DEVICE_MAX_UDP_SHARDS
+#define NC_DEVICE_MAX_UDP_SHARDS 8
+#endif
+
 enum nc_device_state {
     NC_DEVICE_STATE_SETUP,
     NC_DEVICE_STATE_RUNNING,
@@ -44,6 +56,19 @@ struct nc_device_context {
     // This socket is used for local client connections
     struct nc_udp_dispatch_context localUdp;
 
+    // Number of sockets sharing each of the main and the local
+    // ports. With more than one shard the kernel distributes the
+    // flows between the sockets, each with its own receive path.
+    size_t udpShards;
+    // The shards besides udp and localUdp.
+    struct nc_udp_dispatch_context udpShardSockets[NC_DEVICE_MAX_UDP_SHARDS - 1];
+    struct nc_udp_dispatch_context localUdpShardSockets[NC_DEVICE_MAX_UDP_SHARDS - 1];
+    size_t udpShardsBound;
+    size_t localUdpShardsBound;
+
+    // Shared by the keep alives of the attacher and the client
+    // connections, it is deinitialized after them.
+    struct nc_keep_alive_sweep keepAliveSweep;
     struct nc_attach_context attacher;
     struct nc_stream_manager_context streamManager;
     struct nc_client_connection_dispatch_context clientConnect;
@@ -84,6 +109,44 @@ void nc_device_deinit(struct nc_device_context* dev);
 
 void nc_device_set_keys(struct nc_device_context* device, const unsigned char* publicKeyL, size_t publicKeySize, const unsigned char* privateKeyL, size_t privateKeySize);
 
+/**
+ * Set the number of sockets the main and the local ports are opened
+ * with. Must be called before the device is started.
+ */
+np_error_code nc_device_set_udp_shards(struct nc_device_context* dev, size_t shards);
+
+/**
+ * Set the max number of concurrent client connections. Must be
+ * called before the device is started.
+ */
+np_error_code nc_device_set_max_client_connections(struct nc_device_context* dev, size_t maxConnections);
+
+/**
+ * Get the number of bytes which is preallocated for each client
+ * connection.
+ */
+size_t nc_device_get_connection_memory_cost(struct nc_device_context* dev);
+
+/**
+ * Get the number of bytes currently retained by a client connection.
+ */
+np_error_code nc_device_get_connection_memory_usage(struct nc_device_context* dev, uint64_t ref, size_t* usage);
+
+/**
+ * Hibernate client connections which has been idle for idleTimeout
+ * ms, 0 disables hibernation.
+ */
+void nc_device_set_connection_idle_timeout(struct nc_device_context* dev, uint32_t idleTimeout);
+
+/**
+ * Configure the admission of new DTLS handshakes, see
+ * nc_handshake_admission.h
+ */
+void nc_device_set_max_concurrent_handshakes(struct nc_device_context* dev, size_t maxConcurrent);
+np_error_code nc_device_set_handshake_rate_limit(struct nc_device_context* dev, uint32_t rate, uint32_t burst,
+                                                 uint8_t ipv4Prefix, uint8_t ipv6Prefix);
+void nc_device_get_handshake_counters(struct nc_device_context* dev, struct nc_handshake_admission_counters* counters);
+
 np_error_code nc_device_start(struct nc_device_context* dev,
                               const char* appName, const char* appVersion,
                               const char* productId, const char* deviceId,
@@ -110,5 +173,8 @@ void nc_device_events_listener_notify(enum nc_device_event event, void* data);
 np_error_code nc_device_add_server_connect_token(struct nc_device_context* ctx, const char* token);
 np_error_code nc_device_is_server_connect_tokens_synchronized(struct nc_device_context* ctx);
 
+#ifdef __cplusplus
+} // extern c
+#endif
 
 #endif // NC_DEVICE_H
@@ -0,0 +1,152 @@
+#include "nc_handshake_admission.h"
+
+#include <platform/np_logging.h>
+#include <platform/np_timestamp_wrapper.h>
+
+#include <string.h>
+
+#define LOG NABTO_LOG_MODULE_CLIENT_CONNECTION_DISPATCH
+
+// number of table entries which are searched for a source.
+#define SOURCE_PROBES 8
+
+static struct nc_handshake_admission_source* find_source(struct nc_handshake_admission_context* ctx,
+                                                         const struct np_udp_endpoint* ep, uint32_t now);
+static bool take_token(struct nc_handshake_admission_context* ctx, struct nc_handshake_admission_source* source, uint32_t now);
+
+void nc_handshake_admission_init(struct nc_handshake_admission_context* ctx, struct np_platform* pl)
+{
+    memset(ctx, 0, sizeof(struct nc_handshake_admission_context));
+    ctx->pl = pl;
+    ctx->maxConcurrent = NC_HANDSHAKE_ADMISSION_DEFAULT_MAX_CONCURRENT;
+    ctx->rate = NC_HANDSHAKE_ADMISSION_DEFAULT_RATE;
+    ctx->burst = NC_HANDSHAKE_ADMISSION_DEFAULT_BURST;
+    ctx->ipv4Prefix = NC_HANDSHAKE_ADMISSION_DEFAULT_IPV4_PREFIX;
+    ctx->ipv6Prefix = NC_HANDSHAKE_ADMISSION_DEFAULT_IPV6_PREFIX;
+}
+
+void nc_handshake_admission_set_max_concurrent(struct nc_handshake_admission_context* ctx, size_t maxConcurrent)
+{
+    ctx->maxConcurrent = maxConcurrent;
+}
+
+np_error_code nc_handshake_admission_set_rate_limit(struct nc_handshake_admission_context* ctx,
+                                                    uint32_t rate, uint32_t burst,
+                                                    uint8_t ipv4Prefix, uint8_t ipv6Prefix)
+{
+    if ((rate > 0 && burst == 0) || burst > 1000000 || ipv4Prefix > 32 || ipv6Prefix > 128) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    ctx->rate = rate;
+    ctx->burst = burst;
+    ctx->ipv4Prefix = ipv4Prefix;
+    ctx->ipv6Prefix = ipv6Prefix;
+    // the sources are grouped by the old prefixes.
+    memset(ctx->sources, 0, sizeof(ctx->sources));
+    return NABTO_EC_OK;
+}
+
+enum nc_handshake_admission_result nc_handshake_admission_begin(struct nc_handshake_admission_context* ctx,
+                                                               const struct np_udp_endpoint* ep)
+{
+    if (ctx->maxConcurrent > 0 && ctx->inProgress >= ctx->maxConcurrent) {
+        NABTO_LOG_TRACE(LOG, "Deferring handshake, %d handshakes are in progress", (int)ctx->inProgress);
+        ctx->counters.deferred++;
+        return NC_HANDSHAKE_ADMISSION_DEFER;
+    }
+    if (ctx->rate > 0) {
+        uint32_t now = np_timestamp_now_ms(&ctx->pl->timestamp);
+        struct nc_handshake_admission_source* source = find_source(ctx, ep, now);
+        if (!take_token(ctx, source, now)) {
+            NABTO_LOG_TRACE(LOG, "Dropping handshake, the source has exceeded its handshake rate");
+            ctx->counters.dropped++;
+            return NC_HANDSHAKE_ADMISSION_DROP;
+        }
+    }
+    ctx->inProgress++;
+    ctx->counters.accepted++;
+    return NC_HANDSHAKE_ADMISSION_ACCEPT;
+}
+
+void nc_handshake_admission_end(struct nc_handshake_admission_context* ctx)
+{
+    if (ctx->inProgress > 0) {
+        ctx->inProgress--;
+    }
+}
+
+static void source_prefix(struct nc_handshake_admission_context* ctx, const struct np_ip_address* ip, uint8_t* prefix)
+{
+    memset(prefix, 0, 16);
+    size_t bits;
+    if (ip->type == NABTO_IPV4) {
+        memcpy(prefix, ip->ip.v4, 4);
+        bits = ctx->ipv4Prefix;
+    } else {
+        memcpy(prefix, ip->ip.v6, 16);
+        bits = ctx->ipv6Prefix;
+    }
+    size_t i;
+    for (i = 0; i < 16; i++) {
+        if (bits >= 8) {
+            bits -= 8;
+        } else {
+            prefix[i] &= (uint8_t)(0xff << (8 - bits));
+            bits = 0;
+        }
+    }
+}
+
+struct nc_handshake_admission_source* find_source(struct nc_handshake_admission_context* ctx,
+                                                  const struct np_udp_endpoint* ep, uint32_t now)
+{
+    uint8_t prefix[16];
+    source_prefix(ctx, &ep->ip, prefix);
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    size_t i;
+    for (i = 0; i < 16; i++) {
+        hash = (hash ^ prefix[i]) * 16777619u;
+    }
+
+    struct nc_handshake_admission_source* victim = NULL;
+    for (i = 0; i < SOURCE_PROBES; i++) {
+        struct nc_handshake_admission_source* source = &ctx->sources[(hash + i) % NC_HANDSHAKE_ADMISSION_SOURCES];
+        if (source->used && source->type == ep->ip.type && memcmp(source->prefix, prefix, 16) == 0) {
+            return source;
+        }
+        if (victim == NULL || (victim->used && (!source->used || np_timestamp_difference(source->lastSeen, victim->lastSeen) < 0))) {
+            victim = source;
+        }
+    }
+
+    // a new source starts with a full bucket.
+    victim->used = true;
+    victim->type = ep->ip.type;
+    memcpy(victim->prefix, prefix, 16);
+    victim->tokens = ctx->burst * 1000;
+    victim->lastSeen = now;
+    return victim;
+}
+
+bool take_token(struct nc_handshake_admission_context* ctx, struct nc_handshake_admission_source* source, uint32_t now)
+{
+    uint64_t max = (uint64_t)ctx->burst * 1000;
+    int32_t elapsed = np_timestamp_difference(now, source->lastSeen);
+    uint64_t tokens = source->tokens;
+    if (elapsed > 0) {
+        tokens += (uint64_t)elapsed * ctx->rate;
+    }
+    if (tokens > max) {
+        tokens = max;
+    }
+    source->lastSeen = now;
+    bool admitted = false;
+    if (tokens >= 1000) {
+        tokens -= 1000;
+        admitted = true;
+    }
+    source->tokens = (uint32_t)tokens;
+    return admitted;
+}
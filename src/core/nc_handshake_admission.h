@@ -0,0 +1,118 @@
+#ifndef NC_HANDSHAKE_ADMISSION_H
+#define NC_HANDSHAKE_ADMISSION_H
+
+#include <platform/np_platform.h>
+#include <platform/interfaces/np_udp.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Admission control for new DTLS handshakes.
+ *
+ * A handshake costs milliseconds of cpu with the core mutex held, so
+ * the number of concurrent handshakes is limited and each source
+ * address prefix gets a token bucket of new handshakes.
+ */
+
+#ifndef NC_HANDSHAKE_ADMISSION_DEFAULT_MAX_CONCURRENT
+#define NC_HANDSHAKE_ADMISSION_DEFAULT_MAX_CONCURRENT 4
+#endif
+
+// new handshakes per second per source prefix.
+#ifndef NC_HANDSHAKE_ADMISSION_DEFAULT_RATE
+#define NC_HANDSHAKE_ADMISSION_DEFAULT_RATE 5
+#endif
+
+#ifndef NC_HANDSHAKE_ADMISSION_DEFAULT_BURST
+#define NC_HANDSHAKE_ADMISSION_DEFAULT_BURST 10
+#endif
+
+#ifndef NC_HANDSHAKE_ADMISSION_DEFAULT_IPV4_PREFIX
+#define NC_HANDSHAKE_ADMISSION_DEFAULT_IPV4_PREFIX 32
+#endif
+
+#ifndef NC_HANDSHAKE_ADMISSION_DEFAULT_IPV6_PREFIX
+#define NC_HANDSHAKE_ADMISSION_DEFAULT_IPV6_PREFIX 64
+#endif
+
+// Number of source prefixes which are tracked, the least recently
+// seen source is forgotten when the table is full.
+#ifndef NC_HANDSHAKE_ADMISSION_SOURCES
+#define NC_HANDSHAKE_ADMISSION_SOURCES 64
+#endif
+
+enum nc_handshake_admission_result {
+    NC_HANDSHAKE_ADMISSION_ACCEPT,
+    // too many handshakes in progress, the client retransmits the
+    // ClientHello later.
+    NC_HANDSHAKE_ADMISSION_DEFER,
+    // the source has exceeded its handshake rate.
+    NC_HANDSHAKE_ADMISSION_DROP
+};
+
+struct nc_handshake_admission_source {
+    bool used;
+    enum np_ip_address_type type;
+    uint8_t prefix[16];
+    // tokens are counted in 1/1000 handshakes.
+    uint32_t tokens;
+    uint32_t lastSeen;
+};
+
+struct nc_handshake_admission_counters {
+    uint64_t accepted;
+    uint64_t deferred;
+    uint64_t dropped;
+};
+
+struct nc_handshake_admission_context {
+    struct np_platform* pl;
+    size_t maxConcurrent;
+    uint32_t rate;
+    uint32_t burst;
+    uint8_t ipv4Prefix;
+    uint8_t ipv6Prefix;
+
+    size_t inProgress;
+    struct nc_handshake_admission_counters counters;
+    struct nc_handshake_admission_source sources[NC_HANDSHAKE_ADMISSION_SOURCES];
+};
+
+void nc_handshake_admission_init(struct nc_handshake_admission_context* ctx, struct np_platform* pl);
+
+/**
+ * Limit the number of concurrent handshakes, 0 is unlimited.
+ */
+void nc_handshake_admission_set_max_concurrent(struct nc_handshake_admission_context* ctx, size_t maxConcurrent);
+
+/**
+ * Set the number of new handshakes per second and the burst size
+ * allowed per source prefix. A rate of 0 disables the rate limit.
+ *
+ * @return NABTO_EC_INVALID_ARGUMENT if the rate is limited and the burst is 0,
+ *         the burst is above 1000000 or a prefix length is too long.
+ */
+np_error_code nc_handshake_admission_set_rate_limit(struct nc_handshake_admission_context* ctx,
+                                                    uint32_t rate, uint32_t burst,
+                                                    uint8_t ipv4Prefix, uint8_t ipv6Prefix);
+
+/**
+ * Decide if a handshake from the endpoint can begin. If it is
+ * accepted nc_handshake_admission_end has to be called when the
+ * handshake has ended.
+ */
+enum nc_handshake_admission_result nc_handshake_admission_begin(struct nc_handshake_admission_context* ctx,
+                                                               const struct np_udp_endpoint* ep);
+
+/**
+ * Call when an accepted handshake has completed or failed.
+ */
+void nc_handshake_admission_end(struct nc_handshake_admission_context* ctx);
+
+#ifdef __cplusplus
+} // extern c
+#endif
+
+#endif
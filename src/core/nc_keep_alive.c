@@ -2,16 +2,61 @@
 #include <platform/interfaces/np_event_queue.h>
 #include <platform/np_logging.h>
 #include <platform/np_event_queue_wrapper.h>
+#include <platform/np_timestamp_wrapper.h>
 #include <core/nc_packet.h>
 
 #include <string.h>
 
 #define LOG NABTO_LOG_MODULE_KEEP_ALIVE
 
-np_error_code nc_keep_alive_init(struct nc_keep_alive_context* ctx, struct np_platform* pl, keep_alive_wait_callback cb, void* data)
+static void sweep_event(void* data);
+static void sweep_ticks(struct nc_keep_alive_sweep* sweep, uint32_t passed);
+static uint32_t sweep_ticks_passed(struct nc_keep_alive_sweep* sweep, uint32_t now);
+static void sweep_remove(struct nc_keep_alive_context* ctx);
+static uint32_t sweep_jitter(struct nc_keep_alive_sweep* sweep);
+
+np_error_code nc_keep_alive_sweep_init(struct nc_keep_alive_sweep* sweep, struct np_platform* pl)
+{
+    size_t i;
+    sweep->pl = pl;
+    for (i = 0; i < NC_KEEP_ALIVE_SWEEP_BUCKETS; i++) {
+        nn_llist_init(&sweep->buckets[i]);
+    }
+    sweep->tick = 0;
+    sweep->tickTimestamp = 0;
+    sweep->armed = 0;
+    sweep->sweeping = false;
+    sweep->jitterState = 0;
+    if (pl->random.random(pl, &sweep->jitterState, sizeof(sweep->jitterState)) != NABTO_EC_OK) {
+        NABTO_LOG_ERROR(LOG, "Could not create a random seed for the keep alive jitter");
+    }
+    if (sweep->jitterState == 0) {
+        // xorshift needs a nonzero state.
+        sweep->jitterState = 1;
+    }
+    np_event_queue_init_event(&pl->eq, &sweep->event, &sweep_event, sweep);
+    return NABTO_EC_OK;
+}
+
+void nc_keep_alive_sweep_deinit(struct nc_keep_alive_sweep* sweep)
+{
+    if (sweep->pl != NULL) { // if init called
+        np_event_queue_deinit_event(&sweep->pl->eq, &sweep->event);
+        size_t i;
+        for (i = 0; i < NC_KEEP_ALIVE_SWEEP_BUCKETS; i++) {
+            nn_llist_deinit(&sweep->buckets[i]);
+        }
+    }
+}
+
+np_error_code nc_keep_alive_init(struct nc_keep_alive_context* ctx, struct nc_keep_alive_sweep* sweep, keep_alive_wait_callback cb, void* data)
 {
     NABTO_LOG_TRACE(LOG, "initializing keep alive");
-    ctx->pl = pl;
+    ctx->sweep = sweep;
+    ctx->cb = cb;
+    ctx->cbData = data;
+    nn_llist_node_init(&ctx->sweepNode);
+    ctx->started = false;
     ctx->kaInterval = NC_KEEP_ALIVE_DEFAULT_INTERVAL;
     ctx->kaRetryInterval = NC_KEEP_ALIVE_DEFAULT_RETRY_INTERVAL;
     ctx->kaMaxRetries = NC_KEEP_ALIVE_DEFAULT_MAX_RETRIES;
@@ -20,25 +65,26 @@ np_error_code nc_keep_alive_init(struct nc_keep_alive_context* ctx, struct np_pl
     ctx->lostKeepAlives = 0;
 
     ctx->n = ctx->kaInterval/ctx->kaRetryInterval;
-
-    return np_event_queue_create_event(&ctx->pl->eq, cb, data, &ctx->keepAliveEvent);
+    return NABTO_EC_OK;
 }
 
 void nc_keep_alive_deinit(struct nc_keep_alive_context* ctx)
 {
-    if (ctx->pl != NULL) { // if init called
-        np_event_queue_destroy_event(&ctx->pl->eq, ctx->keepAliveEvent);
+    if (ctx->sweep != NULL) { // if init called
+        sweep_remove(ctx);
     }
 }
 
 void nc_keep_alive_stop(struct nc_keep_alive_context* ctx)
 {
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->keepAliveEvent);
+    sweep_remove(ctx);
+    ctx->started = false;
 }
 
 void nc_keep_alive_reset(struct nc_keep_alive_context* ctx)
 {
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->keepAliveEvent);
+    sweep_remove(ctx);
+    ctx->started = false;
     ctx->kaInterval = NC_KEEP_ALIVE_DEFAULT_INTERVAL;
     ctx->kaRetryInterval = NC_KEEP_ALIVE_DEFAULT_RETRY_INTERVAL;
     ctx->kaMaxRetries = NC_KEEP_ALIVE_DEFAULT_MAX_RETRIES;
@@ -78,7 +124,116 @@ enum nc_keep_alive_action nc_keep_alive_should_send(struct nc_keep_alive_context
 
 void nc_keep_alive_wait(struct nc_keep_alive_context* ctx)
 {
-    np_event_queue_post_timed_event(&ctx->pl->eq, ctx->keepAliveEvent, ctx->kaRetryInterval);
+    struct nc_keep_alive_sweep* sweep = ctx->sweep;
+    sweep_remove(ctx);
+
+    uint32_t ticks = (ctx->kaRetryInterval + NC_KEEP_ALIVE_SWEEP_TICK - 1) / NC_KEEP_ALIVE_SWEEP_TICK;
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    if (!ctx->started) {
+        ctx->started = true;
+        ticks = 1 + (sweep_jitter(sweep) % ticks);
+    }
+
+    uint32_t now = np_timestamp_now_ms(&sweep->pl->timestamp);
+    if (sweep->armed == 0 && !sweep->sweeping) {
+        // the sweep has been idle, start the ticks from now.
+        sweep->tickTimestamp = now + NC_KEEP_ALIVE_SWEEP_TICK;
+        np_event_queue_post_timed_event(&sweep->pl->eq, &sweep->event, NC_KEEP_ALIVE_SWEEP_TICK);
+    }
+    // Ticks which have passed but are not handled yet, since the sweep
+    // event is late, are skipped. The first tick after now is less
+    // than a tick away, so a keep alive which is due ticks after it
+    // never expires early.
+    uint32_t tick = sweep->tick;
+    if (np_timestamp_less_or_equal(sweep->tickTimestamp, now)) {
+        tick += sweep_ticks_passed(sweep, now);
+    }
+    ctx->dueTick = tick + ticks;
+    nn_llist_append(&sweep->buckets[ctx->dueTick % NC_KEEP_ALIVE_SWEEP_BUCKETS], &ctx->sweepNode, ctx);
+    sweep->armed++;
+}
+
+void sweep_event(void* data)
+{
+    struct nc_keep_alive_sweep* sweep = data;
+    uint32_t now = np_timestamp_now_ms(&sweep->pl->timestamp);
+    if (sweep->armed > 0 && np_timestamp_less_or_equal(sweep->tickTimestamp, now)) {
+        sweep->sweeping = true;
+        sweep_ticks(sweep, sweep_ticks_passed(sweep, now));
+        sweep->sweeping = false;
+    }
+    if (sweep->armed > 0) {
+        np_event_queue_post_timed_event(&sweep->pl->eq, &sweep->event, (uint32_t)np_timestamp_difference(sweep->tickTimestamp, now));
+    }
+}
+
+/**
+ * Get the number of ticks from the current tick up to and including
+ * the last tick which is due at now. The current tick has to be due.
+ */
+uint32_t sweep_ticks_passed(struct nc_keep_alive_sweep* sweep, uint32_t now)
+{
+    return ((uint32_t)np_timestamp_difference(now, sweep->tickTimestamp) / NC_KEEP_ALIVE_SWEEP_TICK) + 1;
+}
+
+/**
+ * Call the keep alives which are due in the passed ticks. If the event
+ * is late more than one tick has passed, the ticks are handled in one
+ * pass such that a keep alive is called at most once. The sweep is
+ * moved past the ticks before the callbacks are called, so the
+ * callbacks wait relative to now. The keep alives are moved to a list
+ * of their own first, the callbacks can wait again and stop other
+ * keep alives.
+ */
+void sweep_ticks(struct nc_keep_alive_sweep* sweep, uint32_t passed)
+{
+    uint32_t first = sweep->tick;
+    sweep->tick += passed;
+    sweep->tickTimestamp += passed * NC_KEEP_ALIVE_SWEEP_TICK;
+
+    struct nn_llist due;
+    nn_llist_init(&due);
+    uint32_t buckets = passed < NC_KEEP_ALIVE_SWEEP_BUCKETS ? passed : NC_KEEP_ALIVE_SWEEP_BUCKETS;
+    uint32_t i;
+    for (i = 0; i < buckets; i++) {
+        struct nn_llist* bucket = &sweep->buckets[(first + i) % NC_KEEP_ALIVE_SWEEP_BUCKETS];
+        struct nn_llist_iterator it = nn_llist_begin(bucket);
+        while (!nn_llist_is_end(&it)) {
+            struct nc_keep_alive_context* ctx = nn_llist_get_item(&it);
+            nn_llist_next(&it);
+            if ((uint32_t)(ctx->dueTick - first) < passed) {
+                nn_llist_erase_node(&ctx->sweepNode);
+                nn_llist_append(&due, &ctx->sweepNode, ctx);
+            }
+        }
+    }
+    while (!nn_llist_empty(&due)) {
+        struct nn_llist_iterator head = nn_llist_begin(&due);
+        struct nc_keep_alive_context* ctx = nn_llist_get_item(&head);
+        sweep_remove(ctx);
+        ctx->cb(ctx->cbData);
+    }
+    nn_llist_deinit(&due);
+}
+
+void sweep_remove(struct nc_keep_alive_context* ctx)
+{
+    if (nn_llist_node_in_list(&ctx->sweepNode)) {
+        nn_llist_erase_node(&ctx->sweepNode);
+        ctx->sweep->armed--;
+    }
+}
+
+uint32_t sweep_jitter(struct nc_keep_alive_sweep* sweep)
+{
+    uint32_t x = sweep->jitterState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sweep->jitterState = x;
+    return x;
 }
 
 void nc_keep_alive_create_request(struct nc_keep_alive_context* ctx, uint8_t** buffer, size_t* length)
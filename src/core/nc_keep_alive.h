@@ -6,6 +6,12 @@
 
 #include <platform/np_types.h>
 
+#include <nn/llist.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifndef NC_KEEP_ALIVE_MTU_MAX
 #define NC_KEEP_ALIVE_MTU_MAX 1400
 #endif
@@ -26,10 +32,52 @@
 #define NC_KEEP_ALIVE_DEFAULT_RETRY_INTERVAL 2000
 #define NC_KEEP_ALIVE_DEFAULT_MAX_RETRIES 15
 
+/**
+ * The keep alives of the device are checked by one periodic sweep
+ * instead of a timer each. The sweep is a hashed timing wheel, a keep
+ * alive which is due in n ticks is put in the bucket n ticks ahead of
+ * the current tick, and a tick only visits the keep alives in its
+ * bucket. A keep alive which is due more than
+ * NC_KEEP_ALIVE_SWEEP_BUCKETS ticks ahead stays in its bucket until
+ * its round comes.
+ */
+#ifndef NC_KEEP_ALIVE_SWEEP_TICK
+#define NC_KEEP_ALIVE_SWEEP_TICK 250 // ms
+#endif
 
-struct nc_keep_alive_context
+#ifndef NC_KEEP_ALIVE_SWEEP_BUCKETS
+#define NC_KEEP_ALIVE_SWEEP_BUCKETS 32
+#endif
+
+typedef void (*keep_alive_wait_callback)(void* data);
+
+struct nc_keep_alive_sweep
 {
     struct np_platform* pl;
+    struct np_event event;
+    struct nn_llist buckets[NC_KEEP_ALIVE_SWEEP_BUCKETS];
+    // The tick the next sweep handles and the timestamp it is due.
+    uint32_t tick;
+    uint32_t tickTimestamp;
+    // Number of keep alives waiting in the sweep, the event is only
+    // posted while it is nonzero.
+    size_t armed;
+    bool sweeping;
+    // xorshift state for the jitter of keep alives which starts.
+    uint32_t jitterState;
+};
+
+struct nc_keep_alive_context
+{
+    struct nc_keep_alive_sweep* sweep;
+    keep_alive_wait_callback cb;
+    void* cbData;
+    // node in a bucket of the sweep while the keep alive waits.
+    struct nn_llist_node sweepNode;
+    uint32_t dueTick;
+    // false until the first wait after init, stop or reset.
+    bool started;
+
     uint32_t kaInterval;
     uint32_t kaRetryInterval;
     uint32_t kaMaxRetries;
@@ -40,8 +88,6 @@ struct nc_keep_alive_context
 
     bool isSending;
     uint8_t sendBuffer[18];
-    struct np_event* keepAliveEvent;
-
 };
 
 enum nc_keep_alive_action{
@@ -50,17 +96,24 @@ enum nc_keep_alive_action{
     KA_TIMEOUT
 };
 
-typedef void (*keep_alive_wait_callback)(void* data);
+/**
+ * Init the sweep which the keep alives of a device waits in.
+ */
+np_error_code nc_keep_alive_sweep_init(struct nc_keep_alive_sweep* sweep, struct np_platform* pl);
 
 /**
- * Init keep alive with the given parameters
- * @param pl            The platform to use
+ * Deinit the sweep, the keep alives has to be deinitialized first.
+ */
+void nc_keep_alive_sweep_deinit(struct nc_keep_alive_sweep* sweep);
+
+/**
+ * Init keep alive with default parameters
  * @param ctx           The keep alive context to use for keep alive
- * @param interval      The interval between keep alive transmissions
- * @param retryInterval The interval between retransmissions in case of packet loss
- * @param maxRetries    The maximum amount of retransmissions before a connection is considered dead
+ * @param sweep         The sweep the keep alive waits in
+ * @param cb            Called by the sweep when a wait is over
+ * @param data          User data for the callback
  */
-np_error_code nc_keep_alive_init(struct nc_keep_alive_context* ctx, struct np_platform* pl, keep_alive_wait_callback cb, void* data);
+np_error_code nc_keep_alive_init(struct nc_keep_alive_context* ctx, struct nc_keep_alive_sweep* sweep, keep_alive_wait_callback cb, void* data);
 
 void nc_keep_alive_deinit(struct nc_keep_alive_context* ctx);
 
@@ -76,7 +129,17 @@ enum nc_keep_alive_action nc_keep_alive_should_send(struct nc_keep_alive_context
 bool nc_keep_alive_handle_request(struct nc_keep_alive_context* ctx, uint8_t* reqBuffer, size_t reqLength, uint8_t** respBuffer, size_t* respLength);
 
 
+/**
+ * Wait kaRetryInterval ms in the sweep before the callback is
+ * called. The first wait after init, stop or reset is shortened by a
+ * random part of the interval, such that keep alives which starts at
+ * the same time are spread over the ticks.
+ */
 void nc_keep_alive_wait(struct nc_keep_alive_context* ctx);
 void nc_keep_alive_packet_sent(const np_error_code ec, void* data);
 
+#ifdef __cplusplus
+} // extern c
+#endif
+
 #endif //NC_KEEP_ALIVE_H
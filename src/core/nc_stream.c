@@ -76,15 +76,8 @@ np_error_code nc_stream_init(struct np_platform* pl, struct nc_stream_context* c
     nc_stream_module.free_recv_segment = &nc_stream_free_recv_segment;
     nc_stream_module.notify_event = &nc_stream_event_callback;
 
-    np_error_code ec;
-    ec = np_event_queue_create_event(&pl->eq, &nc_stream_event_queue_callback, ctx, &ctx->ev);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
-    ec = np_event_queue_create_event(&pl->eq, &nc_stream_handle_timeout, ctx, &ctx->timer);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
+    np_event_queue_init_event(&pl->eq, &ctx->ev, &nc_stream_event_queue_callback, ctx);
+    np_event_queue_init_event(&pl->eq, &ctx->timer, &nc_stream_handle_timeout, ctx);
 
     ctx->active = true;
     ctx->dtls = dtls;
@@ -126,8 +119,8 @@ void nc_stream_destroy(struct nc_stream_context* ctx)
     ctx->streamId = 0;
 
     struct np_event_queue* eq = &ctx->pl->eq;
-    np_event_queue_destroy_event(eq, ctx->ev);
-    np_event_queue_destroy_event(eq, ctx->timer);
+    np_event_queue_deinit_event(eq, &ctx->ev);
+    np_event_queue_deinit_event(eq, &ctx->timer);
     nabto_stream_destroy(&ctx->stream);
 }
 
@@ -167,13 +160,13 @@ void nc_stream_event(struct nc_stream_context* ctx)
             nc_stream_destroy(ctx);
             return;
         case ET_CLOSED:
-            np_event_queue_cancel_event(&ctx->pl->eq, ctx->timer);
+            np_event_queue_cancel_event(&ctx->pl->eq, &ctx->timer);
             return;
     }
 
     nabto_stream_event_handled(&ctx->stream, eventType);
 
-    np_event_queue_post_maybe_double(&ctx->pl->eq, ctx->ev);
+    np_event_queue_post_maybe_double(&ctx->pl->eq, &ctx->ev);
 }
 
 void nc_stream_handle_wait(struct nc_stream_context* ctx)
@@ -199,7 +192,7 @@ void nc_stream_handle_wait(struct nc_stream_context* ctx)
                 ctx->negativeCount = 0;
             }
             diff += 2; // make sure that we have passed the timestamp inside the module.
-            np_event_queue_post_timed_event(&ctx->pl->eq, ctx->timer, diff);
+            np_event_queue_post_timed_event(&ctx->pl->eq, &ctx->timer, diff);
         }
     }
 }
@@ -272,7 +265,7 @@ void nc_stream_send_packet(struct nc_stream_context* ctx, enum nabto_stream_next
     if (ec != NABTO_EC_OK) {
         NABTO_LOG_ERROR(LOG, "dtls send returned ec: %u", ec);
         nabto_stream_event_handled(&ctx->stream, eventType);
-        np_event_queue_post_maybe_double(&ctx->pl->eq, ctx->ev);
+        np_event_queue_post_maybe_double(&ctx->pl->eq, &ctx->ev);
     }
 }
 
@@ -284,7 +277,7 @@ void nc_stream_event_queue_callback(void* data)
 void nc_stream_event_callback(enum nabto_stream_module_event event, void* data)
 {
     struct nc_stream_context* ctx = (struct nc_stream_context*) data;
-    np_event_queue_post_maybe_double(&ctx->pl->eq, ctx->ev);
+    np_event_queue_post_maybe_double(&ctx->pl->eq, &ctx->ev);
 }
 
 struct nabto_stream_send_segment* nc_stream_alloc_send_segment(size_t bufferSize, void* data)
@@ -299,6 +299,17 @@ void nc_stream_manager_remove_connection(struct nc_stream_manager_context* ctx,
     }
 }
 
+bool nc_stream_manager_connection_has_streams(struct nc_stream_manager_context* ctx, struct nc_client_connection* connection)
+{
+    int i;
+    for(i = 0; i < NABTO_MAX_STREAMS; i++) {
+        if (ctx->streamConns[i] == connection) {
+            return true;
+        }
+    }
+    return false;
+}
+
 uint64_t nc_stream_manager_get_connection_ref(struct nc_stream_manager_context* ctx, struct nabto_stream* stream)
 {
     for (int i = 0; i < NABTO_MAX_STREAMS; i++) {
@@ -6,6 +6,10 @@
 #include <streaming/nabto_stream_window.h>
 #include <core/nc_stream.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #ifndef NABTO_MAX_STREAMS
 #define NABTO_MAX_STREAMS 10
 #endif
@@ -54,10 +58,19 @@ void nc_stream_manager_free_recv_segment(struct nc_stream_manager_context* ctx,
 
 void nc_stream_manager_remove_connection(struct nc_stream_manager_context* ctx, struct nc_client_connection* connection);
 
+/**
+ * Query if a connection has any streams.
+ */
+bool nc_stream_manager_connection_has_streams(struct nc_stream_manager_context* ctx, struct nc_client_connection* connection);
+
 uint64_t nc_stream_manager_get_connection_ref(struct nc_stream_manager_context* ctx, struct nabto_stream* stream);
 
 np_error_code nc_stream_manager_get_ephemeral_stream_port(struct nc_stream_manager_context* ctx, uint32_t* port);
 
 void nc_stream_manager_set_max_segments(struct nc_stream_manager_context* ctx, size_t maxSegments);
 
+#ifdef __cplusplus
+} // extern c
+#endif
+
 #endif
@@ -78,11 +78,8 @@ np_error_code nc_stun_init(struct nc_stun_context* ctx,
     ctx->stunModule.get_stamp = &nc_stun_get_stamp;
     ctx->stunModule.log = &nc_stun_log;
     ctx->stunModule.get_rand = &nc_stun_get_rand;
+    np_event_queue_init_event(eq, &ctx->toEv, &nc_stun_handle_timeout, ctx);
     np_error_code ec;
-    ec = np_event_queue_create_event(eq, &nc_stun_handle_timeout, ctx, &ctx->toEv);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
     ec = nc_dns_multi_resolver_init(pl, &ctx->dnsMultiResolver);
     if (ec != NABTO_EC_OK) {
         return ec;
@@ -106,7 +103,7 @@ void nc_stun_deinit(struct nc_stun_context* ctx)
         struct np_platform* pl = ctx->pl;
         pl->buf.free(ctx->sendBuf);
 
-        np_event_queue_destroy_event(&pl->eq, ctx->toEv);
+        np_event_queue_deinit_event(&pl->eq, &ctx->toEv);
         np_completion_event_deinit(&ctx->dnsCompletionEvent);
         np_completion_event_deinit(&ctx->sendCompletionEvent);
         nc_dns_multi_resolver_deinit(&ctx->dnsMultiResolver);
@@ -207,7 +204,7 @@ void nc_stun_event(struct nc_stun_context* ctx)
 {
     enum nabto_stun_next_event_type event = nabto_stun_next_event_to_handle(&ctx->stun);
     struct np_platform* pl = ctx->pl;
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->toEv);
+    np_event_queue_cancel_event(&ctx->pl->eq, &ctx->toEv);
     switch(event) {
         case STUN_ET_SEND_PRIMARY:
         {
@@ -268,7 +265,7 @@ void nc_stun_event(struct nc_stun_context* ctx)
         case STUN_ET_WAIT:
         {
             uint32_t to = nabto_stun_get_timeout_ms(&ctx->stun);
-            np_event_queue_post_timed_event(&ctx->pl->eq, ctx->toEv, to);
+            np_event_queue_post_timed_event(&ctx->pl->eq, &ctx->toEv, to);
         }
             break;
         case STUN_ET_NO_EVENT:
@@ -21,7 +21,15 @@ np_error_code nc_udp_dispatch_init(struct nc_udp_dispatch_context* ctx, struct n
 {
     memset(ctx, 0, sizeof(struct nc_udp_dispatch_context));
     ctx->pl = pl;
-    ctx->recvBuffer = pl->buf.allocate();
+    size_t i;
+    for (i = 0; i < NC_UDP_DISPATCH_RECV_BATCH_SIZE; i++) {
+        ctx->recvBuffers[i] = pl->buf.allocate();
+        if (ctx->recvBuffers[i] == NULL) {
+            return NABTO_EC_OUT_OF_MEMORY;
+        }
+        ctx->recvEntries[i].buffer = pl->buf.start(ctx->recvBuffers[i]);
+        ctx->recvEntries[i].bufferSize = pl->buf.size(ctx->recvBuffers[i]);
+    }
     np_error_code ec = np_udp_create(&pl->udp, &ctx->sock);
     if (ec != NABTO_EC_OK) {
         return ec;
@@ -34,7 +42,10 @@ void nc_udp_dispatch_deinit(struct nc_udp_dispatch_context* ctx)
     if (ctx->pl != NULL) { // if init was called
         struct np_platform* pl = ctx->pl;
         np_udp_destroy(&pl->udp, ctx->sock);
-        pl->buf.free(ctx->recvBuffer);
+        size_t i;
+        for (i = 0; i < NC_UDP_DISPATCH_RECV_BATCH_SIZE; i++) {
+            pl->buf.free(ctx->recvBuffers[i]);
+        }
         np_completion_event_deinit(&ctx->recvCompletionEvent);
 
     }
@@ -47,6 +58,17 @@ void nc_udp_dispatch_async_bind(struct nc_udp_dispatch_context* ctx, struct np_p
     np_udp_async_bind_port(&pl->udp, ctx->sock, port, completionEvent);
 }
 
+void nc_udp_dispatch_async_bind_shared(struct nc_udp_dispatch_context* ctx, struct np_platform* pl, uint16_t port,
+                                       struct np_completion_event* completionEvent)
+{
+    np_udp_async_bind_port_shared(&pl->udp, ctx->sock, port, completionEvent);
+}
+
+bool nc_udp_dispatch_has_bind_shared(struct nc_udp_dispatch_context* ctx)
+{
+    return np_udp_has_bind_port_shared(&ctx->pl->udp);
+}
+
 void nc_udp_dispatch_start_recv(struct nc_udp_dispatch_context* ctx)
 {
     start_recv(ctx);
@@ -65,6 +87,18 @@ void nc_udp_dispatch_async_send_to(struct nc_udp_dispatch_context* ctx,struct np
     np_udp_async_send_to(&ctx->pl->udp, ctx->sock, ep, buffer, bufferSize, completionEvent);
 }
 
+void nc_udp_dispatch_async_send_batch(struct nc_udp_dispatch_context* ctx,
+                                      struct np_udp_send_entry* entries, size_t entriesSize,
+                                      struct np_completion_event* completionEvent)
+{
+    np_udp_async_send_batch(&ctx->pl->udp, ctx->sock, entries, entriesSize, completionEvent);
+}
+
+bool nc_udp_dispatch_has_send_batch(struct nc_udp_dispatch_context* ctx)
+{
+    return np_udp_has_send_batch(&ctx->pl->udp);
+}
+
 uint16_t nc_udp_dispatch_get_local_port(struct nc_udp_dispatch_context* ctx)
 {
     return np_udp_get_local_port(&ctx->pl->udp, ctx->sock);
@@ -79,18 +113,20 @@ void start_recv(struct nc_udp_dispatch_context* ctx)
 void async_recv_wait_complete(const np_error_code ec, void* userData)
 {
     struct nc_udp_dispatch_context* ctx = userData;
-    struct np_platform* pl = ctx->pl;
     if (ec) {
         return;
     }
 
-    struct np_udp_endpoint ep;
-    uint8_t* bufferStart = pl->buf.start(ctx->recvBuffer);
-    size_t bufferLength = pl->buf.size(ctx->recvBuffer);
-    size_t recvLength;
-    np_error_code recvEc = np_udp_recv_from(&ctx->pl->udp, ctx->sock, &ep, bufferStart, bufferLength, &recvLength);
+    // Drain up to a batch of packets from the socket and dispatch them
+    // all before waiting for the socket to become readable again.
+    size_t received = 0;
+    np_error_code recvEc = np_udp_recv_batch(&ctx->pl->udp, ctx->sock, ctx->recvEntries, NC_UDP_DISPATCH_RECV_BATCH_SIZE, &received);
     if (recvEc == NABTO_EC_OK) {
-        nc_udp_dispatch_handle_packet(&ep, bufferStart, recvLength, ctx);
+        size_t i;
+        for (i = 0; i < received; i++) {
+            struct np_udp_recv_entry* entry = &ctx->recvEntries[i];
+            nc_udp_dispatch_handle_packet(&entry->ep, entry->buffer, (uint16_t)entry->recvSize, ctx);
+        }
     }
 
     if (recvEc == NABTO_EC_OK || recvEc == NABTO_EC_AGAIN) {
@@ -103,19 +139,28 @@ void nc_udp_dispatch_handle_packet(struct np_udp_endpoint* ep,
                                    uint8_t* buffer, uint16_t bufferSize, struct nc_udp_dispatch_context* ctx)
 {
     uint8_t* start = buffer;
+    // shards dispatch to the contexts of the primary, but client
+    // connections are bound to the shard which received the packet.
+    struct nc_udp_dispatch_context* contexts = ctx->primary != NULL ? ctx->primary : ctx;
 
     // ec == OK
-    if(ctx->stun != NULL && ((start[0] == 0) || (start[0] == 1))) {
-        nc_stun_handle_packet(ctx->stun, ep, buffer, bufferSize);
-    }  else if (ctx->attacher != NULL && ((start[0] >= 20)  && (start[0] <= 64))) {
-        nc_attacher_handle_dtls_packet(ctx->attacher, ep, buffer, bufferSize);
-    } else if (ctx->cliConn != NULL && (start[0] >= 240)) {
-        nc_client_connection_dispatch_handle_packet(ctx->cliConn, ctx, ep, buffer, bufferSize);
+    if(contexts->stun != NULL && ((start[0] == 0) || (start[0] == 1))) {
+        nc_stun_handle_packet(contexts->stun, ep, buffer, bufferSize);
+    }  else if (contexts->attacher != NULL && ((start[0] >= 20)  && (start[0] <= 64))) {
+        nc_attacher_handle_dtls_packet(contexts->attacher, ep, buffer, bufferSize);
+    } else if (contexts->cliConn != NULL && (start[0] >= 240)) {
+        nc_client_connection_dispatch_handle_packet(contexts->cliConn, ctx, ep, buffer, bufferSize);
     } else {
         NABTO_LOG_ERROR(LOG, "Unable to dispatch packet with ID: %u", start[0]);
     }
 }
 
+void nc_udp_dispatch_set_primary(struct nc_udp_dispatch_context* ctx,
+                                 struct nc_udp_dispatch_context* primary)
+{
+    ctx->primary = primary;
+}
+
 void nc_udp_dispatch_set_client_connection_context(struct nc_udp_dispatch_context* ctx,
                                                    struct nc_client_connection_dispatch_context* cliConn)
 {
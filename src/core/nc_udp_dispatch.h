@@ -8,6 +8,14 @@
 extern "C" {
 #endif
 
+/**
+ * Max number of datagrams received and dispatched per recv wait
+ * completion.
+ */
+#ifndef NC_UDP_DISPATCH_RECV_BATCH_SIZE
+#define NC_UDP_DISPATCH_RECV_BATCH_SIZE 16
+#endif
+
 struct nc_stun_context;
 
 struct nc_udp_dispatch_context {
@@ -16,8 +24,12 @@ struct nc_udp_dispatch_context {
     struct nc_client_connection_dispatch_context* cliConn;
     struct nc_attach_context* attacher;
     struct nc_stun_context* stun;
+    // If this socket is a shard of another socket bound to the same
+    // port, packets are dispatched to the contexts of the primary.
+    struct nc_udp_dispatch_context* primary;
 
-    struct np_communication_buffer* recvBuffer;
+    struct np_communication_buffer* recvBuffers[NC_UDP_DISPATCH_RECV_BATCH_SIZE];
+    struct np_udp_recv_entry recvEntries[NC_UDP_DISPATCH_RECV_BATCH_SIZE];
 
     struct np_completion_event recvCompletionEvent;
 };
@@ -33,15 +45,44 @@ void nc_udp_dispatch_start_recv(struct nc_udp_dispatch_context* ctx);
 void nc_udp_dispatch_async_bind(struct nc_udp_dispatch_context* ctx, struct np_platform* pl, uint16_t port,
                                 struct np_completion_event* completionEvent);
 
+/**
+ * Bind the socket such that the port can be shared with other
+ * sockets bound with this function. Resolves the completion event
+ * with NABTO_EC_NOT_SUPPORTED if the platform cannot share ports.
+ */
+void nc_udp_dispatch_async_bind_shared(struct nc_udp_dispatch_context* ctx, struct np_platform* pl, uint16_t port,
+                                       struct np_completion_event* completionEvent);
+
+bool nc_udp_dispatch_has_bind_shared(struct nc_udp_dispatch_context* ctx);
+
 np_error_code nc_udp_dispatch_abort(struct nc_udp_dispatch_context* ctx);
 
 void nc_udp_dispatch_async_send_to(struct nc_udp_dispatch_context* ctx, struct np_udp_endpoint* ep,
                                    uint8_t* buffer, uint16_t bufferSize,
                                    struct np_completion_event* completionEvent);
 
+/**
+ * Send several packets in one operation. Only use this if
+ * nc_udp_dispatch_has_send_batch returns true.
+ */
+void nc_udp_dispatch_async_send_batch(struct nc_udp_dispatch_context* ctx,
+                                      struct np_udp_send_entry* entries, size_t entriesSize,
+                                      struct np_completion_event* completionEvent);
+
+bool nc_udp_dispatch_has_send_batch(struct nc_udp_dispatch_context* ctx);
+
 uint16_t nc_udp_dispatch_get_local_port(struct nc_udp_dispatch_context* ctx);
 
 // SET AND CLEAR CONTEXTS
+
+/**
+ * Make ctx a shard of primary. The shard has its own socket and
+ * receive path, received packets are dispatched to the contexts set
+ * on the primary.
+ */
+void nc_udp_dispatch_set_primary(struct nc_udp_dispatch_context* ctx,
+                                 struct nc_udp_dispatch_context* primary);
+
 void nc_udp_dispatch_set_client_connection_context(struct nc_udp_dispatch_context* ctx,
                                                    struct nc_client_connection_dispatch_context* cliConn);
 
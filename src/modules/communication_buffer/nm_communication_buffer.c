@@ -19,6 +19,7 @@ static uint16_t buf_size(struct np_communication_buffer* buf);
 
 
 struct np_communication_buffer {
+    // the allocation, the data starts NP_COMMUNICATION_BUFFER_HEADROOM bytes into it.
     uint8_t* buf;
     uint16_t size;
 };
@@ -39,7 +40,7 @@ struct np_communication_buffer* buf_allocate()
         NABTO_LOG_ERROR(LOG, "Failed to allocate communication buffer structure");
         return NULL;
     }
-    buf->buf = (uint8_t*)malloc(NABTO_COMMUNICATION_BUFFER_LENGTH);
+    buf->buf = (uint8_t*)malloc(NP_COMMUNICATION_BUFFER_HEADROOM + NABTO_COMMUNICATION_BUFFER_LENGTH);
     if (!buf->buf) {
         NABTO_LOG_ERROR(LOG, "Failed to allocate communication buffer");
         free(buf);
@@ -60,7 +61,7 @@ void buf_free(struct np_communication_buffer* buf)
 
 uint8_t* buf_start(struct np_communication_buffer* buf)
 {
-    return buf->buf;
+    return buf->buf + NP_COMMUNICATION_BUFFER_HEADROOM;
 }
 
 uint16_t buf_size(struct np_communication_buffer* buf)
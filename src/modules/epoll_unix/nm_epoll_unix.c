@@ -0,0 +1,201 @@
+#include "nm_epoll_unix.h"
+#include "nm_epoll_unix_udp.h"
+#include "nm_epoll_unix_tcp.h"
+
+#include <platform/np_logging.h>
+#include <platform/np_util.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define LOG NABTO_LOG_MODULE_UDP
+
+/**
+ * Helper function declarations
+ */
+static void* network_thread(void* data);
+static void free_destroyed_sockets(struct nm_epoll_unix* ctx);
+static void handle_events(struct nm_epoll_unix* ctx, struct epoll_event* events, int nfds);
+
+/**
+ * Api functions start
+ */
+np_error_code nm_epoll_unix_init(struct nm_epoll_unix* ctx)
+{
+    nn_llist_init(&ctx->destroyedSockets);
+    ctx->stopped = false;
+    ctx->thread = 0;
+    ctx->epollFd = -1;
+    ctx->eventFd = -1;
+    pthread_mutex_init(&ctx->mutex, NULL);
+
+    ctx->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (ctx->epollFd == -1) {
+        NABTO_LOG_ERROR(LOG, "Failed to create epoll fd (%d) %s", errno, strerror(errno));
+        return NABTO_EC_UNKNOWN;
+    }
+
+    ctx->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->eventFd == -1) {
+        NABTO_LOG_ERROR(LOG, "Failed to create eventfd (%d) %s", errno, strerror(errno));
+        close(ctx->epollFd);
+        ctx->epollFd = -1;
+        return NABTO_EC_UNKNOWN;
+    }
+
+    // the eventfd is the only registration without a socket.
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, ctx->eventFd, &ev) == -1) {
+        NABTO_LOG_ERROR(LOG, "Failed to add eventfd to epoll (%d) %s", errno, strerror(errno));
+        close(ctx->eventFd);
+        close(ctx->epollFd);
+        ctx->eventFd = -1;
+        ctx->epollFd = -1;
+        return NABTO_EC_UNKNOWN;
+    }
+
+    return NABTO_EC_OK;
+}
+
+void nm_epoll_unix_deinit(struct nm_epoll_unix* ctx)
+{
+    nm_epoll_unix_stop(ctx);
+
+    if (ctx->thread != 0) {
+        pthread_join(ctx->thread, NULL);
+    }
+    free_destroyed_sockets(ctx);
+    if (ctx->eventFd != -1) {
+        close(ctx->eventFd);
+    }
+    if (ctx->epollFd != -1) {
+        close(ctx->epollFd);
+    }
+    pthread_mutex_destroy(&ctx->mutex);
+}
+
+void nm_epoll_unix_run(struct nm_epoll_unix* ctx)
+{
+    pthread_create(&ctx->thread, NULL, &network_thread, ctx);
+}
+
+void nm_epoll_unix_stop(struct nm_epoll_unix* ctx)
+{
+    nm_epoll_unix_lock(ctx);
+    ctx->stopped = true;
+    nm_epoll_unix_unlock(ctx);
+    nm_epoll_unix_notify(ctx);
+}
+
+void nm_epoll_unix_notify(struct nm_epoll_unix* ctx)
+{
+    uint64_t one = 1;
+    if (write(ctx->eventFd, &one, sizeof(uint64_t)) < 0) {
+        // EAGAIN means the counter is saturated and a wakeup is pending anyway.
+        NABTO_LOG_TRACE(LOG, "eventfd write failed (%d) %s", errno, strerror(errno));
+    }
+}
+
+np_error_code nm_epoll_unix_add_fd(struct nm_epoll_unix* ctx, struct nm_epoll_unix_base* base, int fd)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(struct epoll_event));
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = base;
+    if (epoll_ctl(ctx->epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        NABTO_LOG_ERROR(LOG, "Failed to add fd to epoll (%d) %s", errno, strerror(errno));
+        return NABTO_EC_UNKNOWN;
+    }
+    return NABTO_EC_OK;
+}
+
+void nm_epoll_unix_defer_free(struct nm_epoll_unix* ctx, struct nm_epoll_unix_base* base, int fd)
+{
+    if (fd != -1) {
+        epoll_ctl(ctx->epollFd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    nn_llist_append(&ctx->destroyedSockets, &base->destroyedNode, base);
+}
+
+void nm_epoll_unix_lock(struct nm_epoll_unix* ctx)
+{
+    pthread_mutex_lock(&ctx->mutex);
+}
+
+void nm_epoll_unix_unlock(struct nm_epoll_unix* ctx)
+{
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+/**
+ * Helper functions start
+ */
+
+/**
+ * The events from the previous epoll_wait has been handled so no
+ * event can reference the destroyed sockets anymore.
+ */
+void free_destroyed_sockets(struct nm_epoll_unix* ctx)
+{
+    while (!nn_llist_empty(&ctx->destroyedSockets)) {
+        struct nn_llist_iterator it = nn_llist_begin(&ctx->destroyedSockets);
+        struct nm_epoll_unix_base* base = nn_llist_get_item(&it);
+        nn_llist_erase_node(&base->destroyedNode);
+        free(base);
+    }
+}
+
+void handle_events(struct nm_epoll_unix* ctx, struct epoll_event* events, int nfds)
+{
+    int i;
+    for (i = 0; i < nfds; i++) {
+        struct nm_epoll_unix_base* base = events[i].data.ptr;
+        if (base == NULL) {
+            uint64_t value;
+            if (read(ctx->eventFd, &value, sizeof(uint64_t)) < 0) {
+                // EAGAIN, another wakeup already reset the counter.
+            }
+        } else if (base->type == NM_EPOLL_UNIX_TYPE_UDP) {
+            nm_epoll_unix_udp_handle_event((struct np_udp_socket*)base, events[i].events);
+        } else if (base->type == NM_EPOLL_UNIX_TYPE_TCP) {
+            nm_epoll_unix_tcp_handle_event((struct np_tcp_socket*)base, events[i].events);
+        }
+    }
+}
+
+void* network_thread(void* data)
+{
+    struct nm_epoll_unix* ctx = data;
+    struct epoll_event events[NM_EPOLL_UNIX_MAX_EVENTS];
+    while(true) {
+        nm_epoll_unix_lock(ctx);
+        free_destroyed_sockets(ctx);
+        bool stopped = ctx->stopped;
+        nm_epoll_unix_unlock(ctx);
+        if (stopped) {
+            return NULL;
+        }
+
+        int nfds = epoll_wait(ctx->epollFd, events, NM_EPOLL_UNIX_MAX_EVENTS, -1);
+        if (nfds < 0) {
+            if (errno != EINTR) {
+                NABTO_LOG_ERROR(LOG, "Error in epoll_wait: (%i) '%s'", errno, strerror(errno));
+            }
+            continue;
+        }
+        NABTO_LOG_TRACE(LOG, "epoll_wait returned with %i events", nfds);
+
+        nm_epoll_unix_lock(ctx);
+        handle_events(ctx, events, nfds);
+        nm_epoll_unix_unlock(ctx);
+    }
+    return NULL;
+}
@@ -0,0 +1,158 @@
+#ifndef NM_EPOLL_UNIX_H
+#define NM_EPOLL_UNIX_H
+
+#include <platform/np_types.h>
+#include <platform/np_platform.h>
+#include <api/nabto_device_threads.h>
+
+#include <nn/llist.h>
+
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Linux epoll based implementation of the udp, tcp and mdns udp bind
+ * interfaces. It has the same surface as the select_unix module.
+ *
+ * File descriptors are registered edge triggered once when they are
+ * created, the registration is never changed afterwards. Each socket
+ * remembers whether it may be readable or writable since the last
+ * edge, an operation is tried right away if the socket is ready and
+ * otherwise it is completed by the network thread on the next edge.
+ */
+
+enum nm_epoll_unix_type {
+    NM_EPOLL_UNIX_TYPE_UDP,
+    NM_EPOLL_UNIX_TYPE_TCP
+};
+
+/**
+ * Common first member of the sockets, the epoll event data points to
+ * this.
+ */
+struct nm_epoll_unix_base {
+    enum nm_epoll_unix_type type;
+    // node in the list of destroyed sockets waiting to be freed by the network thread.
+    struct nn_llist_node destroyedNode;
+};
+
+struct nm_epoll_unix_udp_recv_wait_context {
+    struct np_completion_event* completionEvent;
+};
+
+struct np_udp_socket {
+    struct nm_epoll_unix_base base;
+    struct nm_epoll_unix* epollCtx;
+    int sock;
+    enum np_ip_address_type type;
+
+    bool aborted;
+    bool destroyed;
+    // set if the kernel rejected UDP_SEGMENT, then batches are sent with sendmmsg.
+    bool gsoDisabled;
+    // true if data may be available since the last edge.
+    bool readable;
+    struct nm_epoll_unix_udp_recv_wait_context recv;
+};
+
+struct nm_epoll_unix_tcp_connect_context {
+    struct np_completion_event* completionEvent;
+};
+
+struct nm_epoll_unix_tcp_write_context {
+    struct np_completion_event* completionEvent;
+    const void* data;
+    size_t dataLength;
+};
+
+struct nm_epoll_unix_tcp_read_context {
+    struct np_completion_event* completionEvent;
+    void* buffer;
+    size_t bufferSize;
+    size_t* readLength;
+};
+
+struct np_tcp_socket {
+    struct nm_epoll_unix_base base;
+    struct nm_epoll_unix* epollCtx;
+    int fd;
+
+    struct nm_epoll_unix_tcp_connect_context connect;
+    struct nm_epoll_unix_tcp_write_context write;
+    struct nm_epoll_unix_tcp_read_context read;
+
+    // edge triggered readiness since the last edge.
+    bool readable;
+    bool writable;
+
+    bool destroyed;
+    bool aborted;
+};
+
+// Max number of events handled per epoll_wait call.
+#ifndef NM_EPOLL_UNIX_MAX_EVENTS
+#define NM_EPOLL_UNIX_MAX_EVENTS 64
+#endif
+
+struct nm_epoll_unix {
+    int epollFd;
+    int eventFd;
+    // sockets which has been destroyed but can still be referenced
+    // by events returned from epoll_wait.
+    struct nn_llist destroyedSockets;
+
+    pthread_t thread;
+    // synchronize core thread and network thread access to the sockets.
+    pthread_mutex_t mutex;
+    bool stopped;
+};
+
+/**
+ * Functions used from the API
+ */
+np_error_code nm_epoll_unix_init(struct nm_epoll_unix* ctx);
+void nm_epoll_unix_deinit(struct nm_epoll_unix* ctx);
+
+void nm_epoll_unix_run(struct nm_epoll_unix* ctx);
+void nm_epoll_unix_stop(struct nm_epoll_unix* ctx);
+
+void nm_epoll_unix_lock(struct nm_epoll_unix* ctx);
+void nm_epoll_unix_unlock(struct nm_epoll_unix* ctx);
+
+/**
+ * Functions only used internally in the module
+ */
+
+// wake the network thread.
+void nm_epoll_unix_notify(struct nm_epoll_unix* ctx);
+
+// register a file descriptor edge triggered for both read and write.
+np_error_code nm_epoll_unix_add_fd(struct nm_epoll_unix* ctx, struct nm_epoll_unix_base* base, int fd);
+
+// remove the fd and free the socket from the network thread when no
+// pending events can reference it anymore. Must be called with the lock held.
+void nm_epoll_unix_defer_free(struct nm_epoll_unix* ctx, struct nm_epoll_unix_base* base, int fd);
+
+/**
+ * Get implementations for the implemented modules.
+ */
+
+/**
+ * Get an object implementing the udp interface.
+ */
+struct np_udp nm_epoll_unix_udp_get_impl(struct nm_epoll_unix* ctx);
+
+/**
+ * Get an object implementing the tcp interface.
+ */
+struct np_tcp nm_epoll_unix_tcp_get_impl(struct nm_epoll_unix* ctx);
+
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif // NM_EPOLL_UNIX_H
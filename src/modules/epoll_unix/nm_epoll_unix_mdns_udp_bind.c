@@ -0,0 +1,127 @@
+#include "nm_epoll_unix_udp.h"
+
+#include <platform/np_logging.h>
+#include <platform/np_util.h>
+#include <platform/np_completion_event.h>
+
+#include <modules/mdns/nm_mdns_udp_bind.h>
+#include <modules/unix/nm_unix_mdns.h>
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define LOG NABTO_LOG_MODULE_UDP
+
+static void nm_epoll_unix_async_bind_mdns_ipv4(struct np_udp_socket* sock, struct np_completion_event* completionEvent);
+static void nm_epoll_unix_async_bind_mdns_ipv6(struct np_udp_socket* sock, struct np_completion_event* completionEvent);
+static np_error_code create_socket_ipv6(struct np_udp_socket* s);
+static np_error_code create_socket_ipv4(struct np_udp_socket* s);
+
+
+static struct nm_mdns_udp_bind_functions module = {
+    .async_bind_mdns_ipv4 = &nm_epoll_unix_async_bind_mdns_ipv4,
+    .async_bind_mdns_ipv6 = &nm_epoll_unix_async_bind_mdns_ipv6
+};
+
+struct nm_mdns_udp_bind nm_epoll_unix_mdns_udp_bind_get_impl(struct nm_epoll_unix* ctx)
+{
+    struct nm_mdns_udp_bind obj;
+    obj.mptr = &module;
+    obj.data = ctx;
+    return obj;
+}
+
+
+np_error_code nm_epoll_unix_async_bind_mdns_ipv4_ec(struct np_udp_socket* sock)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "bind called on aborted socket");
+        return NABTO_EC_ABORTED;
+    }
+
+    np_error_code ec;
+    ec = create_socket_ipv4(sock);
+
+    if (ec != NABTO_EC_OK) {
+        return ec;
+    }
+
+    if (!nm_unix_mdns_setup_ipv4_socket(sock->sock)) {
+        close(sock->sock);
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+
+    ec = nm_epoll_unix_udp_register(sock);
+    if (ec != NABTO_EC_OK) {
+        close(sock->sock);
+        sock->sock = -1;
+    }
+    return ec;
+}
+
+void nm_epoll_unix_async_bind_mdns_ipv4(struct np_udp_socket* sock, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_epoll_unix_async_bind_mdns_ipv4_ec(sock);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+np_error_code nm_epoll_unix_async_bind_mdns_ipv6_ec(struct np_udp_socket* sock)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "bind called on aborted socket");
+        return NABTO_EC_ABORTED;
+    }
+
+    np_error_code ec = create_socket_ipv6(sock);
+    if (ec) {
+        return ec;
+    }
+
+    if (!nm_unix_mdns_setup_ipv6_socket(sock->sock)) {
+        close(sock->sock);
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+
+    ec = nm_epoll_unix_udp_register(sock);
+    if (ec != NABTO_EC_OK) {
+        close(sock->sock);
+        sock->sock = -1;
+    }
+    return ec;
+}
+
+void nm_epoll_unix_async_bind_mdns_ipv6(struct np_udp_socket* sock, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_epoll_unix_async_bind_mdns_ipv6_ec(sock);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+
+np_error_code create_socket_ipv6(struct np_udp_socket* s)
+{
+    int sock = nm_epoll_unix_udp_nonblocking_socket(AF_INET6, SOCK_DGRAM);
+    if (sock == -1) {
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+
+    s->type = NABTO_IPV6;
+    s->sock = sock;
+    return NABTO_EC_OK;
+}
+
+
+np_error_code create_socket_ipv4(struct np_udp_socket* s)
+{
+    int sock = nm_epoll_unix_udp_nonblocking_socket(AF_INET, SOCK_DGRAM);
+    if (sock == -1) {
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+    s->type = NABTO_IPV4;
+    s->sock = sock;
+    return NABTO_EC_OK;
+}
@@ -0,0 +1,10 @@
+#ifndef _NM_EPOLL_UNIX_MDNS_UDP_BIND_H_
+#define _NM_EPOLL_UNIX_MDNS_UDP_BIND_H_
+
+#include <modules/mdns/nm_mdns_udp_bind.h>
+
+struct nm_epoll_unix;
+
+struct nm_mdns_udp_bind nm_epoll_unix_mdns_udp_bind_get_impl(struct nm_epoll_unix* ctx);
+
+#endif
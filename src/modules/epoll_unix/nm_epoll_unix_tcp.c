@@ -0,0 +1,447 @@
+#include "nm_epoll_unix_tcp.h"
+
+#include <platform/np_util.h>
+#include <platform/np_logging.h>
+#include <platform/np_completion_event.h>
+
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+
+#define LOG NABTO_LOG_MODULE_TCP
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static np_error_code create(struct np_tcp* obj, struct np_tcp_socket** sock);
+static void destroy(struct np_tcp_socket* sock);
+static void async_connect(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port, struct np_completion_event* completionEvent);
+static void async_write(struct np_tcp_socket* sock, const void* data, size_t dataLength, struct np_completion_event* completionEvent);
+static void async_read(struct np_tcp_socket* sock, void* buffer, size_t bufferLength, size_t* readLength, struct np_completion_event* completionEvent);
+static void tcp_shutdown(struct np_tcp_socket* sock);
+static void tcp_abort(struct np_tcp_socket* sock);
+static void tcp_abort_locked(struct np_tcp_socket* sock);
+
+static void is_connected(struct np_tcp_socket* sock);
+static void tcp_do_write(struct np_tcp_socket* sock);
+static void tcp_do_read(struct np_tcp_socket* sock);
+static np_error_code async_connect_ec(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port);
+static np_error_code is_connected_ec(struct np_tcp_socket* sock);
+static np_error_code tcp_do_write_ec(struct np_tcp_socket* sock);
+static np_error_code tcp_do_read_ec(struct np_tcp_socket* sock);
+
+static struct np_tcp_functions module = {
+    .create = &create,
+    .destroy = &destroy,
+    .async_connect = &async_connect,
+    .async_write = &async_write,
+    .async_read = &async_read,
+    .shutdown = &tcp_shutdown,
+    .abort = &tcp_abort
+};
+
+struct np_tcp nm_epoll_unix_tcp_get_impl(struct nm_epoll_unix* ctx)
+{
+    struct np_tcp obj;
+    obj.mptr = &module;
+    obj.data = ctx;
+    return obj;
+}
+
+void nm_epoll_unix_tcp_handle_event(struct np_tcp_socket* s, uint32_t events)
+{
+    if (s->destroyed) {
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        s->readable = true;
+        tcp_do_read(s);
+    }
+    if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+        s->writable = true;
+        if (s->connect.completionEvent) {
+            is_connected(s);
+        }
+        if (s->write.completionEvent) {
+            tcp_do_write(s);
+        }
+    }
+}
+
+
+np_error_code create(struct np_tcp* obj, struct np_tcp_socket** sock)
+{
+    struct nm_epoll_unix* epollCtx = obj->data;
+    struct np_tcp_socket* s = calloc(1,sizeof(struct np_tcp_socket));
+    if (s == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    s->base.type = NM_EPOLL_UNIX_TYPE_TCP;
+    s->fd = -1;
+    *sock = s;
+    s->epollCtx = epollCtx;
+    s->aborted = false;
+    s->destroyed = false;
+    s->readable = false;
+    s->writable = false;
+    return NABTO_EC_OK;
+}
+
+void destroy(struct np_tcp_socket* sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+    struct nm_epoll_unix* epollCtx = sock->epollCtx;
+    nm_epoll_unix_lock(epollCtx);
+    tcp_abort_locked(sock);
+    sock->destroyed = true;
+    nm_epoll_unix_defer_free(epollCtx, &sock->base, sock->fd);
+    if (sock->fd != -1) {
+        shutdown(sock->fd, SHUT_RDWR);
+        close(sock->fd);
+        sock->fd = -1;
+    }
+    nm_epoll_unix_unlock(epollCtx);
+    // let the network thread free the socket.
+    nm_epoll_unix_notify(epollCtx);
+}
+
+np_error_code async_connect_ec(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port)
+{
+    int s;
+
+    int type = SOCK_STREAM;
+#ifdef SOCK_NONBLOCK
+    // Linux
+    type |= SOCK_NONBLOCK;
+#endif
+
+    if (address->type == NABTO_IPV4) {
+        s = socket(AF_INET, type, 0);
+    } else if (address->type == NABTO_IPV6) {
+        s = socket(AF_INET6, type, 0);
+    } else {
+        return NABTO_EC_NOT_SUPPORTED;
+    }
+    if (s < 0) {
+        return NABTO_EC_UNKNOWN;
+    }
+
+    sock->fd = s;
+
+    int flags;
+#ifndef SOCK_NONBLOCK
+    // Mac
+    flags = fcntl(sock->fd, F_GETFL, 0);
+    if (flags < 0) {
+        NABTO_LOG_ERROR(LOG, "cannot set nonblocking mode, fcntl F_GETFL failed");
+        return NABTO_EC_UNKNOWN;
+    }
+    if (fcntl(sock->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        NABTO_LOG_ERROR(LOG, "cannot set nonblocking mode, fcntl F_SETFL failed");
+        return NABTO_EC_UNKNOWN;
+    }
+#endif
+
+
+    flags = 1;
+    if (setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flags, sizeof(int)) != 0) {
+        NABTO_LOG_ERROR(LOG, "Could not set socket option TCP_NODELAY");
+    }
+
+    flags = 1;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_KEEPALIVE, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not enable KEEPALIVE");
+    }
+
+
+#ifdef SOL_TCP
+    // Linux
+    flags = 9;
+    if(setsockopt(sock->fd, SOL_TCP, TCP_KEEPCNT, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not set TCP_KEEPCNT");
+    }
+
+    flags = 60;
+    if(setsockopt(sock->fd, SOL_TCP, TCP_KEEPIDLE, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not set TCP_KEEPIDLE");
+    }
+
+    flags = 60;
+    if(setsockopt(sock->fd, SOL_TCP, TCP_KEEPINTVL, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not set TCP KEEPINTVL");
+    }
+#endif
+
+
+#if defined(SOL_SOCKET) && defined(SO_NOSIGPIPE)
+    // Mac
+    flags = 1;
+    if (setsockopt(sock->fd, SOL_SOCKET, SO_NOSIGPIPE, (char *) &flags, sizeof(int)) != 0) {
+        NABTO_LOG_ERROR(LOG, "Could not set socket option SO_NOSIGPIPE");
+    }
+#endif
+
+#if defined(IPPROTO_TCP) && defined(TCP_KEEPALIVE)
+    // Mac
+    flags = 60;
+    if(setsockopt(sock->fd, IPPROTO_TCP, TCP_KEEPALIVE, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not set TCP_KEEPCNT");
+    }
+#endif
+
+    {
+        int status;
+        if (address->type == NABTO_IPV4) {
+            struct sockaddr_in host;
+
+            memset(&host,0,sizeof(struct sockaddr_in));
+            host.sin_family = AF_INET;
+            memcpy((void*)&host.sin_addr, address->ip.v4, 4);
+            host.sin_port = htons(port);
+            status = connect(sock->fd, (struct sockaddr*)&host, sizeof(struct sockaddr_in));
+        } else { // Must be ipv6 (address->type == NABTO_IPV6) {
+            struct sockaddr_in6 host;
+
+            memset(&host,0,sizeof(struct sockaddr_in6));
+            host.sin6_family = AF_INET6;
+            memcpy(host.sin6_addr.s6_addr, address->ip.v6, 16);
+            host.sin6_port = htons(port);
+            status = connect(sock->fd, (struct sockaddr*)&host, sizeof(struct sockaddr_in6));
+        }
+        if (status != 0 && errno != EINPROGRESS && errno != EWOULDBLOCK) {
+            NABTO_LOG_ERROR(LOG, "Connect failed %s", strerror(errno));
+            return NABTO_EC_UNKNOWN;
+        }
+        // Register after connect, an unconnected socket reports EPOLLHUP.
+        np_error_code ec = nm_epoll_unix_add_fd(sock->epollCtx, &sock->base, sock->fd);
+        if (ec != NABTO_EC_OK) {
+            return ec;
+        }
+        if (status == 0) {
+            // connected
+            sock->writable = true;
+            return NABTO_EC_OK;
+        }
+    }
+    return NABTO_EC_AGAIN;
+}
+
+void async_connect(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port, struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+    if (sock->connect.completionEvent) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+
+    // the lock is held such that the network thread cannot see the
+    // connect edge before the completion event is set.
+    nm_epoll_unix_lock(sock->epollCtx);
+    sock->connect.completionEvent = completionEvent;
+    np_error_code ec = async_connect_ec(sock, address, port);
+    if (ec != NABTO_EC_AGAIN) {
+        // connected or error.
+        sock->connect.completionEvent = NULL;
+        np_completion_event_resolve(completionEvent, ec);
+    }
+    nm_epoll_unix_unlock(sock->epollCtx);
+}
+
+np_error_code is_connected_ec(struct np_tcp_socket* sock)
+{
+    int err;
+    socklen_t len;
+    len = sizeof(err);
+    if (getsockopt(sock->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0) {
+        NABTO_LOG_ERROR(LOG, "getsockopt error %s",strerror(errno));
+        return NABTO_EC_UNKNOWN;
+    } else {
+        if (err == 0) {
+            return NABTO_EC_OK;
+        } else if ( err == EINPROGRESS) {
+            // Wait for next event
+            return NABTO_EC_AGAIN;
+        } else {
+            NABTO_LOG_ERROR(LOG, "Cannot connect socket %s", strerror(err));
+            return NABTO_EC_UNKNOWN;
+        }
+    }
+}
+
+void is_connected(struct np_tcp_socket* sock) {
+    if (sock->connect.completionEvent == NULL) {
+        return;
+    }
+
+    np_error_code ec = is_connected_ec(sock);
+    if (ec != NABTO_EC_AGAIN) {
+        struct np_completion_event* ev = sock->connect.completionEvent;
+        sock->connect.completionEvent = NULL;
+        np_completion_event_resolve(ev, ec);
+    }
+}
+
+np_error_code tcp_do_write_ec(struct np_tcp_socket* sock)
+{
+    // write until the socket would block, edge triggered epoll only
+    // reports the socket writable again after that.
+    while (sock->write.dataLength > 0) {
+        ssize_t sent = send(sock->fd, sock->write.data, sock->write.dataLength, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // Wait for next event which triggers write.
+                return NABTO_EC_AGAIN;
+            } else {
+                return NABTO_EC_UNKNOWN;
+            }
+        }
+        sock->write.data = (const uint8_t*)sock->write.data + sent;
+        sock->write.dataLength -= sent;
+    }
+    return NABTO_EC_OK;
+}
+
+void tcp_do_write(struct np_tcp_socket* sock)
+{
+    if (sock->write.completionEvent == NULL) {
+        // nothing to write
+        return;
+    }
+
+    sock->writable = false;
+    np_error_code ec = tcp_do_write_ec(sock);
+    if (ec != NABTO_EC_AGAIN) {
+        sock->writable = true;
+        struct np_completion_event* ev = sock->write.completionEvent;
+        sock->write.completionEvent = NULL;
+        np_completion_event_resolve(ev, ec);
+    }
+}
+
+void async_write(struct np_tcp_socket* sock, const void* data, size_t dataLength, struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+    if (sock->write.completionEvent != NULL) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+
+    nm_epoll_unix_lock(sock->epollCtx);
+    sock->write.data = data;
+    sock->write.dataLength = dataLength;
+    sock->write.completionEvent = completionEvent;
+    if (sock->writable) {
+        tcp_do_write(sock);
+    }
+    nm_epoll_unix_unlock(sock->epollCtx);
+}
+
+np_error_code tcp_do_read_ec(struct np_tcp_socket* sock)
+{
+    int readen = recv(sock->fd, sock->read.buffer, sock->read.bufferSize, 0);
+    if (readen == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return NABTO_EC_AGAIN;
+        } else {
+            NABTO_LOG_ERROR(LOG, "recv error %s", strerror(errno));
+            return NABTO_EC_UNKNOWN;
+        }
+    } else if (readen == 0) {
+        return NABTO_EC_EOF;
+    } else {
+        *(sock->read.readLength) = readen;
+        return NABTO_EC_OK;
+    }
+}
+
+void tcp_do_read(struct np_tcp_socket* sock)
+{
+    if (sock->read.completionEvent == NULL) {
+        return;
+    }
+
+    sock->readable = false;
+    np_error_code ec = tcp_do_read_ec(sock);
+
+    if (ec != NABTO_EC_AGAIN) {
+        // more data, eof or an error is still pending on the socket.
+        sock->readable = true;
+        struct np_completion_event* ev = sock->read.completionEvent;
+        sock->read.completionEvent = NULL;
+        np_completion_event_resolve(ev, ec);
+    }
+}
+
+
+void async_read(struct np_tcp_socket* sock, void* buffer, size_t bufferSize, size_t* readLength, struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+    if (sock->read.completionEvent != NULL) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+    nm_epoll_unix_lock(sock->epollCtx);
+    sock->read.buffer = buffer;
+    sock->read.bufferSize = bufferSize;
+    sock->read.readLength = readLength;
+    sock->read.completionEvent = completionEvent;
+    if (sock->readable) {
+        tcp_do_read(sock);
+    }
+    nm_epoll_unix_unlock(sock->epollCtx);
+}
+
+void tcp_shutdown(struct np_tcp_socket* sock)
+{
+    shutdown(sock->fd, SHUT_WR);
+}
+
+void tcp_abort(struct np_tcp_socket* sock)
+{
+    nm_epoll_unix_lock(sock->epollCtx);
+    tcp_abort_locked(sock);
+    nm_epoll_unix_unlock(sock->epollCtx);
+}
+
+void tcp_abort_locked(struct np_tcp_socket* sock)
+{
+    if (sock->aborted) {
+        return;
+    }
+    sock->aborted = true;
+    if (sock->read.completionEvent != NULL) {
+        struct np_completion_event* ev = sock->read.completionEvent;
+        sock->read.completionEvent = NULL;
+        np_completion_event_resolve(ev, NABTO_EC_ABORTED);
+    }
+    if (sock->write.completionEvent != NULL) {
+        struct np_completion_event* ev = sock->write.completionEvent;
+        sock->write.completionEvent = NULL;
+        np_completion_event_resolve(ev, NABTO_EC_ABORTED);
+    }
+    if (sock->connect.completionEvent) {
+        struct np_completion_event* ev = sock->connect.completionEvent;
+        sock->connect.completionEvent = NULL;
+        np_completion_event_resolve(ev, NABTO_EC_ABORTED);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef _NM_EPOLL_UNIX_TCP_H_
+#define _NM_EPOLL_UNIX_TCP_H_
+
+#include "nm_epoll_unix.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// called from the network thread with the lock held.
+void nm_epoll_unix_tcp_handle_event(struct np_tcp_socket* sock, uint32_t events);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
@@ -0,0 +1,413 @@
+#include "nm_epoll_unix_udp.h"
+
+#include <modules/unix/nm_unix_udp.h>
+
+#include <platform/np_logging.h>
+#include <platform/np_util.h>
+#include <platform/np_completion_event.h>
+
+#include <stdlib.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <ifaddrs.h>
+#include <sys/epoll.h>
+
+#define LOG NABTO_LOG_MODULE_UDP
+
+/**
+ * Helper function declarations
+ */
+static void udp_abort_locked(struct np_udp_socket* sock);
+static void udp_set_readable(struct np_udp_socket* sock, np_error_code ec);
+
+/**
+ * Api function declarations
+ */
+static np_error_code nm_epoll_unix_udp_create(struct np_udp* obj, struct np_udp_socket** sock);
+static void nm_epoll_unix_udp_destroy(struct np_udp_socket* sock);
+static void nm_epoll_unix_udp_abort(struct np_udp_socket* sock);
+static void nm_epoll_unix_udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+static void nm_epoll_unix_udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+static void nm_epoll_unix_udp_async_send_to(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
+                                             uint8_t* buffer, uint16_t bufferSize,
+                                             struct np_completion_event* completionEvent);
+static void nm_epoll_unix_udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                                struct np_completion_event* completionEvent);
+static void nm_epoll_unix_udp_async_recv_wait(struct np_udp_socket* socket, struct np_completion_event* completionEvent);
+static np_error_code nm_epoll_unix_udp_recv_from(struct np_udp_socket* socket, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength);
+static np_error_code nm_epoll_unix_udp_recv_batch(struct np_udp_socket* socket, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received);
+static uint16_t nm_epoll_unix_udp_get_local_port(struct np_udp_socket* socket);
+
+static np_error_code bind_port(struct np_udp_socket* s, uint16_t port);
+static np_error_code set_reuse_port(struct np_udp_socket* s);
+static uint16_t get_local_port(struct np_udp_socket* s);
+static np_error_code create_socket_any(struct np_udp_socket* s);
+
+
+
+static struct np_udp_functions module = {
+    .create           = &nm_epoll_unix_udp_create,
+    .destroy          = &nm_epoll_unix_udp_destroy,
+    .abort            = &nm_epoll_unix_udp_abort,
+    .async_bind_port  = &nm_epoll_unix_udp_async_bind_port,
+    .async_bind_port_shared = &nm_epoll_unix_udp_async_bind_port_shared,
+    .async_send_to    = &nm_epoll_unix_udp_async_send_to,
+    .async_send_batch = &nm_epoll_unix_udp_async_send_batch,
+    .async_recv_wait  = &nm_epoll_unix_udp_async_recv_wait,
+    .recv_from        = &nm_epoll_unix_udp_recv_from,
+    .recv_batch       = &nm_epoll_unix_udp_recv_batch,
+    .get_local_port   = &nm_epoll_unix_udp_get_local_port
+};
+
+
+struct np_udp nm_epoll_unix_udp_get_impl(struct nm_epoll_unix* ctx)
+{
+    struct np_udp obj;
+    obj.mptr = &module;
+    obj.data = ctx;
+    return obj;
+}
+
+np_error_code nm_epoll_unix_udp_create(struct np_udp* obj, struct np_udp_socket** sock)
+{
+    struct np_udp_socket* s = calloc(1, sizeof(struct np_udp_socket));
+    if (!s) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    *sock = s;
+    s->sock = -1;
+
+    struct nm_epoll_unix* epollCtx = obj->data;
+
+    s->base.type = NM_EPOLL_UNIX_TYPE_UDP;
+    s->epollCtx = epollCtx;
+    s->aborted = false;
+    s->destroyed = false;
+    s->readable = false;
+
+    return NABTO_EC_OK;
+}
+
+np_error_code nm_epoll_unix_udp_register(struct np_udp_socket* sock)
+{
+    nm_epoll_unix_lock(sock->epollCtx);
+    np_error_code ec = nm_epoll_unix_add_fd(sock->epollCtx, &sock->base, sock->sock);
+    nm_epoll_unix_unlock(sock->epollCtx);
+    return ec;
+}
+
+np_error_code nm_epoll_unix_udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port, bool shared)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "bind called on aborted socket");
+        return NABTO_EC_ABORTED;
+    }
+
+    np_error_code ec;
+
+    ec = create_socket_any(sock);
+    if (ec != NABTO_EC_OK) {
+        return ec;
+    }
+
+    if (shared) {
+        ec = set_reuse_port(sock);
+    }
+    if (ec == NABTO_EC_OK) {
+        ec = bind_port(sock, port);
+    }
+    if (ec == NABTO_EC_OK) {
+        ec = nm_epoll_unix_udp_register(sock);
+    }
+    if (ec != NABTO_EC_OK) {
+        close(sock->sock);
+        sock->sock = -1;
+    }
+
+    return ec;
+}
+
+void nm_epoll_unix_udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_epoll_unix_udp_async_bind_port_ec(sock, port, false);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+void nm_epoll_unix_udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_epoll_unix_udp_async_bind_port_ec(sock, port, true);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+
+np_error_code nm_epoll_unix_udp_async_send_to_ec(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
+                                                  uint8_t* buffer, uint16_t bufferSize)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "send to called on aborted socket");
+        return NABTO_EC_ABORTED;
+    }
+
+    np_error_code ec = nm_unix_udp_send_to(sock->sock, sock->type, ep, buffer, bufferSize);
+    if (ec != NABTO_EC_OK) {
+        return ec;
+    }
+    return NABTO_EC_OK;
+}
+
+void nm_epoll_unix_udp_async_send_to(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
+                                      uint8_t* buffer, uint16_t bufferSize,
+                                      struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_epoll_unix_udp_async_send_to_ec(sock, ep, buffer, bufferSize);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+void nm_epoll_unix_udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                         struct np_completion_event* completionEvent)
+{
+    np_error_code ec;
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "send batch called on aborted socket");
+        ec = NABTO_EC_ABORTED;
+    } else {
+        ec = nm_unix_udp_send_batch(sock->sock, sock->type, &sock->gsoDisabled, entries, entriesSize);
+    }
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+void nm_epoll_unix_udp_async_recv_wait(struct np_udp_socket* sock,
+                                        struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "recv from called on aborted socket");
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+
+    if (sock->recv.completionEvent != NULL) {
+        NABTO_LOG_ERROR(LOG, "operation already in progress");
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+
+    nm_epoll_unix_lock(sock->epollCtx);
+    if (sock->readable) {
+        // no new edge comes before the socket has been drained.
+        nm_epoll_unix_unlock(sock->epollCtx);
+        np_completion_event_resolve(completionEvent, NABTO_EC_OK);
+        return;
+    }
+    sock->recv.completionEvent = completionEvent;
+    nm_epoll_unix_unlock(sock->epollCtx);
+}
+
+/**
+ * The readable flag is cleared before reading such that an edge which
+ * arrives while reading is not lost. If a packet was read there may
+ * be more in the socket.
+ */
+void udp_set_readable(struct np_udp_socket* sock, np_error_code ec)
+{
+    if (ec == NABTO_EC_OK) {
+        nm_epoll_unix_lock(sock->epollCtx);
+        sock->readable = true;
+        nm_epoll_unix_unlock(sock->epollCtx);
+    }
+}
+
+np_error_code nm_epoll_unix_udp_recv_from(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength)
+{
+    nm_epoll_unix_lock(sock->epollCtx);
+    sock->readable = false;
+    nm_epoll_unix_unlock(sock->epollCtx);
+
+    np_error_code ec = nm_unix_udp_recv_from(sock->sock, sock->type, ep, buffer, bufferSize, readLength);
+    udp_set_readable(sock, ec);
+    return ec;
+}
+
+np_error_code nm_epoll_unix_udp_recv_batch(struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    nm_epoll_unix_lock(sock->epollCtx);
+    sock->readable = false;
+    nm_epoll_unix_unlock(sock->epollCtx);
+
+    np_error_code ec = nm_unix_udp_recv_batch(sock->sock, sock->type, entries, entriesSize, received);
+    udp_set_readable(sock, ec);
+    return ec;
+}
+
+uint16_t nm_epoll_unix_udp_get_local_port(struct np_udp_socket* sock)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "get local port called on aborted socket");
+        return 0;
+    }
+    return get_local_port(sock);
+}
+
+void nm_epoll_unix_udp_abort(struct np_udp_socket* sock)
+{
+    nm_epoll_unix_lock(sock->epollCtx);
+    udp_abort_locked(sock);
+    nm_epoll_unix_unlock(sock->epollCtx);
+}
+
+void udp_abort_locked(struct np_udp_socket* sock)
+{
+    if (!sock->aborted) {
+        sock->aborted = true;
+    }
+
+    if (sock->recv.completionEvent != NULL) {
+        struct np_completion_event* ev = sock->recv.completionEvent;
+        sock->recv.completionEvent = NULL;
+        np_completion_event_resolve(ev, NABTO_EC_ABORTED);
+    }
+}
+
+void nm_epoll_unix_udp_destroy(struct np_udp_socket* sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+    struct nm_epoll_unix* epollCtx = sock->epollCtx;
+    nm_epoll_unix_lock(epollCtx);
+    udp_abort_locked(sock);
+    sock->destroyed = true;
+    nm_epoll_unix_defer_free(epollCtx, &sock->base, sock->sock);
+    if (sock->sock != -1) {
+        shutdown(sock->sock, SHUT_RDWR);
+        close(sock->sock);
+        sock->sock = -1;
+    }
+    nm_epoll_unix_unlock(epollCtx);
+    // let the network thread free the socket.
+    nm_epoll_unix_notify(epollCtx);
+}
+
+void nm_epoll_unix_udp_handle_event(struct np_udp_socket* sock, uint32_t events)
+{
+    if (sock->destroyed) {
+        return;
+    }
+    if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+        sock->readable = true;
+        if (sock->recv.completionEvent != NULL) {
+            struct np_completion_event* ev = sock->recv.completionEvent;
+            sock->recv.completionEvent = NULL;
+            np_completion_event_resolve(ev, NABTO_EC_OK);
+        }
+    }
+}
+
+
+int nm_epoll_unix_udp_nonblocking_socket(int domain, int type)
+{
+#if defined(SOCK_NONBLOCK)
+    return socket(domain, type | SOCK_NONBLOCK, 0);
+#endif
+
+#ifdef F_GETFL
+    int sock = socket(domain, type, 0);
+
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags == -1) flags = 0;
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    return sock;
+#endif
+}
+
+np_error_code bind_port(struct np_udp_socket* s, uint16_t port)
+{
+    int status;
+
+    if (s->type == NABTO_IPV6) {
+        struct sockaddr_in6 si_me6;
+        memset(&si_me6, 0, sizeof(si_me6));
+        si_me6.sin6_family = AF_INET6;
+        si_me6.sin6_port = htons(port);
+        si_me6.sin6_addr = in6addr_any;
+        status = bind(s->sock, (struct sockaddr*)&si_me6, sizeof(si_me6));
+    } else {
+        struct sockaddr_in si_me;
+        memset(&si_me, 0, sizeof(si_me));
+        si_me.sin_family = AF_INET;
+        si_me.sin_port = htons(port);
+        si_me.sin_addr.s_addr = INADDR_ANY;
+        status = bind(s->sock, (struct sockaddr*)&si_me, sizeof(si_me));
+    }
+
+    NABTO_LOG_TRACE(LOG, "bind returned %i", status);
+
+    if (status == 0) {
+        return NABTO_EC_OK;
+    } else {
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+}
+
+np_error_code set_reuse_port(struct np_udp_socket* s)
+{
+    int yes = 1;
+    if (setsockopt(s->sock, SOL_SOCKET, SO_REUSEPORT, (void*)&yes, sizeof(yes)) != 0) {
+        int e = errno;
+        NABTO_LOG_ERROR(LOG, "Unable to set SO_REUSEPORT: (%i) '%s'.", e, strerror(e));
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+    return NABTO_EC_OK;
+}
+
+uint16_t get_local_port(struct np_udp_socket* s)
+{
+    if (s->type == NABTO_IPV6) {
+        struct sockaddr_in6 addr;
+        addr.sin6_port = 0;
+        socklen_t length = sizeof(struct sockaddr_in6);
+        getsockname(s->sock, (struct sockaddr*)(&addr), &length);
+        return htons(addr.sin6_port);
+    } else {
+        struct sockaddr_in addr;
+        addr.sin_port = 0;
+        socklen_t length = sizeof(struct sockaddr_in);
+        getsockname(s->sock, (struct sockaddr*)(&addr), &length);
+        return htons(addr.sin_port);
+    }
+}
+
+np_error_code create_socket_any(struct np_udp_socket* s)
+{
+    int sock = nm_epoll_unix_udp_nonblocking_socket(AF_INET6, SOCK_DGRAM);
+    if (sock == -1) {
+        sock = nm_epoll_unix_udp_nonblocking_socket(AF_INET, SOCK_DGRAM);
+        if (sock == -1) {
+            int e = errno;
+            NABTO_LOG_ERROR(LOG, "Unable to create socket: (%i) '%s'.", e, strerror(e));
+            return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+        } else {
+            NABTO_LOG_WARN(LOG, "IPv4 socket opened since IPv6 socket creation failed");
+            s->type = NABTO_IPV4;
+        }
+    } else {
+        int no = 0;
+        s->type = NABTO_IPV6;
+        if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (void* ) &no, sizeof(no)))
+        {
+            int e = errno;
+            NABTO_LOG_ERROR(LOG,"Unable to set option: (%i) '%s'.", e, strerror(e));
+
+            close(sock);
+            return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+        }
+    }
+    s->sock = sock;
+    return NABTO_EC_OK;
+}
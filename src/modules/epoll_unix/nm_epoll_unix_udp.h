@@ -0,0 +1,25 @@
+#ifndef _NM_EPOLL_UNIX_UDP_H_
+#define _NM_EPOLL_UNIX_UDP_H_
+
+#include "nm_epoll_unix.h"
+
+#include <platform/np_platform.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// called from the network thread with the lock held.
+void nm_epoll_unix_udp_handle_event(struct np_udp_socket* sock, uint32_t events);
+
+// register a newly created socket fd with epoll.
+np_error_code nm_epoll_unix_udp_register(struct np_udp_socket* sock);
+
+
+int nm_epoll_unix_udp_nonblocking_socket(int domain, int type);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
@@ -7,11 +7,22 @@
 
 #define LOG NABTO_LOG_MODULE_EVENT_QUEUE
 
+static bool is_posted(struct nm_event_queue_event* event);
+static void list_append(struct nm_event_queue* queue, struct nm_event_queue_event* event);
+static void list_erase(struct nm_event_queue* queue, struct nm_event_queue_event* event);
+static bool heap_before(struct nm_event_queue_event* a, struct nm_event_queue_event* b);
+static struct nm_event_queue_event* heap_meld(struct nm_event_queue_event* a, struct nm_event_queue_event* b);
+static struct nm_event_queue_event* heap_merge_pairs(struct nm_event_queue_event* first);
+static void heap_insert(struct nm_event_queue* queue, struct nm_event_queue_event* event);
+static void heap_remove(struct nm_event_queue* queue, struct nm_event_queue_event* event);
+
 void nm_event_queue_init(struct nm_event_queue* queue)
 {
     nn_llist_init(&queue->events);
-    nn_llist_init(&queue->timedEvents);
-
+    queue->eventsSize = 0;
+    queue->timedEventsRoot = NULL;
+    queue->timedEventsSize = 0;
+    queue->timedEventsSequence = 0;
 }
 
 void nm_event_queue_deinit(struct nm_event_queue* queue)
@@ -25,6 +36,11 @@ void nm_event_queue_event_init(struct nm_event_queue_event* event, np_event_call
     event->cb = cb;
     event->data = data;
     nn_llist_node_init(&event->eventsNode);
+    event->readyStamp = 0;
+    event->queue = NULL;
+    event->heapChild = NULL;
+    event->heapNext = NULL;
+    event->heapPrev = NULL;
 }
 
 void nm_event_queue_event_deinit(struct nm_event_queue_event* event)
@@ -34,46 +50,36 @@ void nm_event_queue_event_deinit(struct nm_event_queue_event* event)
 
 void nm_event_queue_post_event(struct nm_event_queue* queue, struct nm_event_queue_event* event)
 {
-    if (nn_llist_node_in_list(&event->eventsNode)) {
+    if (is_posted(event)) {
         NABTO_LOG_ERROR(LOG, "Double posted event, use the post_maybe_double if this bahavior is intended");
         return;
     }
-    nn_llist_append(&queue->events, &event->eventsNode, event);
+    list_append(queue, event);
 }
 
 void nm_event_queue_post_event_maybe_double(struct nm_event_queue* queue, struct nm_event_queue_event* event)
 {
-    if (nn_llist_node_in_list(&event->eventsNode)) {
+    if (is_posted(event)) {
         return;
     }
-    nn_llist_append(&queue->events, &event->eventsNode, event);
+    list_append(queue, event);
 }
 
 void nm_event_queue_cancel_event(struct nm_event_queue_event* event)
 {
     if (nn_llist_node_in_list(&event->eventsNode)) {
-        nn_llist_erase_node(&event->eventsNode);
+        list_erase(event->queue, event);
+    } else if (event->queue != NULL) {
+        heap_remove(event->queue, event);
     }
 }
 
 void nm_event_queue_post_timed_event(struct nm_event_queue* queue, struct nm_event_queue_event* event, uint32_t timestamp)
 {
+    nm_event_queue_cancel_event(event);
     event->expireTimestamp = timestamp;
-    if (nn_llist_node_in_list(&event->eventsNode)) {
-        nn_llist_erase_node(&event->eventsNode);
-    }
-
-    struct nn_llist_iterator it = nn_llist_begin(&queue->timedEvents);
-    while (!nn_llist_is_end(&it)) {
-        struct nm_event_queue_event* timedEvent = nn_llist_get_item(&it);
-        if (np_timestamp_less_or_equal(timestamp, timedEvent->expireTimestamp)) {
-            nn_llist_insert_before(&it, &event->eventsNode, event);
-            return;
-        }
-        nn_llist_next(&it);
-    }
-    // the event is not added to the list simply because it should be at the very end.
-    nn_llist_append(&queue->timedEvents, &event->eventsNode, event);
+    event->timedSequence = queue->timedEventsSequence++;
+    heap_insert(queue, event);
 }
 
 /**
@@ -89,7 +95,7 @@ bool nm_event_queue_take_event(struct nm_event_queue* queue, struct nm_event_que
     }
 
     *event = nn_llist_get_item(&it);
-    nn_llist_erase(&it);
+    list_erase(queue, *event);
     return true;
 }
 
@@ -100,15 +106,14 @@ bool nm_event_queue_take_event(struct nm_event_queue* queue, struct nm_event_que
  */
 bool nm_event_queue_take_timed_event(struct nm_event_queue* queue, uint32_t now, struct nm_event_queue_event** event)
 {
-    struct nn_llist_iterator it = nn_llist_begin(&queue->timedEvents);
+    struct nm_event_queue_event* ev = queue->timedEventsRoot;
 
-    if (nn_llist_is_end(&it)) {
+    if (ev == NULL) {
         return false;
     }
 
-    struct nm_event_queue_event* ev = nn_llist_get_item(&it);
     if (np_timestamp_less_or_equal(ev->expireTimestamp, now)) {
-        nn_llist_erase(&it);
+        heap_remove(queue, ev);
         *event = ev;
         return true;
     }
@@ -116,6 +121,20 @@ bool nm_event_queue_take_timed_event(struct nm_event_queue* queue, uint32_t now,
     return false;
 }
 
+bool nm_event_queue_take_ready_event(struct nm_event_queue* queue, uint32_t now, uint32_t nowUs, struct nm_event_queue_event** event, uint32_t* readyStamp)
+{
+    if (nm_event_queue_take_event(queue, event)) {
+        *readyStamp = (*event)->readyStamp;
+        return true;
+    }
+    if (nm_event_queue_take_timed_event(queue, now, event)) {
+        uint32_t late = (uint32_t)np_timestamp_difference(now, (*event)->expireTimestamp);
+        *readyStamp = nowUs - (late * 1000);
+        return true;
+    }
+    return false;
+}
+
 /**
  * Get the timestamp of the next event on the event queue.
  *
@@ -124,13 +143,137 @@ bool nm_event_queue_take_timed_event(struct nm_event_queue* queue, uint32_t now,
  */
 bool nm_event_queue_next_timed_event(struct nm_event_queue* queue, uint32_t* nextTime)
 {
-    struct nn_llist_iterator it = nn_llist_begin(&queue->timedEvents);
-
-    if (nn_llist_is_end(&it)) {
+    if (queue->timedEventsRoot == NULL) {
         return false;
     }
 
-    struct nm_event_queue_event* event = nn_llist_get_item(&it);
-    *nextTime = event->expireTimestamp;
+    *nextTime = queue->timedEventsRoot->expireTimestamp;
     return true;
 }
+
+/**
+ * An event is either on the events list, armed as a timed event or
+ * not posted.
+ */
+bool is_posted(struct nm_event_queue_event* event)
+{
+    return event->queue != NULL;
+}
+
+void list_append(struct nm_event_queue* queue, struct nm_event_queue_event* event)
+{
+    nn_llist_append(&queue->events, &event->eventsNode, event);
+    event->queue = queue;
+    queue->eventsSize++;
+}
+
+void list_erase(struct nm_event_queue* queue, struct nm_event_queue_event* event)
+{
+    nn_llist_erase_node(&event->eventsNode);
+    event->queue = NULL;
+    queue->eventsSize--;
+}
+
+/**
+ * @return true iff a expires before b.
+ */
+bool heap_before(struct nm_event_queue_event* a, struct nm_event_queue_event* b)
+{
+    if (a->expireTimestamp == b->expireTimestamp) {
+        return (int32_t)(a->timedSequence - b->timedSequence) < 0;
+    }
+    return np_timestamp_less_or_equal(a->expireTimestamp, b->expireTimestamp);
+}
+
+/**
+ * Meld two heaps whose roots has no siblings, the root which expires
+ * last becomes the first child of the other.
+ */
+struct nm_event_queue_event* heap_meld(struct nm_event_queue_event* a, struct nm_event_queue_event* b)
+{
+    if (a == NULL) {
+        return b;
+    }
+    if (b == NULL) {
+        return a;
+    }
+    if (heap_before(b, a)) {
+        struct nm_event_queue_event* tmp = a;
+        a = b;
+        b = tmp;
+    }
+    b->heapPrev = a;
+    b->heapNext = a->heapChild;
+    if (a->heapChild != NULL) {
+        a->heapChild->heapPrev = b;
+    }
+    a->heapChild = b;
+    return a;
+}
+
+/**
+ * Meld a list of siblings into one heap. The siblings are melded in
+ * pairs from the left, and the pairs are melded from the right, which
+ * gives the amortized O(log n) bound.
+ */
+struct nm_event_queue_event* heap_merge_pairs(struct nm_event_queue_event* first)
+{
+    // the melded pairs in reverse order linked through heapNext.
+    struct nm_event_queue_event* pairs = NULL;
+    while (first != NULL) {
+        struct nm_event_queue_event* a = first;
+        struct nm_event_queue_event* b = a->heapNext;
+        first = (b != NULL) ? b->heapNext : NULL;
+        a->heapNext = NULL;
+        a->heapPrev = NULL;
+        if (b != NULL) {
+            b->heapNext = NULL;
+            b->heapPrev = NULL;
+        }
+        struct nm_event_queue_event* pair = heap_meld(a, b);
+        pair->heapNext = pairs;
+        pairs = pair;
+    }
+
+    struct nm_event_queue_event* root = NULL;
+    while (pairs != NULL) {
+        struct nm_event_queue_event* next = pairs->heapNext;
+        pairs->heapNext = NULL;
+        root = heap_meld(root, pairs);
+        pairs = next;
+    }
+    return root;
+}
+
+void heap_insert(struct nm_event_queue* queue, struct nm_event_queue_event* event)
+{
+    event->queue = queue;
+    event->heapChild = NULL;
+    event->heapNext = NULL;
+    event->heapPrev = NULL;
+    queue->timedEventsRoot = heap_meld(queue->timedEventsRoot, event);
+    queue->timedEventsSize++;
+}
+
+void heap_remove(struct nm_event_queue* queue, struct nm_event_queue_event* event)
+{
+    if (event == queue->timedEventsRoot) {
+        queue->timedEventsRoot = heap_merge_pairs(event->heapChild);
+    } else {
+        // unlink the subtree of the event from its parent and siblings.
+        if (event->heapPrev->heapChild == event) {
+            event->heapPrev->heapChild = event->heapNext;
+        } else {
+            event->heapPrev->heapNext = event->heapNext;
+        }
+        if (event->heapNext != NULL) {
+            event->heapNext->heapPrev = event->heapPrev;
+        }
+        queue->timedEventsRoot = heap_meld(queue->timedEventsRoot, heap_merge_pairs(event->heapChild));
+    }
+    event->queue = NULL;
+    event->heapChild = NULL;
+    event->heapNext = NULL;
+    event->heapPrev = NULL;
+    queue->timedEventsSize--;
+}
@@ -4,9 +4,24 @@
 #include <platform/np_platform.h>
 #include <nn/llist.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Timed events are kept in an intrusive pairing heap ordered by the
+ * expire timestamp, events with the same timestamp expire in the
+ * order they were posted. Posting a timed event is O(1), canceling
+ * and expiring it is O(log n) amortized in the number of armed timed
+ * events, and no memory is allocated.
+ */
 struct nm_event_queue {
     struct nn_llist events;
-    struct nn_llist timedEvents;
+    // The number of events on the events list.
+    size_t eventsSize;
+    struct nm_event_queue_event* timedEventsRoot;
+    size_t timedEventsSize;
+    uint32_t timedEventsSequence;
 };
 
 
@@ -15,7 +30,20 @@ struct nm_event_queue_event {
     void* data;
     struct nn_llist_node eventsNode;
     uint32_t expireTimestamp;
+    // Microsecond timestamp of when the event was posted, it is
+    // maintained by the user of the queue and used to measure the
+    // dispatch latency.
+    uint32_t readyStamp;
 
+    // The queue the event is posted on as a ready event or armed on
+    // as a timed event, else NULL.
+    struct nm_event_queue* queue;
+    uint32_t timedSequence;
+    // pairing heap links, heapPrev is the previous sibling or the
+    // parent of a first child.
+    struct nm_event_queue_event* heapChild;
+    struct nm_event_queue_event* heapNext;
+    struct nm_event_queue_event* heapPrev;
 };
 
 void nm_event_queue_init(struct nm_event_queue* queue);
@@ -45,6 +73,19 @@ bool nm_event_queue_take_event(struct nm_event_queue* queue, struct nm_event_que
  */
 bool nm_event_queue_take_timed_event(struct nm_event_queue* queue, uint32_t now, struct nm_event_queue_event** event);
 
+/**
+ * Take the next event to execute, a posted event is taken before an
+ * expired timed event.
+ *
+ * @param now  The current timestamp in milliseconds.
+ * @param nowUs  The current timestamp in microseconds.
+ * @param readyStamp  Set to the microsecond timestamp the event became
+ *                    ready, that is the readyStamp of a posted event
+ *                    or the expire timestamp of a timed event.
+ * @return true iff an event is returned.
+ */
+bool nm_event_queue_take_ready_event(struct nm_event_queue* queue, uint32_t now, uint32_t nowUs, struct nm_event_queue_event** event, uint32_t* readyStamp);
+
 /**
  * Get the timestamp of the next event on the event queue.
  *
@@ -53,4 +94,8 @@ bool nm_event_queue_take_timed_event(struct nm_event_queue* queue, uint32_t now,
  */
 bool nm_event_queue_next_timed_event(struct nm_event_queue* queue, uint32_t* nextEvent);
 
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
 #endif
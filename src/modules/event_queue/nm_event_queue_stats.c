@@ -0,0 +1,59 @@
+#include "nm_event_queue_stats.h"
+
+#include <string.h>
+
+static struct np_event_queue_histogram* callback_histogram(struct np_event_queue_stats* stats, np_event_callback cb);
+
+void nm_event_queue_stats_init(struct np_event_queue_stats* stats)
+{
+    memset(stats, 0, sizeof(struct np_event_queue_stats));
+}
+
+void nm_event_queue_stats_add_event(struct np_event_queue_stats* stats, np_event_callback cb, size_t depth, uint32_t latency, uint32_t duration)
+{
+    if (depth > UINT32_MAX) {
+        depth = UINT32_MAX;
+    }
+    nm_event_queue_stats_histogram_add(&stats->depth, (uint32_t)depth);
+    nm_event_queue_stats_histogram_add(&stats->latency, latency);
+    nm_event_queue_stats_histogram_add(&stats->duration, duration);
+    nm_event_queue_stats_histogram_add(callback_histogram(stats, cb), duration);
+}
+
+void nm_event_queue_stats_histogram_add(struct np_event_queue_histogram* histogram, uint32_t value)
+{
+    size_t bucket = 0;
+    uint32_t v = value;
+    while (v != 0 && bucket < NP_EVENT_QUEUE_HISTOGRAM_BUCKETS - 1) {
+        v >>= 1;
+        bucket++;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum += value;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+/**
+ * Find the entry of the callback in the open addressed callbacks
+ * table, a callback gets an entry the first time it is seen.
+ */
+struct np_event_queue_histogram* callback_histogram(struct np_event_queue_stats* stats, np_event_callback cb)
+{
+    // functions are aligned so the low bits of the address carries
+    // little information.
+    size_t hash = (size_t)(((uintptr_t)cb >> 4) * 2654435761u);
+    for (size_t i = 0; i < NP_EVENT_QUEUE_STATS_CALLBACKS; i++) {
+        struct np_event_queue_callback_stats* entry = &stats->callbacks[(hash + i) % NP_EVENT_QUEUE_STATS_CALLBACKS];
+        if (entry->cb == cb) {
+            return &entry->duration;
+        }
+        if (entry->cb == NULL) {
+            entry->cb = cb;
+            return &entry->duration;
+        }
+    }
+    return &stats->otherCallbacks;
+}
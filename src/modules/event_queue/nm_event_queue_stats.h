@@ -0,0 +1,37 @@
+#ifndef _NM_EVENT_QUEUE_STATS_H_
+#define _NM_EVENT_QUEUE_STATS_H_
+
+#include <platform/interfaces/np_event_queue.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Record the statistics of an event queue, see np_event_queue_stats.
+ * The event queue serializes the calls, e.g. by recording the events
+ * with the core mutex taken.
+ */
+
+void nm_event_queue_stats_init(struct np_event_queue_stats* stats);
+
+/**
+ * Record an executed event.
+ *
+ * @param cb  The callback of the event.
+ * @param depth  The number of ready events which were waiting when the event was taken.
+ * @param latency  Microseconds from the event became ready until the callback was called.
+ * @param duration  Microseconds the callback took.
+ */
+void nm_event_queue_stats_add_event(struct np_event_queue_stats* stats, np_event_callback cb, size_t depth, uint32_t latency, uint32_t duration);
+
+/**
+ * Add a value to a histogram.
+ */
+void nm_event_queue_stats_histogram_add(struct np_event_queue_histogram* histogram, uint32_t value);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
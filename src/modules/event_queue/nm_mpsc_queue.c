@@ -0,0 +1,85 @@
+#include "nm_mpsc_queue.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+
+#define LOAD_HEAD(queue) __atomic_load_n(&(queue)->head, __ATOMIC_RELAXED)
+#define CAS_HEAD(queue, expected, desired) __atomic_compare_exchange_n(&(queue)->head, (expected), (desired), true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define TAKE_HEAD(queue) __atomic_exchange_n(&(queue)->head, NULL, __ATOMIC_ACQUIRE)
+#define MARK_PUSHED(node) __atomic_exchange_n(&(node)->pushed, 1, __ATOMIC_ACQ_REL)
+#define MARK_RELEASED(node) __atomic_store_n(&(node)->pushed, 0, __ATOMIC_RELEASE)
+
+#elif defined(_MSC_VER)
+
+#include <windows.h>
+
+#define LOAD_HEAD(queue) ((struct nm_mpsc_queue_node*)InterlockedCompareExchangePointer((PVOID volatile*)&(queue)->head, NULL, NULL))
+static bool cas_head(struct nm_mpsc_queue* queue, struct nm_mpsc_queue_node** expected, struct nm_mpsc_queue_node* desired)
+{
+    struct nm_mpsc_queue_node* old = InterlockedCompareExchangePointer((PVOID volatile*)&queue->head, desired, *expected);
+    if (old == *expected) {
+        return true;
+    }
+    *expected = old;
+    return false;
+}
+#define CAS_HEAD(queue, expected, desired) cas_head((queue), (expected), (desired))
+#define TAKE_HEAD(queue) ((struct nm_mpsc_queue_node*)InterlockedExchangePointer((PVOID volatile*)&(queue)->head, NULL))
+#define MARK_PUSHED(node) InterlockedExchange((LONG volatile*)&(node)->pushed, 1)
+#define MARK_RELEASED(node) InterlockedExchange((LONG volatile*)&(node)->pushed, 0)
+
+#else
+#error "nm_mpsc_queue needs atomic operations for this compiler"
+#endif
+
+void nm_mpsc_queue_init(struct nm_mpsc_queue* queue)
+{
+    queue->head = NULL;
+}
+
+void nm_mpsc_queue_node_init(struct nm_mpsc_queue_node* node)
+{
+    node->next = NULL;
+    node->pushed = 0;
+    node->stamp = 0;
+    node->flags = 0;
+}
+
+bool nm_mpsc_queue_push(struct nm_mpsc_queue* queue, struct nm_mpsc_queue_node* node, uint32_t stamp, uint32_t flags, bool* wasEmpty)
+{
+    if (MARK_PUSHED(node) != 0) {
+        return false;
+    }
+    // the node is owned by this push until it is linked.
+    node->stamp = stamp;
+    node->flags = flags;
+    // The consumer only swaps the head with NULL, so a head which is
+    // taken and pushed again in between does not break the push.
+    struct nm_mpsc_queue_node* head = LOAD_HEAD(queue);
+    do {
+        node->next = head;
+    } while (!CAS_HEAD(queue, &head, node));
+    *wasEmpty = (head == NULL);
+    return true;
+}
+
+struct nm_mpsc_queue_node* nm_mpsc_queue_take_all(struct nm_mpsc_queue* queue)
+{
+    struct nm_mpsc_queue_node* node = TAKE_HEAD(queue);
+    // reverse the nodes into push order.
+    struct nm_mpsc_queue_node* first = NULL;
+    while (node != NULL) {
+        struct nm_mpsc_queue_node* next = node->next;
+        node->next = first;
+        first = node;
+        node = next;
+    }
+    return first;
+}
+
+struct nm_mpsc_queue_node* nm_mpsc_queue_release(struct nm_mpsc_queue_node* node)
+{
+    struct nm_mpsc_queue_node* next = node->next;
+    node->next = NULL;
+    MARK_RELEASED(node);
+    return next;
+}
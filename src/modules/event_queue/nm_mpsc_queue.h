@@ -0,0 +1,75 @@
+#ifndef _NM_MPSC_QUEUE_H_
+#define _NM_MPSC_QUEUE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Intrusive lock free multi producer single consumer queue.
+ *
+ * Any thread can push nodes without taking a lock. The consumer takes
+ * all the pushed nodes at once, in the order they were pushed. Only
+ * one thread may take nodes at a time, the user of the queue
+ * serializes the consumers.
+ *
+ * A push reports if the queue was empty, such that the consumer only
+ * needs to be woken once until it has taken the nodes.
+ */
+
+struct nm_mpsc_queue_node {
+    struct nm_mpsc_queue_node* next;
+    // nonzero from the node is pushed until it is released by the consumer.
+    long pushed;
+    // The stamp given to the push which pushed the node.
+    uint32_t stamp;
+    // The flags given to the push which pushed the node.
+    uint32_t flags;
+};
+
+struct nm_mpsc_queue {
+    // the most recently pushed node, the nodes are linked in reverse
+    // push order.
+    struct nm_mpsc_queue_node* head;
+};
+
+void nm_mpsc_queue_init(struct nm_mpsc_queue* queue);
+
+void nm_mpsc_queue_node_init(struct nm_mpsc_queue_node* node);
+
+/**
+ * Push a node unless it is already pushed and not yet released.
+ *
+ * @param stamp  A value such as the time of the push, it is stored in
+ *               the node if it is pushed and can be read by the
+ *               consumer until the node is released.
+ * @param flags  Like the stamp, e.g. how the node was pushed.
+ * @param wasEmpty  Set to true if the queue was empty, the caller then has to wake the consumer.
+ * @return false if the node is already in the queue.
+ */
+bool nm_mpsc_queue_push(struct nm_mpsc_queue* queue, struct nm_mpsc_queue_node* node, uint32_t stamp, uint32_t flags, bool* wasEmpty);
+
+/**
+ * Take all the pushed nodes. The nodes stay pushed until they are
+ * released with nm_mpsc_queue_release.
+ *
+ * @return The first pushed node or NULL if the queue is empty.
+ */
+struct nm_mpsc_queue_node* nm_mpsc_queue_take_all(struct nm_mpsc_queue* queue);
+
+/**
+ * Release a taken node such that it can be pushed again.
+ *
+ * @return The next taken node or NULL.
+ */
+struct nm_mpsc_queue_node* nm_mpsc_queue_release(struct nm_mpsc_queue_node* node);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
@@ -3,14 +3,30 @@
 #include <modules/event_queue/nm_event_queue.h>
 
 #include <platform/np_timestamp_wrapper.h>
+#include <platform/np_logging.h>
 
 #include <stdlib.h>
+#include <stddef.h>
 
-struct np_event {
+#define LOG NABTO_LOG_MODULE_EVENT_QUEUE
+
+// The flags of a posted node, the event was posted with post_maybe_double.
+#define THREAD_EVENT_POSTED_MAYBE_DOUBLE 1
+
+/**
+ * The state of an event, it is stored in the np_event.
+ */
+struct thread_event {
     struct thread_event_queue* queue;
     struct nm_event_queue_event event;
+    struct nm_mpsc_queue_node postedNode;
 };
 
+// the thread_event has to fit in the storage of an np_event.
+typedef char thread_event_fits_np_event[(sizeof(struct thread_event) <= sizeof(struct np_event)) ? 1 : -1];
+
+static void init_event(struct np_event_queue* obj, struct np_event* event, np_event_callback cb, void* cbData);
+static void deinit_event(struct np_event* event);
 static np_error_code create_event(struct np_event_queue* obj, np_event_callback cb, void* cbData, struct np_event** event);
 static void destroy_event(struct np_event* event);
 static void post_event(struct np_event* event);
@@ -19,16 +35,32 @@ static void post_event_maybe_double(struct np_event* event);
 static void cancel_event(struct np_event* event);
 
 static void post_timed_event(struct np_event* event, uint32_t milliseconds);
+static np_error_code set_batch_size(struct np_event_queue* obj, size_t batchSize);
+static size_t event_allocations(struct np_event_queue* obj);
+#if NP_EVENT_QUEUE_STATS
+static void get_stats(struct np_event_queue* obj, struct np_event_queue_stats* stats);
+#endif
+static uint32_t posted_stamp(struct thread_event_queue* queue);
+static bool take_ready_event(struct thread_event_queue* queue, uint32_t now, uint32_t nowUs, struct nm_event_queue_event** event, size_t* depth, uint32_t* readyStamp);
+static void take_posted_events(struct thread_event_queue* queue);
+static void wake_queue_thread(struct thread_event_queue* queue);
 
 static void* queue_thread(void* data);
 
 static struct np_event_queue_functions module = {
+    .init = &init_event,
+    .deinit = &deinit_event,
     .create = &create_event,
     .destroy = &destroy_event,
     .post = &post_event,
     .post_maybe_double = &post_event_maybe_double,
     .cancel = &cancel_event,
     .post_timed = &post_timed_event,
+    .set_batch_size = &set_batch_size,
+    .event_allocations = &event_allocations,
+#if NP_EVENT_QUEUE_STATS
+    .get_stats = &get_stats,
+#endif
 };
 
 struct np_event_queue thread_event_queue_get_impl(struct thread_event_queue* queue)
@@ -42,7 +74,13 @@ struct np_event_queue thread_event_queue_get_impl(struct thread_event_queue* que
 void thread_event_queue_init(struct thread_event_queue* queue, struct nabto_device_mutex* coreMutex, struct np_timestamp* ts)
 {
     nm_event_queue_init(&queue->eventQueue);
+    nm_mpsc_queue_init(&queue->posted);
     queue->stopped = false;
+    queue->batchSize = THREAD_EVENT_QUEUE_DEFAULT_BATCH_SIZE;
+    queue->eventAllocations = 0;
+#if NP_EVENT_QUEUE_STATS
+    nm_event_queue_stats_init(&queue->stats);
+#endif
     queue->coreMutex = coreMutex;
     queue->ts = *ts;
     queue->queueThread = NULL;
@@ -86,65 +124,185 @@ void thread_event_queue_stop_blocking(struct thread_event_queue* queue)
 }
 
 
+void init_event(struct np_event_queue* obj, struct np_event* event, np_event_callback cb, void* cbData)
+{
+    struct thread_event* ev = (struct thread_event*)event;
+    nm_event_queue_event_init(&ev->event, cb, cbData);
+    nm_mpsc_queue_node_init(&ev->postedNode);
+    ev->queue = obj->data;
+}
+
+void deinit_event(struct np_event* event)
+{
+    struct thread_event* ev = (struct thread_event*)event;
+    struct thread_event_queue* eq = ev->queue;
+    nabto_device_threads_mutex_lock(eq->queueMutex);
+    take_posted_events(eq);
+    nm_event_queue_event_deinit(&ev->event);
+    nabto_device_threads_mutex_unlock(eq->queueMutex);
+}
+
 np_error_code create_event(struct np_event_queue* obj, np_event_callback cb, void* cbData, struct np_event** event)
 {
+    struct thread_event_queue* queue = obj->data;
     struct np_event* ev = calloc(1, sizeof(struct np_event));
     if (ev == NULL) {
         return NABTO_EC_OUT_OF_MEMORY;
     }
-    nm_event_queue_event_init(&ev->event, cb, cbData);
-    ev->queue = obj->data;
+    init_event(obj, ev, cb, cbData);
+    nabto_device_threads_mutex_lock(queue->queueMutex);
+    queue->eventAllocations++;
+    nabto_device_threads_mutex_unlock(queue->queueMutex);
     *event = ev;
     return NABTO_EC_OK;
 }
 
 void destroy_event(struct np_event* event)
 {
-    struct thread_event_queue* eq = event->queue;
-    nabto_device_threads_mutex_lock(eq->queueMutex);
-    nm_event_queue_event_deinit(&event->event);
+    deinit_event(event);
     free(event);
-    nabto_device_threads_mutex_unlock(eq->queueMutex);
 }
 
 void post_event(struct np_event* event)
 {
-    struct thread_event_queue* queue = event->queue;
-    nabto_device_threads_mutex_lock(queue->queueMutex);
-    nm_event_queue_post_event(&queue->eventQueue, &event->event);
-    nabto_device_threads_mutex_unlock(queue->queueMutex);
-    nabto_device_threads_cond_signal(queue->condition);
+    struct thread_event* ev = (struct thread_event*)event;
+    struct thread_event_queue* queue = ev->queue;
+    bool wasEmpty = false;
+    if (!nm_mpsc_queue_push(&queue->posted, &ev->postedNode, posted_stamp(queue), 0, &wasEmpty)) {
+        NABTO_LOG_ERROR(LOG, "Double posted event, use the post_maybe_double if this bahavior is intended");
+        return;
+    }
+    if (wasEmpty) {
+        wake_queue_thread(queue);
+    }
 }
 
 void post_event_maybe_double(struct np_event* event)
 {
-    struct thread_event_queue* queue = event->queue;
+    struct thread_event* ev = (struct thread_event*)event;
+    struct thread_event_queue* queue = ev->queue;
+    bool wasEmpty = false;
+    if (nm_mpsc_queue_push(&queue->posted, &ev->postedNode, posted_stamp(queue), THREAD_EVENT_POSTED_MAYBE_DOUBLE, &wasEmpty) && wasEmpty) {
+        wake_queue_thread(queue);
+    }
+}
+
+/**
+ * Taking the queue mutex ensures the queue thread is either before
+ * its check for posted events or waiting for the signal.
+ */
+void wake_queue_thread(struct thread_event_queue* queue)
+{
     nabto_device_threads_mutex_lock(queue->queueMutex);
-    nm_event_queue_post_event_maybe_double(&queue->eventQueue, &event->event);
     nabto_device_threads_mutex_unlock(queue->queueMutex);
     nabto_device_threads_cond_signal(queue->condition);
 }
 
+/**
+ * Move the posted events to the event queue, call with the queue
+ * mutex taken. An event which is already on the event queue or is a
+ * timed event is left as it is, it is an error unless it was posted
+ * with post_maybe_double.
+ */
+void take_posted_events(struct thread_event_queue* queue)
+{
+    struct nm_mpsc_queue_node* node = nm_mpsc_queue_take_all(&queue->posted);
+    while (node != NULL) {
+        struct thread_event* event = (struct thread_event*)((uint8_t*)node - offsetof(struct thread_event, postedNode));
+        uint32_t postedStamp = node->stamp;
+        uint32_t postedFlags = node->flags;
+        node = nm_mpsc_queue_release(node);
+        if (event->event.queue == NULL) {
+            event->event.readyStamp = postedStamp;
+            nm_event_queue_post_event(&queue->eventQueue, &event->event);
+        } else if (!(postedFlags & THREAD_EVENT_POSTED_MAYBE_DOUBLE)) {
+            NABTO_LOG_ERROR(LOG, "Double posted event, use the post_maybe_double if this bahavior is intended");
+        }
+    }
+}
+
 void cancel_event(struct np_event* event)
 {
-    struct thread_event_queue* queue = event->queue;
+    struct thread_event* ev = (struct thread_event*)event;
+    struct thread_event_queue* queue = ev->queue;
     nabto_device_threads_mutex_lock(queue->queueMutex);
-    nm_event_queue_cancel_event(&event->event);
+    take_posted_events(queue);
+    nm_event_queue_cancel_event(&ev->event);
     nabto_device_threads_mutex_unlock(queue->queueMutex);
 }
 
 void post_timed_event(struct np_event* event, uint32_t milliseconds)
 {
-    struct thread_event_queue* queue = event->queue;
+    struct thread_event* ev = (struct thread_event*)event;
+    struct thread_event_queue* queue = ev->queue;
 
     uint32_t now = np_timestamp_now_ms(&queue->ts);
     uint32_t timestamp = now + milliseconds;
     nabto_device_threads_mutex_lock(queue->queueMutex);
-    nm_event_queue_post_timed_event(&queue->eventQueue, &event->event, timestamp);
+    take_posted_events(queue);
+    nm_event_queue_post_timed_event(&queue->eventQueue, &ev->event, timestamp);
     nabto_device_threads_mutex_unlock(queue->queueMutex);
     nabto_device_threads_cond_signal(queue->condition);
 }
 
+np_error_code set_batch_size(struct np_event_queue* obj, size_t batchSize)
+{
+    struct thread_event_queue* queue = obj->data;
+    if (batchSize == 0) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    nabto_device_threads_mutex_lock(queue->queueMutex);
+    queue->batchSize = batchSize;
+    nabto_device_threads_mutex_unlock(queue->queueMutex);
+    return NABTO_EC_OK;
+}
+
+size_t event_allocations(struct np_event_queue* obj)
+{
+    struct thread_event_queue* queue = obj->data;
+    size_t allocations;
+    nabto_device_threads_mutex_lock(queue->queueMutex);
+    allocations = queue->eventAllocations;
+    nabto_device_threads_mutex_unlock(queue->queueMutex);
+    return allocations;
+}
+
+#if NP_EVENT_QUEUE_STATS
+void get_stats(struct np_event_queue* obj, struct np_event_queue_stats* stats)
+{
+    struct thread_event_queue* queue = obj->data;
+    *stats = queue->stats;
+}
+#endif
+
+/**
+ * The time an event is posted is only used for the latency stats.
+ */
+uint32_t posted_stamp(struct thread_event_queue* queue)
+{
+#if NP_EVENT_QUEUE_STATS
+    return np_timestamp_now_us(&queue->ts);
+#else
+    (void)queue;
+    return 0;
+#endif
+}
+
+/**
+ * Take the next ready event, call with the queue mutex taken. The
+ * depth and ready stamp are returned such that the stats can be
+ * recorded without the queue mutex.
+ */
+bool take_ready_event(struct thread_event_queue* queue, uint32_t now, uint32_t nowUs, struct nm_event_queue_event** event, size_t* depth, uint32_t* readyStamp)
+{
+    take_posted_events(queue);
+    if (!nm_event_queue_take_ready_event(&queue->eventQueue, now, nowUs, event, readyStamp)) {
+        return false;
+    }
+    *depth = queue->eventQueue.eventsSize;
+    return true;
+}
+
 void* queue_thread(void* data)
 {
     struct thread_event_queue* queue = data;
@@ -152,13 +310,15 @@ void* queue_thread(void* data)
         uint32_t nextEvent;
         uint32_t now = np_timestamp_now_ms(&queue->ts);
         struct nm_event_queue_event* event = NULL;
+        size_t batchSize = 1;
+        size_t depth = 0;
+        uint32_t readyStamp = 0;
 
 
 
         nabto_device_threads_mutex_lock(queue->queueMutex);
-        if (nm_event_queue_take_event(&queue->eventQueue, &event)) {
-            // ok execute the event later.
-        } else if (nm_event_queue_take_timed_event(&queue->eventQueue, now, &event)) {
+        batchSize = queue->batchSize;
+        if (take_ready_event(queue, now, np_timestamp_now_us(&queue->ts), &event, &depth, &readyStamp)) {
             // ok execute the event later.
         } else if (nm_event_queue_next_timed_event(&queue->eventQueue, &nextEvent)) {
             int32_t diff = np_timestamp_difference(nextEvent, now);
@@ -175,8 +335,30 @@ void* queue_thread(void* data)
 
 
         if (event != NULL) {
+            // Execute the ready events in a batch such that the core
+            // mutex is taken once.
             nabto_device_threads_mutex_lock(queue->coreMutex);
-            event->cb(event->data);
+            uint32_t batchStart = np_timestamp_now_us(&queue->ts);
+            uint32_t start = batchStart;
+            size_t executed = 0;
+            bool taken = true;
+            while (taken) {
+                // the event can be reused or freed by its callback.
+                np_event_callback cb = event->cb;
+                cb(event->data);
+                uint32_t end = np_timestamp_now_us(&queue->ts);
+#if NP_EVENT_QUEUE_STATS
+                nm_event_queue_stats_add_event(&queue->stats, cb, depth, start - readyStamp, end - start);
+#endif
+                start = end;
+                executed++;
+                taken = false;
+                if (executed < batchSize && (uint32_t)(start - batchStart) < THREAD_EVENT_QUEUE_MAX_BATCH_TIME * 1000) {
+                    nabto_device_threads_mutex_lock(queue->queueMutex);
+                    taken = take_ready_event(queue, np_timestamp_now_ms(&queue->ts), start, &event, &depth, &readyStamp);
+                    nabto_device_threads_mutex_unlock(queue->queueMutex);
+                }
+            }
             nabto_device_threads_mutex_unlock(queue->coreMutex);
         }
 
@@ -2,6 +2,8 @@
 #define _SELECT_UNIX_EVENT_QUEUE_H_
 
 #include <modules/event_queue/nm_event_queue.h>
+#include <modules/event_queue/nm_mpsc_queue.h>
+#include <modules/event_queue/nm_event_queue_stats.h>
 #include <api/nabto_device_threads.h>
 
 /**
@@ -23,6 +25,19 @@ extern "C" {
 struct nm_event_queue;
 struct np_platform;
 
+/**
+ * Ready events are executed in batches with the core mutex taken
+ * once. A batch ends when it has executed batchSize events or has run
+ * for THREAD_EVENT_QUEUE_MAX_BATCH_TIME ms.
+ */
+#ifndef THREAD_EVENT_QUEUE_DEFAULT_BATCH_SIZE
+#define THREAD_EVENT_QUEUE_DEFAULT_BATCH_SIZE 32
+#endif
+
+#ifndef THREAD_EVENT_QUEUE_MAX_BATCH_TIME
+#define THREAD_EVENT_QUEUE_MAX_BATCH_TIME 5
+#endif
+
 struct thread_event_queue {
     struct nabto_device_thread* queueThread;
     // coreMutex is used to synchronize all access to the core of the
@@ -35,8 +50,22 @@ struct thread_event_queue {
     struct nabto_device_mutex* queueMutex;
     struct nabto_device_condition* condition;
     struct nm_event_queue eventQueue;
+    // Events are posted to this lock free queue and moved to the
+    // eventQueue by the queue thread, such that posting an event does
+    // not contend with the threads using the queue. The poster which
+    // makes it non empty wakes the queue thread.
+    struct nm_mpsc_queue posted;
     struct np_timestamp ts;
     bool stopped;
+    size_t batchSize;
+    // The number of events allocated with create, events embedded in
+    // their owner are not counted.
+    size_t eventAllocations;
+#if NP_EVENT_QUEUE_STATS
+    // Statistics for the executed events, they are recorded with the
+    // coreMutex taken.
+    struct np_event_queue_stats stats;
+#endif
 };
 
 void thread_event_queue_init(struct thread_event_queue* queue, struct nabto_device_mutex* coreMutex, struct np_timestamp* ts);
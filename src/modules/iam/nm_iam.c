@@ -10,6 +10,8 @@
 
 #include <nn/log.h>
 
+#include <nabto/nabto_device_experimental.h>
+
 #include <stdlib.h>
 
 static const char* LOGM = "iam";
@@ -73,8 +75,8 @@ void nm_iam_deinit(struct nm_iam* iam)
 bool nm_iam_check_access(struct nm_iam* iam, NabtoDeviceConnectionRef ref, const char* action, const struct nn_string_map* attributesIn)
 {
     NabtoDeviceError ec;
-    char* fingerprint;
-    ec = nabto_device_connection_get_client_fingerprint_full_hex(iam->device, ref, &fingerprint);
+    char fingerprint[65];
+    ec = nabto_device_connection_copy_client_fingerprint_full_hex(iam->device, ref, fingerprint, sizeof(fingerprint));
     if (ec) {
         return false;
     }
@@ -92,7 +94,6 @@ bool nm_iam_check_access(struct nm_iam* iam, NabtoDeviceConnectionRef ref, const
     }
 
     struct nm_iam_user* user = nm_iam_find_user_by_fingerprint(iam, fingerprint);
-    nabto_device_string_free(fingerprint);
 
     enum nm_effect effect = NM_EFFECT_DENY;
 
@@ -345,13 +346,12 @@ char* get_fingerprint_from_coap_request(struct nm_iam* iam, NabtoDeviceCoapReque
 
 struct nm_iam_user* nm_iam_find_user_by_coap_request(struct nm_iam* iam, NabtoDeviceCoapRequest* request)
 {
-    char* fp = get_fingerprint_from_coap_request(iam, request);
-    if (fp == NULL) {
+    NabtoDeviceConnectionRef ref = nabto_device_coap_request_get_connection_ref(request);
+    char fp[65];
+    if (nabto_device_connection_copy_client_fingerprint_full_hex(iam->device, ref, fp, sizeof(fp)) != NABTO_DEVICE_EC_OK) {
         return NULL;
     }
-    struct nm_iam_user* user = nm_iam_find_user_by_fingerprint(iam, fp);
-    nabto_device_string_free(fp);
-    return user;
+    return nm_iam_find_user_by_fingerprint(iam, fp);
 }
 
 struct nm_iam_user* nm_iam_find_user_by_id(struct nm_iam* iam, const char* id)
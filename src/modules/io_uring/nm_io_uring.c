@@ -0,0 +1,317 @@
+#include "nm_io_uring.h"
+#include "nm_io_uring_udp.h"
+#include "nm_io_uring_tcp.h"
+
+#include <platform/np_logging.h>
+
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+
+#define LOG NABTO_LOG_MODULE_UDP
+
+/**
+ * Helper function declarations
+ */
+static void* network_thread(void* data);
+static void handle_cqe(struct nm_io_uring* ctx, struct io_uring_cqe* cqe);
+static np_error_code init_udp_buffers(struct nm_io_uring* ctx);
+static void init_tcp_buffers(struct nm_io_uring* ctx);
+
+/**
+ * Api functions start
+ */
+np_error_code nm_io_uring_init(struct nm_io_uring* ctx)
+{
+    memset(ctx, 0, sizeof(struct nm_io_uring));
+    pthread_mutex_init(&ctx->mutex, NULL);
+
+    int ret = io_uring_queue_init(NM_IO_URING_QUEUE_DEPTH, &ctx->ring, 0);
+    if (ret < 0) {
+        NABTO_LOG_ERROR(LOG, "Failed to create io_uring (%d) %s", -ret, strerror(-ret));
+        return NABTO_EC_NOT_SUPPORTED;
+    }
+
+    np_error_code ec = init_udp_buffers(ctx);
+    if (ec != NABTO_EC_OK) {
+        io_uring_queue_exit(&ctx->ring);
+        return ec;
+    }
+
+    ret = io_uring_register_files_sparse(&ctx->ring, NM_IO_URING_MAX_FIXED_FILES);
+    if (ret < 0) {
+        // older kernels, tcp sockets uses normal file descriptors.
+        NABTO_LOG_TRACE(LOG, "Fixed files not available (%d) %s", -ret, strerror(-ret));
+        ctx->fixedFiles = false;
+    } else {
+        ctx->fixedFiles = true;
+    }
+
+    init_tcp_buffers(ctx);
+
+    return NABTO_EC_OK;
+}
+
+void nm_io_uring_deinit(struct nm_io_uring* ctx)
+{
+    nm_io_uring_stop(ctx);
+
+    if (ctx->thread != 0) {
+        pthread_join(ctx->thread, NULL);
+    }
+
+    if (ctx->udpBufRing != NULL) {
+        io_uring_free_buf_ring(&ctx->ring, ctx->udpBufRing, NM_IO_URING_UDP_BUFFER_COUNT, NM_IO_URING_UDP_BUFFER_GROUP);
+    }
+    free(ctx->udpBuffers);
+    if (ctx->tcpBuffersRegistered) {
+        io_uring_unregister_buffers(&ctx->ring);
+    }
+    free(ctx->tcpBuffers);
+    io_uring_queue_exit(&ctx->ring);
+    pthread_mutex_destroy(&ctx->mutex);
+}
+
+void nm_io_uring_run(struct nm_io_uring* ctx)
+{
+    pthread_create(&ctx->thread, NULL, &network_thread, ctx);
+}
+
+void nm_io_uring_stop(struct nm_io_uring* ctx)
+{
+    nm_io_uring_lock(ctx);
+    if (!ctx->stopped) {
+        ctx->stopped = true;
+        // wake the network thread with a nop.
+        struct io_uring_sqe* sqe = nm_io_uring_get_sqe(ctx);
+        if (sqe != NULL) {
+            io_uring_prep_nop(sqe);
+            io_uring_sqe_set_data(sqe, NULL);
+            nm_io_uring_submit(ctx);
+        }
+    }
+    nm_io_uring_unlock(ctx);
+}
+
+void nm_io_uring_lock(struct nm_io_uring* ctx)
+{
+    pthread_mutex_lock(&ctx->mutex);
+}
+
+void nm_io_uring_unlock(struct nm_io_uring* ctx)
+{
+    pthread_mutex_unlock(&ctx->mutex);
+}
+
+struct io_uring_sqe* nm_io_uring_get_sqe(struct nm_io_uring* ctx)
+{
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ctx->ring);
+    if (sqe == NULL) {
+        // the submission queue is full, flush it and try again.
+        io_uring_submit(&ctx->ring);
+        sqe = io_uring_get_sqe(&ctx->ring);
+        if (sqe == NULL) {
+            NABTO_LOG_ERROR(LOG, "io_uring submission queue is full");
+        }
+    }
+    return sqe;
+}
+
+void nm_io_uring_submit(struct nm_io_uring* ctx)
+{
+    int ret = io_uring_submit(&ctx->ring);
+    if (ret < 0) {
+        NABTO_LOG_ERROR(LOG, "io_uring_submit failed (%d) %s", -ret, strerror(-ret));
+    }
+}
+
+void nm_io_uring_cancel(struct nm_io_uring* ctx, struct nm_io_uring_op* op)
+{
+    struct io_uring_sqe* sqe = nm_io_uring_get_sqe(ctx);
+    if (sqe == NULL) {
+        return;
+    }
+    io_uring_prep_cancel(sqe, op, 0);
+    io_uring_sqe_set_data(sqe, NULL);
+}
+
+uint8_t* nm_io_uring_udp_buffer(struct nm_io_uring* ctx, uint16_t bid)
+{
+    return ctx->udpBuffers + ((size_t)bid * NM_IO_URING_UDP_BUFFER_SIZE);
+}
+
+void nm_io_uring_udp_buffer_return(struct nm_io_uring* ctx, uint16_t bid)
+{
+    io_uring_buf_ring_add(ctx->udpBufRing, nm_io_uring_udp_buffer(ctx, bid), NM_IO_URING_UDP_BUFFER_SIZE, bid,
+                          io_uring_buf_ring_mask(NM_IO_URING_UDP_BUFFER_COUNT), 0);
+    io_uring_buf_ring_advance(ctx->udpBufRing, 1);
+}
+
+int nm_io_uring_fixed_file_add(struct nm_io_uring* ctx, int fd)
+{
+    if (!ctx->fixedFiles) {
+        return -1;
+    }
+    int i;
+    for (i = 0; i < NM_IO_URING_MAX_FIXED_FILES; i++) {
+        if (!ctx->fixedFilesUsed[i]) {
+            int ret = io_uring_register_files_update(&ctx->ring, i, &fd, 1);
+            if (ret < 0) {
+                NABTO_LOG_TRACE(LOG, "Could not register fixed file (%d) %s", -ret, strerror(-ret));
+                return -1;
+            }
+            ctx->fixedFilesUsed[i] = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+void nm_io_uring_fixed_file_remove(struct nm_io_uring* ctx, int slot)
+{
+    if (slot < 0) {
+        return;
+    }
+    int empty = -1;
+    io_uring_register_files_update(&ctx->ring, slot, &empty, 1);
+    ctx->fixedFilesUsed[slot] = false;
+}
+
+np_error_code nm_io_uring_tcp_buffer_alloc(struct nm_io_uring* ctx, struct nm_io_uring_tcp_buffer* buffer)
+{
+    if (ctx->tcpBuffersRegistered) {
+        int i;
+        for (i = 0; i < NM_IO_URING_TCP_BUFFER_COUNT; i++) {
+            if (!ctx->tcpBuffersUsed[i]) {
+                ctx->tcpBuffersUsed[i] = true;
+                buffer->index = i;
+                buffer->data = ctx->tcpBuffers + ((size_t)i * NM_IO_URING_TCP_BUFFER_SIZE);
+                return NABTO_EC_OK;
+            }
+        }
+    }
+    buffer->index = -1;
+    buffer->data = malloc(NM_IO_URING_TCP_BUFFER_SIZE);
+    if (buffer->data == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    return NABTO_EC_OK;
+}
+
+void nm_io_uring_tcp_buffer_free(struct nm_io_uring* ctx, struct nm_io_uring_tcp_buffer* buffer)
+{
+    if (buffer->index >= 0) {
+        ctx->tcpBuffersUsed[buffer->index] = false;
+    } else {
+        free(buffer->data);
+    }
+    buffer->data = NULL;
+    buffer->index = -1;
+}
+
+/**
+ * Helper functions start
+ */
+
+void init_tcp_buffers(struct nm_io_uring* ctx)
+{
+    ctx->tcpBuffers = calloc(NM_IO_URING_TCP_BUFFER_COUNT, NM_IO_URING_TCP_BUFFER_SIZE);
+    if (ctx->tcpBuffers == NULL) {
+        return;
+    }
+    struct iovec iovecs[NM_IO_URING_TCP_BUFFER_COUNT];
+    int i;
+    for (i = 0; i < NM_IO_URING_TCP_BUFFER_COUNT; i++) {
+        iovecs[i].iov_base = ctx->tcpBuffers + ((size_t)i * NM_IO_URING_TCP_BUFFER_SIZE);
+        iovecs[i].iov_len = NM_IO_URING_TCP_BUFFER_SIZE;
+    }
+    int ret = io_uring_register_buffers(&ctx->ring, iovecs, NM_IO_URING_TCP_BUFFER_COUNT);
+    if (ret < 0) {
+        // e.g. RLIMIT_MEMLOCK is too low, tcp sockets uses heap buffers.
+        NABTO_LOG_TRACE(LOG, "Could not register tcp buffers (%d) %s", -ret, strerror(-ret));
+        free(ctx->tcpBuffers);
+        ctx->tcpBuffers = NULL;
+        return;
+    }
+    ctx->tcpBuffersRegistered = true;
+}
+
+np_error_code init_udp_buffers(struct nm_io_uring* ctx)
+{
+    int ret;
+    ctx->udpBuffers = calloc(NM_IO_URING_UDP_BUFFER_COUNT, NM_IO_URING_UDP_BUFFER_SIZE);
+    if (ctx->udpBuffers == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+
+    ctx->udpBufRing = io_uring_setup_buf_ring(&ctx->ring, NM_IO_URING_UDP_BUFFER_COUNT, NM_IO_URING_UDP_BUFFER_GROUP, 0, &ret);
+    if (ctx->udpBufRing == NULL) {
+        NABTO_LOG_ERROR(LOG, "Failed to create provided buffer ring (%d) %s", -ret, strerror(-ret));
+        free(ctx->udpBuffers);
+        ctx->udpBuffers = NULL;
+        return NABTO_EC_NOT_SUPPORTED;
+    }
+
+    int mask = io_uring_buf_ring_mask(NM_IO_URING_UDP_BUFFER_COUNT);
+    int i;
+    for (i = 0; i < NM_IO_URING_UDP_BUFFER_COUNT; i++) {
+        io_uring_buf_ring_add(ctx->udpBufRing, nm_io_uring_udp_buffer(ctx, i), NM_IO_URING_UDP_BUFFER_SIZE, i, mask, i);
+    }
+    io_uring_buf_ring_advance(ctx->udpBufRing, NM_IO_URING_UDP_BUFFER_COUNT);
+    return NABTO_EC_OK;
+}
+
+void handle_cqe(struct nm_io_uring* ctx, struct io_uring_cqe* cqe)
+{
+    struct nm_io_uring_op* op = io_uring_cqe_get_data(cqe);
+    if (op == NULL) {
+        // wakeup or cancel request.
+        return;
+    }
+    switch (op->type) {
+        case NM_IO_URING_OP_UDP_RECV:
+        case NM_IO_URING_OP_UDP_SEND:
+            nm_io_uring_udp_handle_completion(op, cqe);
+            break;
+        case NM_IO_URING_OP_TCP_CONNECT:
+        case NM_IO_URING_OP_TCP_READ:
+        case NM_IO_URING_OP_TCP_WRITE:
+            nm_io_uring_tcp_handle_completion(op, cqe);
+            break;
+    }
+}
+
+void* network_thread(void* data)
+{
+    struct nm_io_uring* ctx = data;
+    while(true) {
+        struct io_uring_cqe* cqe;
+        int ret = io_uring_wait_cqe(&ctx->ring, &cqe);
+        if (ret < 0 && ret != -EINTR && ret != -EAGAIN) {
+            // e.g. the ring is torn down, waiting again fails right
+            // away. Aborting the sockets still resolves their
+            // completion events.
+            NABTO_LOG_ERROR(LOG, "io_uring_wait_cqe failed (%d) %s, stopping the network thread", -ret, strerror(-ret));
+            return NULL;
+        }
+
+        nm_io_uring_lock(ctx);
+        unsigned head;
+        unsigned count = 0;
+        io_uring_for_each_cqe(&ctx->ring, head, cqe) {
+            handle_cqe(ctx, cqe);
+            count++;
+        }
+        io_uring_cq_advance(&ctx->ring, count);
+        // completion handlers can have queued new operations.
+        if (io_uring_sq_ready(&ctx->ring) > 0) {
+            nm_io_uring_submit(ctx);
+        }
+        bool stopped = ctx->stopped;
+        nm_io_uring_unlock(ctx);
+        if (stopped) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
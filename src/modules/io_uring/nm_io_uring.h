@@ -0,0 +1,290 @@
+#ifndef NM_IO_URING_H
+#define NM_IO_URING_H
+
+#include <platform/np_types.h>
+#include <platform/np_platform.h>
+
+#include <nn/llist.h>
+
+#include <liburing.h>
+
+#include <sys/socket.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Linux io_uring based implementation of the udp, tcp and mdns udp
+ * bind interfaces.
+ *
+ * UDP sockets use a multishot recvmsg which picks buffers from a
+ * provided buffer ring shared by all the udp sockets, such that
+ * receiving a packet does not need a syscall. TCP sockets are
+ * registered in the fixed file table and read and write through
+ * registered buffers owned by the module, the data is copied to and
+ * from the buffers given by the caller. Since the kernel never
+ * touches the caller buffers they can be released as soon as an
+ * abort has resolved the completion events.
+ *
+ * The core thread submits operations, a network thread reaps the
+ * completions. Both take the module lock.
+ */
+
+// Number of entries in the submission queue.
+#ifndef NM_IO_URING_QUEUE_DEPTH
+#define NM_IO_URING_QUEUE_DEPTH 256
+#endif
+
+// Number of buffers in the udp provided buffer ring, must be a power of 2.
+#ifndef NM_IO_URING_UDP_BUFFER_COUNT
+#define NM_IO_URING_UDP_BUFFER_COUNT 256
+#endif
+
+// Size of each buffer, the buffer also holds the recvmsg header and the source address.
+#ifndef NM_IO_URING_UDP_BUFFER_SIZE
+#define NM_IO_URING_UDP_BUFFER_SIZE 2048
+#endif
+
+// Number of slots in the fixed file table used for tcp sockets.
+#ifndef NM_IO_URING_MAX_FIXED_FILES
+#define NM_IO_URING_MAX_FIXED_FILES 256
+#endif
+
+// Number of registered buffers for tcp, each tcp socket uses two.
+#ifndef NM_IO_URING_TCP_BUFFER_COUNT
+#define NM_IO_URING_TCP_BUFFER_COUNT 128
+#endif
+
+#ifndef NM_IO_URING_TCP_BUFFER_SIZE
+#define NM_IO_URING_TCP_BUFFER_SIZE 8192
+#endif
+
+// Number of packets a udp socket can have in flight, the sends are
+// preallocated in the socket. Packets sent when they are all in use
+// are dropped like packets sent to a full socket buffer.
+#ifndef NM_IO_URING_UDP_SEND_COUNT
+#define NM_IO_URING_UDP_SEND_COUNT 64
+#endif
+
+#define NM_IO_URING_UDP_BUFFER_GROUP 0
+
+enum nm_io_uring_op_type {
+    NM_IO_URING_OP_UDP_RECV,
+    NM_IO_URING_OP_UDP_SEND,
+    NM_IO_URING_OP_TCP_CONNECT,
+    NM_IO_URING_OP_TCP_READ,
+    NM_IO_URING_OP_TCP_WRITE
+};
+
+/**
+ * The user data of every submitted operation, except wakeups and
+ * cancellations which has NULL user data.
+ */
+struct nm_io_uring_op {
+    enum nm_io_uring_op_type type;
+    void* owner;
+};
+
+struct nm_io_uring_udp_packet {
+    uint16_t bid;
+    uint32_t length;
+};
+
+/**
+ * A single sendmsg operation and the state which needs to live until
+ * it completes.
+ */
+struct nm_io_uring_udp_send {
+    struct nm_io_uring_op op;
+    struct nm_io_uring_udp_send_batch* batch;
+    // next free send of the socket.
+    struct nm_io_uring_udp_send* next;
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_storage addr;
+};
+
+/**
+ * All the sendmsg operations from one async_send_to or
+ * async_send_batch call, the completion event is resolved when the
+ * last of them completes.
+ */
+struct nm_io_uring_udp_send_batch {
+    struct nn_llist_node batchesNode;
+    struct np_udp_socket* sock;
+    struct np_completion_event* completionEvent;
+    np_error_code ec;
+    size_t remaining;
+    // next free batch of the socket.
+    struct nm_io_uring_udp_send_batch* next;
+};
+
+struct np_udp_socket {
+    struct nm_io_uring* ctx;
+    int sock;
+    enum np_ip_address_type type;
+
+    bool aborted;
+    bool destroyed;
+
+    struct nm_io_uring_op recvOp;
+    struct msghdr recvMsg;
+    // true while the multishot recv is armed in the kernel.
+    bool recvArmed;
+    // the multishot recv stopped as the buffer ring was empty.
+    bool recvNeedsBuffers;
+    struct np_completion_event* recvCompletionEvent;
+
+    // send batches which has not completed yet.
+    struct nn_llist sendBatches;
+    // A batch has at least one send so there are never more batches
+    // than sends in flight.
+    struct nm_io_uring_udp_send sends[NM_IO_URING_UDP_SEND_COUNT];
+    struct nm_io_uring_udp_send_batch batches[NM_IO_URING_UDP_SEND_COUNT];
+    struct nm_io_uring_udp_send* freeSends;
+    struct nm_io_uring_udp_send_batch* freeBatches;
+
+    // received packets which has not been read yet, the buffers
+    // belongs to the provided buffer ring.
+    struct nm_io_uring_udp_packet packets[NM_IO_URING_UDP_BUFFER_COUNT];
+    size_t packetsHead;
+    size_t packetsSize;
+
+    // operations submitted which has not completed yet. The socket is
+    // freed when it is destroyed and there are no pending operations.
+    size_t pendingOps;
+};
+
+/**
+ * A buffer owned by a tcp socket. The index is the registered buffer
+ * index or -1 if no registered buffer was available and the buffer
+ * is allocated on the heap.
+ */
+struct nm_io_uring_tcp_buffer {
+    uint8_t* data;
+    int index;
+};
+
+struct nm_io_uring_tcp_read_context {
+    struct nm_io_uring_op op;
+    struct nm_io_uring_tcp_buffer buffer;
+    bool pending;
+    struct np_completion_event* completionEvent;
+    void* userBuffer;
+    size_t userBufferSize;
+    size_t* readLength;
+};
+
+struct nm_io_uring_tcp_write_context {
+    struct nm_io_uring_op op;
+    struct nm_io_uring_tcp_buffer buffer;
+    bool pending;
+    struct np_completion_event* completionEvent;
+    const uint8_t* data;
+    size_t dataLength;
+    // bytes of data copied to the buffer by the pending write.
+    size_t chunkLength;
+    size_t chunkOffset;
+};
+
+struct nm_io_uring_tcp_connect_context {
+    struct nm_io_uring_op op;
+    bool pending;
+    struct np_completion_event* completionEvent;
+    struct sockaddr_storage addr;
+};
+
+struct np_tcp_socket {
+    struct nm_io_uring* ctx;
+    int fd;
+    // index in the fixed file table or -1 if the fd is used directly.
+    int fixedSlot;
+
+    struct nm_io_uring_tcp_connect_context connect;
+    struct nm_io_uring_tcp_write_context write;
+    struct nm_io_uring_tcp_read_context read;
+
+    bool destroyed;
+    bool aborted;
+    size_t pendingOps;
+};
+
+struct nm_io_uring {
+    struct io_uring ring;
+
+    struct io_uring_buf_ring* udpBufRing;
+    uint8_t* udpBuffers;
+
+    bool fixedFiles;
+    bool fixedFilesUsed[NM_IO_URING_MAX_FIXED_FILES];
+
+    uint8_t* tcpBuffers;
+    bool tcpBuffersRegistered;
+    bool tcpBuffersUsed[NM_IO_URING_TCP_BUFFER_COUNT];
+
+    pthread_t thread;
+    // synchronize the submission queue, the buffer ring and the
+    // sockets between the core thread and the network thread.
+    pthread_mutex_t mutex;
+    bool stopped;
+};
+
+/**
+ * Functions used from the API
+ */
+np_error_code nm_io_uring_init(struct nm_io_uring* ctx);
+void nm_io_uring_deinit(struct nm_io_uring* ctx);
+
+void nm_io_uring_run(struct nm_io_uring* ctx);
+void nm_io_uring_stop(struct nm_io_uring* ctx);
+
+void nm_io_uring_lock(struct nm_io_uring* ctx);
+void nm_io_uring_unlock(struct nm_io_uring* ctx);
+
+/**
+ * Functions only used internally in the module, all of them must be
+ * called with the lock held.
+ */
+
+// get a submission queue entry, flushes the queue if it is full.
+struct io_uring_sqe* nm_io_uring_get_sqe(struct nm_io_uring* ctx);
+
+void nm_io_uring_submit(struct nm_io_uring* ctx);
+
+// cancel a pending operation.
+void nm_io_uring_cancel(struct nm_io_uring* ctx, struct nm_io_uring_op* op);
+
+// give a udp buffer back to the buffer ring.
+void nm_io_uring_udp_buffer_return(struct nm_io_uring* ctx, uint16_t bid);
+
+uint8_t* nm_io_uring_udp_buffer(struct nm_io_uring* ctx, uint16_t bid);
+
+// register a fd in the fixed file table, returns the slot or -1.
+int nm_io_uring_fixed_file_add(struct nm_io_uring* ctx, int fd);
+void nm_io_uring_fixed_file_remove(struct nm_io_uring* ctx, int slot);
+
+// get a tcp buffer, a registered buffer if one is free.
+np_error_code nm_io_uring_tcp_buffer_alloc(struct nm_io_uring* ctx, struct nm_io_uring_tcp_buffer* buffer);
+void nm_io_uring_tcp_buffer_free(struct nm_io_uring* ctx, struct nm_io_uring_tcp_buffer* buffer);
+
+/**
+ * Get implementations for the implemented modules.
+ */
+
+/**
+ * Get an object implementing the udp interface.
+ */
+struct np_udp nm_io_uring_udp_get_impl(struct nm_io_uring* ctx);
+
+/**
+ * Get an object implementing the tcp interface.
+ */
+struct np_tcp nm_io_uring_tcp_get_impl(struct nm_io_uring* ctx);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif // NM_IO_URING_H
@@ -0,0 +1,10 @@
+#ifndef _NM_IO_URING_MDNS_UDP_BIND_H_
+#define _NM_IO_URING_MDNS_UDP_BIND_H_
+
+#include <modules/mdns/nm_mdns_udp_bind.h>
+
+struct nm_io_uring;
+
+struct nm_mdns_udp_bind nm_io_uring_mdns_udp_bind_get_impl(struct nm_io_uring* ctx);
+
+#endif
@@ -0,0 +1,443 @@
+#include "nm_io_uring_tcp.h"
+
+#include <platform/np_util.h>
+#include <platform/np_logging.h>
+#include <platform/np_completion_event.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+
+#include <netinet/tcp.h>
+
+#define LOG NABTO_LOG_MODULE_TCP
+
+static np_error_code create(struct np_tcp* obj, struct np_tcp_socket** sock);
+static void destroy(struct np_tcp_socket* sock);
+static void async_connect(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port, struct np_completion_event* completionEvent);
+static void async_write(struct np_tcp_socket* sock, const void* data, size_t dataLength, struct np_completion_event* completionEvent);
+static void async_read(struct np_tcp_socket* sock, void* buffer, size_t bufferLength, size_t* readLength, struct np_completion_event* completionEvent);
+static void tcp_shutdown(struct np_tcp_socket* sock);
+static void tcp_abort(struct np_tcp_socket* sock);
+
+static void tcp_abort_locked(struct np_tcp_socket* sock);
+static void tcp_maybe_free(struct np_tcp_socket* sock);
+static np_error_code tcp_create_socket(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port, socklen_t* addrLen);
+static void tcp_prep_fd(struct np_tcp_socket* sock, struct io_uring_sqe* sqe);
+static bool tcp_submit_read(struct np_tcp_socket* sock);
+static bool tcp_submit_write(struct np_tcp_socket* sock);
+static bool tcp_write_next_chunk(struct np_tcp_socket* sock);
+static void tcp_handle_connect(struct np_tcp_socket* sock, struct io_uring_cqe* cqe);
+static void tcp_handle_read(struct np_tcp_socket* sock, struct io_uring_cqe* cqe);
+static void tcp_handle_write(struct np_tcp_socket* sock, struct io_uring_cqe* cqe);
+static void tcp_resolve(struct np_completion_event** completionEvent, np_error_code ec);
+
+static struct np_tcp_functions module = {
+    .create = &create,
+    .destroy = &destroy,
+    .async_connect = &async_connect,
+    .async_write = &async_write,
+    .async_read = &async_read,
+    .shutdown = &tcp_shutdown,
+    .abort = &tcp_abort
+};
+
+struct np_tcp nm_io_uring_tcp_get_impl(struct nm_io_uring* ctx)
+{
+    struct np_tcp obj;
+    obj.mptr = &module;
+    obj.data = ctx;
+    return obj;
+}
+
+void nm_io_uring_tcp_handle_completion(struct nm_io_uring_op* op, struct io_uring_cqe* cqe)
+{
+    struct np_tcp_socket* sock = op->owner;
+    sock->pendingOps--;
+    if (op->type == NM_IO_URING_OP_TCP_CONNECT) {
+        tcp_handle_connect(sock, cqe);
+    } else if (op->type == NM_IO_URING_OP_TCP_READ) {
+        tcp_handle_read(sock, cqe);
+    } else if (op->type == NM_IO_URING_OP_TCP_WRITE) {
+        tcp_handle_write(sock, cqe);
+    }
+    tcp_maybe_free(sock);
+}
+
+np_error_code create(struct np_tcp* obj, struct np_tcp_socket** sock)
+{
+    struct nm_io_uring* ctx = obj->data;
+    struct np_tcp_socket* s = calloc(1,sizeof(struct np_tcp_socket));
+    if (s == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    s->ctx = ctx;
+    s->fd = -1;
+    s->fixedSlot = -1;
+    s->aborted = false;
+    s->destroyed = false;
+    s->connect.op.type = NM_IO_URING_OP_TCP_CONNECT;
+    s->connect.op.owner = s;
+    s->read.op.type = NM_IO_URING_OP_TCP_READ;
+    s->read.op.owner = s;
+    s->write.op.type = NM_IO_URING_OP_TCP_WRITE;
+    s->write.op.owner = s;
+
+    nm_io_uring_lock(ctx);
+    np_error_code ec = nm_io_uring_tcp_buffer_alloc(ctx, &s->read.buffer);
+    if (ec == NABTO_EC_OK) {
+        ec = nm_io_uring_tcp_buffer_alloc(ctx, &s->write.buffer);
+        if (ec != NABTO_EC_OK) {
+            nm_io_uring_tcp_buffer_free(ctx, &s->read.buffer);
+        }
+    }
+    nm_io_uring_unlock(ctx);
+
+    if (ec != NABTO_EC_OK) {
+        free(s);
+        return ec;
+    }
+    *sock = s;
+    return NABTO_EC_OK;
+}
+
+void destroy(struct np_tcp_socket* sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+    struct nm_io_uring* ctx = sock->ctx;
+    nm_io_uring_lock(ctx);
+    tcp_abort_locked(sock);
+    sock->destroyed = true;
+    if (sock->fd != -1) {
+        // pending operations holds a reference to the file, they
+        // complete with -ECANCELED.
+        nm_io_uring_fixed_file_remove(ctx, sock->fixedSlot);
+        sock->fixedSlot = -1;
+        shutdown(sock->fd, SHUT_RDWR);
+        close(sock->fd);
+        sock->fd = -1;
+    }
+    tcp_maybe_free(sock);
+    nm_io_uring_unlock(ctx);
+}
+
+void async_connect(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port, struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+    if (sock->connect.pending) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+
+    socklen_t addrLen;
+    np_error_code ec = tcp_create_socket(sock, address, port, &addrLen);
+    if (ec != NABTO_EC_OK) {
+        np_completion_event_resolve(completionEvent, ec);
+        return;
+    }
+
+    nm_io_uring_lock(sock->ctx);
+    sock->fixedSlot = nm_io_uring_fixed_file_add(sock->ctx, sock->fd);
+    struct io_uring_sqe* sqe = nm_io_uring_get_sqe(sock->ctx);
+    if (sqe == NULL) {
+        nm_io_uring_unlock(sock->ctx);
+        np_completion_event_resolve(completionEvent, NABTO_EC_OUT_OF_MEMORY);
+        return;
+    }
+    io_uring_prep_connect(sqe, sock->fd, (struct sockaddr*)&sock->connect.addr, addrLen);
+    tcp_prep_fd(sock, sqe);
+    io_uring_sqe_set_data(sqe, &sock->connect.op);
+    sock->connect.pending = true;
+    sock->connect.completionEvent = completionEvent;
+    sock->pendingOps++;
+    nm_io_uring_submit(sock->ctx);
+    nm_io_uring_unlock(sock->ctx);
+}
+
+void async_write(struct np_tcp_socket* sock, const void* data, size_t dataLength, struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+    if (sock->write.pending) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+
+    nm_io_uring_lock(sock->ctx);
+    sock->write.data = data;
+    sock->write.dataLength = dataLength;
+    sock->write.completionEvent = completionEvent;
+    if (!tcp_write_next_chunk(sock)) {
+        tcp_resolve(&sock->write.completionEvent, NABTO_EC_OUT_OF_MEMORY);
+    }
+    nm_io_uring_submit(sock->ctx);
+    nm_io_uring_unlock(sock->ctx);
+}
+
+void async_read(struct np_tcp_socket* sock, void* buffer, size_t bufferSize, size_t* readLength, struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+    if (sock->read.pending) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+
+    nm_io_uring_lock(sock->ctx);
+    sock->read.userBuffer = buffer;
+    sock->read.userBufferSize = bufferSize;
+    sock->read.readLength = readLength;
+    sock->read.completionEvent = completionEvent;
+    if (!tcp_submit_read(sock)) {
+        tcp_resolve(&sock->read.completionEvent, NABTO_EC_OUT_OF_MEMORY);
+    }
+    nm_io_uring_submit(sock->ctx);
+    nm_io_uring_unlock(sock->ctx);
+}
+
+void tcp_shutdown(struct np_tcp_socket* sock)
+{
+    shutdown(sock->fd, SHUT_WR);
+}
+
+void tcp_abort(struct np_tcp_socket* sock)
+{
+    nm_io_uring_lock(sock->ctx);
+    tcp_abort_locked(sock);
+    nm_io_uring_unlock(sock->ctx);
+}
+
+/**
+ * Helper functions start
+ */
+
+void tcp_resolve(struct np_completion_event** completionEvent, np_error_code ec)
+{
+    if (*completionEvent != NULL) {
+        struct np_completion_event* ev = *completionEvent;
+        *completionEvent = NULL;
+        np_completion_event_resolve(ev, ec);
+    }
+}
+
+/**
+ * The completion events are resolved right away, the operations
+ * completes later with -ECANCELED. They only touch the buffers owned
+ * by the socket.
+ */
+void tcp_abort_locked(struct np_tcp_socket* sock)
+{
+    if (sock->aborted) {
+        return;
+    }
+    sock->aborted = true;
+    tcp_resolve(&sock->read.completionEvent, NABTO_EC_ABORTED);
+    tcp_resolve(&sock->write.completionEvent, NABTO_EC_ABORTED);
+    tcp_resolve(&sock->connect.completionEvent, NABTO_EC_ABORTED);
+
+    if (sock->read.pending) {
+        nm_io_uring_cancel(sock->ctx, &sock->read.op);
+    }
+    if (sock->write.pending) {
+        nm_io_uring_cancel(sock->ctx, &sock->write.op);
+    }
+    if (sock->connect.pending) {
+        nm_io_uring_cancel(sock->ctx, &sock->connect.op);
+    }
+    nm_io_uring_submit(sock->ctx);
+}
+
+void tcp_maybe_free(struct np_tcp_socket* sock)
+{
+    if (sock->destroyed && sock->pendingOps == 0) {
+        nm_io_uring_tcp_buffer_free(sock->ctx, &sock->read.buffer);
+        nm_io_uring_tcp_buffer_free(sock->ctx, &sock->write.buffer);
+        free(sock);
+    }
+}
+
+void tcp_prep_fd(struct np_tcp_socket* sock, struct io_uring_sqe* sqe)
+{
+    if (sock->fixedSlot >= 0) {
+        sqe->fd = sock->fixedSlot;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
+
+bool tcp_submit_read(struct np_tcp_socket* sock)
+{
+    struct io_uring_sqe* sqe = nm_io_uring_get_sqe(sock->ctx);
+    if (sqe == NULL) {
+        return false;
+    }
+    size_t length = NP_MIN(sock->read.userBufferSize, NM_IO_URING_TCP_BUFFER_SIZE);
+    if (sock->read.buffer.index >= 0) {
+        io_uring_prep_read_fixed(sqe, sock->fd, sock->read.buffer.data, length, 0, sock->read.buffer.index);
+    } else {
+        io_uring_prep_recv(sqe, sock->fd, sock->read.buffer.data, length, 0);
+    }
+    tcp_prep_fd(sock, sqe);
+    io_uring_sqe_set_data(sqe, &sock->read.op);
+    sock->read.pending = true;
+    sock->pendingOps++;
+    return true;
+}
+
+/**
+ * Writes uses send with MSG_NOSIGNAL from the buffer owned by the
+ * socket, a fixed write to a closed connection would raise SIGPIPE.
+ */
+bool tcp_submit_write(struct np_tcp_socket* sock)
+{
+    struct io_uring_sqe* sqe = nm_io_uring_get_sqe(sock->ctx);
+    if (sqe == NULL) {
+        return false;
+    }
+    io_uring_prep_send(sqe, sock->fd, sock->write.buffer.data + sock->write.chunkOffset,
+                       sock->write.chunkLength - sock->write.chunkOffset, MSG_NOSIGNAL);
+    tcp_prep_fd(sock, sqe);
+    io_uring_sqe_set_data(sqe, &sock->write.op);
+    sock->write.pending = true;
+    sock->pendingOps++;
+    return true;
+}
+
+bool tcp_write_next_chunk(struct np_tcp_socket* sock)
+{
+    size_t chunk = NP_MIN(sock->write.dataLength, NM_IO_URING_TCP_BUFFER_SIZE);
+    memcpy(sock->write.buffer.data, sock->write.data, chunk);
+    sock->write.chunkLength = chunk;
+    sock->write.chunkOffset = 0;
+    return tcp_submit_write(sock);
+}
+
+void tcp_handle_connect(struct np_tcp_socket* sock, struct io_uring_cqe* cqe)
+{
+    sock->connect.pending = false;
+    if (cqe->res == 0) {
+        tcp_resolve(&sock->connect.completionEvent, NABTO_EC_OK);
+    } else {
+        NABTO_LOG_ERROR(LOG, "Connect failed %s", strerror(-cqe->res));
+        tcp_resolve(&sock->connect.completionEvent, NABTO_EC_UNKNOWN);
+    }
+}
+
+void tcp_handle_read(struct np_tcp_socket* sock, struct io_uring_cqe* cqe)
+{
+    sock->read.pending = false;
+    if (sock->read.completionEvent == NULL) {
+        // aborted
+        return;
+    }
+    if (cqe->res > 0) {
+        memcpy(sock->read.userBuffer, sock->read.buffer.data, cqe->res);
+        *(sock->read.readLength) = cqe->res;
+        tcp_resolve(&sock->read.completionEvent, NABTO_EC_OK);
+    } else if (cqe->res == 0) {
+        tcp_resolve(&sock->read.completionEvent, NABTO_EC_EOF);
+    } else {
+        NABTO_LOG_ERROR(LOG, "recv error %s", strerror(-cqe->res));
+        tcp_resolve(&sock->read.completionEvent, NABTO_EC_UNKNOWN);
+    }
+}
+
+void tcp_handle_write(struct np_tcp_socket* sock, struct io_uring_cqe* cqe)
+{
+    sock->write.pending = false;
+    if (sock->write.completionEvent == NULL) {
+        // aborted
+        return;
+    }
+    if (cqe->res < 0) {
+        tcp_resolve(&sock->write.completionEvent, NABTO_EC_UNKNOWN);
+        return;
+    }
+
+    bool submitted;
+    sock->write.chunkOffset += cqe->res;
+    if (sock->write.chunkOffset < sock->write.chunkLength) {
+        submitted = tcp_submit_write(sock);
+    } else {
+        sock->write.data += sock->write.chunkLength;
+        sock->write.dataLength -= sock->write.chunkLength;
+        if (sock->write.dataLength == 0) {
+            tcp_resolve(&sock->write.completionEvent, NABTO_EC_OK);
+            return;
+        }
+        submitted = tcp_write_next_chunk(sock);
+    }
+    if (!submitted) {
+        tcp_resolve(&sock->write.completionEvent, NABTO_EC_OUT_OF_MEMORY);
+    }
+}
+
+np_error_code tcp_create_socket(struct np_tcp_socket* sock, struct np_ip_address* address, uint16_t port, socklen_t* addrLen)
+{
+    int s;
+    // the socket is blocking, io_uring waits for readiness itself.
+    if (address->type == NABTO_IPV4) {
+        s = socket(AF_INET, SOCK_STREAM, 0);
+    } else if (address->type == NABTO_IPV6) {
+        s = socket(AF_INET6, SOCK_STREAM, 0);
+    } else {
+        return NABTO_EC_NOT_SUPPORTED;
+    }
+    if (s < 0) {
+        return NABTO_EC_UNKNOWN;
+    }
+
+    sock->fd = s;
+
+    int flags = 1;
+    if (setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, (char *) &flags, sizeof(int)) != 0) {
+        NABTO_LOG_ERROR(LOG, "Could not set socket option TCP_NODELAY");
+    }
+
+    flags = 1;
+    if(setsockopt(sock->fd, SOL_SOCKET, SO_KEEPALIVE, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not enable KEEPALIVE");
+    }
+
+    flags = 9;
+    if(setsockopt(sock->fd, SOL_TCP, TCP_KEEPCNT, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not set TCP_KEEPCNT");
+    }
+
+    flags = 60;
+    if(setsockopt(sock->fd, SOL_TCP, TCP_KEEPIDLE, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not set TCP_KEEPIDLE");
+    }
+
+    flags = 60;
+    if(setsockopt(sock->fd, SOL_TCP, TCP_KEEPINTVL, &flags, sizeof(flags)) < 0) {
+        NABTO_LOG_ERROR(LOG, "could not set TCP KEEPINTVL");
+    }
+
+    memset(&sock->connect.addr, 0, sizeof(struct sockaddr_storage));
+    if (address->type == NABTO_IPV4) {
+        struct sockaddr_in* host = (struct sockaddr_in*)&sock->connect.addr;
+        host->sin_family = AF_INET;
+        memcpy((void*)&host->sin_addr, address->ip.v4, 4);
+        host->sin_port = htons(port);
+        *addrLen = sizeof(struct sockaddr_in);
+    } else {
+        struct sockaddr_in6* host = (struct sockaddr_in6*)&sock->connect.addr;
+        host->sin6_family = AF_INET6;
+        memcpy(host->sin6_addr.s6_addr, address->ip.v6, 16);
+        host->sin6_port = htons(port);
+        *addrLen = sizeof(struct sockaddr_in6);
+    }
+    return NABTO_EC_OK;
+}
@@ -0,0 +1,17 @@
+#ifndef _NM_IO_URING_TCP_H_
+#define _NM_IO_URING_TCP_H_
+
+#include "nm_io_uring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// called from the network thread with the lock held.
+void nm_io_uring_tcp_handle_completion(struct nm_io_uring_op* op, struct io_uring_cqe* cqe);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
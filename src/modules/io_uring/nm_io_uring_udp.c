@@ -0,0 +1,667 @@
+#include "nm_io_uring_udp.h"
+
+#include <platform/np_logging.h>
+#include <platform/np_util.h>
+#include <platform/np_completion_event.h>
+
+#include <nn/llist.h>
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#define LOG NABTO_LOG_MODULE_UDP
+
+/**
+ * Helper function declarations
+ */
+static void udp_abort_locked(struct np_udp_socket* sock);
+static void udp_maybe_free(struct np_udp_socket* sock);
+static void udp_submit_sends(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize, struct np_completion_event* completionEvent);
+static np_error_code udp_arm_recv(struct np_udp_socket* sock);
+static bool udp_pop_packet(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength);
+static void udp_handle_recv(struct np_udp_socket* sock, struct io_uring_cqe* cqe);
+static void udp_handle_send(struct nm_io_uring_udp_send* send, struct io_uring_cqe* cqe);
+static void udp_free_batch(struct np_udp_socket* sock, struct nm_io_uring_udp_send_batch* batch);
+
+/**
+ * Api function declarations
+ */
+static np_error_code nm_io_uring_udp_create(struct np_udp* obj, struct np_udp_socket** sock);
+static void nm_io_uring_udp_destroy(struct np_udp_socket* sock);
+static void nm_io_uring_udp_abort(struct np_udp_socket* sock);
+static void nm_io_uring_udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+static void nm_io_uring_udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+static void nm_io_uring_udp_async_send_to(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
+                                          uint8_t* buffer, uint16_t bufferSize,
+                                          struct np_completion_event* completionEvent);
+static void nm_io_uring_udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                             struct np_completion_event* completionEvent);
+static void nm_io_uring_udp_async_recv_wait(struct np_udp_socket* socket, struct np_completion_event* completionEvent);
+static np_error_code nm_io_uring_udp_recv_from(struct np_udp_socket* socket, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength);
+static np_error_code nm_io_uring_udp_recv_batch(struct np_udp_socket* socket, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received);
+static uint16_t nm_io_uring_udp_get_local_port(struct np_udp_socket* socket);
+
+static bool udp_endpoint_to_sockaddr(struct np_udp_socket* s, const struct np_udp_endpoint* ep, struct sockaddr_storage* addr, socklen_t* addrLen);
+static np_error_code udp_send_error(int status);
+static np_error_code bind_port(struct np_udp_socket* s, uint16_t port);
+static np_error_code set_reuse_port(struct np_udp_socket* s);
+static uint16_t get_local_port(struct np_udp_socket* s);
+static np_error_code create_socket_any(struct np_udp_socket* s);
+
+static struct np_udp_functions module = {
+    .create           = &nm_io_uring_udp_create,
+    .destroy          = &nm_io_uring_udp_destroy,
+    .abort            = &nm_io_uring_udp_abort,
+    .async_bind_port  = &nm_io_uring_udp_async_bind_port,
+    .async_bind_port_shared = &nm_io_uring_udp_async_bind_port_shared,
+    .async_send_to    = &nm_io_uring_udp_async_send_to,
+    .async_send_batch = &nm_io_uring_udp_async_send_batch,
+    .async_recv_wait  = &nm_io_uring_udp_async_recv_wait,
+    .recv_from        = &nm_io_uring_udp_recv_from,
+    .recv_batch       = &nm_io_uring_udp_recv_batch,
+    .get_local_port   = &nm_io_uring_udp_get_local_port
+};
+
+struct np_udp nm_io_uring_udp_get_impl(struct nm_io_uring* ctx)
+{
+    struct np_udp obj;
+    obj.mptr = &module;
+    obj.data = ctx;
+    return obj;
+}
+
+np_error_code nm_io_uring_udp_create(struct np_udp* obj, struct np_udp_socket** sock)
+{
+    struct np_udp_socket* s = calloc(1, sizeof(struct np_udp_socket));
+    if (!s) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    s->ctx = obj->data;
+    s->sock = -1;
+    s->aborted = false;
+    s->destroyed = false;
+    s->recvOp.type = NM_IO_URING_OP_UDP_RECV;
+    s->recvOp.owner = s;
+    nn_llist_init(&s->sendBatches);
+    s->freeSends = NULL;
+    s->freeBatches = NULL;
+    size_t i;
+    for (i = 0; i < NM_IO_URING_UDP_SEND_COUNT; i++) {
+        s->sends[i].next = s->freeSends;
+        s->freeSends = &s->sends[i];
+        s->batches[i].next = s->freeBatches;
+        s->freeBatches = &s->batches[i];
+    }
+    *sock = s;
+    return NABTO_EC_OK;
+}
+
+np_error_code nm_io_uring_udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port, bool shared)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "bind called on aborted socket");
+        return NABTO_EC_ABORTED;
+    }
+
+    np_error_code ec;
+
+    ec = create_socket_any(sock);
+    if (ec != NABTO_EC_OK) {
+        return ec;
+    }
+
+    if (shared) {
+        ec = set_reuse_port(sock);
+    }
+    if (ec == NABTO_EC_OK) {
+        ec = bind_port(sock, port);
+    }
+    if (ec == NABTO_EC_OK) {
+        ec = nm_io_uring_udp_start_recv(sock);
+    }
+    if (ec != NABTO_EC_OK) {
+        close(sock->sock);
+        sock->sock = -1;
+    }
+    return ec;
+}
+
+void nm_io_uring_udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_io_uring_udp_async_bind_port_ec(sock, port, false);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+void nm_io_uring_udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_io_uring_udp_async_bind_port_ec(sock, port, true);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+void nm_io_uring_udp_async_send_to(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
+                                   uint8_t* buffer, uint16_t bufferSize,
+                                   struct np_completion_event* completionEvent)
+{
+    struct np_udp_send_entry entry;
+    entry.ep = *ep;
+    entry.buffer = buffer;
+    entry.bufferSize = bufferSize;
+    udp_submit_sends(sock, &entry, 1, completionEvent);
+}
+
+void nm_io_uring_udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                      struct np_completion_event* completionEvent)
+{
+    udp_submit_sends(sock, entries, entriesSize, completionEvent);
+}
+
+void nm_io_uring_udp_async_recv_wait(struct np_udp_socket* sock,
+                                     struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "recv from called on aborted socket");
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+
+    nm_io_uring_lock(sock->ctx);
+    if (sock->recvCompletionEvent != NULL) {
+        nm_io_uring_unlock(sock->ctx);
+        NABTO_LOG_ERROR(LOG, "operation already in progress");
+        np_completion_event_resolve(completionEvent, NABTO_EC_OPERATION_IN_PROGRESS);
+        return;
+    }
+    if (sock->packetsSize > 0) {
+        nm_io_uring_unlock(sock->ctx);
+        np_completion_event_resolve(completionEvent, NABTO_EC_OK);
+        return;
+    }
+    sock->recvCompletionEvent = completionEvent;
+    nm_io_uring_unlock(sock->ctx);
+}
+
+np_error_code nm_io_uring_udp_recv_from(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength)
+{
+    nm_io_uring_lock(sock->ctx);
+    bool got = udp_pop_packet(sock, ep, buffer, bufferSize, readLength);
+    nm_io_uring_unlock(sock->ctx);
+    if (!got) {
+        return NABTO_EC_AGAIN;
+    }
+    return NABTO_EC_OK;
+}
+
+np_error_code nm_io_uring_udp_recv_batch(struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    size_t i;
+    nm_io_uring_lock(sock->ctx);
+    for (i = 0; i < entriesSize; i++) {
+        if (!udp_pop_packet(sock, &entries[i].ep, entries[i].buffer, entries[i].bufferSize, &entries[i].recvSize)) {
+            break;
+        }
+    }
+    nm_io_uring_unlock(sock->ctx);
+    *received = i;
+    if (i == 0) {
+        return NABTO_EC_AGAIN;
+    }
+    return NABTO_EC_OK;
+}
+
+uint16_t nm_io_uring_udp_get_local_port(struct np_udp_socket* sock)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "get local port called on aborted socket");
+        return 0;
+    }
+    return get_local_port(sock);
+}
+
+void nm_io_uring_udp_abort(struct np_udp_socket* sock)
+{
+    nm_io_uring_lock(sock->ctx);
+    udp_abort_locked(sock);
+    nm_io_uring_unlock(sock->ctx);
+}
+
+void nm_io_uring_udp_destroy(struct np_udp_socket* sock)
+{
+    if (sock == NULL) {
+        return;
+    }
+    struct nm_io_uring* ctx = sock->ctx;
+    nm_io_uring_lock(ctx);
+    udp_abort_locked(sock);
+    sock->destroyed = true;
+
+    // give the buffers of the unread packets back to the ring.
+    while (sock->packetsSize > 0) {
+        nm_io_uring_udp_buffer_return(ctx, sock->packets[sock->packetsHead].bid);
+        sock->packetsHead = (sock->packetsHead + 1) % NM_IO_URING_UDP_BUFFER_COUNT;
+        sock->packetsSize--;
+    }
+
+    if (sock->sock != -1) {
+        // pending operations holds a reference to the file, they
+        // complete with -ECANCELED.
+        close(sock->sock);
+        sock->sock = -1;
+    }
+    udp_maybe_free(sock);
+    nm_io_uring_unlock(ctx);
+}
+
+np_error_code nm_io_uring_udp_start_recv(struct np_udp_socket* sock)
+{
+    nm_io_uring_lock(sock->ctx);
+    np_error_code ec = udp_arm_recv(sock);
+    nm_io_uring_unlock(sock->ctx);
+    return ec;
+}
+
+void nm_io_uring_udp_handle_completion(struct nm_io_uring_op* op, struct io_uring_cqe* cqe)
+{
+    if (op->type == NM_IO_URING_OP_UDP_RECV) {
+        udp_handle_recv(op->owner, cqe);
+    } else {
+        udp_handle_send(op->owner, cqe);
+    }
+}
+
+int nm_io_uring_udp_socket(int domain, int type)
+{
+    // io_uring returns -EAGAIN instead of waiting for O_NONBLOCK
+    // sockets, so the sockets are blocking.
+    return socket(domain, type, 0);
+}
+
+/**
+ * Helper functions start
+ */
+
+void udp_abort_locked(struct np_udp_socket* sock)
+{
+    if (!sock->aborted) {
+        sock->aborted = true;
+        if (sock->recvArmed) {
+            nm_io_uring_cancel(sock->ctx, &sock->recvOp);
+            nm_io_uring_submit(sock->ctx);
+        }
+    }
+
+    if (sock->recvCompletionEvent != NULL) {
+        struct np_completion_event* ev = sock->recvCompletionEvent;
+        sock->recvCompletionEvent = NULL;
+        np_completion_event_resolve(ev, NABTO_EC_ABORTED);
+    }
+
+    // The sends is not cancelled, udp sends does not block so they
+    // complete right away, the batches are returned when they do.
+    struct nm_io_uring_udp_send_batch* batch;
+    NN_LLIST_FOREACH(batch, &sock->sendBatches) {
+        if (batch->completionEvent != NULL) {
+            struct np_completion_event* ev = batch->completionEvent;
+            batch->completionEvent = NULL;
+            np_completion_event_resolve(ev, NABTO_EC_ABORTED);
+        }
+    }
+}
+
+void udp_maybe_free(struct np_udp_socket* sock)
+{
+    if (sock->destroyed && sock->pendingOps == 0) {
+        free(sock);
+    }
+}
+
+void udp_submit_sends(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize, struct np_completion_event* completionEvent)
+{
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "send to called on aborted socket");
+        np_completion_event_resolve(completionEvent, NABTO_EC_ABORTED);
+        return;
+    }
+
+    nm_io_uring_lock(sock->ctx);
+    struct nm_io_uring_udp_send_batch* batch = sock->freeBatches;
+    if (batch == NULL) {
+        // all the sends are in flight, drop the packets like a full socket buffer does.
+        nm_io_uring_unlock(sock->ctx);
+        NABTO_LOG_TRACE(LOG, "No free udp sends, dropping %d packets", (int)entriesSize);
+        np_completion_event_resolve(completionEvent, NABTO_EC_OK);
+        return;
+    }
+    sock->freeBatches = batch->next;
+    batch->sock = sock;
+    batch->completionEvent = completionEvent;
+    batch->ec = NABTO_EC_OK;
+    batch->remaining = 0;
+
+    size_t i;
+    for (i = 0; i < entriesSize; i++) {
+        struct nm_io_uring_udp_send* send = sock->freeSends;
+        if (send == NULL) {
+            NABTO_LOG_TRACE(LOG, "No free udp sends, dropping %d packets", (int)(entriesSize - i));
+            break;
+        }
+        socklen_t addrLen;
+        if (!udp_endpoint_to_sockaddr(sock, &entries[i].ep, &send->addr, &addrLen)) {
+            batch->ec = NABTO_EC_FAILED_TO_SEND_PACKET;
+            continue;
+        }
+        struct io_uring_sqe* sqe = nm_io_uring_get_sqe(sock->ctx);
+        if (sqe == NULL) {
+            batch->ec = NABTO_EC_FAILED_TO_SEND_PACKET;
+            break;
+        }
+        sock->freeSends = send->next;
+        send->op.type = NM_IO_URING_OP_UDP_SEND;
+        send->op.owner = send;
+        send->batch = batch;
+        send->iov.iov_base = entries[i].buffer;
+        send->iov.iov_len = entries[i].bufferSize;
+        send->msg.msg_name = &send->addr;
+        send->msg.msg_namelen = addrLen;
+        send->msg.msg_iov = &send->iov;
+        send->msg.msg_iovlen = 1;
+        io_uring_prep_sendmsg(sqe, sock->sock, &send->msg, 0);
+        io_uring_sqe_set_data(sqe, &send->op);
+        batch->remaining++;
+        sock->pendingOps++;
+    }
+
+    if (batch->remaining == 0) {
+        np_error_code ec = batch->ec;
+        udp_free_batch(sock, batch);
+        nm_io_uring_unlock(sock->ctx);
+        np_completion_event_resolve(completionEvent, ec);
+        return;
+    }
+    nn_llist_append(&sock->sendBatches, &batch->batchesNode, batch);
+    // all the packets of the batch are submitted with one syscall.
+    nm_io_uring_submit(sock->ctx);
+    nm_io_uring_unlock(sock->ctx);
+}
+
+void udp_handle_send(struct nm_io_uring_udp_send* send, struct io_uring_cqe* cqe)
+{
+    struct nm_io_uring_udp_send_batch* batch = send->batch;
+    struct np_udp_socket* sock = batch->sock;
+    if (cqe->res < 0) {
+        np_error_code ec = udp_send_error(-cqe->res);
+        if (ec != NABTO_EC_OK) {
+            batch->ec = ec;
+        }
+    }
+    sock->pendingOps--;
+    send->next = sock->freeSends;
+    sock->freeSends = send;
+    batch->remaining--;
+    if (batch->remaining == 0) {
+        nn_llist_erase_node(&batch->batchesNode);
+        if (batch->completionEvent != NULL) {
+            np_completion_event_resolve(batch->completionEvent, batch->ec);
+        }
+        udp_free_batch(sock, batch);
+    }
+    udp_maybe_free(sock);
+}
+
+void udp_free_batch(struct np_udp_socket* sock, struct nm_io_uring_udp_send_batch* batch)
+{
+    batch->next = sock->freeBatches;
+    sock->freeBatches = batch;
+}
+
+np_error_code udp_arm_recv(struct np_udp_socket* sock)
+{
+    struct io_uring_sqe* sqe = nm_io_uring_get_sqe(sock->ctx);
+    if (sqe == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    // The msghdr tells the kernel how much room to reserve for the
+    // source address in front of the payload in the provided buffer.
+    memset(&sock->recvMsg, 0, sizeof(struct msghdr));
+    sock->recvMsg.msg_namelen = sizeof(struct sockaddr_storage);
+    io_uring_prep_recvmsg_multishot(sqe, sock->sock, &sock->recvMsg, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = NM_IO_URING_UDP_BUFFER_GROUP;
+    io_uring_sqe_set_data(sqe, &sock->recvOp);
+    sock->recvArmed = true;
+    sock->recvNeedsBuffers = false;
+    sock->pendingOps++;
+    nm_io_uring_submit(sock->ctx);
+    return NABTO_EC_OK;
+}
+
+void udp_handle_recv(struct np_udp_socket* sock, struct io_uring_cqe* cqe)
+{
+    struct nm_io_uring* ctx = sock->ctx;
+    bool more = (cqe->flags & IORING_CQE_F_MORE);
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (sock->destroyed || cqe->res < 0 || sock->packetsSize == NM_IO_URING_UDP_BUFFER_COUNT) {
+            nm_io_uring_udp_buffer_return(ctx, bid);
+        } else {
+            size_t tail = (sock->packetsHead + sock->packetsSize) % NM_IO_URING_UDP_BUFFER_COUNT;
+            sock->packets[tail].bid = bid;
+            sock->packets[tail].length = cqe->res;
+            sock->packetsSize++;
+            if (sock->recvCompletionEvent != NULL) {
+                struct np_completion_event* ev = sock->recvCompletionEvent;
+                sock->recvCompletionEvent = NULL;
+                np_completion_event_resolve(ev, NABTO_EC_OK);
+            }
+        }
+    }
+
+    if (!more) {
+        // the multishot recv has terminated.
+        sock->recvArmed = false;
+        sock->pendingOps--;
+        if (sock->destroyed || sock->aborted) {
+            udp_maybe_free(sock);
+        } else if (cqe->res == -ENOBUFS) {
+            // rearmed when the core gives buffers back.
+            sock->recvNeedsBuffers = true;
+        } else {
+            if (cqe->res < 0) {
+                NABTO_LOG_TRACE(LOG, "multishot recv terminated (%d) %s", -cqe->res, strerror(-cqe->res));
+            }
+            udp_arm_recv(sock);
+        }
+    }
+}
+
+bool udp_pop_packet(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength)
+{
+    if (sock->packetsSize == 0) {
+        return false;
+    }
+    struct nm_io_uring* ctx = sock->ctx;
+    struct nm_io_uring_udp_packet* packet = &sock->packets[sock->packetsHead];
+    sock->packetsHead = (sock->packetsHead + 1) % NM_IO_URING_UDP_BUFFER_COUNT;
+    sock->packetsSize--;
+
+    uint8_t* buf = nm_io_uring_udp_buffer(ctx, packet->bid);
+    struct io_uring_recvmsg_out* out = io_uring_recvmsg_validate(buf, packet->length, &sock->recvMsg);
+    if (out == NULL) {
+        nm_io_uring_udp_buffer_return(ctx, packet->bid);
+        *readLength = 0;
+        return true;
+    }
+
+    struct sockaddr_storage* addr = io_uring_recvmsg_name(out);
+    if (addr->ss_family == AF_INET6) {
+        struct sockaddr_in6* sa = (struct sockaddr_in6*)addr;
+        memcpy(&ep->ip.ip.v6, &sa->sin6_addr.s6_addr, sizeof(ep->ip.ip.v6));
+        ep->port = ntohs(sa->sin6_port);
+        ep->ip.type = NABTO_IPV6;
+    } else {
+        struct sockaddr_in* sa = (struct sockaddr_in*)addr;
+        memcpy(&ep->ip.ip.v4, &sa->sin_addr.s_addr, sizeof(ep->ip.ip.v4));
+        ep->port = ntohs(sa->sin_port);
+        ep->ip.type = NABTO_IPV4;
+    }
+
+    size_t length = io_uring_recvmsg_payload_length(out, packet->length, &sock->recvMsg);
+    if (length > bufferSize) {
+        length = bufferSize;
+    }
+    memcpy(buffer, io_uring_recvmsg_payload(out, &sock->recvMsg), length);
+    *readLength = length;
+
+    nm_io_uring_udp_buffer_return(ctx, packet->bid);
+    if (sock->recvNeedsBuffers && !sock->aborted) {
+        udp_arm_recv(sock);
+    }
+    return true;
+}
+
+bool udp_endpoint_to_sockaddr(struct np_udp_socket* s, const struct np_udp_endpoint* ep, struct sockaddr_storage* addr, socklen_t* addrLen)
+{
+    struct np_ip_address sendIp;
+
+    if (s->type == ep->ip.type) {
+        // No conversion needed.
+        sendIp = ep->ip;
+    } else if (s->type == NABTO_IPV6 && ep->ip.type == NABTO_IPV4) {
+        // convert ipv4 to ipv6 mapped ipv4
+        np_ip_convert_v4_to_v4_mapped(&ep->ip, &sendIp);
+    } else if (s->type == NABTO_IPV4 && np_ip_is_v4_mapped(&ep->ip)) {
+        np_ip_convert_v4_mapped_to_v4(&ep->ip, &sendIp);
+    } else {
+        NABTO_LOG_TRACE(LOG, "Cannot send ipv6 packets on an ipv4 socket.");
+        return false;
+    }
+
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+    if (sendIp.type == NABTO_IPV4) {
+        struct sockaddr_in* srv_addr = (struct sockaddr_in*)addr;
+        srv_addr->sin_family = AF_INET;
+        srv_addr->sin_port = htons (ep->port);
+        memcpy((void*)&srv_addr->sin_addr, sendIp.ip.v4, sizeof(srv_addr->sin_addr));
+        *addrLen = sizeof(struct sockaddr_in);
+    } else { // IPv6
+        struct sockaddr_in6* srv_addr = (struct sockaddr_in6*)addr;
+        srv_addr->sin6_family = AF_INET6;
+        srv_addr->sin6_flowinfo = 0;
+        srv_addr->sin6_scope_id = 0;
+        srv_addr->sin6_port = htons (ep->port);
+        memcpy((void*)&srv_addr->sin6_addr,sendIp.ip.v6, sizeof(srv_addr->sin6_addr));
+        *addrLen = sizeof(struct sockaddr_in6);
+    }
+    return true;
+}
+
+np_error_code udp_send_error(int status)
+{
+    NABTO_LOG_TRACE(LOG, "UDP returned error status (%d) %s", status, strerror(status));
+    if (status == EAGAIN || status == EWOULDBLOCK) {
+        // expected
+        // just drop the packet and the upper layers will take care of retransmissions.
+        return NABTO_EC_OK;
+    }
+    if (status == EADDRNOTAVAIL || // if we send to ipv6 scopes we do not have
+        status == ENETUNREACH || // if we send ipv6 on a system without it.
+        status == EAFNOSUPPORT) // if we send ipv6 on an ipv4 only socket
+    {
+        NABTO_LOG_TRACE(LOG,"ERROR: (%i) '%s' in nm_io_uring_udp_send", (int) status, strerror(status));
+    } else {
+        NABTO_LOG_ERROR(LOG,"ERROR: (%i) '%s' in nm_io_uring_udp_send", (int) status, strerror(status));
+    }
+    return NABTO_EC_FAILED_TO_SEND_PACKET;
+}
+
+
+np_error_code bind_port(struct np_udp_socket* s, uint16_t port)
+{
+    int status;
+
+    if (s->type == NABTO_IPV6) {
+        struct sockaddr_in6 si_me6;
+        memset(&si_me6, 0, sizeof(si_me6));
+        si_me6.sin6_family = AF_INET6;
+        si_me6.sin6_port = htons(port);
+        si_me6.sin6_addr = in6addr_any;
+        status = bind(s->sock, (struct sockaddr*)&si_me6, sizeof(si_me6));
+    } else {
+        struct sockaddr_in si_me;
+        memset(&si_me, 0, sizeof(si_me));
+        si_me.sin_family = AF_INET;
+        si_me.sin_port = htons(port);
+        si_me.sin_addr.s_addr = INADDR_ANY;
+        status = bind(s->sock, (struct sockaddr*)&si_me, sizeof(si_me));
+    }
+
+    NABTO_LOG_TRACE(LOG, "bind returned %i", status);
+
+    if (status == 0) {
+        return NABTO_EC_OK;
+    } else {
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+}
+
+np_error_code set_reuse_port(struct np_udp_socket* s)
+{
+    int yes = 1;
+    if (setsockopt(s->sock, SOL_SOCKET, SO_REUSEPORT, (void*)&yes, sizeof(yes)) != 0) {
+        int e = errno;
+        NABTO_LOG_ERROR(LOG, "Unable to set SO_REUSEPORT: (%i) '%s'.", e, strerror(e));
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+    return NABTO_EC_OK;
+}
+
+uint16_t get_local_port(struct np_udp_socket* s)
+{
+    if (s->type == NABTO_IPV6) {
+        struct sockaddr_in6 addr;
+        addr.sin6_port = 0;
+        socklen_t length = sizeof(struct sockaddr_in6);
+        getsockname(s->sock, (struct sockaddr*)(&addr), &length);
+        return htons(addr.sin6_port);
+    } else {
+        struct sockaddr_in addr;
+        addr.sin_port = 0;
+        socklen_t length = sizeof(struct sockaddr_in);
+        getsockname(s->sock, (struct sockaddr*)(&addr), &length);
+        return htons(addr.sin_port);
+    }
+}
+
+np_error_code create_socket_any(struct np_udp_socket* s)
+{
+    int sock = nm_io_uring_udp_socket(AF_INET6, SOCK_DGRAM);
+    if (sock == -1) {
+        sock = nm_io_uring_udp_socket(AF_INET, SOCK_DGRAM);
+        if (sock == -1) {
+            int e = errno;
+            NABTO_LOG_ERROR(LOG, "Unable to create socket: (%i) '%s'.", e, strerror(e));
+            return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+        } else {
+            NABTO_LOG_WARN(LOG, "IPv4 socket opened since IPv6 socket creation failed");
+            s->type = NABTO_IPV4;
+        }
+    } else {
+        int no = 0;
+        s->type = NABTO_IPV6;
+        if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (void* ) &no, sizeof(no)))
+        {
+            int e = errno;
+            NABTO_LOG_ERROR(LOG,"Unable to set option: (%i) '%s'.", e, strerror(e));
+
+            close(sock);
+            return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+        }
+    }
+    s->sock = sock;
+    return NABTO_EC_OK;
+}
@@ -0,0 +1,24 @@
+#ifndef _NM_IO_URING_UDP_H_
+#define _NM_IO_URING_UDP_H_
+
+#include "nm_io_uring.h"
+
+#include <platform/np_platform.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// called from the network thread with the lock held.
+void nm_io_uring_udp_handle_completion(struct nm_io_uring_op* op, struct io_uring_cqe* cqe);
+
+// arm the multishot recv on a bound socket.
+np_error_code nm_io_uring_udp_start_recv(struct np_udp_socket* sock);
+
+int nm_io_uring_udp_socket(int domain, int type);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
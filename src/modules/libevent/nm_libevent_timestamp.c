@@ -13,13 +13,21 @@
 #include <winsock2.h>
 #endif
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
 
 
 
 static uint32_t ts_now_ms(struct np_timestamp* obj);
+static uint32_t ts_now_us(struct np_timestamp* obj);
 
 static const struct np_timestamp_functions module = {
-    .now_ms = &ts_now_ms
+    .now_ms = &ts_now_ms,
+    .now_us = &ts_now_us
 };
 
 
@@ -40,3 +48,25 @@ uint32_t ts_now_ms(struct np_timestamp* obj)
 
     return ((((uint64_t)tv.tv_sec)*1000) + (((uint64_t)tv.tv_usec)/1000));
 }
+
+/**
+ * The microsecond timestamp reads the clock, such that it can measure
+ * durations within one iteration of the event loop. It is monotonic
+ * such that a duration does not wrap when the wall clock is set.
+ */
+uint32_t ts_now_us(struct np_timestamp* obj)
+{
+    (void)obj;
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint32_t)((((uint64_t)counter.QuadPart / frequency.QuadPart) * 1000000) +
+                      ((((uint64_t)counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart));
+#else
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (((uint64_t)spec.tv_sec * 1000000) + (spec.tv_nsec / 1000));
+#endif
+}
@@ -5,6 +5,10 @@
 #include <platform/np_logging.h>
 #include <platform/np_completion_event.h>
 
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+#include <modules/unix/nm_unix_udp.h>
+#endif
+
 #include <event2/util.h>
 #include <event2/event.h>
 #include <event.h>
@@ -42,6 +46,8 @@ struct np_udp_socket {
     evutil_socket_t sock;
     struct nm_libevent_context* impl;
     bool aborted;
+    // set if the kernel rejected UDP_SEGMENT, then batches are sent with sendmmsg.
+    bool gsoDisabled;
     struct event* event;
 };
 
@@ -49,14 +55,18 @@ static np_error_code udp_create(struct np_udp* obj, struct np_udp_socket** sock)
 static void udp_destroy(struct np_udp_socket* sock);
 static void udp_abort(struct np_udp_socket* sock);
 static void udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+static void udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
 
 static void udp_async_send_to(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
                               uint8_t* buffer, uint16_t bufferSize,
                               struct np_completion_event* completionEvent);
+static void udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                 struct np_completion_event* completionEvent);
 
 static void udp_async_recv_wait(struct np_udp_socket* socket,
                                 struct np_completion_event* completionEvent);
 static np_error_code udp_recv_from(struct np_udp_socket* socket, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength);
+static np_error_code udp_recv_batch(struct np_udp_socket* socket, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received);
 
 static void udp_ready_callback(evutil_socket_t s, short events, void* userData);
 
@@ -64,7 +74,11 @@ static uint16_t udp_get_local_port(struct np_udp_socket* socket);
 
 static np_error_code udp_create_socket_any(struct np_udp_socket* s);
 static np_error_code udp_bind_port(struct np_udp_socket* s, uint16_t port);
+static np_error_code udp_set_reuse_port(struct np_udp_socket* s);
 static np_error_code udp_send_to(struct np_udp_socket* s, const struct np_udp_endpoint* ep, const uint8_t* buffer, uint16_t bufferSize);
+static np_error_code udp_send_batch(struct np_udp_socket* s, struct np_udp_send_entry* entries, size_t entriesSize);
+static bool udp_endpoint_to_sockaddr(struct np_udp_socket* s, const struct np_udp_endpoint* ep, struct sockaddr_storage* addr, socklen_type* addrLen);
+static np_error_code udp_send_error(int status);
 static void complete_recv_wait(struct np_udp_socket* sock, np_error_code ec);
 
 static struct np_udp_functions module = {
@@ -72,9 +86,12 @@ static struct np_udp_functions module = {
     .destroy              = &udp_destroy,
     .abort                = &udp_abort,
     .async_bind_port      = &udp_async_bind_port,
+    .async_bind_port_shared = &udp_async_bind_port_shared,
     .async_send_to        = &udp_async_send_to,
+    .async_send_batch     = &udp_async_send_batch,
     .async_recv_wait      = &udp_async_recv_wait,
     .recv_from            = &udp_recv_from,
+    .recv_batch           = &udp_recv_batch,
     .get_local_port       = &udp_get_local_port
 };
 
@@ -151,7 +168,7 @@ void udp_destroy(struct np_udp_socket* sock)
     free(sock);
 }
 
-np_error_code udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port)
+np_error_code udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port, bool shared)
 {
     if (sock->aborted) {
         NABTO_LOG_ERROR(LOG, "bind called on aborted socket");
@@ -166,9 +183,16 @@ np_error_code udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port)
         return ec;
     }
 
-    ec = udp_bind_port(sock, port);
+    if (shared) {
+        ec = udp_set_reuse_port(sock);
+    }
+    if (ec == NABTO_EC_OK) {
+        ec = udp_bind_port(sock, port);
+    }
     if (ec != NABTO_EC_OK) {
         evutil_closesocket(sock->sock);
+        sock->sock = NM_INVALID_SOCKET;
+        return ec;
     }
     nm_libevent_udp_add_to_libevent(sock);
     return NABTO_EC_OK;
@@ -176,7 +200,13 @@ np_error_code udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port)
 
 void udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
 {
-    np_error_code ec = udp_async_bind_port_ec(sock, port);
+    np_error_code ec = udp_async_bind_port_ec(sock, port, false);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+void udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = udp_async_bind_port_ec(sock, port, true);
     np_completion_event_resolve(completionEvent, ec);
 }
 
@@ -199,6 +229,18 @@ void udp_async_send_to(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
     np_completion_event_resolve(completionEvent, ec);
 }
 
+void udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                          struct np_completion_event* completionEvent)
+{
+    np_error_code ec;
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "send batch called on aborted socket");
+        ec = NABTO_EC_ABORTED;
+    } else {
+        ec = udp_send_batch(sock, entries, entriesSize);
+    }
+    np_completion_event_resolve(completionEvent, ec);
+}
 
 void udp_async_recv_wait(struct np_udp_socket* sock,
                          struct np_completion_event* completionEvent)
@@ -250,10 +292,8 @@ evutil_socket_t nm_libevent_udp_create_nonblocking_socket(int domain, int type)
     return sock;
 }
 
-np_error_code udp_send_to(struct np_udp_socket* s, const struct np_udp_endpoint* ep, const uint8_t* buffer, uint16_t bufferSize)
+bool udp_endpoint_to_sockaddr(struct np_udp_socket* s, const struct np_udp_endpoint* ep, struct sockaddr_storage* addr, socklen_type* addrLen)
 {
-    ssize_type res;
-
     struct np_ip_address sendIp;
 
     if (s->type == ep->ip.type) {
@@ -266,44 +306,80 @@ np_error_code udp_send_to(struct np_udp_socket* s, const struct np_udp_endpoint*
         np_ip_convert_v4_mapped_to_v4(&ep->ip, &sendIp);
     } else {
         NABTO_LOG_TRACE(LOG, "Cannot send ipv6 packets on an ipv4 socket.");
-        return NABTO_EC_FAILED_TO_SEND_PACKET;
+        return false;
     }
 
-    NABTO_LOG_TRACE(LOG, "Sending packet of size %d, to %s, port %d", bufferSize, np_ip_address_to_string(&sendIp), ep->port);
+    memset(addr, 0, sizeof(struct sockaddr_storage));
     if (sendIp.type == NABTO_IPV4) {
-        struct sockaddr_in srv_addr;
-        srv_addr.sin_family = AF_INET;
-        srv_addr.sin_port = htons (ep->port);
-        memcpy((void*)&srv_addr.sin_addr, sendIp.ip.v4, sizeof(srv_addr.sin_addr));
-        res = sendto (s->sock, buffer, bufferSize, 0, (struct sockaddr*)&srv_addr, sizeof(srv_addr));
+        struct sockaddr_in* srv_addr = (struct sockaddr_in*)addr;
+        srv_addr->sin_family = AF_INET;
+        srv_addr->sin_port = htons (ep->port);
+        memcpy((void*)&srv_addr->sin_addr, sendIp.ip.v4, sizeof(srv_addr->sin_addr));
+        *addrLen = sizeof(struct sockaddr_in);
     } else { // IPv6
-        struct sockaddr_in6 srv_addr;
-        srv_addr.sin6_family = AF_INET6;
-        srv_addr.sin6_flowinfo = 0;
-        srv_addr.sin6_scope_id = 0;
-        srv_addr.sin6_port = htons (ep->port);
-        memcpy((void*)&srv_addr.sin6_addr,sendIp.ip.v6, sizeof(srv_addr.sin6_addr));
-        res = sendto (s->sock, buffer, bufferSize, 0, (struct sockaddr*)&srv_addr, sizeof(srv_addr));
+        struct sockaddr_in6* srv_addr = (struct sockaddr_in6*)addr;
+        srv_addr->sin6_family = AF_INET6;
+        srv_addr->sin6_flowinfo = 0;
+        srv_addr->sin6_scope_id = 0;
+        srv_addr->sin6_port = htons (ep->port);
+        memcpy((void*)&srv_addr->sin6_addr,sendIp.ip.v6, sizeof(srv_addr->sin6_addr));
+        *addrLen = sizeof(struct sockaddr_in6);
     }
+    return true;
+}
 
-    if (res < 0) {
-        int status = EVUTIL_SOCKET_ERROR();
-        if (ERR_IS_EAGAIN(status)) {
-            // expected
-            // just drop the packet and the upper layers will take care of retransmissions.
-            NABTO_LOG_TRACE(LOG, "Dropping udp packet, the packet will be retransmitted later (%d) %s", status, evutil_socket_error_to_string(status));
-            return NABTO_EC_OK;
-        } else if (ERR_IS_EXPECTED(status)) {
-            NABTO_LOG_TRACE(LOG,"ERROR: (%i) '%s' in udp_send_to", (int) status, strerror(status));
-        } else {
-            NABTO_LOG_ERROR(LOG,"ERROR: (%i) '%s' in udp_send_to", (int) status, strerror(status));
-        }
+np_error_code udp_send_error(int status)
+{
+    if (ERR_IS_EAGAIN(status)) {
+        // expected
+        // just drop the packet and the upper layers will take care of retransmissions.
+        NABTO_LOG_TRACE(LOG, "Dropping udp packet, the packet will be retransmitted later (%d) %s", status, evutil_socket_error_to_string(status));
+        return NABTO_EC_OK;
+    } else if (ERR_IS_EXPECTED(status)) {
+        NABTO_LOG_TRACE(LOG,"ERROR: (%i) '%s' in udp_send_to", (int) status, evutil_socket_error_to_string(status));
+    } else {
+        NABTO_LOG_ERROR(LOG,"ERROR: (%i) '%s' in udp_send_to", (int) status, evutil_socket_error_to_string(status));
+    }
+    return NABTO_EC_FAILED_TO_SEND_PACKET;
+}
+
+np_error_code udp_send_to(struct np_udp_socket* s, const struct np_udp_endpoint* ep, const uint8_t* buffer, uint16_t bufferSize)
+{
+    struct sockaddr_storage addr;
+    socklen_type addrLen;
+    if (!udp_endpoint_to_sockaddr(s, ep, &addr, &addrLen)) {
         return NABTO_EC_FAILED_TO_SEND_PACKET;
     }
 
+    NABTO_LOG_TRACE(LOG, "Sending packet of size %d, to %s, port %d", bufferSize, np_ip_address_to_string(&ep->ip), ep->port);
+    ssize_type res = sendto (s->sock, buffer, bufferSize, 0, (struct sockaddr*)&addr, addrLen);
+    if (res < 0) {
+        return udp_send_error(EVUTIL_SOCKET_ERROR());
+    }
+
     return NABTO_EC_OK;
 }
 
+#if defined(HAVE_SENDMMSG)
+np_error_code udp_send_batch(struct np_udp_socket* s, struct np_udp_send_entry* entries, size_t entriesSize)
+{
+    return nm_unix_udp_send_batch(s->sock, s->type, &s->gsoDisabled, entries, entriesSize);
+}
+#else
+np_error_code udp_send_batch(struct np_udp_socket* s, struct np_udp_send_entry* entries, size_t entriesSize)
+{
+    np_error_code ec = NABTO_EC_OK;
+    size_t i;
+    for (i = 0; i < entriesSize; i++) {
+        np_error_code sendEc = udp_send_to(s, &entries[i].ep, entries[i].buffer, entries[i].bufferSize);
+        if (sendEc != NABTO_EC_OK) {
+            ec = sendEc;
+        }
+    }
+    return ec;
+}
+#endif
+
 np_error_code udp_recv_from(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength)
 {
     ssize_type recvLength;
@@ -340,6 +416,32 @@ np_error_code udp_recv_from(struct np_udp_socket* sock, struct np_udp_endpoint*
     return NABTO_EC_OK;
 }
 
+#if defined(HAVE_RECVMMSG)
+np_error_code udp_recv_batch(struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    return nm_unix_udp_recv_batch(sock->sock, sock->type, entries, entriesSize, received);
+}
+#else
+np_error_code udp_recv_batch(struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    // No recvmmsg, read packets one at a time until the socket would block.
+    size_t i;
+    for (i = 0; i < entriesSize; i++) {
+        np_error_code ec = udp_recv_from(sock, &entries[i].ep, entries[i].buffer, entries[i].bufferSize, &entries[i].recvSize);
+        if (ec != NABTO_EC_OK) {
+            *received = i;
+            if (i > 0) {
+                // deliver what we got, errors are reported on the next call.
+                return NABTO_EC_OK;
+            }
+            return ec;
+        }
+    }
+    *received = entriesSize;
+    return NABTO_EC_OK;
+}
+#endif
+
 np_error_code udp_bind_port(struct np_udp_socket* s, uint16_t port)
 {
     int status;
@@ -369,6 +471,22 @@ np_error_code udp_bind_port(struct np_udp_socket* s, uint16_t port)
     }
 }
 
+np_error_code udp_set_reuse_port(struct np_udp_socket* s)
+{
+#if defined(SO_REUSEPORT)
+    int yes = 1;
+    if (setsockopt(s->sock, SOL_SOCKET, SO_REUSEPORT, (void*)&yes, sizeof(yes)) != 0) {
+        int e = EVUTIL_SOCKET_ERROR();
+        NABTO_LOG_ERROR(LOG, "Unable to set SO_REUSEPORT: (%i) '%s'.", e, evutil_socket_error_to_string(e));
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+    return NABTO_EC_OK;
+#else
+    (void)s;
+    return NABTO_EC_NOT_SUPPORTED;
+#endif
+}
+
 uint16_t udp_get_local_port(struct np_udp_socket* s)
 {
     if (s->aborted) {
@@ -22,6 +22,8 @@ struct np_udp_socket {
     evutil_socket_t sock;
     struct nm_libevent_context* impl;
     bool aborted;
+    // set if the kernel rejected UDP_SEGMENT, then batches are sent with sendmmsg.
+    bool gsoDisabled;
     struct event* event;
 };
 
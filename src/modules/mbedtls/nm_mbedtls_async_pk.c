@@ -0,0 +1,406 @@
+#include "nm_mbedtls_async_pk.h"
+
+#include <platform/np_logging.h>
+#include <platform/np_event_queue_wrapper.h>
+
+#include <mbedtls/pk.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/platform_util.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LOG NABTO_LOG_MODULE_DTLS_SRV
+
+enum nm_mbedtls_async_pk_job_state {
+    // the job is in the free list.
+    NM_MBEDTLS_ASYNC_PK_JOB_FREE,
+    NM_MBEDTLS_ASYNC_PK_JOB_QUEUED,
+    NM_MBEDTLS_ASYNC_PK_JOB_RUNNING,
+    // the worker is done, the job is in the done list.
+    NM_MBEDTLS_ASYNC_PK_JOB_DONE,
+    // the callback has been invoked on the core thread.
+    NM_MBEDTLS_ASYNC_PK_JOB_COMPLETED
+};
+
+/**
+ * The state and the next pointer are protected by the pool mutex.
+ */
+struct nm_mbedtls_async_pk_job {
+    struct nm_mbedtls_async_pk_pool* pool;
+    struct nm_mbedtls_async_pk_job* next;
+    enum nm_mbedtls_async_pk_job_state state;
+    // released by the user before it completed, the pool frees it.
+    bool released;
+
+    uint8_t key[NM_MBEDTLS_ASYNC_PK_MAX_KEY_SIZE];
+    size_t keySize;
+    mbedtls_md_type_t mdAlg;
+    unsigned char hash[MBEDTLS_MD_MAX_SIZE];
+    size_t hashLen;
+
+    int ret;
+    unsigned char output[MBEDTLS_PK_SIGNATURE_MAX_SIZE];
+    size_t outputLen;
+
+    nm_mbedtls_async_pk_callback cb;
+    void* cbData;
+};
+
+// Each worker has its own copy of the key and its own random
+// generator since mbedtls contexts are not thread safe.
+struct nm_mbedtls_async_pk_worker {
+    struct nm_mbedtls_async_pk_pool* pool;
+    struct nm_mbedtls_async_pk_thread* thread;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context ctrDrbg;
+    mbedtls_pk_context key;
+    uint8_t keyDer[NM_MBEDTLS_ASYNC_PK_MAX_KEY_SIZE];
+    size_t keyDerSize;
+};
+
+struct nm_mbedtls_async_pk_pool {
+    struct np_platform* pl;
+    const struct nm_mbedtls_async_pk_threads* threads;
+    struct nm_mbedtls_async_pk_mutex* mutex;
+    struct nm_mbedtls_async_pk_condition* condition;
+    bool stopped;
+
+    struct nm_mbedtls_async_pk_job jobs[NM_MBEDTLS_ASYNC_PK_MAX_JOBS];
+    struct nm_mbedtls_async_pk_job* freeJobs;
+
+    // jobs waiting for a worker.
+    struct nm_mbedtls_async_pk_job* queueHead;
+    struct nm_mbedtls_async_pk_job* queueTail;
+    // jobs which are done but not yet completed on the core thread.
+    struct nm_mbedtls_async_pk_job* doneHead;
+    struct nm_mbedtls_async_pk_job* doneTail;
+    struct np_event completeEvent;
+
+    struct nm_mbedtls_async_pk_worker* workers;
+    size_t workersSize;
+};
+
+static np_error_code sign(void* data, const uint8_t* key, size_t keySize,
+                          mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLen,
+                          nm_mbedtls_async_pk_callback cb, void* cbData,
+                          struct nm_mbedtls_async_pk_job** job);
+static bool result(struct nm_mbedtls_async_pk_job* job, int* ret,
+                   unsigned char* output, size_t* outputLen, size_t outputSize);
+static void release(struct nm_mbedtls_async_pk_job* job);
+
+static void* worker_thread(void* data);
+static void complete_jobs(void* data);
+static void free_job(struct nm_mbedtls_async_pk_job* job);
+
+static struct nm_mbedtls_async_pk_functions module = {
+    .sign = &sign,
+    .result = &result,
+    .release = &release
+};
+
+struct nm_mbedtls_async_pk nm_mbedtls_async_pk_pool_get_impl(struct nm_mbedtls_async_pk_pool* pool)
+{
+    struct nm_mbedtls_async_pk asyncPk;
+    asyncPk.mptr = &module;
+    asyncPk.data = pool;
+    return asyncPk;
+}
+
+np_error_code nm_mbedtls_async_pk_pool_create(struct np_platform* pl,
+                                              const struct nm_mbedtls_async_pk_threads* threads,
+                                              size_t workers,
+                                              struct nm_mbedtls_async_pk_pool** pool)
+{
+    *pool = NULL;
+    if (workers == 0 || workers > NM_MBEDTLS_ASYNC_PK_MAX_WORKERS) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    struct nm_mbedtls_async_pk_pool* p = calloc(1, sizeof(struct nm_mbedtls_async_pk_pool));
+    if (p == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    p->pl = pl;
+    p->threads = threads;
+    size_t i;
+    for (i = NM_MBEDTLS_ASYNC_PK_MAX_JOBS; i > 0; i--) {
+        struct nm_mbedtls_async_pk_job* job = &p->jobs[i-1];
+        job->pool = p;
+        job->next = p->freeJobs;
+        p->freeJobs = job;
+    }
+    np_event_queue_init_event(&pl->eq, &p->completeEvent, &complete_jobs, p);
+    p->workers = calloc(workers, sizeof(struct nm_mbedtls_async_pk_worker));
+    p->mutex = threads->create_mutex();
+    p->condition = threads->create_condition();
+    if (p->workers == NULL || p->mutex == NULL || p->condition == NULL) {
+        nm_mbedtls_async_pk_pool_destroy(p);
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+
+    const char* pers = "dtls_server_async_pk";
+    for (i = 0; i < workers; i++) {
+        struct nm_mbedtls_async_pk_worker* worker = &p->workers[i];
+        worker->pool = p;
+        mbedtls_entropy_init(&worker->entropy);
+        mbedtls_ctr_drbg_init(&worker->ctrDrbg);
+        mbedtls_pk_init(&worker->key);
+        p->workersSize++;
+
+        int ret = mbedtls_ctr_drbg_seed(&worker->ctrDrbg, mbedtls_entropy_func, &worker->entropy,
+                                        (const unsigned char*)pers, strlen(pers));
+        if (ret != 0) {
+            NABTO_LOG_ERROR(LOG, "mbedtls_ctr_drbg_seed returned %d", ret);
+            nm_mbedtls_async_pk_pool_destroy(p);
+            return NABTO_EC_UNKNOWN;
+        }
+        np_error_code ec = threads->create_thread(&worker_thread, worker, &worker->thread);
+        if (ec != NABTO_EC_OK) {
+            worker->thread = NULL;
+            nm_mbedtls_async_pk_pool_destroy(p);
+            return ec;
+        }
+    }
+    *pool = p;
+    return NABTO_EC_OK;
+}
+
+void nm_mbedtls_async_pk_pool_destroy(struct nm_mbedtls_async_pk_pool* pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+    const struct nm_mbedtls_async_pk_threads* threads = pool->threads;
+    size_t i;
+    if (pool->mutex != NULL) {
+        threads->mutex_lock(pool->mutex);
+        pool->stopped = true;
+        threads->mutex_unlock(pool->mutex);
+        for (i = 0; i < pool->workersSize; i++) {
+            threads->cond_signal(pool->condition);
+        }
+    }
+    for (i = 0; i < pool->workersSize; i++) {
+        struct nm_mbedtls_async_pk_worker* worker = &pool->workers[i];
+        if (worker->thread != NULL) {
+            threads->join_thread(worker->thread);
+        }
+        mbedtls_pk_free(&worker->key);
+        mbedtls_ctr_drbg_free(&worker->ctrDrbg);
+        mbedtls_entropy_free(&worker->entropy);
+        mbedtls_platform_zeroize(worker->keyDer, sizeof(worker->keyDer));
+    }
+
+    np_event_queue_deinit_event(&pool->pl->eq, &pool->completeEvent);
+    if (pool->condition != NULL) {
+        threads->free_condition(pool->condition);
+    }
+    if (pool->mutex != NULL) {
+        threads->free_mutex(pool->mutex);
+    }
+    free(pool->workers);
+    mbedtls_platform_zeroize(pool->jobs, sizeof(pool->jobs));
+    free(pool);
+}
+
+np_error_code sign(void* data, const uint8_t* key, size_t keySize,
+                   mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLen,
+                   nm_mbedtls_async_pk_callback cb, void* cbData,
+                   struct nm_mbedtls_async_pk_job** job)
+{
+    struct nm_mbedtls_async_pk_pool* pool = data;
+    if (keySize > NM_MBEDTLS_ASYNC_PK_MAX_KEY_SIZE || hashLen > MBEDTLS_MD_MAX_SIZE) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    const struct nm_mbedtls_async_pk_threads* threads = pool->threads;
+    threads->mutex_lock(pool->mutex);
+    struct nm_mbedtls_async_pk_job* j = pool->freeJobs;
+    if (j == NULL) {
+        threads->mutex_unlock(pool->mutex);
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    pool->freeJobs = j->next;
+    j->next = NULL;
+    j->released = false;
+    memcpy(j->key, key, keySize);
+    j->keySize = keySize;
+    j->mdAlg = mdAlg;
+    memcpy(j->hash, hash, hashLen);
+    j->hashLen = hashLen;
+    j->ret = 0;
+    j->outputLen = 0;
+    j->cb = cb;
+    j->cbData = cbData;
+    j->state = NM_MBEDTLS_ASYNC_PK_JOB_QUEUED;
+
+    if (pool->queueTail == NULL) {
+        pool->queueHead = j;
+    } else {
+        pool->queueTail->next = j;
+    }
+    pool->queueTail = j;
+    threads->mutex_unlock(pool->mutex);
+    threads->cond_signal(pool->condition);
+
+    *job = j;
+    return NABTO_EC_OK;
+}
+
+bool result(struct nm_mbedtls_async_pk_job* job, int* ret,
+            unsigned char* output, size_t* outputLen, size_t outputSize)
+{
+    struct nm_mbedtls_async_pk_pool* pool = job->pool;
+    pool->threads->mutex_lock(pool->mutex);
+    bool completed = (job->state == NM_MBEDTLS_ASYNC_PK_JOB_COMPLETED);
+    pool->threads->mutex_unlock(pool->mutex);
+    // A completed job is not touched by the workers.
+    if (!completed) {
+        return false;
+    }
+    *ret = job->ret;
+    if (job->ret == 0) {
+        if (job->outputLen > outputSize) {
+            *ret = MBEDTLS_ERR_PK_BAD_INPUT_DATA;
+        } else {
+            memcpy(output, job->output, job->outputLen);
+            *outputLen = job->outputLen;
+        }
+    }
+    return true;
+}
+
+void release(struct nm_mbedtls_async_pk_job* job)
+{
+    struct nm_mbedtls_async_pk_pool* pool = job->pool;
+    const struct nm_mbedtls_async_pk_threads* threads = pool->threads;
+    threads->mutex_lock(pool->mutex);
+    if (job->state == NM_MBEDTLS_ASYNC_PK_JOB_QUEUED) {
+        // remove it from the queue
+        struct nm_mbedtls_async_pk_job** it = &pool->queueHead;
+        struct nm_mbedtls_async_pk_job* prev = NULL;
+        while (*it != job) {
+            prev = *it;
+            it = &(*it)->next;
+        }
+        *it = job->next;
+        if (pool->queueTail == job) {
+            pool->queueTail = prev;
+        }
+        free_job(job);
+    } else if (job->state == NM_MBEDTLS_ASYNC_PK_JOB_COMPLETED) {
+        free_job(job);
+    } else {
+        // a worker has the job, it is freed when it is completed.
+        job->released = true;
+    }
+    threads->mutex_unlock(pool->mutex);
+}
+
+static int sign_job(struct nm_mbedtls_async_pk_worker* worker, struct nm_mbedtls_async_pk_job* job)
+{
+    if (worker->keyDerSize != job->keySize || memcmp(worker->keyDer, job->key, job->keySize) != 0) {
+        mbedtls_pk_free(&worker->key);
+        mbedtls_pk_init(&worker->key);
+        worker->keyDerSize = 0;
+        int ret = mbedtls_pk_parse_key(&worker->key, job->key, job->keySize, NULL, 0);
+        if (ret != 0) {
+            NABTO_LOG_ERROR(LOG, "mbedtls_pk_parse_key returned %d", ret);
+            return ret;
+        }
+        memcpy(worker->keyDer, job->key, job->keySize);
+        worker->keyDerSize = job->keySize;
+    }
+    return mbedtls_pk_sign(&worker->key, job->mdAlg, job->hash, job->hashLen,
+                           job->output, &job->outputLen,
+                           mbedtls_ctr_drbg_random, &worker->ctrDrbg);
+}
+
+void* worker_thread(void* data)
+{
+    struct nm_mbedtls_async_pk_worker* worker = data;
+    struct nm_mbedtls_async_pk_pool* pool = worker->pool;
+    const struct nm_mbedtls_async_pk_threads* threads = pool->threads;
+    threads->mutex_lock(pool->mutex);
+    while (true) {
+        while (!pool->stopped && pool->queueHead == NULL) {
+            threads->cond_wait(pool->condition, pool->mutex);
+        }
+        if (pool->stopped) {
+            break;
+        }
+        struct nm_mbedtls_async_pk_job* job = pool->queueHead;
+        pool->queueHead = job->next;
+        if (pool->queueHead == NULL) {
+            pool->queueTail = NULL;
+        }
+        job->next = NULL;
+        job->state = NM_MBEDTLS_ASYNC_PK_JOB_RUNNING;
+        threads->mutex_unlock(pool->mutex);
+
+        int ret = sign_job(worker, job);
+
+        threads->mutex_lock(pool->mutex);
+        job->ret = ret;
+        job->state = NM_MBEDTLS_ASYNC_PK_JOB_DONE;
+        if (pool->doneTail == NULL) {
+            pool->doneHead = job;
+        } else {
+            pool->doneTail->next = job;
+        }
+        pool->doneTail = job;
+        threads->mutex_unlock(pool->mutex);
+
+        np_event_queue_post_maybe_double(&pool->pl->eq, &pool->completeEvent);
+
+        threads->mutex_lock(pool->mutex);
+    }
+    threads->mutex_unlock(pool->mutex);
+    return NULL;
+}
+
+/**
+ * Invoke the callbacks of the done jobs on the core thread.
+ */
+void complete_jobs(void* data)
+{
+    struct nm_mbedtls_async_pk_pool* pool = data;
+    const struct nm_mbedtls_async_pk_threads* threads = pool->threads;
+    // The jobs are taken one at a time, since a callback can release
+    // other jobs which are done.
+    while (true) {
+        threads->mutex_lock(pool->mutex);
+        struct nm_mbedtls_async_pk_job* job = pool->doneHead;
+        if (job == NULL) {
+            threads->mutex_unlock(pool->mutex);
+            return;
+        }
+        pool->doneHead = job->next;
+        if (pool->doneHead == NULL) {
+            pool->doneTail = NULL;
+        }
+        job->next = NULL;
+        // released is only set on the core thread.
+        if (job->released) {
+            free_job(job);
+            threads->mutex_unlock(pool->mutex);
+        } else {
+            job->state = NM_MBEDTLS_ASYNC_PK_JOB_COMPLETED;
+            threads->mutex_unlock(pool->mutex);
+            job->cb(job->cbData);
+        }
+    }
+}
+
+/**
+ * Put a job back in the free list, the pool mutex has to be taken.
+ */
+void free_job(struct nm_mbedtls_async_pk_job* job)
+{
+    struct nm_mbedtls_async_pk_pool* pool = job->pool;
+    mbedtls_platform_zeroize(job, sizeof(struct nm_mbedtls_async_pk_job));
+    job->pool = pool;
+    job->state = NM_MBEDTLS_ASYNC_PK_JOB_FREE;
+    job->next = pool->freeJobs;
+    pool->freeJobs = job;
+}
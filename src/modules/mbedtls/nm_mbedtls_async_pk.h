@@ -0,0 +1,127 @@
+#ifndef NM_MBEDTLS_ASYNC_PK_H
+#define NM_MBEDTLS_ASYNC_PK_H
+
+#include <platform/np_platform.h>
+#include <platform/np_error_code.h>
+
+#include <mbedtls/md.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Asynchronous private key operations for the DTLS server.
+ *
+ * The signature in a DTLS handshake takes milliseconds of cpu, with
+ * an async pk implementation the server makes the signature outside
+ * of the core thread and continues the handshake when the result is
+ * ready. The functions are called from the core thread.
+ */
+
+// Max size of a DER encoded private key.
+#define NM_MBEDTLS_ASYNC_PK_MAX_KEY_SIZE 256
+
+#ifndef NM_MBEDTLS_ASYNC_PK_MAX_WORKERS
+#define NM_MBEDTLS_ASYNC_PK_MAX_WORKERS 16
+#endif
+
+// Number of jobs in the pool, a sign request is made on the core
+// thread when all jobs are in use.
+#ifndef NM_MBEDTLS_ASYNC_PK_MAX_JOBS
+#define NM_MBEDTLS_ASYNC_PK_MAX_JOBS 32
+#endif
+
+struct nm_mbedtls_async_pk_job;
+
+typedef void (*nm_mbedtls_async_pk_callback)(void* data);
+
+struct nm_mbedtls_async_pk_functions {
+    /**
+     * Sign a hash with a DER encoded private key. The callback is
+     * invoked from the event queue when the result is ready, unless
+     * the job is released first.
+     */
+    np_error_code (*sign)(void* data, const uint8_t* key, size_t keySize,
+                          mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLen,
+                          nm_mbedtls_async_pk_callback cb, void* cbData,
+                          struct nm_mbedtls_async_pk_job** job);
+
+    /**
+     * Get the result of a job.
+     *
+     * @return false if the job has not completed yet, else ret is
+     *         the mbedtls return value of the operation.
+     */
+    bool (*result)(struct nm_mbedtls_async_pk_job* job, int* ret,
+                   unsigned char* output, size_t* outputLen, size_t outputSize);
+
+    /**
+     * Release a job, a job which has not completed is cancelled.
+     */
+    void (*release)(struct nm_mbedtls_async_pk_job* job);
+};
+
+struct nm_mbedtls_async_pk {
+    const struct nm_mbedtls_async_pk_functions* mptr;
+    void* data;
+};
+
+struct nm_mbedtls_async_pk_thread;
+struct nm_mbedtls_async_pk_mutex;
+struct nm_mbedtls_async_pk_condition;
+
+/**
+ * The thread primitives used by the pool, they are provided by the
+ * user of the module such that the module does not depend on a
+ * specific threads implementation.
+ */
+struct nm_mbedtls_async_pk_threads {
+    /**
+     * Create and start a thread which runs routine(data).
+     */
+    np_error_code (*create_thread)(void* (*routine)(void*), void* data,
+                                   struct nm_mbedtls_async_pk_thread** thread);
+    /**
+     * Join and free a thread.
+     */
+    void (*join_thread)(struct nm_mbedtls_async_pk_thread* thread);
+
+    struct nm_mbedtls_async_pk_mutex* (*create_mutex)(void);
+    void (*free_mutex)(struct nm_mbedtls_async_pk_mutex* mutex);
+    void (*mutex_lock)(struct nm_mbedtls_async_pk_mutex* mutex);
+    void (*mutex_unlock)(struct nm_mbedtls_async_pk_mutex* mutex);
+
+    struct nm_mbedtls_async_pk_condition* (*create_condition)(void);
+    void (*free_condition)(struct nm_mbedtls_async_pk_condition* condition);
+    void (*cond_signal)(struct nm_mbedtls_async_pk_condition* condition);
+    void (*cond_wait)(struct nm_mbedtls_async_pk_condition* condition,
+                      struct nm_mbedtls_async_pk_mutex* mutex);
+};
+
+struct nm_mbedtls_async_pk_pool;
+
+/**
+ * Create a pool of worker threads which makes the private key
+ * operations. The threads struct has to outlive the pool.
+ *
+ * @return NABTO_EC_INVALID_ARGUMENT if workers is 0 or above NM_MBEDTLS_ASYNC_PK_MAX_WORKERS.
+ */
+np_error_code nm_mbedtls_async_pk_pool_create(struct np_platform* pl,
+                                              const struct nm_mbedtls_async_pk_threads* threads,
+                                              size_t workers,
+                                              struct nm_mbedtls_async_pk_pool** pool);
+
+/**
+ * Stop and join the worker threads. The users of the pool has to
+ * have released their jobs.
+ */
+void nm_mbedtls_async_pk_pool_destroy(struct nm_mbedtls_async_pk_pool* pool);
+
+struct nm_mbedtls_async_pk nm_mbedtls_async_pk_pool_get_impl(struct nm_mbedtls_async_pk_pool* pool);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
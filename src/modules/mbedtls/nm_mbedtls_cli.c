@@ -26,8 +26,6 @@
 #define LOG NABTO_LOG_MODULE_DTLS_CLI
 #define DEBUG_LEVEL 0
 
-const int allowedCipherSuitesList[] = { MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM, 0 };
-
 struct np_dtls_cli_context {
     struct np_platform* pl;
     enum sslState state;
@@ -43,7 +41,7 @@ struct np_dtls_cli_context {
     uint32_t sentCount;
 
     struct nn_llist sendList;
-    struct np_event* startSendEvent;
+    struct np_event startSendEvent;
 
     bool sending;
     bool receiving;
@@ -61,6 +59,13 @@ struct np_dtls_cli_context {
     mbedtls_pk_context privateKey;
     mbedtls_ssl_context ssl;
 
+    // The session from the last completed handshake, it is offered
+    // to the peer on the next connect such that the peer can resume
+    // it with an abbreviated handshake.
+    mbedtls_ssl_session savedSession;
+    bool hasSavedSession;
+    // The peer certificate is not sent in an abbreviated handshake.
+    uint8_t savedFingerprint[32];
 };
 
 const char* nm_mbedtls_cli_alpnList[] = {NABTO_PROTOCOL_VERSION , NULL};
@@ -88,6 +93,8 @@ static void nm_dtls_timed_event_do_one(void* data);
 static np_error_code dtls_cli_init_connection(struct np_dtls_cli_context* ctx);
 static np_error_code nm_mbedtls_cli_reset(struct np_dtls_cli_context* ctx);
 static np_error_code nm_dtls_connect(struct np_dtls_cli_context* ctx);
+static void save_session(struct np_dtls_cli_context* ctx);
+static void forget_session(struct np_dtls_cli_context* ctx);
 
 // Function called by mbedtls when data should be sent to the network
 int nm_dtls_mbedtls_send(void* ctx, const unsigned char* buffer, size_t bufferSize);
@@ -180,12 +187,14 @@ np_error_code nm_mbedtls_cli_create(struct np_platform* pl, struct np_dtls_cli_c
         return NABTO_EC_OUT_OF_MEMORY;
     }
     ctx->pl = pl;
+    np_event_queue_init_event(&pl->eq, &ctx->startSendEvent, &nm_mbedtls_cli_start_send_deferred, ctx);
     mbedtls_ssl_init( &ctx->ssl );
     mbedtls_ssl_config_init( &ctx->conf );
     mbedtls_ctr_drbg_init( &ctx->ctr_drbg );
     mbedtls_entropy_init( &ctx->entropy );
     mbedtls_x509_crt_init( &ctx->publicKey );
     mbedtls_pk_init( &ctx->privateKey );
+    mbedtls_ssl_session_init( &ctx->savedSession );
 
     ctx->sender = packetSender;
     ctx->dataHandler = dataHandler;
@@ -214,11 +223,6 @@ np_error_code nm_mbedtls_cli_create(struct np_platform* pl, struct np_dtls_cli_c
         return NABTO_EC_UNKNOWN;
     }
 
-    ec = np_event_queue_create_event(&pl->eq, &nm_mbedtls_cli_start_send_deferred, ctx, &ctx->startSendEvent);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
-
     *client = ctx;
     return NABTO_EC_OK;
 }
@@ -255,7 +259,7 @@ np_error_code dtls_cli_init_connection(struct np_dtls_cli_context* ctx)
     }
 
     mbedtls_ssl_conf_ciphersuites(&ctx->conf,
-                                  allowedCipherSuitesList);
+                                  nm_dtls_util_ciphersuites());
 
     mbedtls_ssl_conf_alpn_protocols(&ctx->conf, nm_mbedtls_cli_alpnList );
     mbedtls_ssl_conf_authmode( &ctx->conf, MBEDTLS_SSL_VERIFY_OPTIONAL );
@@ -283,6 +287,13 @@ np_error_code dtls_cli_init_connection(struct np_dtls_cli_context* ctx)
 np_error_code nm_mbedtls_cli_reset(struct np_dtls_cli_context* ctx)
 {
     mbedtls_ssl_session_reset( &ctx->ssl );
+    if (ctx->hasSavedSession) {
+        int ret = mbedtls_ssl_set_session( &ctx->ssl, &ctx->savedSession );
+        if (ret != 0) {
+            NABTO_LOG_TRACE(LOG, "Cannot offer the saved session, mbedtls_ssl_set_session returned %d", ret);
+            forget_session(ctx);
+        }
+    }
     // remove the first element until the list is empty
 
     while(!nn_llist_empty(&ctx->sendList)) {
@@ -295,7 +306,7 @@ np_error_code nm_mbedtls_cli_reset(struct np_dtls_cli_context* ctx)
     ctx->recvBufferSize = 0;
 
     nm_mbedtls_timer_cancel(&ctx->timer);
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->startSendEvent);
+    np_event_queue_cancel_event(&ctx->pl->eq, &ctx->startSendEvent);
     return NABTO_EC_OK;
 }
 
@@ -311,7 +322,7 @@ void nm_mbedtls_cli_do_free(struct np_dtls_cli_context* ctx)
     }
 
     nm_mbedtls_timer_cancel(&ctx->timer);
-    np_event_queue_destroy_event(&ctx->pl->eq, ctx->startSendEvent);
+    np_event_queue_deinit_event(&ctx->pl->eq, &ctx->startSendEvent);
     nm_mbedtls_timer_deinit(&ctx->timer);
     pl->buf.free(ctx->sslRecvBuf);
     pl->buf.free(ctx->sslSendBuffer);
@@ -322,6 +333,7 @@ void nm_mbedtls_cli_do_free(struct np_dtls_cli_context* ctx)
     mbedtls_ctr_drbg_free( &ctx->ctr_drbg );
     mbedtls_ssl_config_free( &ctx->conf );
     mbedtls_ssl_free( &ctx->ssl );
+    mbedtls_ssl_session_free( &ctx->savedSession );
 
     free(ctx);
 }
@@ -352,6 +364,8 @@ np_error_code nm_mbedtls_cli_set_keys(struct np_dtls_cli_context* ctx,
                                    const unsigned char* privateKeyL, size_t privateKeySize)
 {
     int ret;
+    // a session is bound to the keys it was established with.
+    forget_session(ctx);
     mbedtls_x509_crt_init( &ctx->publicKey );
     mbedtls_pk_init( &ctx->privateKey );
     ret = mbedtls_x509_crt_parse( &ctx->publicKey, publicKeyL, publicKeySize+1);
@@ -382,6 +396,11 @@ np_error_code get_fingerprint(struct np_dtls_cli_context* ctx, uint8_t* fp)
 {
     const mbedtls_x509_crt* crt = mbedtls_ssl_get_peer_cert(&ctx->ssl);
     if (!crt) {
+        if (ctx->state == DATA && ctx->hasSavedSession) {
+            // the session was resumed
+            memcpy(fp, ctx->savedFingerprint, 32);
+            return NABTO_EC_OK;
+        }
         return NABTO_EC_UNKNOWN;
     }
     return nm_dtls_util_fp_from_crt(crt, fp);
@@ -422,6 +441,7 @@ void nm_dtls_event_do_one(void* data)
                    ctx->ssl.in_msg[1] == MBEDTLS_SSL_ALERT_MSG_ACCESS_DENIED)
         {
             ctx->state = CLOSING;
+            forget_session(ctx);
             nm_mbedtls_timer_cancel(&ctx->timer);
             ctx->eventHandler(NP_DTLS_CLI_EVENT_ACCESS_DENIED, ctx->callbackData);
             return;
@@ -430,12 +450,14 @@ void nm_dtls_event_do_one(void* data)
             {
                 NABTO_LOG_INFO(LOG,  " failed  ! mbedtls_ssl_handshake returned -0x%04x", -ret );
                 ctx->state = CLOSING;
+                forget_session(ctx);
                 nm_mbedtls_timer_cancel(&ctx->timer);
                 ctx->eventHandler(NP_DTLS_CLI_EVENT_CLOSED, ctx->callbackData);
                 return;
             }
             NABTO_LOG_TRACE(LOG, "State changed to DATA");
             ctx->state = DATA;
+            save_session(ctx);
             ctx->eventHandler(NP_DTLS_CLI_EVENT_HANDSHAKE_COMPLETE, ctx->callbackData);
         }
         return;
@@ -457,6 +479,7 @@ void nm_dtls_event_do_one(void* data)
         } else if (ret == MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE &&
                    ctx->ssl.in_msg[1] == MBEDTLS_SSL_ALERT_MSG_ACCESS_DENIED)
         {
+            forget_session(ctx);
             nm_mbedtls_timer_cancel(&ctx->timer);
             ctx->eventHandler(NP_DTLS_CLI_EVENT_ACCESS_DENIED, ctx->callbackData);
             return;
@@ -473,9 +496,46 @@ void nm_dtls_event_do_one(void* data)
     }
 }
 
+/**
+ * Save the session of the completed handshake for the next connect
+ * together with the fingerprint of the peer.
+ */
+void save_session(struct np_dtls_cli_context* ctx)
+{
+    const mbedtls_x509_crt* crt = mbedtls_ssl_get_peer_cert(&ctx->ssl);
+    if (crt != NULL) {
+        if (nm_dtls_util_fp_from_crt(crt, ctx->savedFingerprint) != NABTO_EC_OK) {
+            forget_session(ctx);
+            return;
+        }
+    } else if (!ctx->hasSavedSession) {
+        // neither a certificate nor a resumed session, the peer is unknown.
+        return;
+    }
+
+    mbedtls_ssl_session_free(&ctx->savedSession);
+    mbedtls_ssl_session_init(&ctx->savedSession);
+    int ret = mbedtls_ssl_get_session(&ctx->ssl, &ctx->savedSession);
+    if (ret != 0) {
+        NABTO_LOG_TRACE(LOG, "Cannot save the session, mbedtls_ssl_get_session returned %d", ret);
+        forget_session(ctx);
+        return;
+    }
+    ctx->hasSavedSession = true;
+}
+
+void forget_session(struct np_dtls_cli_context* ctx)
+{
+    if (ctx->hasSavedSession) {
+        mbedtls_ssl_session_free(&ctx->savedSession);
+        mbedtls_ssl_session_init(&ctx->savedSession);
+        ctx->hasSavedSession = false;
+    }
+}
+
 void nm_mbedtls_cli_start_send(struct np_dtls_cli_context* ctx)
 {
-    np_event_queue_post_maybe_double(&ctx->pl->eq, ctx->startSendEvent);
+    np_event_queue_post_maybe_double(&ctx->pl->eq, &ctx->startSendEvent);
 }
 
 void nm_mbedtls_cli_start_send_deferred(void* data)
@@ -4,8 +4,16 @@
 #include <stdbool.h>
 #include <platform/np_platform.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 bool nm_mbedtls_random_init(struct np_platform* pl);
 
 void nm_mbedtls_random_deinit(struct np_platform* pl);
 
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
 #endif
@@ -1,9 +1,11 @@
 #include "nm_mbedtls_srv.h"
 #include "nm_mbedtls_util.h"
 #include "nm_mbedtls_timer.h"
+#include "nm_mbedtls_async_pk.h"
 
 #include <platform/np_logging.h>
 #include <platform/np_event_queue_wrapper.h>
+#include <platform/np_timestamp_wrapper.h>
 #include <core/nc_version.h>
 
 #include <mbedtls/entropy.h>
@@ -11,12 +13,16 @@
 #include <mbedtls/certs.h>
 #include <mbedtls/x509.h>
 #include <mbedtls/ssl.h>
-//#include <mbedtls/ssl_cookie.h>
+#include <mbedtls/ssl_cookie.h>
+#include <mbedtls/platform_util.h>
 #include <mbedtls/net_sockets.h>
 #include <mbedtls/error.h>
 #include <mbedtls/debug.h>
 #include <mbedtls/timing.h>
 #include <mbedtls/ssl_ciphersuites.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/platform.h>
+#include <mbedtls/version.h>
 
 #include <string.h>
 #include <stdlib.h>
@@ -25,22 +31,120 @@
 #define LOG NABTO_LOG_MODULE_DTLS_SRV
 #define DEBUG_LEVEL 0
 
-static const int allowedCipherSuitesList[] = { MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM, 0 };
+// Max number of records encrypted and handed to the sender in one burst.
+#ifndef NM_MBEDTLS_SRV_SEND_BURST_SIZE
+#define NM_MBEDTLS_SRV_SEND_BURST_SIZE 4
+#endif
+
+// Max number of bursts handed to the sender before the first one has
+// completed.
+#ifndef NM_MBEDTLS_SRV_SEND_QUEUE_DEPTH
+#define NM_MBEDTLS_SRV_SEND_QUEUE_DEPTH 2
+#endif
+
+// Max number of records a connection encrypts in one event queue
+// turn, such that a connection with a long send queue does not starve
+// the other connections.
+#ifndef NM_MBEDTLS_SRV_MAX_RECORDS_PER_TURN
+#define NM_MBEDTLS_SRV_MAX_RECORDS_PER_TURN 32
+#endif
+
+// Default number of connections in the connection pool.
+#ifndef NM_MBEDTLS_SRV_DEFAULT_MAX_CONNECTIONS
+#define NM_MBEDTLS_SRV_DEFAULT_MAX_CONNECTIONS 10
+#endif
+
+// Size of the receive buffer and the send buffers of a connection.
+#ifndef NM_MBEDTLS_SRV_BUFFER_SIZE
+#define NM_MBEDTLS_SRV_BUFFER_SIZE 1500
+#endif
+
+// Number of sessions which are cached such that returning clients
+// can resume them with an abbreviated handshake. 0 disables the cache.
+#ifndef NM_MBEDTLS_SRV_SESSION_CACHE_SIZE
+#define NM_MBEDTLS_SRV_SESSION_CACHE_SIZE 16
+#endif
+
+#ifndef NM_MBEDTLS_SRV_SESSION_CACHE_TIMEOUT_MS
+#define NM_MBEDTLS_SRV_SESSION_CACHE_TIMEOUT_MS (10*60*1000)
+#endif
+
+#define NM_MBEDTLS_SRV_FINGERPRINT_SIZE 32
+
+// mbedtls keeps the certificate of the peer in the session in versions
+// before 2.19 and when MBEDTLS_SSL_KEEP_PEER_CERTIFICATE is defined.
+#if MBEDTLS_VERSION_NUMBER < 0x02130000 || defined(MBEDTLS_SSL_KEEP_PEER_CERTIFICATE)
+#define NM_MBEDTLS_SRV_SESSION_HAS_PEER_CERT 1
+#endif
+
+// mbedtls 2.23 and later resizes the record buffers of a connection
+// after the handshake.
+#if MBEDTLS_VERSION_NUMBER >= 0x02170000 && defined(MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH)
+#define NM_MBEDTLS_SRV_VARIABLE_BUFFER_LENGTH 1
+#endif
+
+// mbedtls 2.19 and later can save an established connection and load
+// it into a new context, which is used to hibernate idle connections.
+#if MBEDTLS_VERSION_NUMBER >= 0x02130000 && defined(MBEDTLS_SSL_CONTEXT_SERIALIZATION)
+#define NM_MBEDTLS_SRV_HIBERNATION 1
+#endif
+
+// Sizes of the DTLS record header and the DTLS handshake header.
+#define NM_MBEDTLS_SRV_RECORD_HEADER_SIZE 13
+#define NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE 12
+
+// Each buffer in the buffer slab has room for the headers the sender
+// prepends to a record.
+#define NM_MBEDTLS_SRV_BUFFER_STRIDE (NP_COMMUNICATION_BUFFER_HEADROOM + NM_MBEDTLS_SRV_BUFFER_SIZE)
+#define NM_MBEDTLS_SRV_BUFFERS_PER_CONNECTION (1 + (NM_MBEDTLS_SRV_SEND_QUEUE_DEPTH * NM_MBEDTLS_SRV_SEND_BURST_SIZE))
 
 const char* nm_mbedtls_srv_alpnList[] = {NABTO_PROTOCOL_VERSION , NULL};
 
+// Records written by mbedtls for a single channel which are given to
+// the sender in one operation.
+struct nm_mbedtls_srv_send_burst {
+    struct np_dtls_srv_connection* connection;
+    struct np_dtls_srv_record records[NM_MBEDTLS_SRV_SEND_BURST_SIZE];
+    size_t recordsSize;
+    uint8_t channelId;
+    bool sending;
+};
+
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+// A resumable session. Resumed sessions does not have the peer
+// certificate so the fingerprint of the peer is kept with the session.
+struct nm_mbedtls_srv_session {
+    bool used;
+    uint32_t created;
+    int ciphersuite;
+    int compression;
+    size_t idLen;
+    unsigned char id[32];
+    unsigned char master[48];
+    uint32_t verifyResult;
+    bool hasFingerprint;
+    uint8_t fingerprint[NM_MBEDTLS_SRV_FINGERPRINT_SIZE];
+};
+#endif
+
 struct np_dtls_srv_connection {
     struct np_platform* pl;
+    struct np_dtls_srv* server;
     enum sslState state;
     mbedtls_ssl_context ssl;
     uint8_t currentChannelId;
     uint8_t* recvBuffer;
     size_t recvBufferSize;
-    struct np_communication_buffer* sslRecvBuf;
-    struct np_communication_buffer* sslSendBuffer;
-    size_t sslSendBufferSize;
+    // buffers in the buffer slab of the server.
+    uint8_t* sslRecvBuf;
+    // Ring of bursts. Records are written to sendBursts[sendBurst]
+    // until it is given to the sender, then the next burst is used.
+    struct nm_mbedtls_srv_send_burst sendBursts[NM_MBEDTLS_SRV_SEND_QUEUE_DEPTH];
+    size_t sendBurst;
+    // number of bursts the sender has not completed yet.
+    size_t sendingBursts;
     struct nm_mbedtls_timer timer;
-    struct np_event* closeEv;
+    struct np_event closeEv;
 
     np_dtls_close_callback closeCb;
     void* closeCbData;
@@ -49,16 +153,24 @@ struct np_dtls_srv_connection {
     uint32_t sentCount;
 
     struct nn_llist sendList;
-    struct np_event* startSendEvent;
-    struct np_event* deferredEventEvent;
+    struct np_event startSendEvent;
+    struct np_event deferredEventEvent;
     enum np_dtls_srv_event deferredEvent;
 
     np_dtls_srv_sender sender;
     np_dtls_srv_data_handler dataHandler;
     np_dtls_srv_event_handler eventHandler;
     void* senderData;
-    bool sending;
     uint8_t channelId;
+
+    // fingerprint of the peer, saved when the handshake completes.
+    bool hasPeerFingerprint;
+    uint8_t peerFingerprint[NM_MBEDTLS_SRV_FINGERPRINT_SIZE];
+
+    // The saved mbedtls context of a hibernated connection. It is
+    // NULL while the mbedtls context is set up.
+    uint8_t* hibernatedState;
+    size_t hibernatedStateSize;
 };
 
 struct np_dtls_srv {
@@ -68,6 +180,27 @@ struct np_dtls_srv {
     mbedtls_ssl_config conf;
     mbedtls_x509_crt publicKey;
     mbedtls_pk_context privateKey;
+    mbedtls_ssl_cookie_ctx cookie;
+    // fingerprint of publicKey, computed when the keys are set.
+    uint8_t fingerprint[NM_MBEDTLS_SRV_FINGERPRINT_SIZE];
+
+    // The handshake signatures are made outside of the core thread
+    // if an async pk implementation is set.
+    struct nm_mbedtls_async_pk asyncPk;
+    uint8_t privateKeyDer[NM_MBEDTLS_ASYNC_PK_MAX_KEY_SIZE];
+    size_t privateKeyDerSize;
+
+    // Connection pool. The connections and their buffers are
+    // allocated in two slabs when the first connection is created.
+    size_t maxConnections;
+    struct np_dtls_srv_connection* connections;
+    uint8_t* buffers;
+    struct np_dtls_srv_connection** freeConnections;
+    size_t freeConnectionsSize;
+
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+    struct nm_mbedtls_srv_session sessions[NM_MBEDTLS_SRV_SESSION_CACHE_SIZE];
+#endif
 };
 
 static np_error_code nm_mbedtls_srv_create(struct np_platform* pl, struct np_dtls_srv** server);
@@ -98,11 +231,47 @@ static np_error_code nm_mbedtls_srv_get_fingerprint(struct np_platform* pl, stru
                                                  uint8_t* fp);
 static np_error_code nm_mbedtls_srv_get_server_fingerprint(struct np_dtls_srv* server, uint8_t* fp);
 
+static np_error_code nm_mbedtls_srv_set_max_connections(struct np_dtls_srv* server, size_t maxConnections);
+static size_t nm_mbedtls_srv_get_connection_memory_cost(struct np_dtls_srv* server);
+static size_t nm_mbedtls_srv_get_connection_memory_usage(struct np_dtls_srv_connection* ctx);
+static np_error_code nm_mbedtls_srv_hibernate(struct np_dtls_srv_connection* ctx);
+
+static np_error_code nm_mbedtls_srv_verify_client_hello(struct np_dtls_srv* server,
+                                                        const uint8_t* clientId, size_t clientIdSize,
+                                                        const uint8_t* packet, size_t packetSize,
+                                                        uint8_t* response, size_t* responseSize);
+static np_error_code nm_mbedtls_srv_set_client_id(struct np_dtls_srv_connection* ctx, const uint8_t* clientId, size_t clientIdSize);
+
+static np_error_code pool_init(struct np_dtls_srv* server);
+static void pool_deinit(struct np_dtls_srv* server);
+static np_error_code pool_alloc(struct np_dtls_srv* server, struct np_dtls_srv_connection** connection);
+static void pool_free(struct np_dtls_srv* server, struct np_dtls_srv_connection* connection);
+static void free_connection_resources(struct np_dtls_srv_connection* ctx);
+
+static void save_peer_fingerprint(struct np_dtls_srv_connection* ctx);
+static void release_handshake_state(struct np_dtls_srv_connection* ctx);
+static bool wake_connection(struct np_dtls_srv_connection* ctx);
+#if defined(MBEDTLS_SSL_ASYNC_PRIVATE)
+static void async_pk_configure(struct np_dtls_srv* server);
+static int async_pk_sign(mbedtls_ssl_context* ssl, mbedtls_x509_crt* cert,
+                         mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLen);
+static int async_pk_resume(mbedtls_ssl_context* ssl, unsigned char* output, size_t* outputLen, size_t outputSize);
+static void async_pk_cancel(mbedtls_ssl_context* ssl);
+static void async_pk_done(void* data);
+#endif
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+static int session_cache_get(void* data, mbedtls_ssl_session* session);
+static int session_cache_set(void* data, const mbedtls_ssl_session* session);
+static struct nm_mbedtls_srv_session* session_cache_find(struct np_dtls_srv* server, const unsigned char* id, size_t idLen);
+static void session_cache_clear(struct np_dtls_srv* server);
+#endif
+
 //static void nm_mbedtls_srv_tls_logger( void *ctx, int level, const char *file, int line, const char *str );
 void nm_mbedtls_srv_connection_send_callback(const np_error_code ec, void* data);
 void nm_mbedtls_srv_do_one(void* data);
 void nm_mbedtls_srv_start_send(struct np_dtls_srv_connection* ctx);
 void nm_mbedtls_srv_start_send_deferred(void* data);
+static void nm_mbedtls_srv_flush_send_records(struct np_dtls_srv_connection* ctx);
 
 // Function called by mbedtls when data should be sent to the network
 int nm_mbedtls_srv_mbedtls_send(void* ctx, const unsigned char* buffer, size_t bufferSize);
@@ -126,6 +295,10 @@ np_error_code nm_mbedtls_srv_get_packet_count(struct np_dtls_srv_connection* ctx
 
 // Get the result of the application layer protocol negotiation
 const char*  nm_mbedtls_srv_get_alpn_protocol(struct np_dtls_srv_connection* ctx) {
+    if (ctx->hibernatedState != NULL) {
+        // only connections which negotiated the protocol are hibernated.
+        return nm_mbedtls_srv_alpnList[0];
+    }
     return mbedtls_ssl_get_alpn_protocol(&ctx->ssl);
 }
 
@@ -146,6 +319,12 @@ np_error_code nm_mbedtls_srv_init(struct np_platform* pl)
     pl->dtlsS.get_alpn_protocol = &nm_mbedtls_srv_get_alpn_protocol;
     pl->dtlsS.get_packet_count = &nm_mbedtls_srv_get_packet_count;
     pl->dtlsS.handle_packet = &nm_mbedtls_srv_handle_packet;
+    pl->dtlsS.set_max_connections = &nm_mbedtls_srv_set_max_connections;
+    pl->dtlsS.get_connection_memory_cost = &nm_mbedtls_srv_get_connection_memory_cost;
+    pl->dtlsS.get_connection_memory_usage = &nm_mbedtls_srv_get_connection_memory_usage;
+    pl->dtlsS.hibernate = &nm_mbedtls_srv_hibernate;
+    pl->dtlsS.verify_client_hello = &nm_mbedtls_srv_verify_client_hello;
+    pl->dtlsS.set_client_id = &nm_mbedtls_srv_set_client_id;
     return NABTO_EC_OK;
 }
 
@@ -154,6 +333,10 @@ np_error_code nm_mbedtls_srv_init(struct np_platform* pl)
  */
 np_error_code nm_mbedtls_srv_get_fingerprint(struct np_platform* pl, struct np_dtls_srv_connection* ctx, uint8_t* fp)
 {
+    if (ctx->hasPeerFingerprint) {
+        memcpy(fp, ctx->peerFingerprint, NM_MBEDTLS_SRV_FINGERPRINT_SIZE);
+        return NABTO_EC_OK;
+    }
     const mbedtls_x509_crt* crt = mbedtls_ssl_get_peer_cert(&ctx->ssl);
     if (crt == NULL) {
         NABTO_LOG_ERROR(LOG, "Failed to get peer cert from mbedtls");
@@ -165,7 +348,8 @@ np_error_code nm_mbedtls_srv_get_fingerprint(struct np_platform* pl, struct np_d
 
 np_error_code nm_mbedtls_srv_get_server_fingerprint(struct np_dtls_srv* server, uint8_t* fp)
 {
-    return nm_dtls_util_fp_from_crt(&server->publicKey, fp);
+    memcpy(fp, server->fingerprint, NM_MBEDTLS_SRV_FINGERPRINT_SIZE);
+    return NABTO_EC_OK;
 }
 
 np_error_code nm_mbedtls_srv_create(struct np_platform* pl, struct np_dtls_srv** server)
@@ -175,11 +359,13 @@ np_error_code nm_mbedtls_srv_create(struct np_platform* pl, struct np_dtls_srv**
         return NABTO_EC_OUT_OF_MEMORY;
     }
     (*server)->pl = pl;
+    (*server)->maxConnections = NM_MBEDTLS_SRV_DEFAULT_MAX_CONNECTIONS;
     mbedtls_ssl_config_init( &(*server)->conf );
     mbedtls_entropy_init( &(*server)->entropy );
     mbedtls_ctr_drbg_init( &(*server)->ctr_drbg );
     mbedtls_x509_crt_init( &(*server)->publicKey );
     mbedtls_pk_init( &(*server)->privateKey );
+    mbedtls_ssl_cookie_init( &(*server)->cookie );
     return NABTO_EC_OK;
 }
 
@@ -190,14 +376,533 @@ void nm_mbedtls_srv_destroy(struct np_dtls_srv* server)
     mbedtls_ctr_drbg_free( &server->ctr_drbg );
     mbedtls_x509_crt_free( &server->publicKey );
     mbedtls_pk_free( &server->privateKey );
+    mbedtls_ssl_cookie_free( &server->cookie );
+    mbedtls_platform_zeroize(server->privateKeyDer, sizeof(server->privateKeyDer));
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+    session_cache_clear(server);
+#endif
 
+    pool_deinit(server);
     free(server);
 }
 
+np_error_code nm_mbedtls_srv_set_max_connections(struct np_dtls_srv* server, size_t maxConnections)
+{
+    if (maxConnections == 0) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    if (server->connections != NULL && server->freeConnectionsSize != server->maxConnections) {
+        // connections in the pool are in use.
+        return NABTO_EC_INVALID_STATE;
+    }
+    // the pool is reallocated with the new size when the next
+    // connection is created.
+    pool_deinit(server);
+    server->maxConnections = maxConnections;
+    return NABTO_EC_OK;
+}
+
+size_t nm_mbedtls_srv_get_connection_memory_cost(struct np_dtls_srv* server)
+{
+    (void)server;
+    size_t cost = sizeof(struct np_dtls_srv_connection) +
+        sizeof(struct np_dtls_srv_connection*) +
+        (NM_MBEDTLS_SRV_BUFFERS_PER_CONNECTION * NM_MBEDTLS_SRV_BUFFER_STRIDE);
+    // The record buffers which mbedtls allocates in mbedtls_ssl_setup.
+#if defined(MBEDTLS_SSL_IN_CONTENT_LEN) && defined(MBEDTLS_SSL_OUT_CONTENT_LEN)
+    cost += MBEDTLS_SSL_IN_CONTENT_LEN + MBEDTLS_SSL_OUT_CONTENT_LEN;
+#else
+    cost += 2 * MBEDTLS_SSL_MAX_CONTENT_LEN;
+#endif
+    return cost;
+}
+
+size_t nm_mbedtls_srv_get_connection_memory_usage(struct np_dtls_srv_connection* ctx)
+{
+    size_t usage = sizeof(struct np_dtls_srv_connection) +
+        sizeof(struct np_dtls_srv_connection*) +
+        (NM_MBEDTLS_SRV_BUFFERS_PER_CONNECTION * NM_MBEDTLS_SRV_BUFFER_STRIDE);
+    if (ctx->hibernatedState != NULL) {
+        return usage + ctx->hibernatedStateSize;
+    }
+#if defined(NM_MBEDTLS_SRV_VARIABLE_BUFFER_LENGTH)
+    usage += ctx->ssl.in_buf_len + ctx->ssl.out_buf_len;
+#elif defined(MBEDTLS_SSL_IN_CONTENT_LEN) && defined(MBEDTLS_SSL_OUT_CONTENT_LEN)
+    usage += MBEDTLS_SSL_IN_CONTENT_LEN + MBEDTLS_SSL_OUT_CONTENT_LEN;
+#else
+    usage += 2 * MBEDTLS_SSL_MAX_CONTENT_LEN;
+#endif
+    if (ctx->ssl.session != NULL) {
+        usage += sizeof(mbedtls_ssl_session);
+#if defined(NM_MBEDTLS_SRV_SESSION_HAS_PEER_CERT)
+        const mbedtls_x509_crt* crt = ctx->ssl.session->peer_cert;
+        if (crt != NULL) {
+            usage += sizeof(mbedtls_x509_crt) + crt->raw.len;
+        }
+#endif
+    }
+    return usage;
+}
+
+static size_t read_uint24(const uint8_t* p)
+{
+    return ((size_t)p[0] << 16) | ((size_t)p[1] << 8) | p[2];
+}
+
+static void write_uint24(uint8_t* p, size_t value)
+{
+    p[0] = (uint8_t)(value >> 16);
+    p[1] = (uint8_t)(value >> 8);
+    p[2] = (uint8_t)value;
+}
+
+/**
+ * This is the same check mbedtls does in ssl_parse_client_hello, but
+ * without an ssl context, such that a connection is only allocated
+ * when the client has proven that it can receive packets on its
+ * address.
+ */
+np_error_code nm_mbedtls_srv_verify_client_hello(struct np_dtls_srv* server,
+                                                 const uint8_t* clientId, size_t clientIdSize,
+                                                 const uint8_t* packet, size_t packetSize,
+                                                 uint8_t* response, size_t* responseSize)
+{
+    // record header: type, version, epoch, sequence number, length
+    if (packetSize < NM_MBEDTLS_SRV_RECORD_HEADER_SIZE + NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE ||
+        packet[0] != MBEDTLS_SSL_MSG_HANDSHAKE ||
+        packet[3] != 0 || packet[4] != 0)
+    {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    size_t recordLength = ((size_t)packet[11] << 8) | packet[12];
+    if (recordLength < NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE ||
+        recordLength > packetSize - NM_MBEDTLS_SRV_RECORD_HEADER_SIZE)
+    {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+
+    // handshake header: type, length, message sequence, fragment offset, fragment length
+    const uint8_t* hs = packet + NM_MBEDTLS_SRV_RECORD_HEADER_SIZE;
+    size_t bodyLength = read_uint24(hs + 1);
+    if (hs[0] != MBEDTLS_SSL_HS_CLIENT_HELLO ||
+        read_uint24(hs + 6) != 0 ||
+        read_uint24(hs + 9) != bodyLength ||
+        bodyLength > recordLength - NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE)
+    {
+        // mbedtls does not support fragmented ClientHellos either.
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+
+    // ClientHello: version, random, session id, cookie, ...
+    const uint8_t* body = hs + NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE;
+    size_t offset = 2 + 32;
+    if (bodyLength < offset + 1) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    size_t sessionIdLength = body[offset];
+    offset += 1 + sessionIdLength;
+    if (sessionIdLength > 32 || bodyLength < offset + 1) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    size_t cookieLength = body[offset];
+    offset += 1;
+    if (bodyLength < offset + cookieLength) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+
+    if (cookieLength > 0 &&
+        mbedtls_ssl_cookie_check(&server->cookie, body + offset, cookieLength, clientId, clientIdSize) == 0)
+    {
+        return NABTO_EC_OK;
+    }
+
+    // The HelloVerifyRequest uses the record sequence number and the
+    // message sequence number of the ClientHello, RFC 6347 4.2.1.
+    size_t headersSize = NM_MBEDTLS_SRV_RECORD_HEADER_SIZE + NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE;
+    if (*responseSize < headersSize + 3) {
+        return NABTO_EC_UNKNOWN;
+    }
+    memcpy(response, packet, 11);
+    uint8_t* hvr = response + NM_MBEDTLS_SRV_RECORD_HEADER_SIZE;
+    memset(hvr, 0, NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE);
+    hvr[0] = MBEDTLS_SSL_HS_HELLO_VERIFY_REQUEST;
+    hvr[4] = hs[4];
+    hvr[5] = hs[5];
+
+    // HelloVerifyRequest: server version, cookie
+    uint8_t* hvrBody = hvr + NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE;
+    // DTLS 1.2
+    hvrBody[0] = 0xfe;
+    hvrBody[1] = 0xfd;
+    uint8_t* cookie = hvrBody + 3;
+    uint8_t* p = cookie;
+    int ret = mbedtls_ssl_cookie_write(&server->cookie, &p, response + *responseSize, clientId, clientIdSize);
+    if (ret != 0) {
+        NABTO_LOG_ERROR(LOG, "mbedtls_ssl_cookie_write returned %d", ret);
+        return NABTO_EC_UNKNOWN;
+    }
+    hvrBody[2] = (uint8_t)(p - cookie);
+
+    size_t hvrBodyLength = 3 + (size_t)(p - cookie);
+    write_uint24(hvr + 1, hvrBodyLength);
+    write_uint24(hvr + 9, hvrBodyLength);
+    size_t hvrRecordLength = NM_MBEDTLS_SRV_HANDSHAKE_HEADER_SIZE + hvrBodyLength;
+    response[11] = (uint8_t)(hvrRecordLength >> 8);
+    response[12] = (uint8_t)hvrRecordLength;
+    *responseSize = NM_MBEDTLS_SRV_RECORD_HEADER_SIZE + hvrRecordLength;
+    return NABTO_EC_AGAIN;
+}
+
+np_error_code nm_mbedtls_srv_set_client_id(struct np_dtls_srv_connection* ctx, const uint8_t* clientId, size_t clientIdSize)
+{
+    int ret = mbedtls_ssl_set_client_transport_id(&ctx->ssl, clientId, clientIdSize);
+    if (ret == MBEDTLS_ERR_SSL_ALLOC_FAILED) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    } else if (ret != 0) {
+        NABTO_LOG_ERROR(LOG, "mbedtls_ssl_set_client_transport_id returned %d", ret);
+        return NABTO_EC_UNKNOWN;
+    }
+    return NABTO_EC_OK;
+}
+
+/**
+ * Save the fingerprint of the peer such that it is available after
+ * the handshake. A resumed session has no peer certificate, its
+ * fingerprint is found in the session cache.
+ */
+void save_peer_fingerprint(struct np_dtls_srv_connection* ctx)
+{
+    const mbedtls_x509_crt* crt = mbedtls_ssl_get_peer_cert(&ctx->ssl);
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+    struct nm_mbedtls_srv_session* session = session_cache_find(ctx->server, ctx->ssl.session->id, ctx->ssl.session->id_len);
+#endif
+    if (crt != NULL) {
+        if (nm_dtls_util_fp_from_crt(crt, ctx->peerFingerprint) != NABTO_EC_OK) {
+            return;
+        }
+        ctx->hasPeerFingerprint = true;
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+        if (session != NULL) {
+            memcpy(session->fingerprint, ctx->peerFingerprint, NM_MBEDTLS_SRV_FINGERPRINT_SIZE);
+            session->hasFingerprint = true;
+        }
+#endif
+    }
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+    else if (session != NULL && session->hasFingerprint) {
+        NABTO_LOG_TRACE(LOG, "Resumed a cached session");
+        memcpy(ctx->peerFingerprint, session->fingerprint, NM_MBEDTLS_SRV_FINGERPRINT_SIZE);
+        ctx->hasPeerFingerprint = true;
+    }
+#endif
+}
+
+/**
+ * mbedtls frees the handshake parameters when the handshake is
+ * done. The certificate of the peer is also only needed during the
+ * handshake once the fingerprint is saved, so it is freed too.
+ */
+void release_handshake_state(struct np_dtls_srv_connection* ctx)
+{
+#if defined(NM_MBEDTLS_SRV_SESSION_HAS_PEER_CERT)
+    mbedtls_ssl_session* session = ctx->ssl.session;
+    if (ctx->hasPeerFingerprint && session != NULL && session->peer_cert != NULL) {
+        mbedtls_x509_crt_free(session->peer_cert);
+        mbedtls_free(session->peer_cert);
+        session->peer_cert = NULL;
+    }
+#else
+    (void)ctx;
+#endif
+}
+
+/**
+ * Save the mbedtls context of an idle connection and free it, such
+ * that only the keys and the record state are kept. The context is
+ * loaded again by wake_connection when the connection is used.
+ */
+np_error_code nm_mbedtls_srv_hibernate(struct np_dtls_srv_connection* ctx)
+{
+#if defined(NM_MBEDTLS_SRV_HIBERNATION)
+    if (ctx->hibernatedState != NULL) {
+        return NABTO_EC_OK;
+    }
+    if (ctx->state != DATA) {
+        return NABTO_EC_INVALID_STATE;
+    }
+    if (!nn_llist_empty(&ctx->sendList) || ctx->sendingBursts > 0 ||
+        ctx->sendBursts[ctx->sendBurst].recordsSize > 0)
+    {
+        return NABTO_EC_OPERATION_IN_PROGRESS;
+    }
+    size_t size = 0;
+    int ret = mbedtls_ssl_context_save(&ctx->ssl, NULL, 0, &size);
+    if (ret != MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL) {
+        // e.g. a partially read datagram.
+        NABTO_LOG_TRACE(LOG, "The connection cannot be saved, mbedtls_ssl_context_save returned %d", ret);
+        return NABTO_EC_INVALID_STATE;
+    }
+    uint8_t* state = malloc(size);
+    if (state == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    ret = mbedtls_ssl_context_save(&ctx->ssl, state, size, &size);
+    if (ret != 0) {
+        NABTO_LOG_ERROR(LOG, "mbedtls_ssl_context_save returned %d", ret);
+        free(state);
+        return NABTO_EC_UNKNOWN;
+    }
+    nm_mbedtls_timer_cancel(&ctx->timer);
+    mbedtls_ssl_free(&ctx->ssl);
+    ctx->hibernatedState = state;
+    ctx->hibernatedStateSize = size;
+    NABTO_LOG_TRACE(LOG, "Hibernated the connection in %u bytes", (unsigned int)size);
+    return NABTO_EC_OK;
+#else
+    (void)ctx;
+    return NABTO_EC_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * Load the mbedtls context of a hibernated connection. A connection
+ * which cannot be loaded is closed.
+ *
+ * @return false if the connection could not be loaded.
+ */
+bool wake_connection(struct np_dtls_srv_connection* ctx)
+{
+    if (ctx->hibernatedState == NULL) {
+        return true;
+    }
+    int ret = MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE;
+    uint8_t* state = ctx->hibernatedState;
+    size_t size = ctx->hibernatedStateSize;
+    ctx->hibernatedState = NULL;
+    ctx->hibernatedStateSize = 0;
+#if defined(NM_MBEDTLS_SRV_HIBERNATION)
+    mbedtls_ssl_init(&ctx->ssl);
+    ret = mbedtls_ssl_setup(&ctx->ssl, &ctx->server->conf);
+    if (ret == 0) {
+        mbedtls_ssl_set_timer_cb(&ctx->ssl, &ctx->timer, &nm_mbedtls_timer_set_delay,
+                                 &nm_mbedtls_timer_get_delay);
+        mbedtls_ssl_set_bio(&ctx->ssl, ctx,
+                            &nm_mbedtls_srv_mbedtls_send, &nm_mbedtls_srv_mbedtls_recv, NULL);
+        ret = mbedtls_ssl_context_load(&ctx->ssl, state, size);
+    }
+#endif
+    mbedtls_platform_zeroize(state, size);
+    free(state);
+    if (ret != 0) {
+        NABTO_LOG_ERROR(LOG, "Cannot wake the hibernated connection, mbedtls returned %d", ret);
+        // a freed context is safe to use for close notify and free.
+        mbedtls_ssl_free(&ctx->ssl);
+        if (ctx->state != CLOSING) {
+            ctx->state = CLOSING;
+            deferred_event_callback(ctx, NP_DTLS_SRV_EVENT_CLOSED);
+        }
+        return false;
+    }
+    return true;
+}
+
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+static bool session_expired(struct nm_mbedtls_srv_session* session, uint32_t now)
+{
+    int32_t age = np_timestamp_difference(now, session->created);
+    return (age < 0 || age > NM_MBEDTLS_SRV_SESSION_CACHE_TIMEOUT_MS);
+}
+
+static void session_forget(struct nm_mbedtls_srv_session* session)
+{
+    mbedtls_platform_zeroize(session, sizeof(struct nm_mbedtls_srv_session));
+}
+
+struct nm_mbedtls_srv_session* session_cache_find(struct np_dtls_srv* server, const unsigned char* id, size_t idLen)
+{
+    if (idLen == 0 || idLen > sizeof(server->sessions[0].id)) {
+        return NULL;
+    }
+    uint32_t now = np_timestamp_now_ms(&server->pl->timestamp);
+    size_t i;
+    for (i = 0; i < NM_MBEDTLS_SRV_SESSION_CACHE_SIZE; i++) {
+        struct nm_mbedtls_srv_session* session = &server->sessions[i];
+        if (!session->used || session->idLen != idLen || memcmp(session->id, id, idLen) != 0) {
+            continue;
+        }
+        if (session_expired(session, now)) {
+            session_forget(session);
+            return NULL;
+        }
+        return session;
+    }
+    return NULL;
+}
+
+// Called by mbedtls when a client asks to resume a session, the
+// session has the id and the ciphersuite from the ClientHello.
+int session_cache_get(void* data, mbedtls_ssl_session* session)
+{
+    struct np_dtls_srv* server = data;
+    struct nm_mbedtls_srv_session* cached = session_cache_find(server, session->id, session->id_len);
+    if (cached == NULL ||
+        cached->ciphersuite != session->ciphersuite ||
+        cached->compression != session->compression)
+    {
+        return 1;
+    }
+    memcpy(session->master, cached->master, sizeof(cached->master));
+    session->verify_result = cached->verifyResult;
+    return 0;
+}
+
+// Called by mbedtls when a full handshake has completed.
+int session_cache_set(void* data, const mbedtls_ssl_session* session)
+{
+    struct np_dtls_srv* server = data;
+    if (session->id_len == 0 || session->id_len > sizeof(server->sessions[0].id)) {
+        return 1;
+    }
+    uint32_t now = np_timestamp_now_ms(&server->pl->timestamp);
+    struct nm_mbedtls_srv_session* victim = session_cache_find(server, session->id, session->id_len);
+    size_t i;
+    for (i = 0; victim == NULL && i < NM_MBEDTLS_SRV_SESSION_CACHE_SIZE; i++) {
+        struct nm_mbedtls_srv_session* s = &server->sessions[i];
+        if (!s->used || session_expired(s, now)) {
+            victim = s;
+        }
+    }
+    if (victim == NULL) {
+        // all sessions are in use, replace the oldest.
+        victim = &server->sessions[0];
+        for (i = 1; i < NM_MBEDTLS_SRV_SESSION_CACHE_SIZE; i++) {
+            struct nm_mbedtls_srv_session* s = &server->sessions[i];
+            if (np_timestamp_difference(s->created, victim->created) < 0) {
+                victim = s;
+            }
+        }
+    }
+    session_forget(victim);
+    victim->used = true;
+    victim->created = now;
+    victim->ciphersuite = session->ciphersuite;
+    victim->compression = session->compression;
+    victim->idLen = session->id_len;
+    memcpy(victim->id, session->id, session->id_len);
+    memcpy(victim->master, session->master, sizeof(victim->master));
+    victim->verifyResult = session->verify_result;
+    return 0;
+}
+
+void session_cache_clear(struct np_dtls_srv* server)
+{
+    size_t i;
+    for (i = 0; i < NM_MBEDTLS_SRV_SESSION_CACHE_SIZE; i++) {
+        session_forget(&server->sessions[i]);
+    }
+}
+#endif
+
+np_error_code nm_mbedtls_srv_set_async_pk(struct np_dtls_srv* server, const struct nm_mbedtls_async_pk* asyncPk)
+{
+#if defined(MBEDTLS_SSL_ASYNC_PRIVATE)
+    if (asyncPk == NULL) {
+        memset(&server->asyncPk, 0, sizeof(struct nm_mbedtls_async_pk));
+    } else {
+        server->asyncPk = *asyncPk;
+    }
+    async_pk_configure(server);
+    return NABTO_EC_OK;
+#else
+    (void)server; (void)asyncPk;
+    return NABTO_EC_NOT_IMPLEMENTED;
+#endif
+}
+
+#if defined(MBEDTLS_SSL_ASYNC_PRIVATE)
+void async_pk_configure(struct np_dtls_srv* server)
+{
+    if (server->asyncPk.mptr != NULL && server->privateKeyDerSize > 0) {
+        mbedtls_ssl_conf_async_private_cb(&server->conf, &async_pk_sign, NULL,
+                                          &async_pk_resume, &async_pk_cancel, server);
+    } else {
+        mbedtls_ssl_conf_async_private_cb(&server->conf, NULL, NULL, NULL, NULL, NULL);
+    }
+}
+
+/**
+ * Called by mbedtls when the ServerKeyExchange has to be signed. The
+ * handshake returns MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS until the
+ * signature is ready.
+ */
+int async_pk_sign(mbedtls_ssl_context* ssl, mbedtls_x509_crt* cert,
+                  mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLen)
+{
+    (void)cert;
+    struct np_dtls_srv_connection* ctx = ssl->p_bio;
+    struct np_dtls_srv* server = ctx->server;
+    struct nm_mbedtls_async_pk_job* job;
+    np_error_code ec = server->asyncPk.mptr->sign(server->asyncPk.data,
+                                                  server->privateKeyDer, server->privateKeyDerSize,
+                                                  mdAlg, hash, hashLen,
+                                                  &async_pk_done, ctx, &job);
+    if (ec != NABTO_EC_OK) {
+        // sign on the core thread instead.
+        NABTO_LOG_TRACE(LOG, "Cannot sign asynchronously, %s", np_error_code_to_string(ec));
+        return MBEDTLS_ERR_SSL_HW_ACCEL_FALLTHROUGH;
+    }
+    mbedtls_ssl_set_async_operation_data(ssl, job);
+    return 0;
+}
+
+int async_pk_resume(mbedtls_ssl_context* ssl, unsigned char* output, size_t* outputLen, size_t outputSize)
+{
+    struct np_dtls_srv_connection* ctx = ssl->p_bio;
+    struct np_dtls_srv* server = ctx->server;
+    struct nm_mbedtls_async_pk_job* job = mbedtls_ssl_get_async_operation_data(ssl);
+    int ret;
+    if (job == NULL) {
+        return MBEDTLS_ERR_SSL_INTERNAL_ERROR;
+    }
+    if (!server->asyncPk.mptr->result(job, &ret, output, outputLen, outputSize)) {
+        return MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS;
+    }
+    server->asyncPk.mptr->release(job);
+    mbedtls_ssl_set_async_operation_data(ssl, NULL);
+    return ret;
+}
+
+// Called by mbedtls if the connection is reset or freed while the
+// signature is in progress.
+void async_pk_cancel(mbedtls_ssl_context* ssl)
+{
+    struct np_dtls_srv_connection* ctx = ssl->p_bio;
+    struct np_dtls_srv* server = ctx->server;
+    struct nm_mbedtls_async_pk_job* job = mbedtls_ssl_get_async_operation_data(ssl);
+    if (job != NULL) {
+        server->asyncPk.mptr->release(job);
+        mbedtls_ssl_set_async_operation_data(ssl, NULL);
+    }
+}
+
+// The signature is ready, continue the handshake.
+void async_pk_done(void* data)
+{
+    struct np_dtls_srv_connection* ctx = data;
+    nm_mbedtls_srv_do_one(ctx);
+}
+#endif
+
 np_error_code nm_mbedtls_srv_set_keys(struct np_dtls_srv* server,
                                    const unsigned char* publicKeyL, size_t publicKeySize,
                                    const unsigned char* privateKeyL, size_t privateKeySize)
 {
+    // mbedtls cannot parse a key into a context which has a key, so
+    // the old keys are freed when the keys are replaced.
+    mbedtls_x509_crt_free( &server->publicKey );
+    mbedtls_x509_crt_init( &server->publicKey );
+    mbedtls_pk_free( &server->privateKey );
+    mbedtls_pk_init( &server->privateKey );
     return nm_mbedtls_srv_init_config(server, publicKeyL, publicKeySize, privateKeyL, privateKeySize);
 }
 
@@ -208,54 +913,34 @@ np_error_code nm_mbedtls_srv_create_connection(struct np_dtls_srv* server,
                                             np_dtls_srv_event_handler eventHandler, void* data)
 {
     int ret;
-    struct np_dtls_srv_connection* ctx = (struct np_dtls_srv_connection*)calloc(1, sizeof(struct np_dtls_srv_connection));
-    if(!ctx) {
-        return NABTO_EC_OUT_OF_MEMORY;
-    }
-    ctx->sslRecvBuf = server->pl->buf.allocate();
-    ctx->sslSendBuffer = server->pl->buf.allocate();
-    if (!ctx->sslRecvBuf || !ctx->sslSendBuffer) {
-        free(ctx);
-        return NABTO_EC_OUT_OF_MEMORY;
+    struct np_dtls_srv_connection* ctx;
+    np_error_code ec = pool_alloc(server, &ctx);
+    if (ec != NABTO_EC_OK) {
+        return ec;
     }
+    mbedtls_ssl_init( &ctx->ssl );
     ctx->pl = server->pl;
     ctx->sender = sender;
     ctx->dataHandler = dataHandler;
     ctx->eventHandler = eventHandler;
     ctx->senderData = data;
     ctx->channelId = NP_DTLS_SRV_DEFAULT_CHANNEL_ID;
-    ctx->sending = false;
 
     nn_llist_init(&ctx->sendList);
 
     struct np_platform* pl = ctx->pl;
 
-    np_error_code ec;
-    ec = np_event_queue_create_event(&pl->eq, &nm_mbedtls_srv_start_send_deferred, ctx, &ctx->startSendEvent);
-    if(ec != NABTO_EC_OK) {
-        return ec;
-    }
-
-    ec = np_event_queue_create_event(&pl->eq, &nm_mbedtls_srv_do_event_callback, ctx, &ctx->deferredEventEvent);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
-    ec = np_event_queue_create_event(&pl->eq, &nm_mbedtls_srv_event_close, ctx, &ctx->closeEv);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
-
-    ec = nm_mbedtls_timer_init(&ctx->timer, ctx->pl, &nm_mbedtls_srv_timed_event_do_one, ctx);
-    if (ec != NABTO_EC_OK) {
-        return ec;
-    }
+    np_event_queue_init_event(&pl->eq, &ctx->startSendEvent, &nm_mbedtls_srv_start_send_deferred, ctx);
+    np_event_queue_init_event(&pl->eq, &ctx->deferredEventEvent, &nm_mbedtls_srv_do_event_callback, ctx);
+    np_event_queue_init_event(&pl->eq, &ctx->closeEv, &nm_mbedtls_srv_event_close, ctx);
+    nm_mbedtls_timer_init(&ctx->timer, ctx->pl, &nm_mbedtls_srv_timed_event_do_one, ctx);
 
     NABTO_LOG_TRACE(LOG, "New DTLS srv connection was allocated.");
     //mbedtls connection initialization
-    mbedtls_ssl_init( &ctx->ssl );
     if( ( ret = mbedtls_ssl_setup( &ctx->ssl, &server->conf ) ) != 0 )
     {
         NABTO_LOG_ERROR(LOG, " failed ! mbedtls_ssl_setup returned %d", ret );
+        free_connection_resources(ctx);
         return NABTO_EC_UNKNOWN;
     }
 
@@ -277,6 +962,7 @@ np_error_code nm_mbedtls_srv_create_connection(struct np_dtls_srv* server,
     ret = mbedtls_ssl_set_hs_own_cert(&ctx->ssl, &server->publicKey, &server->privateKey);
     if (ret != 0) {
         NABTO_LOG_ERROR(LOG, "failed ! mbedtls_ssl_set_hs_own_cert returned %d", ret);
+        free_connection_resources(ctx);
         return NABTO_EC_UNKNOWN;
     }
 
@@ -289,7 +975,6 @@ np_error_code nm_mbedtls_srv_create_connection(struct np_dtls_srv* server,
 
 static void nm_mbedtls_srv_destroy_connection(struct np_dtls_srv_connection* connection)
 {
-    struct np_platform* pl = connection->pl;
     struct np_dtls_srv_connection* ctx = connection;
     ctx->state = CLOSING;
     // remove the first element until the list is empty
@@ -300,20 +985,101 @@ static void nm_mbedtls_srv_destroy_connection(struct np_dtls_srv_connection* con
         first->cb(NABTO_EC_CONNECTION_CLOSING, first->data);
     }
     nm_mbedtls_timer_cancel(&ctx->timer);
+    free_connection_resources(ctx);
+}
+
+void free_connection_resources(struct np_dtls_srv_connection* ctx)
+{
+    struct np_event_queue* eq = &ctx->pl->eq;
     nm_mbedtls_timer_deinit(&ctx->timer);
-    struct np_event_queue* eq = &pl->eq;
-    np_event_queue_destroy_event(eq, ctx->closeEv);
-    np_event_queue_destroy_event(eq, ctx->startSendEvent);
-    np_event_queue_destroy_event(eq, ctx->deferredEventEvent);
-    pl->buf.free(connection->sslRecvBuf);
-    pl->buf.free(connection->sslSendBuffer);
-    mbedtls_ssl_free(&connection->ssl);
-    free(connection);
+    np_event_queue_deinit_event(eq, &ctx->closeEv);
+    np_event_queue_deinit_event(eq, &ctx->startSendEvent);
+    np_event_queue_deinit_event(eq, &ctx->deferredEventEvent);
+    if (ctx->hibernatedState != NULL) {
+        mbedtls_platform_zeroize(ctx->hibernatedState, ctx->hibernatedStateSize);
+        free(ctx->hibernatedState);
+        ctx->hibernatedState = NULL;
+    }
+    mbedtls_ssl_free(&ctx->ssl);
+    pool_free(ctx->server, ctx);
+}
+
+np_error_code pool_init(struct np_dtls_srv* server)
+{
+    size_t n = server->maxConnections;
+    server->connections = calloc(n, sizeof(struct np_dtls_srv_connection));
+    server->buffers = calloc(n * NM_MBEDTLS_SRV_BUFFERS_PER_CONNECTION, NM_MBEDTLS_SRV_BUFFER_STRIDE);
+    server->freeConnections = calloc(n, sizeof(struct np_dtls_srv_connection*));
+    if (server->connections == NULL || server->buffers == NULL || server->freeConnections == NULL) {
+        pool_deinit(server);
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+    size_t i;
+    for (i = 0; i < n; i++) {
+        // the first connection in the slab is at the top of the stack.
+        server->freeConnections[i] = &server->connections[n - 1 - i];
+    }
+    server->freeConnectionsSize = n;
+    return NABTO_EC_OK;
+}
+
+void pool_deinit(struct np_dtls_srv* server)
+{
+    free(server->connections);
+    free(server->buffers);
+    free(server->freeConnections);
+    server->connections = NULL;
+    server->buffers = NULL;
+    server->freeConnections = NULL;
+    server->freeConnectionsSize = 0;
+}
+
+np_error_code pool_alloc(struct np_dtls_srv* server, struct np_dtls_srv_connection** connection)
+{
+    if (server->connections == NULL) {
+        np_error_code ec = pool_init(server);
+        if (ec != NABTO_EC_OK) {
+            return ec;
+        }
+    }
+    if (server->freeConnectionsSize == 0) {
+        NABTO_LOG_TRACE(LOG, "The DTLS connection pool is exhausted");
+        return NABTO_EC_OUT_OF_CONNECTIONS;
+    }
+    server->freeConnectionsSize--;
+    struct np_dtls_srv_connection* ctx = server->freeConnections[server->freeConnectionsSize];
+    memset(ctx, 0, sizeof(struct np_dtls_srv_connection));
+    size_t index = (size_t)(ctx - server->connections);
+    uint8_t* buffers = server->buffers + (index * NM_MBEDTLS_SRV_BUFFERS_PER_CONNECTION * NM_MBEDTLS_SRV_BUFFER_STRIDE);
+    ctx->sslRecvBuf = buffers + NP_COMMUNICATION_BUFFER_HEADROOM;
+    size_t b;
+    for (b = 0; b < NM_MBEDTLS_SRV_SEND_QUEUE_DEPTH; b++) {
+        struct nm_mbedtls_srv_send_burst* burst = &ctx->sendBursts[b];
+        burst->connection = ctx;
+        size_t i;
+        for (i = 0; i < NM_MBEDTLS_SRV_SEND_BURST_SIZE; i++) {
+            size_t buffer = 1 + (b * NM_MBEDTLS_SRV_SEND_BURST_SIZE) + i;
+            burst->records[i].buffer = buffers + (buffer * NM_MBEDTLS_SRV_BUFFER_STRIDE) + NP_COMMUNICATION_BUFFER_HEADROOM;
+        }
+    }
+    ctx->pl = server->pl;
+    ctx->server = server;
+    *connection = ctx;
+    return NABTO_EC_OK;
+}
+
+void pool_free(struct np_dtls_srv* server, struct np_dtls_srv_connection* connection)
+{
+    server->freeConnections[server->freeConnectionsSize] = connection;
+    server->freeConnectionsSize++;
 }
 
 np_error_code nm_mbedtls_srv_handle_packet(struct np_platform* pl, struct np_dtls_srv_connection*ctx,
                                         uint8_t channelId, uint8_t* buffer, uint16_t bufferSize)
 {
+    if (!wake_connection(ctx)) {
+        return NABTO_EC_UNKNOWN;
+    }
     ctx->currentChannelId = channelId;
     ctx->recvBuffer = buffer;
     ctx->recvBufferSize = bufferSize;
@@ -334,7 +1100,8 @@ void nm_mbedtls_srv_do_one(void* data)
         int ret;
         ret = mbedtls_ssl_handshake( &ctx->ssl );
         if (ret == MBEDTLS_ERR_SSL_WANT_READ ||
-            ret == MBEDTLS_ERR_SSL_WANT_WRITE)
+            ret == MBEDTLS_ERR_SSL_WANT_WRITE ||
+            ret == MBEDTLS_ERR_SSL_ASYNC_IN_PROGRESS)
         {
             // keep state as CONNECTING
         } else if (ret == MBEDTLS_ERR_SSL_TIMEOUT) {
@@ -344,6 +1111,8 @@ void nm_mbedtls_srv_do_one(void* data)
         } else if (ret == 0) {
             NABTO_LOG_TRACE(LOG, "State changed to DATA");
 
+            save_peer_fingerprint(ctx);
+            release_handshake_state(ctx);
             ctx->state = DATA;
             deferred_event_callback(ctx, NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE);
         } else {
@@ -351,11 +1120,10 @@ void nm_mbedtls_srv_do_one(void* data)
             nm_mbedtls_timer_cancel(&ctx->timer);
             ctx->state = CLOSING;
             deferred_event_callback(ctx, NP_DTLS_SRV_EVENT_CLOSED);
-            return;
         }
     } else if (ctx->state == DATA) {
         int ret;
-        ret = mbedtls_ssl_read(&ctx->ssl, ctx->pl->buf.start(ctx->sslRecvBuf), ctx->pl->buf.size(ctx->sslRecvBuf) );
+        ret = mbedtls_ssl_read(&ctx->ssl, ctx->sslRecvBuf, NM_MBEDTLS_SRV_BUFFER_SIZE );
         if (ret == 0) {
             // EOF
             ctx->state = CLOSING;
@@ -363,8 +1131,9 @@ void nm_mbedtls_srv_do_one(void* data)
         } else if (ret > 0) {
             uint64_t seq = *((uint64_t*)ctx->ssl.in_ctr);
             ctx->recvCount++;
+            nm_mbedtls_srv_flush_send_records(ctx);
             ctx->dataHandler(ctx->currentChannelId, seq,
-                             pl->buf.start(ctx->sslRecvBuf), ret, ctx->senderData);
+                             ctx->sslRecvBuf, ret, ctx->senderData);
             return;
         } else if (ret == MBEDTLS_ERR_SSL_WANT_READ ||
                    ret == MBEDTLS_ERR_SSL_WANT_WRITE)
@@ -380,21 +1149,23 @@ void nm_mbedtls_srv_do_one(void* data)
             deferred_event_callback(ctx, NP_DTLS_SRV_EVENT_CLOSED);
         }
     }
+    // hand records written by the handshake or the read to the network.
+    nm_mbedtls_srv_flush_send_records(ctx);
 }
 
 void deferred_event_callback(struct np_dtls_srv_connection* ctx, enum np_dtls_srv_event event)
 {
     struct np_platform* pl = ctx->pl;
     ctx->deferredEvent = event;
-    np_event_queue_post(&pl->eq, ctx->deferredEventEvent);
+    np_event_queue_post(&pl->eq, &ctx->deferredEventEvent);
 }
 
 void nm_mbedtls_srv_do_event_callback(void* data)
 {
     struct np_dtls_srv_connection* ctx = data;
-    if (ctx->state == CLOSING && ctx->sending) {
+    if (ctx->state == CLOSING && ctx->sendingBursts > 0) {
 
-        np_event_queue_post(&ctx->pl->eq, ctx->deferredEventEvent);
+        np_event_queue_post(&ctx->pl->eq, &ctx->deferredEventEvent);
     } else {
         ctx->eventHandler(ctx->deferredEvent, ctx->senderData);
     }
@@ -402,42 +1173,63 @@ void nm_mbedtls_srv_do_event_callback(void* data)
 
 void nm_mbedtls_srv_start_send(struct np_dtls_srv_connection* ctx)
 {
-    np_event_queue_post_maybe_double(&ctx->pl->eq, ctx->startSendEvent);
+    np_event_queue_post_maybe_double(&ctx->pl->eq, &ctx->startSendEvent);
 }
 
 void nm_mbedtls_srv_start_send_deferred(void* data)
 {
     struct np_dtls_srv_connection* ctx = (struct np_dtls_srv_connection*) data;
-    if (ctx->sending) {
-        return;
-    }
 
-    if (nn_llist_empty(&ctx->sendList)) {
-        // empty send queue
+    if (!nn_llist_empty(&ctx->sendList) && !wake_connection(ctx)) {
+        // the queued records are failed when the connection is destroyed.
         return;
     }
 
-    struct nn_llist_iterator it = nn_llist_begin(&ctx->sendList);
-    struct np_dtls_srv_send_context* next = nn_llist_get_item(&it);
-    nn_llist_erase(&it);
-
-    ctx->channelId = next->channelId;
-    int ret = mbedtls_ssl_write( &ctx->ssl, (unsigned char *) next->buffer, next->bufferSize );
-    ctx->channelId = NP_DTLS_SRV_DEFAULT_CHANNEL_ID;
-    if (next->cb == NULL) {
-        ctx->sentCount++;
-    } else if (ret == MBEDTLS_ERR_SSL_BAD_INPUT_DATA) {
-        // packet too large
-        NABTO_LOG_ERROR(LOG, "ssl_write failed with: %i (Packet too large)", ret);
-        next->cb(NABTO_EC_MALFORMED_PACKET, next->data);
-    } else if (ret < 0) {
-        // unknown error
-        NABTO_LOG_ERROR(LOG, "ssl_write failed with: %i", ret);
-        next->cb(NABTO_EC_UNKNOWN, next->data);
-    } else {
-        ctx->sentCount++;
-        next->cb(NABTO_EC_OK, next->data);
+    // Encrypt queued records into bursts for a single channel. A full
+    // burst is given to the sender and the next burst is filled while
+    // it is in flight.
+    size_t records = 0;
+    while (!nn_llist_empty(&ctx->sendList)) {
+        struct nm_mbedtls_srv_send_burst* burst = &ctx->sendBursts[ctx->sendBurst];
+        if (burst->sending) {
+            // all bursts are in flight, the send callback continues.
+            break;
+        }
+        if (records == NM_MBEDTLS_SRV_MAX_RECORDS_PER_TURN) {
+            // let the other events run before the rest is sent.
+            nm_mbedtls_srv_start_send(ctx);
+            break;
+        }
+        struct nn_llist_iterator it = nn_llist_begin(&ctx->sendList);
+        struct np_dtls_srv_send_context* next = nn_llist_get_item(&it);
+        if (burst->recordsSize == NM_MBEDTLS_SRV_SEND_BURST_SIZE ||
+            (burst->recordsSize > 0 && next->channelId != burst->channelId))
+        {
+            nm_mbedtls_srv_flush_send_records(ctx);
+            continue;
+        }
+        nn_llist_erase(&it);
+        records++;
+
+        ctx->channelId = next->channelId;
+        int ret = mbedtls_ssl_write( &ctx->ssl, (unsigned char *) next->buffer, next->bufferSize );
+        ctx->channelId = NP_DTLS_SRV_DEFAULT_CHANNEL_ID;
+        if (next->cb == NULL) {
+            ctx->sentCount++;
+        } else if (ret == MBEDTLS_ERR_SSL_BAD_INPUT_DATA) {
+            // packet too large
+            NABTO_LOG_ERROR(LOG, "ssl_write failed with: %i (Packet too large)", ret);
+            next->cb(NABTO_EC_MALFORMED_PACKET, next->data);
+        } else if (ret < 0) {
+            // unknown error
+            NABTO_LOG_ERROR(LOG, "ssl_write failed with: %i", ret);
+            next->cb(NABTO_EC_UNKNOWN, next->data);
+        } else {
+            ctx->sentCount++;
+            next->cb(NABTO_EC_OK, next->data);
+        }
     }
+    nm_mbedtls_srv_flush_send_records(ctx);
 }
 
 np_error_code nm_mbedtls_srv_async_send_data(struct np_platform* pl, struct np_dtls_srv_connection* ctx,
@@ -453,14 +1245,14 @@ np_error_code nm_mbedtls_srv_async_send_data(struct np_platform* pl, struct np_d
 
 void nm_mbedtls_srv_event_close(void* data){
     struct np_dtls_srv_connection* ctx = (struct np_dtls_srv_connection*) data;
-    if (ctx->sending) {
-        np_event_queue_post(&ctx->pl->eq, ctx->closeEv);
+    if (ctx->sendingBursts > 0) {
+        np_event_queue_post(&ctx->pl->eq, &ctx->closeEv);
         return;
     }
     nm_mbedtls_timer_cancel(&ctx->timer);
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->closeEv);
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->startSendEvent);
-    np_event_queue_cancel_event(&ctx->pl->eq, ctx->deferredEventEvent);
+    np_event_queue_cancel_event(&ctx->pl->eq, &ctx->closeEv);
+    np_event_queue_cancel_event(&ctx->pl->eq, &ctx->startSendEvent);
+    np_event_queue_cancel_event(&ctx->pl->eq, &ctx->deferredEventEvent);
 
     np_dtls_close_callback cb = ctx->closeCb;
     void* cbData = ctx->closeCbData;
@@ -478,9 +1270,12 @@ np_error_code nm_mbedtls_srv_async_close(struct np_platform* pl, struct np_dtls_
     }
     ctx->closeCb = cb;
     ctx->closeCbData = data;
+    // if the connection cannot be woken it is closed without a close notify.
+    wake_connection(ctx);
     ctx->state = CLOSING;
     mbedtls_ssl_close_notify(&ctx->ssl);
-    np_event_queue_post(&ctx->pl->eq, ctx->closeEv);
+    nm_mbedtls_srv_flush_send_records(ctx);
+    np_event_queue_post(&ctx->pl->eq, &ctx->closeEv);
     return NABTO_EC_OK;
 }
 
@@ -526,8 +1321,10 @@ np_error_code nm_mbedtls_srv_init_config(struct np_dtls_srv* server,
         return NABTO_EC_UNKNOWN;
     }
 
+    // mbedtls is built with MBEDTLS_SSL_SRV_RESPECT_CLIENT_PREFERENCE,
+    // the first suite in the ClientHello which is in this list is used.
     mbedtls_ssl_conf_ciphersuites(&server->conf,
-                                  allowedCipherSuitesList);
+                                  nm_dtls_util_ciphersuites());
 
     mbedtls_ssl_conf_alpn_protocols(&server->conf, nm_mbedtls_srv_alpnList );
 
@@ -551,6 +1348,12 @@ np_error_code nm_mbedtls_srv_init_config(struct np_dtls_srv* server,
         return NABTO_EC_UNKNOWN;
     }
 
+    np_error_code ec = nm_dtls_util_fp_from_crt(&server->publicKey, server->fingerprint);
+    if (ec != NABTO_EC_OK) {
+        NABTO_LOG_ERROR(LOG, "Cannot get the fingerprint of the public key");
+        return ec;
+    }
+
     ret =  mbedtls_pk_parse_key( &server->privateKey, (const unsigned char*)privateKeyL, privateKeySize+1, NULL, 0 );
     if( ret != 0 )
     {
@@ -563,8 +1366,37 @@ np_error_code nm_mbedtls_srv_init_config(struct np_dtls_srv* server,
         NABTO_LOG_ERROR(LOG,"mbedtls_ssl_conf_own_cert returned %d", ret);
         return NABTO_EC_UNKNOWN;
     }
-#if defined(MBEDTLS_SSL_DTLS_HELLO_VERIFY)
-    mbedtls_ssl_conf_dtls_cookies(&server->conf, NULL, NULL, NULL);
+
+#if defined(MBEDTLS_SSL_ASYNC_PRIVATE)
+    // The async pk implementation gets the key in DER, which
+    // mbedtls_pk_write_key_der writes at the end of the buffer.
+    mbedtls_platform_zeroize(server->privateKeyDer, sizeof(server->privateKeyDer));
+    server->privateKeyDerSize = 0;
+    ret = mbedtls_pk_write_key_der(&server->privateKey, server->privateKeyDer, sizeof(server->privateKeyDer));
+    if (ret > 0) {
+        memmove(server->privateKeyDer, server->privateKeyDer + sizeof(server->privateKeyDer) - ret, ret);
+        server->privateKeyDerSize = (size_t)ret;
+    } else {
+        NABTO_LOG_ERROR(LOG, "mbedtls_pk_write_key_der returned %d, signing on the core thread", ret);
+    }
+    async_pk_configure(server);
+#endif
+    // The cookies are checked by verify_client_hello before a
+    // connection is created, mbedtls checks them again with the same
+    // key when the connection handles the ClientHello.
+    mbedtls_ssl_cookie_free( &server->cookie );
+    mbedtls_ssl_cookie_init( &server->cookie );
+    if( ( ret = mbedtls_ssl_cookie_setup( &server->cookie, mbedtls_ctr_drbg_random, &server->ctr_drbg ) ) != 0 )
+    {
+        NABTO_LOG_ERROR(LOG, "mbedtls_ssl_cookie_setup returned %d", ret);
+        return NABTO_EC_UNKNOWN;
+    }
+    mbedtls_ssl_conf_dtls_cookies(&server->conf, mbedtls_ssl_cookie_write, mbedtls_ssl_cookie_check, &server->cookie);
+
+#if NM_MBEDTLS_SRV_SESSION_CACHE_SIZE > 0
+    // sessions established with the old keys are not resumed.
+    session_cache_clear(server);
+    mbedtls_ssl_conf_session_cache(&server->conf, server, &session_cache_get, &session_cache_set);
 #endif
 
     mbedtls_ssl_conf_handshake_timeout(&server->conf, 1000, 16000);
@@ -576,35 +1408,65 @@ np_error_code nm_mbedtls_srv_init_config(struct np_dtls_srv* server,
 int nm_mbedtls_srv_mbedtls_send(void* data, const unsigned char* buffer, size_t bufferSize)
 {
     struct np_dtls_srv_connection* ctx = (struct np_dtls_srv_connection*) data;
-    struct np_platform* pl = ctx->pl;
-    if (!ctx->sending) {
-        memcpy(ctx->pl->buf.start(ctx->sslSendBuffer), buffer, bufferSize);
-        ctx->sslSendBufferSize = bufferSize;
-        ctx->sending = true;
-        np_error_code ec = ctx->sender(ctx->channelId, pl->buf.start(ctx->sslSendBuffer), bufferSize, &nm_mbedtls_srv_connection_send_callback, ctx, ctx->senderData);
-        if (ec != NABTO_EC_OK) {
-            ctx->sending = false;
-            ctx->sslSendBufferSize = 0;
-            return MBEDTLS_ERR_SSL_WANT_WRITE;
-        }
-        return bufferSize;
-    } else {
+    struct nm_mbedtls_srv_send_burst* burst = &ctx->sendBursts[ctx->sendBurst];
+    if (!burst->sending &&
+        (burst->recordsSize == NM_MBEDTLS_SRV_SEND_BURST_SIZE ||
+         (burst->recordsSize > 0 && burst->channelId != ctx->channelId)))
+    {
+        // a burst only contains records for a single channel, give it
+        // to the sender and continue in the next burst.
+        nm_mbedtls_srv_flush_send_records(ctx);
+        burst = &ctx->sendBursts[ctx->sendBurst];
+    }
+    if (burst->sending) {
         return MBEDTLS_ERR_SSL_WANT_WRITE;
     }
+    // The record is copied into the burst and given to the sender when
+    // the burst is flushed.
+    struct np_dtls_srv_record* record = &burst->records[burst->recordsSize];
+    memcpy(record->buffer, buffer, bufferSize);
+    record->bufferSize = (uint16_t)bufferSize;
+    if (burst->recordsSize == 0) {
+        burst->channelId = ctx->channelId;
+    }
+    burst->recordsSize++;
+    return bufferSize;
+}
+
+void nm_mbedtls_srv_flush_send_records(struct np_dtls_srv_connection* ctx)
+{
+    struct nm_mbedtls_srv_send_burst* burst = &ctx->sendBursts[ctx->sendBurst];
+    if (burst->sending || burst->recordsSize == 0) {
+        return;
+    }
+    burst->sending = true;
+    ctx->sendingBursts++;
+    ctx->sendBurst = (ctx->sendBurst + 1) % NM_MBEDTLS_SRV_SEND_QUEUE_DEPTH;
+    np_error_code ec = ctx->sender(burst->channelId, burst->records, burst->recordsSize, &nm_mbedtls_srv_connection_send_callback, burst, ctx->senderData);
+    if (ec != NABTO_EC_OK) {
+        // The records are lost like any other udp packet, DTLS and the
+        // upper layers takes care of retransmissions.
+        NABTO_LOG_TRACE(LOG, "Dropping %d records, sender failed with %s", (int)burst->recordsSize, np_error_code_to_string(ec));
+        burst->sending = false;
+        burst->recordsSize = 0;
+        ctx->sendingBursts--;
+    }
 }
 
 void nm_mbedtls_srv_connection_send_callback(const np_error_code ec, void* data)
 {
-    struct np_dtls_srv_connection* ctx = (struct np_dtls_srv_connection*) data;
+    struct nm_mbedtls_srv_send_burst* burst = data;
     if (data == NULL) {
         return;
     }
-    ctx->sending = false;
+    struct np_dtls_srv_connection* ctx = burst->connection;
+    burst->sending = false;
+    burst->recordsSize = 0;
+    ctx->sendingBursts--;
     if (ec != NABTO_EC_OK) {
         NABTO_LOG_ERROR(LOG, "Connection Async Send failed with code: %u", ec);
         return;
     }
-    ctx->sslSendBufferSize = 0;
     if(ctx->state == CLOSING) {
         return;
     }
@@ -8,8 +8,20 @@
 extern "C" {
 #endif
 
+struct nm_mbedtls_async_pk;
+
 np_error_code nm_mbedtls_srv_init(struct np_platform* pl);
 
+/**
+ * Make the private key signatures of handshakes with an async pk
+ * implementation, e.g. a pool of worker threads, such that the core
+ * thread is not blocked while the signatures are made. NULL makes the
+ * signatures on the core thread again.
+ *
+ * @return NABTO_EC_NOT_IMPLEMENTED if mbedtls is built without MBEDTLS_SSL_ASYNC_PRIVATE.
+ */
+np_error_code nm_mbedtls_srv_set_async_pk(struct np_dtls_srv* server, const struct nm_mbedtls_async_pk* asyncPk);
+
 #ifdef __cplusplus
 } //extern "C"
 #endif
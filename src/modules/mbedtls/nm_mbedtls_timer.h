@@ -12,7 +12,7 @@ struct nm_mbedtls_timer {
     struct np_platform* pl;
     uint32_t intermediateTp;
     uint32_t finalTp;
-    struct np_event* tEv;
+    struct np_event tEv;
     nm_mbedtls_timer_callback cb;
     void* cbData;
 };
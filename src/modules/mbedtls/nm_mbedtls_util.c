@@ -11,6 +11,8 @@
 #include "mbedtls/x509_crt.h"
 #include "mbedtls/x509_csr.h"
 #include "mbedtls/sha256.h"
+#include "mbedtls/ssl_ciphersuites.h"
+#include "mbedtls/aesni.h"
 #include <string.h>
 
 np_error_code nm_dtls_util_fp_from_crt(const mbedtls_x509_crt* crt, uint8_t* hash)
@@ -26,6 +28,48 @@ np_error_code nm_dtls_util_fp_from_crt(const mbedtls_x509_crt* crt, uint8_t* has
     return NABTO_EC_OK;
 }
 
+#if defined(MBEDTLS_GCM_C)
+#define NM_DTLS_UTIL_GCM MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256,
+#else
+#define NM_DTLS_UTIL_GCM
+#endif
+
+#if defined(MBEDTLS_CHACHAPOLY_C)
+#define NM_DTLS_UTIL_CHACHAPOLY MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256,
+#else
+#define NM_DTLS_UTIL_CHACHAPOLY
+#endif
+
+static const int aesFirstCiphersuites[] = {
+    NM_DTLS_UTIL_GCM
+    NM_DTLS_UTIL_CHACHAPOLY
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM,
+    0
+};
+
+static const int chachaFirstCiphersuites[] = {
+    NM_DTLS_UTIL_CHACHAPOLY
+    NM_DTLS_UTIL_GCM
+    MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_CCM,
+    0
+};
+
+const int* nm_dtls_util_ciphersuites(void)
+{
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    if (mbedtls_aesni_has_support(MBEDTLS_AESNI_AES) && mbedtls_aesni_has_support(MBEDTLS_AESNI_CLMUL)) {
+        return aesFirstCiphersuites;
+    }
+    return chachaFirstCiphersuites;
+#elif defined(MBEDTLS_AESCE_C) && defined(__ARM_FEATURE_CRYPTO)
+    // mbedtls uses the ARMv8 crypto extension for AES, without it GCM
+    // is slower than ChaCha20-Poly1305.
+    return aesFirstCiphersuites;
+#else
+    return chachaFirstCiphersuites;
+#endif
+}
+
 struct crt_from_private_key {
     mbedtls_pk_context key;
     mbedtls_entropy_context entropy;
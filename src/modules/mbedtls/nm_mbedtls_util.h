@@ -21,6 +21,13 @@ typedef struct nm_dtls_util_connection_ctx nm_dtls_util_connection_ctx;
 
 np_error_code nm_dtls_util_fp_from_crt(const mbedtls_x509_crt* crt, uint8_t* fp);
 
+/**
+ * The DTLS ciphersuites in the order of preference, zero terminated.
+ * AES-GCM is preferred if mbedtls uses the AES instructions of the
+ * cpu, else ChaCha20-Poly1305. AES-CCM is last for peers which only has that.
+ */
+const int* nm_dtls_util_ciphersuites(void);
+
 np_error_code nm_dtls_create_crt_from_private_key(const char* privateKey, char** crt);
 
 /**
@@ -27,6 +27,8 @@ struct np_udp_socket {
 
     struct nn_llist_node udpSocketsNode;
     bool aborted;
+    // set if the kernel rejected UDP_SEGMENT, then batches are sent with sendmmsg.
+    bool gsoDisabled;
     struct nm_select_unix_udp_recv_wait_context recv;
 };
 
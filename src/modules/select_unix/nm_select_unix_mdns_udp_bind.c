@@ -5,8 +5,8 @@
 #include <platform/np_completion_event.h>
 
 #include <modules/mdns/nm_mdns_udp_bind.h>
+#include <modules/unix/nm_unix_mdns.h>
 
-#include <stdlib.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -14,9 +14,6 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <arpa/inet.h>
-#include <net/if.h>
-#include <ifaddrs.h>
 
 #define LOG NABTO_LOG_MODULE_UDP
 
@@ -24,10 +21,6 @@ static void nm_select_unix_async_bind_mdns_ipv4(struct np_udp_socket* sock, stru
 static void nm_select_unix_async_bind_mdns_ipv6(struct np_udp_socket* sock, struct np_completion_event* completionEvent);
 static np_error_code create_socket_ipv6(struct np_udp_socket* s);
 static np_error_code create_socket_ipv4(struct np_udp_socket* s);
-static bool init_mdns_ipv6_socket(int sock);
-static bool init_mdns_ipv4_socket(int sock);
-static void mdns_update_ipv4_socket_registration(int sock);
-static void mdns_update_ipv6_socket_registration(int sock);
 
 
 static struct nm_mdns_udp_bind_functions module = {
@@ -58,13 +51,11 @@ np_error_code nm_select_unix_async_bind_mdns_ipv4_ec(struct np_udp_socket* sock)
         return ec;
     }
 
-    if (!init_mdns_ipv4_socket(sock->sock)) {
+    if (!nm_unix_mdns_setup_ipv4_socket(sock->sock)) {
         close(sock->sock);
         return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
     }
 
-    mdns_update_ipv4_socket_registration(sock->sock);
-
     return NABTO_EC_OK;
 }
 
@@ -86,20 +77,11 @@ np_error_code nm_select_unix_async_bind_mdns_ipv6_ec(struct np_udp_socket* sock)
         return ec;
     }
 
-    int no = 0;
-    int status = setsockopt(sock->sock, IPPROTO_IPV6, IPV6_V6ONLY, (void* ) &no, sizeof(no));
-    if (status < 0)
-    {
-        NABTO_LOG_ERROR(LOG, "Cannot set IPV6_V6ONLY");
-    }
-
-    if (!init_mdns_ipv6_socket(sock->sock)) {
+    if (!nm_unix_mdns_setup_ipv6_socket(sock->sock)) {
         close(sock->sock);
         return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
     }
 
-    mdns_update_ipv6_socket_registration(sock->sock);
-
     return NABTO_EC_OK;
 }
 
@@ -117,12 +99,6 @@ np_error_code create_socket_ipv6(struct np_udp_socket* s)
         return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
     }
 
-    int no = 0;
-    int status = setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (void* ) &no, sizeof(no));
-    if (status < 0) {
-        NABTO_LOG_ERROR(LOG, "Cannot set IPV6_V6ONLY");
-    }
-
     s->type = NABTO_IPV6;
     s->sock = sock;
     return NABTO_EC_OK;
@@ -139,136 +115,3 @@ np_error_code create_socket_ipv4(struct np_udp_socket* s)
     s->sock = sock;
     return NABTO_EC_OK;
 }
-
-bool init_mdns_ipv6_socket(int sock)
-{
-    int reuse = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0) {
-        return false;
-    }
-
-#ifdef SO_REUSEPORT
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0) {
-        return false;
-    }
-#endif
-
-    struct sockaddr_in6 si_me;
-    memset(&si_me, 0, sizeof(si_me));
-    si_me.sin6_family = AF_INET6;
-    si_me.sin6_port = htons(5353);
-    si_me.sin6_addr = in6addr_any;
-    if (bind(sock, (struct sockaddr*)&si_me, sizeof(si_me)) < 0) {
-        NABTO_LOG_INFO(LOG, "bind mdns ipv6 failed (%d) %s", errno, strerror(errno));
-        return false;
-    }
-
-    struct ipv6_mreq group;
-    memset(&group, 0, sizeof(struct ipv6_mreq));
-    inet_pton(AF_INET6, "ff02::fb", &group.ipv6mr_multiaddr);
-    group.ipv6mr_interface = 0;
-    int status = setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char *)&group, sizeof(struct ipv6_mreq));
-    if (status < 0) {
-        NABTO_LOG_ERROR(LOG, "Cannot add ipv6 default membership %d", errno);
-    }
-
-    return true;
-}
-
-
-bool init_mdns_ipv4_socket(int sock)
-{
-    int reuse = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse)) < 0) {
-        return false;
-    }
-
-#ifdef SO_REUSEPORT
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char*)&reuse, sizeof(reuse)) < 0) {
-        return false;
-    }
-#endif
-
-    struct sockaddr_in si_me;
-    memset(&si_me, 0, sizeof(si_me));
-    si_me.sin_family = AF_INET;
-    si_me.sin_port = htons(5353);
-    si_me.sin_addr.s_addr = INADDR_ANY;
-    if (bind(sock, (struct sockaddr*)&si_me, sizeof(si_me)) < 0) {
-        return false;
-    }
-
-    struct ip_mreq group;
-    memset(&group, 0, sizeof(struct ip_mreq));
-    group.imr_multiaddr.s_addr = inet_addr("224.0.0.251");
-    group.imr_interface.s_addr = INADDR_ANY;
-    int status = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&group, sizeof(group));
-    if (status < 0) {
-        NABTO_LOG_ERROR(LOG, "Cannot add ipv4 default membership %d", errno);
-    }
-
-    return true;
-}
-
-void mdns_update_ipv4_socket_registration(int sock)
-{
-    struct ifaddrs* interfaces = NULL;
-    if (getifaddrs(&interfaces) == 0) {
-
-        struct ifaddrs* iterator = interfaces;
-        while (iterator != NULL) {
-            if (iterator->ifa_addr != NULL) {
-                struct ip_mreqn group;
-                memset(&group, 0, sizeof(struct ip_mreq));
-                group.imr_multiaddr.s_addr = inet_addr("224.0.0.251");
-                //struct sockaddr_in* in = (struct sockaddr_in*)iterator->ifa_addr;
-                int index = if_nametoindex(iterator->ifa_name);
-                group.imr_ifindex = index;
-                int status = setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&group, sizeof(group));
-                if (status < 0) {
-                    if (errno == EADDRINUSE) {
-                        // ok probable already registered
-                    } else {
-                        NABTO_LOG_TRACE(LOG, "Cannot add ipv4 membership %d interface %s", errno, iterator->ifa_name);
-                    }
-                }
-
-            }
-
-            iterator = iterator->ifa_next;
-        }
-        freeifaddrs(interfaces);
-    }
-}
-
-void mdns_update_ipv6_socket_registration(int sock)
-{
-    struct ifaddrs* interfaces = NULL;
-    if (getifaddrs(&interfaces) == 0) {
-
-        struct ifaddrs* iterator = interfaces;
-        while (iterator != NULL) {
-            if (iterator->ifa_addr != NULL)
-            {
-                int index = if_nametoindex(iterator->ifa_name);
-
-                struct ipv6_mreq group;
-                memset(&group, 0, sizeof(struct ipv6_mreq));
-                inet_pton(AF_INET6, "ff02::fb", &group.ipv6mr_multiaddr);
-                group.ipv6mr_interface = index;
-                int status = setsockopt(sock, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char *)&group, sizeof(struct ipv6_mreq));
-                if (status < 0) {
-                    if (errno == EADDRINUSE) {
-                        // some interface indexes occurs more than
-                        // once, the interface can only be joined for
-                        // a multicast group once for each socket.
-                    } else {
-                        NABTO_LOG_TRACE(LOG, "Cannot add ipv6 membership %d interface name %s", errno, iterator->ifa_name);
-                    }
-                }
-            }
-            iterator = iterator->ifa_next;
-        }
-        freeifaddrs(interfaces);
-    }
-}
@@ -1,5 +1,7 @@
 #include "nm_select_unix_udp.h"
 
+#include <modules/unix/nm_unix_udp.h>
+
 #include <platform/np_logging.h>
 #include <platform/np_util.h>
 #include <platform/np_completion_event.h>
@@ -31,16 +33,19 @@ static np_error_code nm_select_unix_udp_create(struct np_udp* obj, struct np_udp
 static void nm_select_unix_udp_destroy(struct np_udp_socket* sock);
 static void nm_select_unix_udp_abort(struct np_udp_socket* sock);
 static void nm_select_unix_udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+static void nm_select_unix_udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
 static void nm_select_unix_udp_async_send_to(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
                                              uint8_t* buffer, uint16_t bufferSize,
                                              struct np_completion_event* completionEvent);
+static void nm_select_unix_udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                                struct np_completion_event* completionEvent);
 static void nm_select_unix_udp_async_recv_wait(struct np_udp_socket* socket, struct np_completion_event* completionEvent);
 static np_error_code nm_select_unix_udp_recv_from(struct np_udp_socket* socket, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength);
+static np_error_code nm_select_unix_udp_recv_batch(struct np_udp_socket* socket, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received);
 static uint16_t nm_select_unix_udp_get_local_port(struct np_udp_socket* socket);
 
-static np_error_code udp_send_to(struct np_udp_socket* s, const struct np_udp_endpoint* ep, const uint8_t* buffer, uint16_t bufferSize);
-static np_error_code udp_recv_from(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength);
 static np_error_code bind_port(struct np_udp_socket* s, uint16_t port);
+static np_error_code set_reuse_port(struct np_udp_socket* s);
 static uint16_t get_local_port(struct np_udp_socket* s);
 static np_error_code create_socket_any(struct np_udp_socket* s);
 
@@ -51,9 +56,12 @@ static struct np_udp_functions module = {
     .destroy          = &nm_select_unix_udp_destroy,
     .abort            = &nm_select_unix_udp_abort,
     .async_bind_port  = &nm_select_unix_udp_async_bind_port,
+    .async_bind_port_shared = &nm_select_unix_udp_async_bind_port_shared,
     .async_send_to    = &nm_select_unix_udp_async_send_to,
+    .async_send_batch = &nm_select_unix_udp_async_send_batch,
     .async_recv_wait  = &nm_select_unix_udp_async_recv_wait,
     .recv_from        = &nm_select_unix_udp_recv_from,
+    .recv_batch       = &nm_select_unix_udp_recv_batch,
     .get_local_port   = &nm_select_unix_udp_get_local_port
 };
 
@@ -90,7 +98,7 @@ np_error_code nm_select_unix_udp_create(struct np_udp* obj, struct np_udp_socket
     return NABTO_EC_OK;
 }
 
-np_error_code nm_select_unix_udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port)
+np_error_code nm_select_unix_udp_async_bind_port_ec(struct np_udp_socket* sock, uint16_t port, bool shared)
 {
     if (sock->aborted) {
         NABTO_LOG_ERROR(LOG, "bind called on aborted socket");
@@ -104,17 +112,29 @@ np_error_code nm_select_unix_udp_async_bind_port_ec(struct np_udp_socket* sock,
         return ec;
     }
 
-    ec = bind_port(sock, port);
+    if (shared) {
+        ec = set_reuse_port(sock);
+    }
+    if (ec == NABTO_EC_OK) {
+        ec = bind_port(sock, port);
+    }
     if (ec != NABTO_EC_OK) {
         close(sock->sock);
+        sock->sock = -1;
     }
 
-    return NABTO_EC_OK;
+    return ec;
 }
 
 void nm_select_unix_udp_async_bind_port(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
 {
-    np_error_code ec = nm_select_unix_udp_async_bind_port_ec(sock, port);
+    np_error_code ec = nm_select_unix_udp_async_bind_port_ec(sock, port, false);
+    np_completion_event_resolve(completionEvent, ec);
+}
+
+void nm_select_unix_udp_async_bind_port_shared(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
+{
+    np_error_code ec = nm_select_unix_udp_async_bind_port_ec(sock, port, true);
     np_completion_event_resolve(completionEvent, ec);
 }
 
@@ -127,7 +147,7 @@ np_error_code nm_select_unix_udp_async_send_to_ec(struct np_udp_socket* sock, st
         return NABTO_EC_ABORTED;
     }
 
-    np_error_code ec = udp_send_to(sock, ep, buffer, bufferSize);
+    np_error_code ec = nm_unix_udp_send_to(sock->sock, sock->type, ep, buffer, bufferSize);
     if (ec != NABTO_EC_OK) {
         return ec;
     }
@@ -142,6 +162,18 @@ void nm_select_unix_udp_async_send_to(struct np_udp_socket* sock, struct np_udp_
     np_completion_event_resolve(completionEvent, ec);
 }
 
+void nm_select_unix_udp_async_send_batch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                         struct np_completion_event* completionEvent)
+{
+    np_error_code ec;
+    if (sock->aborted) {
+        NABTO_LOG_ERROR(LOG, "send batch called on aborted socket");
+        ec = NABTO_EC_ABORTED;
+    } else {
+        ec = nm_unix_udp_send_batch(sock->sock, sock->type, &sock->gsoDisabled, entries, entriesSize);
+    }
+    np_completion_event_resolve(completionEvent, ec);
+}
 
 void nm_select_unix_udp_async_recv_wait(struct np_udp_socket* sock,
                                         struct np_completion_event* completionEvent)
@@ -165,7 +197,12 @@ void nm_select_unix_udp_async_recv_wait(struct np_udp_socket* sock,
 
 np_error_code nm_select_unix_udp_recv_from(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength)
 {
-    return udp_recv_from(sock, ep, buffer, bufferSize, readLength);
+    return nm_unix_udp_recv_from(sock->sock, sock->type, ep, buffer, bufferSize, readLength);
+}
+
+np_error_code nm_select_unix_udp_recv_batch(struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    return nm_unix_udp_recv_batch(sock->sock, sock->type, entries, entriesSize, received);
 }
 
 uint16_t nm_select_unix_udp_get_local_port(struct np_udp_socket* sock)
@@ -265,98 +302,6 @@ int nm_select_unix_udp_nonblocking_socket(int domain, int type)
 #endif
 }
 
-np_error_code udp_send_to(struct np_udp_socket* s, const struct np_udp_endpoint* ep, const uint8_t* buffer, uint16_t bufferSize)
-{
-    ssize_t res;
-
-    struct np_ip_address sendIp;
-
-    if (s->type == ep->ip.type) {
-        // No conversion needed.
-        sendIp = ep->ip;
-    } else if (s->type == NABTO_IPV6 && ep->ip.type == NABTO_IPV4) {
-        // convert ipv4 to ipv6 mapped ipv4
-        np_ip_convert_v4_to_v4_mapped(&ep->ip, &sendIp);
-    } else if (s->type == NABTO_IPV4 && np_ip_is_v4_mapped(&ep->ip)) {
-        np_ip_convert_v4_mapped_to_v4(&ep->ip, &sendIp);
-    } else {
-        NABTO_LOG_TRACE(LOG, "Cannot send ipv6 packets on an ipv4 socket.");
-        return NABTO_EC_FAILED_TO_SEND_PACKET;
-    }
-
-    NABTO_LOG_TRACE(LOG, "Sending packet of size %d, to %s:%d", bufferSize, np_ip_address_to_string(&sendIp), ep->port);
-    if (sendIp.type == NABTO_IPV4) {
-        struct sockaddr_in srv_addr;
-        srv_addr.sin_family = AF_INET;
-        srv_addr.sin_port = htons (ep->port);
-        memcpy((void*)&srv_addr.sin_addr, sendIp.ip.v4, sizeof(srv_addr.sin_addr));
-        res = sendto (s->sock, buffer, bufferSize, 0, (struct sockaddr*)&srv_addr, sizeof(srv_addr));
-    } else { // IPv6
-        struct sockaddr_in6 srv_addr;
-        srv_addr.sin6_family = AF_INET6;
-        srv_addr.sin6_flowinfo = 0;
-        srv_addr.sin6_scope_id = 0;
-        srv_addr.sin6_port = htons (ep->port);
-        memcpy((void*)&srv_addr.sin6_addr,sendIp.ip.v6, sizeof(srv_addr.sin6_addr));
-        res = sendto (s->sock, buffer, bufferSize, 0, (struct sockaddr*)&srv_addr, sizeof(srv_addr));
-    }
-
-    if (res < 0) {
-        int status = errno;
-        NABTO_LOG_TRACE(LOG, "UDP returned error status (%d) %s", status, strerror(status));
-        if (status == EAGAIN || status == EWOULDBLOCK) {
-            // expected
-            // just drop the packet and the upper layers will take care of retransmissions.
-        } else {
-
-            if (status == EADDRNOTAVAIL || // if we send to ipv6 scopes we do not have
-                status == ENETUNREACH || // if we send ipv6 on a system without it.
-                status == EAFNOSUPPORT) // if we send ipv6 on an ipv4 only socket
-            {
-                NABTO_LOG_TRACE(LOG,"ERROR: (%i) '%s' in nm_epoll_event_send_to", (int) status, strerror(status));
-            } else {
-                NABTO_LOG_ERROR(LOG,"ERROR: (%i) '%s' in nm_epoll_event_send_to", (int) status, strerror(status));
-            }
-            return NABTO_EC_FAILED_TO_SEND_PACKET;
-        }
-    }
-
-    return NABTO_EC_OK;
-}
-
-np_error_code udp_recv_from(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* readLength)
-{
-    ssize_t recvLength;
-    if (sock->type == NABTO_IPV6) {
-        struct sockaddr_in6 sa;
-        socklen_t addrlen = sizeof(sa);
-        recvLength = recvfrom(sock->sock, buffer, bufferSize, 0, (struct sockaddr*)&sa, &addrlen);
-        memcpy(&ep->ip.ip.v6, &sa.sin6_addr.s6_addr, sizeof(ep->ip.ip.v6));
-        ep->port = ntohs(sa.sin6_port);
-        ep->ip.type = NABTO_IPV6;
-    } else {
-        struct sockaddr_in sa;
-        socklen_t addrlen = sizeof(sa);
-        recvLength = recvfrom(sock->sock, buffer, bufferSize, 0, (struct sockaddr*)&sa, &addrlen);
-        memcpy(&ep->ip.ip.v4, &sa.sin_addr.s_addr, sizeof(ep->ip.ip.v4));
-        ep->port = ntohs(sa.sin_port);
-        ep->ip.type = NABTO_IPV4;
-    }
-    if (recvLength < 0) {
-        int status = errno;
-        if (status == EAGAIN || status == EWOULDBLOCK) {
-            // expected
-            // wait for next event to check for data.
-            return NABTO_EC_AGAIN;
-        } else {
-            NABTO_LOG_ERROR(LOG,"ERROR: (%d) '%s' in udp_recv_from", status, strerror(status));
-            return NABTO_EC_UDP_SOCKET_ERROR;
-        }
-    }
-    *readLength = recvLength;
-    return NABTO_EC_OK;
-}
-
 np_error_code bind_port(struct np_udp_socket* s, uint16_t port)
 {
     int status;
@@ -386,6 +331,22 @@ np_error_code bind_port(struct np_udp_socket* s, uint16_t port)
     }
 }
 
+np_error_code set_reuse_port(struct np_udp_socket* s)
+{
+#if defined(SO_REUSEPORT)
+    int yes = 1;
+    if (setsockopt(s->sock, SOL_SOCKET, SO_REUSEPORT, (void*)&yes, sizeof(yes)) != 0) {
+        int e = errno;
+        NABTO_LOG_ERROR(LOG, "Unable to set SO_REUSEPORT: (%i) '%s'.", e, strerror(e));
+        return NABTO_EC_UDP_SOCKET_CREATION_ERROR;
+    }
+    return NABTO_EC_OK;
+#else
+    (void)s;
+    return NABTO_EC_NOT_SUPPORTED;
+#endif
+}
+
 uint16_t get_local_port(struct np_udp_socket* s)
 {
     if (s->type == NABTO_IPV6) {
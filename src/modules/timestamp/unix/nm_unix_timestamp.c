@@ -5,9 +5,11 @@
 #include <time.h>
 
 static uint32_t ts_now_ms(struct np_timestamp* obj);
+static uint32_t ts_now_us(struct np_timestamp* obj);
 
 static struct np_timestamp_functions module = {
-    .now_ms               = &ts_now_ms
+    .now_ms               = &ts_now_ms,
+    .now_us               = &ts_now_us
 };
 
 struct np_timestamp nm_unix_ts_get_impl()
@@ -24,3 +26,11 @@ uint32_t ts_now_ms(struct np_timestamp* obj)
     clock_gettime(CLOCK_REALTIME, &spec);
     return ((spec.tv_sec * 1000) + (spec.tv_nsec / 1000000));
 }
+
+uint32_t ts_now_us(struct np_timestamp* obj)
+{
+    (void)obj;
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (((uint64_t)spec.tv_sec * 1000000) + (spec.tv_nsec / 1000));
+}
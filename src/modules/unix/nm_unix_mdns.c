@@ -146,3 +146,25 @@ void nm_unix_mdns_update_ipv6_socket_registration(int sock)
         freeifaddrs(interfaces);
     }
 }
+
+bool nm_unix_mdns_setup_ipv4_socket(int sock)
+{
+    if (!nm_unix_init_mdns_ipv4_socket(sock)) {
+        return false;
+    }
+    nm_unix_mdns_update_ipv4_socket_registration(sock);
+    return true;
+}
+
+bool nm_unix_mdns_setup_ipv6_socket(int sock)
+{
+    int no = 0;
+    if (setsockopt(sock, IPPROTO_IPV6, IPV6_V6ONLY, (void* ) &no, sizeof(no)) < 0) {
+        NABTO_LOG_ERROR(LOG, "Cannot set IPV6_V6ONLY");
+    }
+    if (!nm_unix_init_mdns_ipv6_socket(sock)) {
+        return false;
+    }
+    nm_unix_mdns_update_ipv6_socket_registration(sock);
+    return true;
+}
@@ -13,5 +13,15 @@ bool nm_unix_init_mdns_ipv4_socket(int sock);
 void nm_unix_mdns_update_ipv4_socket_registration(int sock);
 void nm_unix_mdns_update_ipv6_socket_registration(int sock);
 
+/**
+ * Bind a socket created by a network module to the mdns port and join
+ * the mdns multicast group on all interfaces. The ipv6 socket also
+ * accepts ipv4 traffic.
+ *
+ * @return false if the socket could not be bound.
+ */
+bool nm_unix_mdns_setup_ipv4_socket(int sock);
+bool nm_unix_mdns_setup_ipv6_socket(int sock);
+
 
 #endif
@@ -0,0 +1,396 @@
+#if (defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)) && !defined(_GNU_SOURCE)
+// recvmmsg and sendmmsg are GNU extensions
+#define _GNU_SOURCE
+#endif
+
+#include "nm_unix_udp.h"
+
+#include <platform/np_logging.h>
+#include <platform/np_ip_address.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+
+#if defined(HAVE_NETINET_UDP_H)
+#include <netinet/udp.h>
+#endif
+
+#define LOG NABTO_LOG_MODULE_UDP
+
+#if defined(HAVE_SENDMMSG)
+static np_error_code udp_send_chunk(int sock, enum np_ip_address_type sockType, bool* gsoDisabled,
+                                    struct np_udp_send_entry* entries, size_t entriesSize);
+#if defined(UDP_SEGMENT)
+static bool udp_can_send_segmented(struct np_udp_send_entry* entries, size_t entriesSize,
+                                   struct sockaddr_storage* addrs, socklen_t* addrLens);
+static np_error_code udp_send_segmented(int sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                        struct sockaddr_storage* addr, socklen_t addrLen);
+#endif
+#endif
+
+#if defined(HAVE_RECVMMSG)
+static void sockaddr_to_endpoint(struct sockaddr_storage* addr, struct np_udp_endpoint* ep);
+#endif
+
+bool nm_unix_udp_endpoint_to_sockaddr(enum np_ip_address_type sockType, const struct np_udp_endpoint* ep,
+                                      struct sockaddr_storage* addr, socklen_t* addrLen)
+{
+    struct np_ip_address sendIp;
+
+    if (sockType == ep->ip.type) {
+        // No conversion needed.
+        sendIp = ep->ip;
+    } else if (sockType == NABTO_IPV6 && ep->ip.type == NABTO_IPV4) {
+        // convert ipv4 to ipv6 mapped ipv4
+        np_ip_convert_v4_to_v4_mapped(&ep->ip, &sendIp);
+    } else if (sockType == NABTO_IPV4 && np_ip_is_v4_mapped(&ep->ip)) {
+        np_ip_convert_v4_mapped_to_v4(&ep->ip, &sendIp);
+    } else {
+        NABTO_LOG_TRACE(LOG, "Cannot send ipv6 packets on an ipv4 socket.");
+        return false;
+    }
+
+    memset(addr, 0, sizeof(struct sockaddr_storage));
+    if (sendIp.type == NABTO_IPV4) {
+        struct sockaddr_in* srv_addr = (struct sockaddr_in*)addr;
+        srv_addr->sin_family = AF_INET;
+        srv_addr->sin_port = htons (ep->port);
+        memcpy((void*)&srv_addr->sin_addr, sendIp.ip.v4, sizeof(srv_addr->sin_addr));
+        *addrLen = sizeof(struct sockaddr_in);
+    } else { // IPv6
+        struct sockaddr_in6* srv_addr = (struct sockaddr_in6*)addr;
+        srv_addr->sin6_family = AF_INET6;
+        srv_addr->sin6_flowinfo = 0;
+        srv_addr->sin6_scope_id = 0;
+        srv_addr->sin6_port = htons (ep->port);
+        memcpy((void*)&srv_addr->sin6_addr,sendIp.ip.v6, sizeof(srv_addr->sin6_addr));
+        *addrLen = sizeof(struct sockaddr_in6);
+    }
+    return true;
+}
+
+np_error_code nm_unix_udp_send_error(int status)
+{
+    NABTO_LOG_TRACE(LOG, "UDP returned error status (%d) %s", status, strerror(status));
+    if (status == EAGAIN || status == EWOULDBLOCK) {
+        // expected
+        // just drop the packet and the upper layers will take care of retransmissions.
+        return NABTO_EC_OK;
+    }
+    if (status == EADDRNOTAVAIL || // if we send to ipv6 scopes we do not have
+        status == ENETUNREACH || // if we send ipv6 on a system without it.
+        status == EAFNOSUPPORT) // if we send ipv6 on an ipv4 only socket
+    {
+        NABTO_LOG_TRACE(LOG,"ERROR: (%i) '%s' in udp send", (int) status, strerror(status));
+    } else {
+        NABTO_LOG_ERROR(LOG,"ERROR: (%i) '%s' in udp send", (int) status, strerror(status));
+    }
+    return NABTO_EC_FAILED_TO_SEND_PACKET;
+}
+
+np_error_code nm_unix_udp_send_to(int sock, enum np_ip_address_type sockType, const struct np_udp_endpoint* ep,
+                                  const uint8_t* buffer, uint16_t bufferSize)
+{
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    if (!nm_unix_udp_endpoint_to_sockaddr(sockType, ep, &addr, &addrLen)) {
+        return NABTO_EC_FAILED_TO_SEND_PACKET;
+    }
+
+    NABTO_LOG_TRACE(LOG, "Sending packet of size %d, to %s:%d", bufferSize, np_ip_address_to_string(&ep->ip), ep->port);
+    ssize_t res = sendto (sock, buffer, bufferSize, 0, (struct sockaddr*)&addr, addrLen);
+    if (res < 0) {
+        return nm_unix_udp_send_error(errno);
+    }
+
+    return NABTO_EC_OK;
+}
+
+#if defined(HAVE_SENDMMSG)
+
+#if defined(UDP_SEGMENT)
+/**
+ * GSO can be used if all the packets goes to the same endpoint and
+ * all but the last packet has the same size, the last packet may be
+ * shorter.
+ */
+bool udp_can_send_segmented(struct np_udp_send_entry* entries, size_t entriesSize,
+                            struct sockaddr_storage* addrs, socklen_t* addrLens)
+{
+    if (entriesSize < 2 || entriesSize > NM_UNIX_UDP_MAX_GSO_SEGMENTS) {
+        return false;
+    }
+    size_t total = 0;
+    size_t i;
+    for (i = 0; i < entriesSize; i++) {
+        if (addrLens[i] == 0 || addrLens[i] != addrLens[0] || memcmp(&addrs[i], &addrs[0], addrLens[0]) != 0) {
+            return false;
+        }
+        if (entries[i].bufferSize > entries[0].bufferSize) {
+            return false;
+        }
+        if (i + 1 < entriesSize && entries[i].bufferSize != entries[0].bufferSize) {
+            return false;
+        }
+        total += entries[i].bufferSize;
+    }
+    return total <= UINT16_MAX;
+}
+
+/**
+ * Send the packets as one GSO super datagram which the kernel splits
+ * into datagrams of the size of the first packet.
+ *
+ * @return NABTO_EC_NOT_SUPPORTED if the kernel or the device does not support UDP_SEGMENT.
+ */
+np_error_code udp_send_segmented(int sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                                 struct sockaddr_storage* addr, socklen_t addrLen)
+{
+    struct iovec iovecs[NM_UNIX_UDP_MAX_GSO_SEGMENTS];
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    struct msghdr msg;
+    size_t i;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    memset(control, 0, sizeof(control));
+    for (i = 0; i < entriesSize; i++) {
+        iovecs[i].iov_base = entries[i].buffer;
+        iovecs[i].iov_len = entries[i].bufferSize;
+    }
+    msg.msg_name = addr;
+    msg.msg_namelen = addrLen;
+    msg.msg_iov = iovecs;
+    msg.msg_iovlen = entriesSize;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t segmentSize = entries[0].bufferSize;
+    memcpy(CMSG_DATA(cm), &segmentSize, sizeof(uint16_t));
+
+    if (sendmsg(sock, &msg, 0) < 0) {
+        int status = errno;
+        if (status == EIO || status == EINVAL || status == ENOPROTOOPT || status == EOPNOTSUPP) {
+            NABTO_LOG_TRACE(LOG, "UDP_SEGMENT not usable (%d) %s, falling back to sendmmsg", status, strerror(status));
+            return NABTO_EC_NOT_SUPPORTED;
+        }
+        return nm_unix_udp_send_error(status);
+    }
+    return NABTO_EC_OK;
+}
+#endif
+
+np_error_code udp_send_chunk(int sock, enum np_ip_address_type sockType, bool* gsoDisabled,
+                             struct np_udp_send_entry* entries, size_t entriesSize)
+{
+    struct mmsghdr msgs[NM_UNIX_UDP_MAX_SEND_BATCH];
+    struct iovec iovecs[NM_UNIX_UDP_MAX_SEND_BATCH];
+    struct sockaddr_storage addrs[NM_UNIX_UDP_MAX_SEND_BATCH];
+    socklen_t addrLens[NM_UNIX_UDP_MAX_SEND_BATCH];
+    size_t msgsSize = 0;
+    np_error_code ec = NABTO_EC_OK;
+    size_t i;
+
+    for (i = 0; i < entriesSize; i++) {
+        if (!nm_unix_udp_endpoint_to_sockaddr(sockType, &entries[i].ep, &addrs[i], &addrLens[i])) {
+            addrLens[i] = 0;
+            ec = NABTO_EC_FAILED_TO_SEND_PACKET;
+            continue;
+        }
+        memset(&msgs[msgsSize], 0, sizeof(struct mmsghdr));
+        iovecs[msgsSize].iov_base = entries[i].buffer;
+        iovecs[msgsSize].iov_len = entries[i].bufferSize;
+        msgs[msgsSize].msg_hdr.msg_iov = &iovecs[msgsSize];
+        msgs[msgsSize].msg_hdr.msg_iovlen = 1;
+        msgs[msgsSize].msg_hdr.msg_name = &addrs[i];
+        msgs[msgsSize].msg_hdr.msg_namelen = addrLens[i];
+        msgsSize++;
+    }
+
+#if defined(UDP_SEGMENT)
+    if (!*gsoDisabled && udp_can_send_segmented(entries, entriesSize, addrs, addrLens)) {
+        np_error_code gsoEc = udp_send_segmented(sock, entries, entriesSize, &addrs[0], addrLens[0]);
+        if (gsoEc != NABTO_EC_NOT_SUPPORTED) {
+            return gsoEc;
+        }
+        *gsoDisabled = true;
+    }
+#else
+    (void)gsoDisabled;
+#endif
+
+    size_t sent = 0;
+    while (sent < msgsSize) {
+        int res = sendmmsg(sock, msgs + sent, (unsigned int)(msgsSize - sent), 0);
+        if (res < 0) {
+            int status = errno;
+            np_error_code sendEc = nm_unix_udp_send_error(status);
+            if (sendEc == NABTO_EC_OK) {
+                // the socket would block, drop the rest and let upper layers retransmit.
+                break;
+            }
+            ec = sendEc;
+            // skip the failing packet and continue with the rest.
+            sent++;
+        } else {
+            sent += res;
+        }
+    }
+    return ec;
+}
+
+np_error_code nm_unix_udp_send_batch(int sock, enum np_ip_address_type sockType, bool* gsoDisabled,
+                                     struct np_udp_send_entry* entries, size_t entriesSize)
+{
+    np_error_code ec = NABTO_EC_OK;
+    NABTO_LOG_TRACE(LOG, "Sending batch of %d packets", (int)entriesSize);
+    while (entriesSize > 0) {
+        size_t chunk = entriesSize;
+        if (chunk > NM_UNIX_UDP_MAX_SEND_BATCH) {
+            chunk = NM_UNIX_UDP_MAX_SEND_BATCH;
+        }
+        np_error_code chunkEc = udp_send_chunk(sock, sockType, gsoDisabled, entries, chunk);
+        if (chunkEc != NABTO_EC_OK) {
+            ec = chunkEc;
+        }
+        entries += chunk;
+        entriesSize -= chunk;
+    }
+    return ec;
+}
+#else
+np_error_code nm_unix_udp_send_batch(int sock, enum np_ip_address_type sockType, bool* gsoDisabled,
+                                     struct np_udp_send_entry* entries, size_t entriesSize)
+{
+    (void)gsoDisabled;
+    np_error_code ec = NABTO_EC_OK;
+    size_t i;
+    for (i = 0; i < entriesSize; i++) {
+        np_error_code sendEc = nm_unix_udp_send_to(sock, sockType, &entries[i].ep, entries[i].buffer, entries[i].bufferSize);
+        if (sendEc != NABTO_EC_OK) {
+            ec = sendEc;
+        }
+    }
+    return ec;
+}
+#endif
+
+np_error_code nm_unix_udp_recv_from(int sock, enum np_ip_address_type sockType, struct np_udp_endpoint* ep,
+                                    uint8_t* buffer, size_t bufferSize, size_t* readLength)
+{
+    ssize_t recvLength;
+    if (sockType == NABTO_IPV6) {
+        struct sockaddr_in6 sa;
+        socklen_t addrlen = sizeof(sa);
+        recvLength = recvfrom(sock, buffer, bufferSize, 0, (struct sockaddr*)&sa, &addrlen);
+        memcpy(&ep->ip.ip.v6, &sa.sin6_addr.s6_addr, sizeof(ep->ip.ip.v6));
+        ep->port = ntohs(sa.sin6_port);
+        ep->ip.type = NABTO_IPV6;
+    } else {
+        struct sockaddr_in sa;
+        socklen_t addrlen = sizeof(sa);
+        recvLength = recvfrom(sock, buffer, bufferSize, 0, (struct sockaddr*)&sa, &addrlen);
+        memcpy(&ep->ip.ip.v4, &sa.sin_addr.s_addr, sizeof(ep->ip.ip.v4));
+        ep->port = ntohs(sa.sin_port);
+        ep->ip.type = NABTO_IPV4;
+    }
+    if (recvLength < 0) {
+        int status = errno;
+        if (status == EAGAIN || status == EWOULDBLOCK) {
+            // expected
+            // wait for next event to check for data.
+            return NABTO_EC_AGAIN;
+        } else {
+            NABTO_LOG_ERROR(LOG,"ERROR: (%d) '%s' in udp_recv_from", status, strerror(status));
+            return NABTO_EC_UDP_SOCKET_ERROR;
+        }
+    }
+    *readLength = recvLength;
+    return NABTO_EC_OK;
+}
+
+#if defined(HAVE_RECVMMSG)
+np_error_code nm_unix_udp_recv_batch(int sock, enum np_ip_address_type sockType,
+                                     struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    (void)sockType;
+    struct mmsghdr msgs[NM_UNIX_UDP_MAX_RECV_BATCH];
+    struct iovec iovecs[NM_UNIX_UDP_MAX_RECV_BATCH];
+    struct sockaddr_storage addrs[NM_UNIX_UDP_MAX_RECV_BATCH];
+
+    *received = 0;
+    if (entriesSize > NM_UNIX_UDP_MAX_RECV_BATCH) {
+        entriesSize = NM_UNIX_UDP_MAX_RECV_BATCH;
+    }
+
+    memset(msgs, 0, sizeof(struct mmsghdr) * entriesSize);
+    size_t i;
+    for (i = 0; i < entriesSize; i++) {
+        iovecs[i].iov_base = entries[i].buffer;
+        iovecs[i].iov_len = entries[i].bufferSize;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+    }
+
+    int count = recvmmsg(sock, msgs, (unsigned int)entriesSize, MSG_DONTWAIT, NULL);
+    if (count < 0) {
+        int status = errno;
+        if (status == EAGAIN || status == EWOULDBLOCK) {
+            return NABTO_EC_AGAIN;
+        } else {
+            NABTO_LOG_ERROR(LOG,"ERROR: (%d) '%s' in udp_recv_batch", status, strerror(status));
+            return NABTO_EC_UDP_SOCKET_ERROR;
+        }
+    }
+
+    for (i = 0; i < (size_t)count; i++) {
+        sockaddr_to_endpoint(&addrs[i], &entries[i].ep);
+        entries[i].recvSize = msgs[i].msg_len;
+    }
+    *received = count;
+    return NABTO_EC_OK;
+}
+
+void sockaddr_to_endpoint(struct sockaddr_storage* addr, struct np_udp_endpoint* ep)
+{
+    if (addr->ss_family == AF_INET6) {
+        struct sockaddr_in6* sa = (struct sockaddr_in6*)addr;
+        memcpy(&ep->ip.ip.v6, &sa->sin6_addr.s6_addr, sizeof(ep->ip.ip.v6));
+        ep->port = ntohs(sa->sin6_port);
+        ep->ip.type = NABTO_IPV6;
+    } else {
+        struct sockaddr_in* sa = (struct sockaddr_in*)addr;
+        memcpy(&ep->ip.ip.v4, &sa->sin_addr.s_addr, sizeof(ep->ip.ip.v4));
+        ep->port = ntohs(sa->sin_port);
+        ep->ip.type = NABTO_IPV4;
+    }
+}
+#else
+np_error_code nm_unix_udp_recv_batch(int sock, enum np_ip_address_type sockType,
+                                     struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    // No recvmmsg, read packets one at a time until the socket would block.
+    size_t i;
+    for (i = 0; i < entriesSize; i++) {
+        np_error_code ec = nm_unix_udp_recv_from(sock, sockType, &entries[i].ep, entries[i].buffer, entries[i].bufferSize, &entries[i].recvSize);
+        if (ec != NABTO_EC_OK) {
+            *received = i;
+            if (i > 0) {
+                // deliver what we got, errors are reported on the next call.
+                return NABTO_EC_OK;
+            }
+            return ec;
+        }
+    }
+    *received = entriesSize;
+    return NABTO_EC_OK;
+}
+#endif
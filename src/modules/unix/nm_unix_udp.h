@@ -0,0 +1,82 @@
+#ifndef NM_UNIX_UDP_H
+#define NM_UNIX_UDP_H
+
+#include <platform/np_platform.h>
+
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Send and receive functions for nonblocking unix udp sockets, shared
+ * by the udp modules of the select_unix, epoll_unix and libevent
+ * platforms. Batches are sent with sendmmsg, or as one UDP_SEGMENT
+ * (GSO) datagram when the packets go to the same endpoint, and
+ * received with recvmmsg when the system has them.
+ */
+
+// Max number of datagrams read by a single recv_batch call.
+#ifndef NM_UNIX_UDP_MAX_RECV_BATCH
+#define NM_UNIX_UDP_MAX_RECV_BATCH 32
+#endif
+
+// Max number of datagrams given to a single sendmmsg call.
+#ifndef NM_UNIX_UDP_MAX_SEND_BATCH
+#define NM_UNIX_UDP_MAX_SEND_BATCH 32
+#endif
+
+// Linux limits a GSO send to 64 segments.
+#define NM_UNIX_UDP_MAX_GSO_SEGMENTS 64
+
+/**
+ * Convert an endpoint to a socket address for a socket of the given
+ * type, ipv4 endpoints are mapped on ipv6 sockets.
+ *
+ * @return false if the endpoint cannot be reached from the socket.
+ */
+bool nm_unix_udp_endpoint_to_sockaddr(enum np_ip_address_type sockType, const struct np_udp_endpoint* ep,
+                                      struct sockaddr_storage* addr, socklen_t* addrLen);
+
+/**
+ * Map the errno of a failed send to an error code. A send which would
+ * block is not an error, the packet is dropped and the upper layers
+ * retransmits.
+ */
+np_error_code nm_unix_udp_send_error(int status);
+
+np_error_code nm_unix_udp_send_to(int sock, enum np_ip_address_type sockType, const struct np_udp_endpoint* ep,
+                                  const uint8_t* buffer, uint16_t bufferSize);
+
+/**
+ * Send a batch of packets. The packets which can be sent are sent
+ * even if some fail.
+ *
+ * @param gsoDisabled  Set if the kernel rejects UDP_SEGMENT, then the
+ *                     following batches are sent with sendmmsg.
+ * @return NABTO_EC_OK if no packet failed.
+ */
+np_error_code nm_unix_udp_send_batch(int sock, enum np_ip_address_type sockType, bool* gsoDisabled,
+                                     struct np_udp_send_entry* entries, size_t entriesSize);
+
+/**
+ * @return NABTO_EC_AGAIN if there is no packet to read.
+ */
+np_error_code nm_unix_udp_recv_from(int sock, enum np_ip_address_type sockType, struct np_udp_endpoint* ep,
+                                    uint8_t* buffer, size_t bufferSize, size_t* readLength);
+
+/**
+ * Read up to entriesSize packets, at most NM_UNIX_UDP_MAX_RECV_BATCH
+ * are read by one call.
+ *
+ * @return NABTO_EC_AGAIN if there is no packet to read.
+ */
+np_error_code nm_unix_udp_recv_batch(int sock, enum np_ip_address_type sockType,
+                                     struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received);
+
+#ifdef __cplusplus
+} //extern "C"
+#endif
+
+#endif
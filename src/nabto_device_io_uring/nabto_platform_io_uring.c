@@ -0,0 +1,105 @@
+#include <api/nabto_device_platform.h>
+#include <api/nabto_device_threads.h>
+#include <api/nabto_device_integration.h>
+
+#include <modules/io_uring/nm_io_uring.h>
+#include <modules/io_uring/nm_io_uring_mdns_udp_bind.h>
+#include <modules/event_queue/thread_event_queue.h>
+#include <modules/mbedtls/nm_mbedtls_random.h>
+#include <modules/mbedtls/nm_mbedtls_srv.h>
+#include <modules/mbedtls/nm_mbedtls_cli.h>
+#include <modules/mdns/nm_mdns_server.h>
+#include <modules/timestamp/unix/nm_unix_timestamp.h>
+#include <modules/dns/unix/nm_unix_dns.h>
+#include <modules/unix/nm_unix_local_ip.h>
+#include <modules/communication_buffer/nm_communication_buffer.h>
+
+#include <stddef.h>
+#include <stdlib.h>
+
+/**
+ * Platform integration which uses io_uring for udp and tcp. It needs
+ * Linux 6.0 or newer for multishot recvmsg with provided buffer
+ * rings.
+ */
+struct io_uring_platform
+{
+    struct nm_io_uring ioUring;
+    struct thread_event_queue eventQueue;
+    struct nm_unix_dns_resolver dnsResolver;
+    struct nm_mdns_server mdnsServer;
+};
+
+/**
+ * This function is called from nabto_device_new.
+ */
+np_error_code nabto_device_platform_init(struct nabto_device_context* device, struct nabto_device_mutex* coreMutex)
+{
+    struct io_uring_platform* platform = calloc(1, sizeof(struct io_uring_platform));
+    if (platform == NULL) {
+        return NABTO_EC_OUT_OF_MEMORY;
+    }
+
+    np_error_code ec = nm_io_uring_init(&platform->ioUring);
+    if (ec != NABTO_EC_OK) {
+        // The kernel does not support the needed io_uring features.
+        free(platform);
+        return ec;
+    }
+    nm_io_uring_run(&platform->ioUring);
+
+    nm_unix_dns_resolver_init(&platform->dnsResolver);
+    nm_unix_dns_resolver_run(&platform->dnsResolver);
+
+    struct np_udp udpImpl = nm_io_uring_udp_get_impl(&platform->ioUring);
+    struct np_tcp tcpImpl = nm_io_uring_tcp_get_impl(&platform->ioUring);
+    struct np_dns dnsImpl = nm_unix_dns_resolver_get_impl(&platform->dnsResolver);
+    struct np_timestamp timestampImpl = nm_unix_ts_get_impl();
+    struct np_local_ip localIpImpl = nm_unix_local_ip_get_impl();
+
+    thread_event_queue_init(&platform->eventQueue, coreMutex, &timestampImpl);
+    thread_event_queue_run(&platform->eventQueue);
+    struct np_event_queue eventQueueImpl = thread_event_queue_get_impl(&platform->eventQueue);
+
+    struct nm_mdns_udp_bind mdnsUdpBindImpl = nm_io_uring_mdns_udp_bind_get_impl(&platform->ioUring);
+
+    nm_mdns_server_init(&platform->mdnsServer, &eventQueueImpl, &udpImpl, &mdnsUdpBindImpl, &localIpImpl);
+    struct np_mdns mdnsImpl = nm_mdns_server_get_impl(&platform->mdnsServer);
+
+    nabto_device_integration_set_platform_data(device, platform);
+
+    nabto_device_integration_set_udp_impl(device, &udpImpl);
+    nabto_device_integration_set_tcp_impl(device, &tcpImpl);
+    nabto_device_integration_set_timestamp_impl(device, &timestampImpl);
+    nabto_device_integration_set_dns_impl(device, &dnsImpl);
+    nabto_device_integration_set_local_ip_impl(device, &localIpImpl);
+    nabto_device_integration_set_mdns_impl(device, &mdnsImpl);
+    nabto_device_integration_set_event_queue_impl(device, &eventQueueImpl);
+
+    return NABTO_EC_OK;
+}
+
+/**
+ * This function is called from nabto_device_free.
+ */
+void nabto_device_platform_deinit(struct nabto_device_context* device)
+{
+    struct io_uring_platform* platform = nabto_device_integration_get_platform_data(device);
+    nm_mdns_server_deinit(&platform->mdnsServer);
+    thread_event_queue_deinit(&platform->eventQueue);
+    nm_unix_dns_resolver_deinit(&platform->dnsResolver);
+    nm_io_uring_deinit(&platform->ioUring);
+    free(platform);
+}
+
+/**
+ * This function is called from nabto_device_stop or nabto_device_free
+ * if the device is freed without being stopped first.
+ */
+void nabto_device_platform_stop_blocking(struct nabto_device_context* device)
+{
+    struct io_uring_platform* platform = nabto_device_integration_get_platform_data(device);
+    nm_mdns_server_stop(&platform->mdnsServer);
+    nm_io_uring_stop(&platform->ioUring);
+    thread_event_queue_stop_blocking(&platform->eventQueue);
+}
@@ -4,14 +4,39 @@
 #include <api/nabto_device_future.h>
 
 #include <platform/np_logging.h>
+#include <platform/np_timestamp_wrapper.h>
+
+#include <modules/event_queue/nm_event_queue.h>
+#include <modules/event_queue/nm_mpsc_queue.h>
+#include <modules/event_queue/nm_event_queue_stats.h>
 
 #include <stdlib.h>
+#include <stddef.h>
 
 #include <event.h>
 #include <event2/event.h>
 
 #define LOG NABTO_LOG_MODULE_EVENT_QUEUE
 
+// The flags of a posted node, the event was posted with post_maybe_double.
+#define LIBEVENT_EVENT_POSTED_MAYBE_DOUBLE 1
+
+/**
+ * Ready events are executed in batches with the core mutex taken
+ * once. A batch ends when it has executed batchSize events or has run
+ * for LIBEVENT_EVENT_QUEUE_MAX_BATCH_TIME ms, the rest of the ready
+ * events are executed after libevent has handled other active events.
+ */
+#ifndef LIBEVENT_EVENT_QUEUE_DEFAULT_BATCH_SIZE
+#define LIBEVENT_EVENT_QUEUE_DEFAULT_BATCH_SIZE 32
+#endif
+
+#ifndef LIBEVENT_EVENT_QUEUE_MAX_BATCH_TIME
+#define LIBEVENT_EVENT_QUEUE_MAX_BATCH_TIME 5
+#endif
+
+static void init_event(struct np_event_queue* obj, struct np_event* event, np_event_callback cb, void* cbData);
+static void deinit_event(struct np_event* event);
 static np_error_code create(struct np_event_queue* obj, np_event_callback cb, void* cbData, struct np_event** event);
 static void destroy(struct np_event* event);
 static void post(struct np_event* event);
@@ -19,36 +44,97 @@ static void post_maybe_double(struct np_event* event);
 
 static void post_timed(struct np_event* event, uint32_t milliseconds);
 static void cancel(struct np_event* event);
+static np_error_code set_batch_size(struct np_event_queue* obj, size_t batchSize);
+static size_t event_allocations(struct np_event_queue* obj);
+#if NP_EVENT_QUEUE_STATS
+static void get_stats(struct np_event_queue* obj, struct np_event_queue_stats* stats);
+#endif
 
-static void handle_event(evutil_socket_t s, short events, void* data);
+static void handle_ready_events(evutil_socket_t s, short events, void* data);
 
+/**
+ * The ready and timed events are kept in an nm_event_queue, such that
+ * an event is only state in the np_event. libevent sees two events
+ * for the whole queue, one which is activated when an event is
+ * posted and one timer which expires with the first timed event.
+ */
 struct libevent_event_queue {
     struct nabto_device_mutex* mutex;
     struct nabto_device_thread* coreThread;
     struct event_base* eventBase;
+    struct np_timestamp ts;
+
+    // The queueMutex protects the event queue, the batch size and the
+    // allocation count, events can be posted without the core mutex
+    // being taken.
+    struct nabto_device_mutex* queueMutex;
+    struct nm_event_queue eventQueue;
+    // Posted events are pushed to this lock free queue and moved to
+    // the event queue by the libevent thread. The poster which makes
+    // it non empty activates the readyEvent.
+    struct nm_mpsc_queue posted;
+    // libevent event which executes a batch of ready events.
+    struct event* readyEvent;
+    // libevent timer which is armed for the first timed event, it
+    // executes the ready events like the readyEvent.
+    struct event* timerEvent;
+    size_t batchSize;
+    size_t eventAllocations;
+#if NP_EVENT_QUEUE_STATS
+    // Statistics for the executed events, they are recorded with the
+    // core mutex taken.
+    struct np_event_queue_stats stats;
+#endif
 };
 
-struct np_event {
+/**
+ * The state of an event, it is stored in the np_event.
+ */
+struct libevent_event {
     struct libevent_event_queue* eq;
-    np_event_callback cb;
-    void* data;
-    struct event event;
+    struct nm_event_queue_event event;
+    struct nm_mpsc_queue_node postedNode;
 };
 
+// the libevent_event has to fit in the storage of an np_event.
+typedef char libevent_event_fits_np_event[(sizeof(struct libevent_event) <= sizeof(struct np_event)) ? 1 : -1];
+
+static void take_posted_events(struct libevent_event_queue* eq);
+static bool has_ready_events(struct libevent_event_queue* eq, uint32_t now);
+static void arm_timer(struct libevent_event_queue* eq, uint32_t now);
+static uint32_t posted_stamp(struct libevent_event_queue* eq);
+
 static struct np_event_queue_functions module = {
+    .init = &init_event,
+    .deinit = &deinit_event,
     .create = &create,
     .destroy = &destroy,
     .post = &post,
     .post_maybe_double = &post_maybe_double,
     .cancel = &cancel,
-    .post_timed = &post_timed
+    .post_timed = &post_timed,
+    .set_batch_size = &set_batch_size,
+    .event_allocations = &event_allocations,
+#if NP_EVENT_QUEUE_STATS
+    .get_stats = &get_stats,
+#endif
 };
 
-struct np_event_queue libevent_event_queue_create(struct event_base* eventBase, struct nabto_device_mutex* mutex)
+struct np_event_queue libevent_event_queue_create(struct event_base* eventBase, struct nabto_device_mutex* mutex, struct np_timestamp* ts)
 {
     struct libevent_event_queue* eq = calloc(1, sizeof(struct libevent_event_queue));
     eq->eventBase = eventBase;
     eq->mutex = mutex;
+    eq->ts = *ts;
+    eq->queueMutex = nabto_device_threads_create_mutex();
+    nm_event_queue_init(&eq->eventQueue);
+    nm_mpsc_queue_init(&eq->posted);
+    eq->readyEvent = event_new(eventBase, -1, 0, &handle_ready_events, eq);
+    eq->timerEvent = event_new(eventBase, -1, 0, &handle_ready_events, eq);
+    eq->batchSize = LIBEVENT_EVENT_QUEUE_DEFAULT_BATCH_SIZE;
+#if NP_EVENT_QUEUE_STATS
+    nm_event_queue_stats_init(&eq->stats);
+#endif
     struct np_event_queue obj;
     obj.mptr = &module;
     obj.data = eq;
@@ -57,32 +143,145 @@ struct np_event_queue libevent_event_queue_create(struct event_base* eventBase,
 
 void libevent_event_queue_destroy(struct np_event_queue* obj)
 {
-    free(obj->data);
+    struct libevent_event_queue* eq = obj->data;
+    event_free(eq->timerEvent);
+    event_free(eq->readyEvent);
+    nabto_device_threads_free_mutex(eq->queueMutex);
+    free(eq);
 }
 
-void handle_event(evutil_socket_t s, short events, void* data)
+void handle_ready_events(evutil_socket_t s, short events, void* data)
 {
 //    NABTO_LOG_TRACE(LOG, "handle event");
-    struct np_event* event = data;
-    struct libevent_event_queue* eq = event->eq;
+    struct libevent_event_queue* eq = data;
+    size_t executed = 0;
+    bool more = false;
 
     nabto_device_threads_mutex_lock(eq->mutex);
-    event->cb(event->data);
+    // The millisecond timestamp is cached by libevent, the batch time
+    // and the stats use the microsecond timestamp which is not.
+    uint32_t batchStart = np_timestamp_now_us(&eq->ts);
+    uint32_t start = batchStart;
+    while (true) {
+        struct nm_event_queue_event* event = NULL;
+        size_t depth = 0;
+        uint32_t readyStamp = 0;
+        uint32_t now = np_timestamp_now_ms(&eq->ts);
+        nabto_device_threads_mutex_lock(eq->queueMutex);
+        take_posted_events(eq);
+        if (executed < eq->batchSize && (uint32_t)(start - batchStart) < LIBEVENT_EVENT_QUEUE_MAX_BATCH_TIME * 1000) {
+            if (nm_event_queue_take_ready_event(&eq->eventQueue, now, start, &event, &readyStamp)) {
+                depth = eq->eventQueue.eventsSize;
+            }
+        } else {
+            more = has_ready_events(eq, now);
+        }
+        if (event == NULL && !more) {
+            arm_timer(eq, now);
+        }
+        nabto_device_threads_mutex_unlock(eq->queueMutex);
+        if (event == NULL) {
+            break;
+        }
+        // the event can be reused or freed by its callback.
+        np_event_callback cb = event->cb;
+        cb(event->data);
+        uint32_t end = np_timestamp_now_us(&eq->ts);
+#if NP_EVENT_QUEUE_STATS
+        nm_event_queue_stats_add_event(&eq->stats, cb, depth, start - readyStamp, end - start);
+#else
+        (void)depth;
+        (void)readyStamp;
+#endif
+        start = end;
+        executed++;
+    }
     nabto_device_threads_mutex_unlock(eq->mutex);
+
+    if (more) {
+        // let libevent handle network events before the next batch.
+        event_active(eq->readyEvent, 0, 0);
+    }
+}
+
+/**
+ * Call with the queue mutex taken.
+ */
+bool has_ready_events(struct libevent_event_queue* eq, uint32_t now)
+{
+    uint32_t nextEvent;
+    return eq->eventQueue.eventsSize > 0 ||
+        (nm_event_queue_next_timed_event(&eq->eventQueue, &nextEvent) && np_timestamp_less_or_equal(nextEvent, now));
+}
+
+/**
+ * Arm the timer for the first timed event, call with the queue mutex
+ * taken. A timer which fires for a canceled event finds no ready
+ * events and is armed again.
+ */
+void arm_timer(struct libevent_event_queue* eq, uint32_t now)
+{
+    uint32_t nextEvent;
+    if (!nm_event_queue_next_timed_event(&eq->eventQueue, &nextEvent)) {
+        return;
+    }
+    int32_t diff = np_timestamp_difference(nextEvent, now);
+    if (diff < 0) {
+        diff = 0;
+    }
+    struct timeval tv;
+    tv.tv_sec = (diff / 1000);
+    tv.tv_usec = ((diff % 1000) * 1000);
+    event_add(eq->timerEvent, &tv);
+}
+
+/**
+ * Move the posted events to the event queue, call with the queue
+ * mutex taken. An event which is already on the event queue or is a
+ * timed event is left as it is, it is an error unless it was posted
+ * with post_maybe_double.
+ */
+void take_posted_events(struct libevent_event_queue* eq)
+{
+    struct nm_mpsc_queue_node* node = nm_mpsc_queue_take_all(&eq->posted);
+    while (node != NULL) {
+        struct libevent_event* event = (struct libevent_event*)((uint8_t*)node - offsetof(struct libevent_event, postedNode));
+        uint32_t postedStamp = node->stamp;
+        uint32_t postedFlags = node->flags;
+        node = nm_mpsc_queue_release(node);
+        if (event->event.queue == NULL) {
+            event->event.readyStamp = postedStamp;
+            nm_event_queue_post_event(&eq->eventQueue, &event->event);
+        } else if (!(postedFlags & LIBEVENT_EVENT_POSTED_MAYBE_DOUBLE)) {
+            NABTO_LOG_ERROR(LOG, "Double posted event, use the post_maybe_double if this bahavior is intended");
+        }
+    }
+}
+
+void init_event(struct np_event_queue* obj, struct np_event* event, np_event_callback cb, void* cbData)
+{
+    struct libevent_event* ev = (struct libevent_event*)event;
+    ev->eq = obj->data;
+    nm_event_queue_event_init(&ev->event, cb, cbData);
+    nm_mpsc_queue_node_init(&ev->postedNode);
+}
+
+void deinit_event(struct np_event* event)
+{
+    cancel(event);
 }
 
 np_error_code create(struct np_event_queue* obj, np_event_callback cb, void* cbData, struct np_event** event)
 {
+    struct libevent_event_queue* eq = obj->data;
     struct np_event* ev = calloc(1, sizeof(struct np_event));
     if (ev == NULL) {
         return NABTO_EC_OUT_OF_MEMORY;
     }
-    struct libevent_event_queue* eq = obj->data;
-    ev->eq = eq;
-    ev->cb = cb;
-    ev->data = cbData;
-
-    event_assign(&ev->event, eq->eventBase, -1, 0, &handle_event, ev);
+    init_event(obj, ev, cb, cbData);
+    nabto_device_threads_mutex_lock(eq->queueMutex);
+    eq->eventAllocations++;
+    nabto_device_threads_mutex_unlock(eq->queueMutex);
 
     *event = ev;
     return NABTO_EC_OK;
@@ -90,37 +289,99 @@ np_error_code create(struct np_event_queue* obj, np_event_callback cb, void* cbD
 
 void destroy(struct np_event* event)
 {
-    cancel(event);
+    deinit_event(event);
     free(event);
 }
 
 void post(struct np_event* event)
 {
     //NABTO_LOG_TRACE(LOG, "post event");
-    //struct np_platform* pl = event->pl;
-    //struct nabto_device_event_queue* eq = pl->eqData;
-    event_active(&event->event, 0, 0);
+    struct libevent_event* ev = (struct libevent_event*)event;
+    struct libevent_event_queue* eq = ev->eq;
+    bool wasEmpty = false;
+    if (!nm_mpsc_queue_push(&eq->posted, &ev->postedNode, posted_stamp(eq), 0, &wasEmpty)) {
+        NABTO_LOG_ERROR(LOG, "Double posted event, use the post_maybe_double if this bahavior is intended");
+        return;
+    }
+    if (wasEmpty) {
+        event_active(eq->readyEvent, 0, 0);
+    }
 }
 
 void post_maybe_double(struct np_event* event)
 {
-    // TODO
-    //struct np_platform* pl = event->pl;
-    //struct nabto_device_event_queue* eq = pl->eqData;
-    event_active(&event->event, 0, 0);
+    struct libevent_event* ev = (struct libevent_event*)event;
+    struct libevent_event_queue* eq = ev->eq;
+    bool wasEmpty = false;
+    if (nm_mpsc_queue_push(&eq->posted, &ev->postedNode, posted_stamp(eq), LIBEVENT_EVENT_POSTED_MAYBE_DOUBLE, &wasEmpty) && wasEmpty) {
+        event_active(eq->readyEvent, 0, 0);
+    }
 }
 
 void post_timed(struct np_event* event, uint32_t milliseconds)
 {
-    //struct np_platform* pl = event->pl;
-    //struct nabto_device_event_queue* eq = pl->eqData;
-    struct timeval tv;
-    tv.tv_sec = (milliseconds / 1000);
-    tv.tv_usec = ((milliseconds % 1000) * 1000);
-    event_add (&event->event, &tv);
+    struct libevent_event* ev = (struct libevent_event*)event;
+    struct libevent_event_queue* eq = ev->eq;
+    uint32_t now = np_timestamp_now_ms(&eq->ts);
+    nabto_device_threads_mutex_lock(eq->queueMutex);
+    take_posted_events(eq);
+    nm_event_queue_post_timed_event(&eq->eventQueue, &ev->event, now + milliseconds);
+    if (eq->eventQueue.timedEventsRoot == &ev->event) {
+        // the event is the first timed event.
+        arm_timer(eq, now);
+    }
+    nabto_device_threads_mutex_unlock(eq->queueMutex);
 }
 
 void cancel(struct np_event* event)
 {
-    event_del(&event->event);
+    struct libevent_event* ev = (struct libevent_event*)event;
+    struct libevent_event_queue* eq = ev->eq;
+    nabto_device_threads_mutex_lock(eq->queueMutex);
+    take_posted_events(eq);
+    nm_event_queue_cancel_event(&ev->event);
+    nabto_device_threads_mutex_unlock(eq->queueMutex);
+}
+
+np_error_code set_batch_size(struct np_event_queue* obj, size_t batchSize)
+{
+    struct libevent_event_queue* eq = obj->data;
+    if (batchSize == 0) {
+        return NABTO_EC_INVALID_ARGUMENT;
+    }
+    nabto_device_threads_mutex_lock(eq->queueMutex);
+    eq->batchSize = batchSize;
+    nabto_device_threads_mutex_unlock(eq->queueMutex);
+    return NABTO_EC_OK;
+}
+
+size_t event_allocations(struct np_event_queue* obj)
+{
+    struct libevent_event_queue* eq = obj->data;
+    size_t allocations;
+    nabto_device_threads_mutex_lock(eq->queueMutex);
+    allocations = eq->eventAllocations;
+    nabto_device_threads_mutex_unlock(eq->queueMutex);
+    return allocations;
+}
+
+#if NP_EVENT_QUEUE_STATS
+void get_stats(struct np_event_queue* obj, struct np_event_queue_stats* stats)
+{
+    struct libevent_event_queue* eq = obj->data;
+    *stats = eq->stats;
+}
+#endif
+
+/**
+ * The time an event is posted is only used for the latency stats.
+ */
+uint32_t posted_stamp(struct libevent_event_queue* eq)
+{
+#if NP_EVENT_QUEUE_STATS
+    return np_timestamp_now_us(&eq->ts);
+#else
+    (void)eq;
+    return 0;
+#endif
 }
@@ -6,8 +6,9 @@
 struct nabto_device_future;
 struct nabto_device_mutex;
 struct event_base;
+struct np_timestamp;
 
-struct np_event_queue libevent_event_queue_create(struct event_base* eventBase, struct nabto_device_mutex* mutex);
+struct np_event_queue libevent_event_queue_create(struct event_base* eventBase, struct nabto_device_mutex* mutex, struct np_timestamp* ts);
 
 void libevent_event_queue_destroy(struct np_event_queue* pl);
 
@@ -70,7 +70,7 @@ np_error_code nabto_device_platform_init(struct nabto_device_context* device, st
     struct np_local_ip localIp = nm_libevent_local_ip_get_impl(&platform->libeventContext);
 
     // Create an event queue which is based on libevent.
-    platform->eq = libevent_event_queue_create(platform->eventBase, eventMutex);
+    platform->eq = libevent_event_queue_create(platform->eventBase, eventMutex, &timestamp);
 
 
     // Create a mdns server
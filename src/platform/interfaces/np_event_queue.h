@@ -20,8 +20,89 @@ extern "C" {
 
 typedef void (*np_event_callback)(void* data);
 
-// opaque pointers
-struct np_event;
+/**
+ * The size of an event in pointer sized words. The event queue
+ * implementation keeps its event state in this storage.
+ */
+#ifndef NP_EVENT_STORAGE_WORDS
+#define NP_EVENT_STORAGE_WORDS 16
+#endif
+
+/**
+ * An event is embedded in the object which owns it, such as a
+ * connection, a stream or a completion event, such that an event is
+ * initialized without allocating memory. The content is private to
+ * the event queue implementation and an initialized event must not be
+ * moved.
+ */
+struct np_event {
+    union {
+        void* ptr;
+        uint64_t u64;
+    } storage[NP_EVENT_STORAGE_WORDS];
+};
+
+/**
+ * Define NP_EVENT_QUEUE_STATS as 0 to build the event queues without
+ * statistics, the queues then do not keep an np_event_queue_stats and
+ * do not read the clock for the latencies.
+ */
+#ifndef NP_EVENT_QUEUE_STATS
+#define NP_EVENT_QUEUE_STATS 1
+#endif
+
+/**
+ * The number of buckets in an event queue histogram and the number of
+ * distinct callbacks the callback durations are kept for.
+ */
+#ifndef NP_EVENT_QUEUE_HISTOGRAM_BUCKETS
+#define NP_EVENT_QUEUE_HISTOGRAM_BUCKETS 24
+#endif
+
+#ifndef NP_EVENT_QUEUE_STATS_CALLBACKS
+#define NP_EVENT_QUEUE_STATS_CALLBACKS 64
+#endif
+
+/**
+ * A histogram with log2 sized buckets. Bucket 0 counts the value 0,
+ * bucket i counts values in [2^(i-1), 2^i) and the last bucket also
+ * counts all larger values.
+ */
+struct np_event_queue_histogram {
+    uint64_t buckets[NP_EVENT_QUEUE_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint32_t max;
+};
+
+/**
+ * The durations of the callbacks of events with the same callback
+ * function.
+ */
+struct np_event_queue_callback_stats {
+    np_event_callback cb;
+    struct np_event_queue_histogram duration;
+};
+
+/**
+ * Statistics for the events the event queue has executed.
+ */
+struct np_event_queue_stats {
+    // The number of ready events which are waiting when an event is
+    // taken for execution.
+    struct np_event_queue_histogram depth;
+    // Microseconds from an event is posted, or a timed event expires,
+    // until its callback is called.
+    struct np_event_queue_histogram latency;
+    // Microseconds the callbacks take.
+    struct np_event_queue_histogram duration;
+    // Callback durations by callback function, the table is open
+    // addressed by the function pointer and entries which are not
+    // used has a NULL cb.
+    struct np_event_queue_callback_stats callbacks[NP_EVENT_QUEUE_STATS_CALLBACKS];
+    // Durations of callbacks which did not fit in the callbacks table.
+    struct np_event_queue_histogram otherCallbacks;
+};
 
 struct np_event_queue_functions;
 
@@ -33,7 +114,26 @@ struct np_event_queue {
 
 struct np_event_queue_functions {
     /**
-     * Create a new event
+     * Initialize an event which is owned by the caller. Initializing
+     * an event does not allocate memory.
+     *
+     * @param obj  The event queue object.
+     * @param event  The event to initialize.
+     * @param cb  The callback to associate with the event.
+     * @param cbData  The data to associate with the callback.
+     */
+    void (*init)(struct np_event_queue* obj, struct np_event* event, np_event_callback cb, void* cbData);
+
+    /**
+     * Deinitialize an event, the event is canceled if it is posted.
+     *
+     * @param event  The event.
+     */
+    void (*deinit)(struct np_event* event);
+
+    /**
+     * Allocate and initialize a new event. The allocation is counted,
+     * see event_allocations.
      *
      * @param obj  The event queue object.
      * @param cb  The callback to associate with the event.
@@ -44,13 +144,15 @@ struct np_event_queue_functions {
     np_error_code (*create)(struct np_event_queue* obj, np_event_callback cb, void* cbData, struct np_event** event);
 
     /**
-     * Destroy an event.
+     * Destroy an event created with create.
      * @param event  The event.
      */
     void (*destroy)(struct np_event* event);
 
     /**
-     * Post the event to the event queue
+     * Post the event to the event queue. Posting an event which is
+     * already posted or is a timed event is an error, the post is
+     * ignored and logged.
      *
      * @param event
      */
@@ -59,7 +161,8 @@ struct np_event_queue_functions {
     /**
      * Post an event which has the chance of being double
      * posted. i.e. be added to the event queue before it has been
-     * executed.
+     * executed. If the event is already posted or is a timed event
+     * the post is ignored.
      *
      * @param event  The event.
      */
@@ -80,6 +183,38 @@ struct np_event_queue_functions {
      */
     void (*post_timed)(struct np_event* event, uint32_t milliseconds);
 
+    /**
+     * Optional. Set the max number of ready events which are executed
+     * each time the core mutex is taken. Batching events saves lock
+     * traffic under load, a smaller batch lets threads waiting for
+     * the core mutex in earlier.
+     *
+     * @param obj  The event queue object.
+     * @param batchSize  The max number of events in a batch, at least 1.
+     * @return NABTO_EC_OK  iff the batch size is set.
+     */
+    np_error_code (*set_batch_size)(struct np_event_queue* obj, size_t batchSize);
+
+    /**
+     * Optional. Get the number of events which has been allocated by
+     * create. Events which are embedded in their owner and
+     * initialized with init are not counted, such that the count
+     * shows if events are allocated on the hot path.
+     *
+     * @param obj  The event queue object.
+     * @return The number of allocated events.
+     */
+    size_t (*event_allocations)(struct np_event_queue* obj);
+
+    /**
+     * Optional. Get a copy of the statistics for the executed events.
+     * NULL if the event queue is built without NP_EVENT_QUEUE_STATS.
+     *
+     * @param obj  The event queue object.
+     * @param stats  The stats to copy to.
+     */
+    void (*get_stats)(struct np_event_queue* obj, struct np_event_queue_stats* stats);
+
 };
 
 #ifdef __cplusplus
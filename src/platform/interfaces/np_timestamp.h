@@ -25,6 +25,17 @@ struct np_timestamp_functions {
      * @return  The current timestamp in milliseconds.
      */
     uint32_t (*now_ms)(struct np_timestamp* obj);
+
+    /**
+     * Optional. Return a timestamp in microseconds which wraps around
+     * whenever the value reaches 2^32. It is used to measure short
+     * durations such as the time an event callback takes, so it
+     * should not be cached like the millisecond timestamp can be.
+     *
+     * @param  obj  The timestamp object.
+     * @return  The current timestamp in microseconds.
+     */
+    uint32_t (*now_us)(struct np_timestamp* obj);
 };
 
 #ifdef __cplusplus
@@ -18,6 +18,26 @@ struct np_udp_endpoint {
     uint16_t port;
 };
 
+/**
+ * A single datagram slot used by recv_batch. The caller provides the
+ * buffer and bufferSize, the implementation fills in ep and recvSize.
+ */
+struct np_udp_recv_entry {
+    struct np_udp_endpoint ep;
+    uint8_t* buffer;
+    size_t bufferSize;
+    size_t recvSize;
+};
+
+/**
+ * A single datagram used by async_send_batch.
+ */
+struct np_udp_send_entry {
+    struct np_udp_endpoint ep;
+    uint8_t* buffer;
+    uint16_t bufferSize;
+};
+
 struct np_udp {
     const struct np_udp_functions* mptr;
     // Pointer to data which is implementation specific.
@@ -84,6 +104,23 @@ struct np_udp_functions {
      */
     void (*async_bind_port)(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
 
+    /**
+     * Bind a socket to a port which can be shared with other sockets
+     * bound the same way, e.g. by setting SO_REUSEPORT before the
+     * bind. The kernel distributes the incoming flows between the
+     * sockets sharing the port such that the packets from one remote
+     * endpoint always arrives at the same socket.
+     *
+     * This is an optional function, if it is NULL
+     * np_udp_async_bind_port_shared resolves the completion event
+     * with NABTO_EC_NOT_SUPPORTED.
+     *
+     * @param sock  The socket resource;
+     * @param port  The port to bind to, 0 means ephemeral port.
+     * @param completionEvent  The event to be resolved when the socket is bound and ready to be used.
+     */
+    void (*async_bind_port_shared)(struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+
     /**
      * Send packet async. It's the responsibility of the caller to
      * keep the ep and buffer alive until the completion event is
@@ -104,6 +141,29 @@ struct np_udp_functions {
                           uint8_t* buffer, uint16_t bufferSize,
                           struct np_completion_event* completionEvent);
 
+    /**
+     * Send several packets in one operation. This is an optional
+     * function, if it is NULL np_udp_async_send_batch resolves the
+     * completion event with NABTO_EC_NOT_SUPPORTED, use
+     * np_udp_has_send_batch to test for support.
+     *
+     * The entries can have different endpoints. It's the
+     * responsibility of the caller to keep the entries and the
+     * buffers alive until the completion event is resolved.
+     *
+     * The completion event is resolved with NABTO_EC_OK if the
+     * packets was handed to the network. Like async_send_to packets
+     * which cannot be sent because the socket would block are
+     * dropped and left for the upper layers to retransmit.
+     *
+     * @param sock  The socket resource.
+     * @param entries  The packets to send.
+     * @param entriesSize  The number of packets to send.
+     * @param completionEvent  The completion event, which is resolved when all the packets has been sent.
+     */
+    void (*async_send_batch)(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                             struct np_completion_event* completionEvent);
+
     /**
      * Wait for a packet to be ready to be received. This needs to be
      * combined with recv_from.
@@ -143,6 +203,25 @@ struct np_udp_functions {
      */
     np_error_code (*recv_from)(struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* recvSize);
 
+    /**
+     * Recv up to entriesSize UDP packets from a socket in one
+     * operation. This is an optional function, if it is NULL the
+     * wrapper falls back to calling recv_from once.
+     *
+     * Like recv_from this is called after async_recv_wait has
+     * resolved with NABTO_EC_OK.
+     *
+     * @param sock  The socket resource
+     * @param entries  Array of entries, each entry has a buffer and bufferSize
+     *                 provided by the caller.
+     * @param entriesSize  The number of entries in the array.
+     * @param received  The number of entries which has been filled with a packet.
+     * @return NABTO_EC_OK iff one or more packets was received.
+     *         NABTO_EC_AGAIN if the socket does not have ready data or the retrieval would have blocked.
+     *         NABTO_EC_EOF if no more data can be received from the socket.
+     */
+    np_error_code (*recv_batch)(struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received);
+
     /**
      * Get the local port number
      *
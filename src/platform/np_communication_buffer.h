@@ -13,6 +13,17 @@
 extern "C" {
 #endif
 
+/**
+ * Every communication buffer has this many bytes of headroom in front
+ * of start(). A layer can prepend a header to the data in the buffer
+ * by writing it into the headroom and using start()-headerSize as the
+ * new start, instead of moving the data. Likewise a header is
+ * stripped by advancing the pointer.
+ */
+#ifndef NP_COMMUNICATION_BUFFER_HEADROOM
+#define NP_COMMUNICATION_BUFFER_HEADROOM 16
+#endif
+
 struct np_communication_buffer;
 
 struct np_platform;
@@ -20,7 +31,9 @@ struct np_platform;
 struct np_communication_buffer_module {
     struct np_communication_buffer* (*allocate)(void);
     void (*free)(struct np_communication_buffer*);
+    // start of the data, NP_COMMUNICATION_BUFFER_HEADROOM bytes into the buffer.
     uint8_t* (*start)(struct np_communication_buffer*);
+    // size of the data area, the headroom is not included.
     uint16_t (*size)(struct np_communication_buffer*);
 };
 
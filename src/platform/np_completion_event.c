@@ -15,12 +15,13 @@ np_error_code np_completion_event_init(struct np_event_queue* eq, struct np_comp
     completionEvent->userData = userData;
     completionEvent->eq = *eq;
 
-    return np_event_queue_create_event(eq, &resolve_event_callback, completionEvent, &completionEvent->event);
+    np_event_queue_init_event(eq, &completionEvent->event, &resolve_event_callback, completionEvent);
+    return NABTO_EC_OK;
 }
 
 void np_completion_event_deinit(struct np_completion_event* completionEvent)
 {
-    np_event_queue_destroy_event(&completionEvent->eq, completionEvent->event);
+    np_event_queue_deinit_event(&completionEvent->eq, &completionEvent->event);
 }
 
 void np_completion_event_reinit(struct np_completion_event* completionEvent, np_completion_event_callback cb, void* userData)
@@ -34,7 +35,7 @@ void np_completion_event_reinit(struct np_completion_event* completionEvent, np_
 void np_completion_event_resolve(struct np_completion_event* completionEvent, np_error_code ec)
 {
     completionEvent->ec = ec;
-    np_event_queue_post(&completionEvent->eq, completionEvent->event);
+    np_event_queue_post(&completionEvent->eq, &completionEvent->event);
 }
 
 
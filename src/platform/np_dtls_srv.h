@@ -3,6 +3,7 @@
 
 #include <platform/np_error_code.h>
 #include <platform/np_dtls.h>
+#include <platform/np_communication_buffer.h>
 
 /**
  * DTLS Server interface
@@ -21,9 +22,26 @@ enum np_dtls_srv_event {
     NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE
 };
 
+/**
+ * An encrypted DTLS record which is ready to be sent to the network.
+ *
+ * The buffer has NP_COMMUNICATION_BUFFER_HEADROOM bytes of headroom,
+ * the sender can prepend up to that many bytes of header in front of
+ * it.
+ */
+struct np_dtls_srv_record {
+    uint8_t* buffer;
+    uint16_t bufferSize;
+};
+
 typedef void (*np_dtls_srv_send_callback)(const np_error_code ec, void* data);
+
+/**
+ * Send a burst of one or more records on the given channel. The
+ * records and buffers are kept alive until the callback is invoked.
+ */
 typedef np_error_code (*np_dtls_srv_sender)(uint8_t channelId,
-                                            uint8_t* buffer, uint16_t bufferSize,
+                                            struct np_dtls_srv_record* records, size_t recordsSize,
                                             np_dtls_srv_send_callback cb, void* data,
                                             void* senderData);
 typedef void (*np_dtls_srv_event_handler)(enum np_dtls_srv_event event, void* data);
@@ -77,6 +95,68 @@ struct np_dtls_srv_module {
     const char* (*get_alpn_protocol)(struct np_dtls_srv_connection* ctx);
 
     np_error_code (*get_packet_count)(struct np_dtls_srv_connection* ctx, uint32_t* recvCount, uint32_t* sentCount);
+
+    /**
+     * Set the max number of concurrent connections. The connections
+     * and their buffers are preallocated in a pool of this size,
+     * create_connection returns NABTO_EC_OUT_OF_CONNECTIONS when the
+     * pool is exhausted.
+     *
+     * @return NABTO_EC_OK if the pool was resized
+     *         NABTO_EC_INVALID_ARGUMENT if maxConnections is 0
+     *         NABTO_EC_INVALID_STATE if connections in the pool are in use.
+     */
+    np_error_code (*set_max_connections)(struct np_dtls_srv* server, size_t maxConnections);
+
+    /**
+     * Get the number of bytes used by a connection.
+     */
+    size_t (*get_connection_memory_cost)(struct np_dtls_srv* server);
+
+    /**
+     * Get the number of bytes retained by an existing connection. It
+     * can be lower than the memory cost once the handshake is done,
+     * since the handshake state is released and the record buffers
+     * are shrunk if the client negotiated smaller records.
+     */
+    size_t (*get_connection_memory_usage)(struct np_dtls_srv_connection* ctx);
+
+    /**
+     * Release the state of an established connection which is not
+     * needed while it is idle, such that only its keys and record
+     * state are kept. The connection is woken up transparently by the
+     * next packet or send.
+     *
+     * @return NABTO_EC_OK if the connection is hibernated
+     *         NABTO_EC_OPERATION_IN_PROGRESS if records are being sent
+     *         NABTO_EC_INVALID_STATE if the connection is not established
+     *         NABTO_EC_NOT_SUPPORTED if the implementation cannot hibernate connections.
+     */
+    np_error_code (*hibernate)(struct np_dtls_srv_connection* ctx);
+
+    /**
+     * Statelessly verify the cookie in a ClientHello before a
+     * connection is created for it. The client id identifies the
+     * transport of the client, e.g. its address.
+     *
+     * If the ClientHello does not contain a valid cookie a
+     * HelloVerifyRequest is written to response, the caller sends it
+     * to the client.
+     *
+     * @return NABTO_EC_OK if the cookie is valid and a connection can be created.
+     *         NABTO_EC_AGAIN if a HelloVerifyRequest was written to response.
+     *         NABTO_EC_INVALID_ARGUMENT if the packet is not a ClientHello.
+     */
+    np_error_code (*verify_client_hello)(struct np_dtls_srv* server,
+                                         const uint8_t* clientId, size_t clientIdSize,
+                                         const uint8_t* packet, size_t packetSize,
+                                         uint8_t* response, size_t* responseSize);
+
+    /**
+     * Set the client id of a new connection, it has to be the id the
+     * ClientHello was verified with.
+     */
+    np_error_code (*set_client_id)(struct np_dtls_srv_connection* ctx, const uint8_t* clientId, size_t clientIdSize);
 };
 
 #ifdef __cplusplus
@@ -4,6 +4,16 @@
 
 #define LOG NABTO_LOG_MODULE_EVENT_QUEUE
 
+void np_event_queue_init_event(struct np_event_queue* eq, struct np_event* event, np_event_callback cb, void* data)
+{
+    eq->mptr->init(eq, event, cb, data);
+}
+
+void np_event_queue_deinit_event(struct np_event_queue* eq, struct np_event* event)
+{
+    eq->mptr->deinit(event);
+}
+
 np_error_code np_event_queue_create_event(struct np_event_queue* eq, np_event_callback cb, void* data, struct np_event** event)
 {
     return eq->mptr->create(eq, cb, data, event);
@@ -40,3 +50,29 @@ void np_event_queue_cancel_event(struct np_event_queue* eq, struct np_event* ev)
 {
     eq->mptr->cancel(ev);
 }
+
+np_error_code np_event_queue_set_batch_size(struct np_event_queue* eq, size_t batchSize)
+{
+    if (eq->mptr->set_batch_size == NULL) {
+        return NABTO_EC_NOT_IMPLEMENTED;
+    }
+    return eq->mptr->set_batch_size(eq, batchSize);
+}
+
+np_error_code np_event_queue_get_event_allocations(struct np_event_queue* eq, size_t* allocations)
+{
+    if (eq->mptr->event_allocations == NULL) {
+        return NABTO_EC_NOT_IMPLEMENTED;
+    }
+    *allocations = eq->mptr->event_allocations(eq);
+    return NABTO_EC_OK;
+}
+
+np_error_code np_event_queue_get_stats(struct np_event_queue* eq, struct np_event_queue_stats* stats)
+{
+    if (eq->mptr->get_stats == NULL) {
+        return NABTO_EC_NOT_IMPLEMENTED;
+    }
+    eq->mptr->get_stats(eq, stats);
+    return NABTO_EC_OK;
+}
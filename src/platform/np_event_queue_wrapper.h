@@ -12,12 +12,22 @@ extern "C" {
  */
 
 /**
- * Create a new event.
+ * Initialize an event which is embedded in its owner.
+ */
+void np_event_queue_init_event(struct np_event_queue* eq, struct np_event* event, np_event_callback cb, void* data);
+
+/**
+ * Deinitialize an event.
+ */
+void np_event_queue_deinit_event(struct np_event_queue* eq, struct np_event* event);
+
+/**
+ * Allocate a new event, prefer an event embedded in its owner.
  */
 np_error_code np_event_queue_create_event(struct np_event_queue* eq, np_event_callback cb, void* data, struct np_event** event);
 
 /**
- * Destroy an event.
+ * Destroy an allocated event.
  */
 void np_event_queue_destroy_event(struct np_event_queue* eq, struct np_event* event);
 
@@ -37,6 +47,27 @@ void np_event_queue_post_timed_event(struct np_event_queue* eq, struct np_event*
 
 void np_event_queue_cancel_event(struct np_event_queue* eq, struct np_event* ev);
 
+/**
+ * Set the batch size of the event queue.
+ *
+ * @return NABTO_EC_NOT_IMPLEMENTED if the event queue executes one event at a time.
+ */
+np_error_code np_event_queue_set_batch_size(struct np_event_queue* eq, size_t batchSize);
+
+/**
+ * Get the number of events which has been allocated with np_event_queue_create_event.
+ *
+ * @return NABTO_EC_NOT_IMPLEMENTED if the event queue does not count allocations.
+ */
+np_error_code np_event_queue_get_event_allocations(struct np_event_queue* eq, size_t* allocations);
+
+/**
+ * Get the statistics for the executed events.
+ *
+ * @return NABTO_EC_NOT_IMPLEMENTED if the event queue does not keep statistics.
+ */
+np_error_code np_event_queue_get_stats(struct np_event_queue* eq, struct np_event_queue_stats* stats);
+
 #ifdef __cplusplus
 } //extern "C"
 #endif
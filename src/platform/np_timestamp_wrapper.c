@@ -5,6 +5,14 @@ uint32_t np_timestamp_now_ms(struct np_timestamp* obj)
     return obj->mptr->now_ms(obj);
 }
 
+uint32_t np_timestamp_now_us(struct np_timestamp* obj)
+{
+    if (obj->mptr->now_us == NULL) {
+        return obj->mptr->now_ms(obj) * 1000;
+    }
+    return obj->mptr->now_us(obj);
+}
+
 bool np_timestamp_passed_or_now(struct np_timestamp* obj, uint32_t stamp)
 {
     return np_timestamp_less_or_equal(stamp, np_timestamp_now_ms(obj));
@@ -13,6 +13,12 @@ extern "C" {
  */
 uint32_t np_timestamp_now_ms(struct np_timestamp* obj);
 
+/**
+ * Get the microsecond timestamp, the millisecond timestamp is used
+ * if the platform does not implement now_us.
+ */
+uint32_t np_timestamp_now_us(struct np_timestamp* obj);
+
 
 /**
  * Timestamp helper functions
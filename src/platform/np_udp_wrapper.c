@@ -1,5 +1,7 @@
 #include "np_udp_wrapper.h"
 
+#include "np_completion_event.h"
+
 // Wrapper functions for the functionality. See above struct for documentation for the functions.
 np_error_code np_udp_create(struct np_udp* udp, struct np_udp_socket** sock)
 {
@@ -21,6 +23,20 @@ void np_udp_async_bind_port(struct np_udp* udp, struct np_udp_socket* sock, uint
     return udp->mptr->async_bind_port(sock, port, completionEvent);
 }
 
+void np_udp_async_bind_port_shared(struct np_udp* udp, struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent)
+{
+    if (udp->mptr->async_bind_port_shared == NULL) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_NOT_SUPPORTED);
+        return;
+    }
+    return udp->mptr->async_bind_port_shared(sock, port, completionEvent);
+}
+
+bool np_udp_has_bind_port_shared(struct np_udp* udp)
+{
+    return udp->mptr->async_bind_port_shared != NULL;
+}
+
 void np_udp_async_send_to(struct np_udp* udp,
                                  struct np_udp_socket* sock, struct np_udp_endpoint* ep,
                                  uint8_t* buffer, uint16_t bufferSize,
@@ -29,6 +45,22 @@ void np_udp_async_send_to(struct np_udp* udp,
     return udp->mptr->async_send_to(sock, ep, buffer, bufferSize, completionEvent);
 }
 
+void np_udp_async_send_batch(struct np_udp* udp, struct np_udp_socket* sock,
+                             struct np_udp_send_entry* entries, size_t entriesSize,
+                             struct np_completion_event* completionEvent)
+{
+    if (udp->mptr->async_send_batch == NULL) {
+        np_completion_event_resolve(completionEvent, NABTO_EC_NOT_SUPPORTED);
+        return;
+    }
+    return udp->mptr->async_send_batch(sock, entries, entriesSize, completionEvent);
+}
+
+bool np_udp_has_send_batch(struct np_udp* udp)
+{
+    return udp->mptr->async_send_batch != NULL;
+}
+
 void np_udp_async_recv_wait(struct np_udp* udp, struct np_udp_socket* sock, struct np_completion_event* completionEvent)
 {
     return udp->mptr->async_recv_wait(sock, completionEvent);
@@ -39,6 +71,22 @@ np_error_code np_udp_recv_from(struct np_udp* udp, struct np_udp_socket* sock, s
     return udp->mptr->recv_from(sock, ep, buffer, bufferSize, recvSize);
 }
 
+np_error_code np_udp_recv_batch(struct np_udp* udp, struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received)
+{
+    if (udp->mptr->recv_batch != NULL) {
+        return udp->mptr->recv_batch(sock, entries, entriesSize, received);
+    }
+    // fallback for implementations without batch support.
+    *received = 0;
+    if (entriesSize == 0) {
+        return NABTO_EC_OK;
+    }
+    np_error_code ec = udp->mptr->recv_from(sock, &entries[0].ep, entries[0].buffer, entries[0].bufferSize, &entries[0].recvSize);
+    if (ec == NABTO_EC_OK) {
+        *received = 1;
+    }
+    return ec;
+}
 
 uint16_t np_udp_get_local_port(struct np_udp* udp, struct np_udp_socket* sock)
 {
@@ -16,15 +16,32 @@ void np_udp_abort(struct np_udp* udp, struct np_udp_socket* sock);
 
 void np_udp_async_bind_port(struct np_udp* udp, struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
 
+void np_udp_async_bind_port_shared(struct np_udp* udp, struct np_udp_socket* sock, uint16_t port, struct np_completion_event* completionEvent);
+
+/**
+ * Test if the udp implementation has the optional async_bind_port_shared function.
+ */
+bool np_udp_has_bind_port_shared(struct np_udp* udp);
+
 void np_udp_async_send_to(struct np_udp* udp,
                           struct np_udp_socket* sock, struct np_udp_endpoint* ep,
                           uint8_t* buffer, uint16_t bufferSize,
                           struct np_completion_event* completionEvent);
 
+void np_udp_async_send_batch(struct np_udp* udp, struct np_udp_socket* sock,
+                             struct np_udp_send_entry* entries, size_t entriesSize,
+                             struct np_completion_event* completionEvent);
+
+/**
+ * Test if the udp implementation has the optional async_send_batch function.
+ */
+bool np_udp_has_send_batch(struct np_udp* udp);
+
 void np_udp_async_recv_wait(struct np_udp* udp, struct np_udp_socket* sock, struct np_completion_event* completionEvent);
 
 np_error_code np_udp_recv_from(struct np_udp* udp, struct np_udp_socket* sock, struct np_udp_endpoint* ep, uint8_t* buffer, size_t bufferSize, size_t* recvSize);
 
+np_error_code np_udp_recv_batch(struct np_udp* udp, struct np_udp_socket* sock, struct np_udp_recv_entry* entries, size_t entriesSize, size_t* received);
 
 uint16_t np_udp_get_local_port(struct np_udp* udp, struct np_udp_socket* sock);
 
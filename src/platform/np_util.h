@@ -14,6 +14,7 @@ extern "C" {
 // header include order then becomes an issue.
 
 #define NP_MAX(a,b) (((a)>(b))?(a):(b))
+#define NP_MIN(a,b) (((a)<(b))?(a):(b))
 
 bool np_hex_to_data_length(const char* hex, size_t hexLength, uint8_t* data, size_t dataLength);
 bool np_hex_to_data(const char* hex, uint8_t* data, size_t dataLength);
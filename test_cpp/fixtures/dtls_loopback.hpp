@@ -0,0 +1,314 @@
+#pragma once
+
+#include <platform/np_platform.h>
+#include <platform/np_dtls_srv.h>
+#include <platform/np_dtls_cli.h>
+#include <platform/np_event_queue_wrapper.h>
+
+#include <fixtures/dtls_server/test_certificates.hpp>
+
+#include <boost/test/unit_test.hpp>
+
+#include <array>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <vector>
+
+namespace nabto {
+namespace test {
+
+/**
+ * A DTLS client and a DTLS server connection which exchange packets
+ * through the event queue instead of a socket. The ClientHello cookie
+ * is verified before the server connection is created, like
+ * nc_client_connection_dispatch does.
+ *
+ * The hooks are called on the event queue.
+ */
+class DtlsLoopback {
+ public:
+    struct Packet {
+        std::vector<uint8_t> data;
+    };
+
+    struct Callback {
+        void (*cb)(const np_error_code ec, void* data);
+        void* data;
+    };
+
+    DtlsLoopback(struct np_platform* pl, struct np_dtls_srv* server, uint8_t clientId)
+        : pl_(pl), server_(server), clientId_(clientId)
+    {
+        np_event_queue_init_event(&pl_->eq, &deliverEvent_, &DtlsLoopback::deliver, this);
+        np_event_queue_init_event(&pl_->eq, &connectEvent_, &DtlsLoopback::connectEvent, this);
+        np_event_queue_init_event(&pl_->eq, &executeEvent_, &DtlsLoopback::executeEvent, this);
+        BOOST_TEST(pl_->dtlsC.create(pl_, &client_, &DtlsLoopback::clientSender, &DtlsLoopback::clientData, &DtlsLoopback::clientEvent, this) == NABTO_EC_OK);
+        BOOST_TEST(pl_->dtlsC.set_keys(client_,
+                                       reinterpret_cast<const unsigned char*>(clientPublicKey.c_str()), clientPublicKey.size(),
+                                       reinterpret_cast<const unsigned char*>(clientPrivateKey.c_str()), clientPrivateKey.size()) == NABTO_EC_OK);
+    }
+
+    /**
+     * Call when the event queue is stopped.
+     */
+    void destroy()
+    {
+        if (connection_ != NULL) {
+            pl_->dtlsS.destroy_connection(connection_);
+        }
+        pl_->dtlsC.destroy(client_);
+        np_event_queue_deinit_event(&pl_->eq, &deliverEvent_);
+        np_event_queue_deinit_event(&pl_->eq, &connectEvent_);
+        np_event_queue_deinit_event(&pl_->eq, &executeEvent_);
+    }
+
+    void start()
+    {
+        np_event_queue_post(&pl_->eq, &connectEvent_);
+    }
+
+    /**
+     * Call on the event queue. The server connection is destroyed and
+     * the client connects again, offering the session of its last
+     * handshake.
+     */
+    void reconnect()
+    {
+        if (connection_ != NULL) {
+            pl_->dtlsS.destroy_connection(connection_);
+            connection_ = NULL;
+        }
+        BOOST_TEST(pl_->dtlsC.reset(client_) == NABTO_EC_OK);
+        BOOST_TEST(pl_->dtlsC.connect(client_) == NABTO_EC_OK);
+    }
+
+    /**
+     * Call on the event queue. The data is sent from the server
+     * connection to the client.
+     */
+    np_error_code serverSend(const std::vector<uint8_t>& data)
+    {
+        serverSends_.push_back(ServerSend());
+        ServerSend& send = serverSends_.back();
+        send.data = data;
+        send.ctx.buffer = send.data.data();
+        send.ctx.bufferSize = (uint16_t)send.data.size();
+        send.ctx.channelId = 0;
+        send.ctx.cb = &DtlsLoopback::sent;
+        send.ctx.data = NULL;
+        return pl_->dtlsS.async_send_data(pl_, connection_, &send.ctx);
+    }
+
+    /**
+     * Call on the event queue. The data is sent from the client to the
+     * server connection.
+     */
+    np_error_code clientSend(const std::vector<uint8_t>& data)
+    {
+        clientSends_.push_back(ClientSend());
+        ClientSend& send = clientSends_.back();
+        send.data = data;
+        send.ctx.buffer = send.data.data();
+        send.ctx.bufferSize = (uint16_t)send.data.size();
+        send.ctx.cb = &DtlsLoopback::sent;
+        send.ctx.data = NULL;
+        return pl_->dtlsC.async_send_data(client_, &send.ctx);
+    }
+
+    /**
+     * Run f on the event queue and wait for it to return.
+     */
+    void execute(std::function<void ()> f)
+    {
+        std::promise<void> done;
+        execute_ = [&f, &done]() {
+            f();
+            done.set_value();
+        };
+        np_event_queue_post(&pl_->eq, &executeEvent_);
+        done.get_future().get();
+    }
+
+    std::function<void (enum np_dtls_srv_event event)> serverEvent_;
+    std::function<void (uint8_t* buffer, uint16_t bufferSize)> serverData_;
+    std::function<void (enum np_dtls_cli_event event)> clientEvent_;
+    std::function<void (uint8_t* buffer, uint16_t bufferSize)> clientData_;
+
+    // Number of plaintext Certificate handshake records the server has
+    // sent, a resumed session is abbreviated without them.
+    size_t serverCertificateRecords_ = 0;
+
+    struct np_platform* pl_;
+    struct np_dtls_srv* server_;
+    struct np_dtls_cli_context* client_ = NULL;
+    struct np_dtls_srv_connection* connection_ = NULL;
+
+ private:
+    struct ServerSend {
+        struct np_dtls_srv_send_context ctx;
+        std::vector<uint8_t> data;
+    };
+
+    struct ClientSend {
+        struct np_dtls_cli_send_context ctx;
+        std::vector<uint8_t> data;
+    };
+
+    static void sent(const np_error_code ec, void* data)
+    {
+        (void)data;
+        BOOST_TEST(ec == NABTO_EC_OK);
+    }
+
+    static void connectEvent(void* data)
+    {
+        DtlsLoopback* self = (DtlsLoopback*)data;
+        BOOST_TEST(self->pl_->dtlsC.connect(self->client_) == NABTO_EC_OK);
+    }
+
+    static void executeEvent(void* data)
+    {
+        DtlsLoopback* self = (DtlsLoopback*)data;
+        self->execute_();
+    }
+
+    static np_error_code clientSender(uint8_t* buffer, uint16_t bufferSize,
+                                      np_dtls_cli_send_callback cb, void* data,
+                                      void* senderData)
+    {
+        DtlsLoopback* self = (DtlsLoopback*)senderData;
+        self->toServer_.push_back(Packet{std::vector<uint8_t>(buffer, buffer + bufferSize)});
+        self->callbacks_.push_back(Callback{cb, data});
+        np_event_queue_post_maybe_double(&self->pl_->eq, &self->deliverEvent_);
+        return NABTO_EC_OK;
+    }
+
+    static np_error_code serverSender(uint8_t channelId,
+                                      struct np_dtls_srv_record* records, size_t recordsSize,
+                                      np_dtls_srv_send_callback cb, void* data,
+                                      void* senderData)
+    {
+        (void)channelId;
+        DtlsLoopback* self = (DtlsLoopback*)senderData;
+        for (size_t i = 0; i < recordsSize; i++) {
+            self->countCertificates(records[i].buffer, records[i].bufferSize);
+            self->toClient_.push_back(Packet{std::vector<uint8_t>(records[i].buffer, records[i].buffer + records[i].bufferSize)});
+        }
+        self->callbacks_.push_back(Callback{cb, data});
+        np_event_queue_post_maybe_double(&self->pl_->eq, &self->deliverEvent_);
+        return NABTO_EC_OK;
+    }
+
+    void countCertificates(const uint8_t* buffer, size_t bufferSize)
+    {
+        // a datagram can contain several records.
+        size_t offset = 0;
+        while (offset + 14 <= bufferSize) {
+            size_t length = ((size_t)buffer[offset + 11] << 8) | buffer[offset + 12];
+            bool plaintext = buffer[offset + 3] == 0 && buffer[offset + 4] == 0;
+            if (buffer[offset] == 22 && plaintext && buffer[offset + 13] == 11) {
+                serverCertificateRecords_++;
+            }
+            offset += 13 + length;
+        }
+    }
+
+    /**
+     * Deliver the packets sent so far and complete their send
+     * operations, packets sent meanwhile are delivered in the next
+     * turn.
+     */
+    static void deliver(void* data)
+    {
+        DtlsLoopback* self = (DtlsLoopback*)data;
+        std::deque<Packet> toServer;
+        std::deque<Packet> toClient;
+        std::deque<Callback> callbacks;
+        toServer.swap(self->toServer_);
+        toClient.swap(self->toClient_);
+        callbacks.swap(self->callbacks_);
+
+        for (auto& p : toServer) {
+            self->serverReceive(p.data);
+        }
+        for (auto& p : toClient) {
+            self->pl_->dtlsC.handle_packet(self->client_, p.data.data(), (uint16_t)p.data.size());
+        }
+        for (auto& c : callbacks) {
+            c.cb(NABTO_EC_OK, c.data);
+        }
+    }
+
+    void serverReceive(std::vector<uint8_t>& packet)
+    {
+        if (connection_ == NULL) {
+            std::array<uint8_t, 128> response;
+            size_t responseSize = response.size();
+            np_error_code ec = pl_->dtlsS.verify_client_hello(server_, &clientId_, 1,
+                                                              packet.data(), packet.size(),
+                                                              response.data(), &responseSize);
+            if (ec == NABTO_EC_AGAIN) {
+                toClient_.push_back(Packet{std::vector<uint8_t>(response.data(), response.data() + responseSize)});
+                np_event_queue_post_maybe_double(&pl_->eq, &deliverEvent_);
+                return;
+            } else if (ec != NABTO_EC_OK) {
+                // e.g. a record for a connection which has been destroyed.
+                return;
+            }
+            BOOST_TEST(pl_->dtlsS.create_connection(server_, &connection_, &DtlsLoopback::serverSender,
+                                                    &DtlsLoopback::serverDataHandler, &DtlsLoopback::serverEventHandler, this) == NABTO_EC_OK);
+            BOOST_TEST(pl_->dtlsS.set_client_id(connection_, &clientId_, 1) == NABTO_EC_OK);
+        }
+        pl_->dtlsS.handle_packet(pl_, connection_, 0, packet.data(), (uint16_t)packet.size());
+    }
+
+    static void serverDataHandler(uint8_t channelId, uint64_t sequence,
+                                  uint8_t* buffer, uint16_t bufferSize, void* data)
+    {
+        (void)channelId; (void)sequence;
+        DtlsLoopback* self = (DtlsLoopback*)data;
+        if (self->serverData_) {
+            self->serverData_(buffer, bufferSize);
+        }
+    }
+
+    static void serverEventHandler(enum np_dtls_srv_event event, void* data)
+    {
+        DtlsLoopback* self = (DtlsLoopback*)data;
+        if (self->serverEvent_) {
+            self->serverEvent_(event);
+        }
+    }
+
+    static void clientData(uint8_t* buffer, uint16_t bufferSize, void* data)
+    {
+        DtlsLoopback* self = (DtlsLoopback*)data;
+        if (self->clientData_) {
+            self->clientData_(buffer, bufferSize);
+        }
+    }
+
+    static void clientEvent(enum np_dtls_cli_event event, void* data)
+    {
+        DtlsLoopback* self = (DtlsLoopback*)data;
+        if (self->clientEvent_) {
+            self->clientEvent_(event);
+        }
+    }
+
+    uint8_t clientId_;
+    struct np_event deliverEvent_;
+    struct np_event connectEvent_;
+    struct np_event executeEvent_;
+    std::function<void ()> execute_;
+
+    std::deque<Packet> toServer_;
+    std::deque<Packet> toClient_;
+    std::deque<Callback> callbacks_;
+    std::list<ServerSend> serverSends_;
+    std::list<ClientSend> clientSends_;
+};
+
+} } // namespace
@@ -8,6 +8,14 @@
 #include "test_platform_libevent.hpp"
 #endif
 
+#ifdef HAVE_EPOLL_UNIX
+#include "test_platform_epoll_unix.hpp"
+#endif
+
+#ifdef HAVE_LIBURING
+#include "test_platform_io_uring.hpp"
+#endif
+
 #include <vector>
 
 
@@ -36,6 +44,16 @@ std::vector<std::shared_ptr<TestPlatformFactory> > TestPlatformFactory::multi()
 #endif
 #if defined(HAVE_SELECT_UNIX)
     factories.push_back(std::make_shared<TestPlatformSelectUnixFactory>());
+#endif
+#if defined(HAVE_EPOLL_UNIX)
+    factories.push_back(std::make_shared<TestPlatformEpollUnixFactory>());
+#endif
+#if defined(HAVE_LIBURING)
+    // liburing can be present on a kernel which refuses io_uring_setup,
+    // e.g. in containers, then the io_uring platform is skipped.
+    if (TestPlatformIoUringFactory::supported()) {
+        factories.push_back(std::make_shared<TestPlatformIoUringFactory>());
+    }
 #endif
     return factories;
 
@@ -0,0 +1,95 @@
+#include "test_platform_epoll_unix.hpp"
+
+#include <platform/np_platform.h>
+#include <platform/np_logging.h>
+#include <modules/mbedtls/nm_mbedtls_cli.h>
+#include <modules/mbedtls/nm_mbedtls_srv.h>
+#include <modules/mbedtls/nm_mbedtls_random.h>
+#include <modules/dns/unix/nm_unix_dns.h>
+#include <modules/timestamp/unix/nm_unix_timestamp.h>
+#include <modules/epoll_unix/nm_epoll_unix.h>
+#include <modules/logging/test/nm_logging_test.h>
+#include <modules/event_queue/thread_event_queue.h>
+#include <modules/communication_buffer/nm_communication_buffer.h>
+
+namespace nabto {
+namespace test {
+
+
+class TestPlatformEpollUnix : public TestPlatform {
+ public:
+
+    TestPlatformEpollUnix() {
+        mutex_ = nabto_device_threads_create_mutex();
+        init();
+    }
+
+    ~TestPlatformEpollUnix() {
+        stop();
+        deinit();
+        nabto_device_threads_free_mutex(mutex_);
+    }
+
+    virtual void init()
+    {
+        nm_logging_test_init();
+        nm_communication_buffer_init(&pl_);
+        BOOST_REQUIRE(nm_epoll_unix_init(&epollCtx_) == NABTO_EC_OK);
+
+        nm_unix_dns_resolver_init(&dns_);
+
+        pl_.timestamp = nm_unix_ts_get_impl();
+
+        thread_event_queue_init(&eventQueue_, mutex_, &pl_.timestamp);
+
+        pl_.tcp = nm_epoll_unix_tcp_get_impl(&epollCtx_);
+        pl_.udp = nm_epoll_unix_udp_get_impl(&epollCtx_);
+        pl_.dns = nm_unix_dns_resolver_get_impl(&dns_);
+        pl_.eq = thread_event_queue_get_impl(&eventQueue_);
+
+        nm_mbedtls_cli_init(&pl_);
+        nm_mbedtls_srv_init(&pl_);
+        nm_mbedtls_random_init(&pl_);
+
+        nm_unix_dns_resolver_run(&dns_);
+        thread_event_queue_run(&eventQueue_);
+
+        nm_epoll_unix_run(&epollCtx_);
+    }
+
+    void deinit()
+    {
+        nm_mbedtls_random_deinit(&pl_);
+        nm_unix_dns_resolver_deinit(&dns_);
+        nm_epoll_unix_deinit(&epollCtx_);
+        thread_event_queue_deinit(&eventQueue_);
+    }
+
+    virtual void stop()
+    {
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+        nm_epoll_unix_stop(&epollCtx_);
+        thread_event_queue_stop_blocking(&eventQueue_);
+    }
+
+    struct np_platform* getPlatform() {
+        return &pl_;
+    }
+ private:
+    struct np_platform pl_;
+    struct nm_epoll_unix epollCtx_;
+    bool stopped_ = false;
+    struct nm_unix_dns_resolver dns_;
+    struct thread_event_queue eventQueue_;
+    struct nabto_device_mutex* mutex_;
+};
+
+std::shared_ptr<TestPlatform> TestPlatformEpollUnixFactory::create()
+{
+    return std::make_shared<TestPlatformEpollUnix>();
+}
+
+} } // namespace
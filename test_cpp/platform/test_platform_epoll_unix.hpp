@@ -0,0 +1,17 @@
+#pragma once
+
+#include "test_platform.hpp"
+
+namespace nabto {
+namespace test {
+
+/**
+ * The epoll socket structs has the same names as the ones from
+ * select_unix, so the platform is kept in its own translation unit.
+ */
+class TestPlatformEpollUnixFactory : public TestPlatformFactory {
+ public:
+    std::shared_ptr<TestPlatform> create();
+};
+
+} } // namespace
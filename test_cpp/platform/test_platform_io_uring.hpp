@@ -0,0 +1,22 @@
+#pragma once
+
+#include "test_platform.hpp"
+
+namespace nabto {
+namespace test {
+
+/**
+ * The io_uring socket structs has the same names as the ones from
+ * select_unix, so the platform is kept in its own translation unit.
+ */
+class TestPlatformIoUringFactory : public TestPlatformFactory {
+ public:
+    std::shared_ptr<TestPlatform> create();
+
+    /**
+     * @return false if the kernel does not support the io_uring features the module needs.
+     */
+    static bool supported();
+};
+
+} } // namespace
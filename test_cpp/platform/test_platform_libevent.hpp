@@ -5,6 +5,7 @@
 #include <modules/logging/test/nm_logging_test.h>
 #include <modules/mbedtls/nm_mbedtls_cli.h>
 #include <modules/mbedtls/nm_mbedtls_srv.h>
+#include <modules/mbedtls/nm_mbedtls_random.h>
 #include <modules/communication_buffer/nm_communication_buffer.h>
 #include <modules/event_queue/thread_event_queue.h>
 #include <api/nabto_device_threads.h>
@@ -54,6 +55,7 @@ class TestPlatformLibevent : public TestPlatform {
 
         nm_mbedtls_cli_init(&pl_);
         nm_mbedtls_srv_init(&pl_);
+        nm_mbedtls_random_init(&pl_);
 
         thread_event_queue_run(&eventQueue_);
 
@@ -62,6 +64,7 @@ class TestPlatformLibevent : public TestPlatform {
 
     void deinit()
     {
+        nm_mbedtls_random_deinit(&pl_);
         thread_event_queue_deinit(&eventQueue_);
         nm_libevent_deinit(&libeventContext_);
 
@@ -6,6 +6,7 @@
 #include <platform/np_logging.h>
 #include <modules/mbedtls/nm_mbedtls_cli.h>
 #include <modules/mbedtls/nm_mbedtls_srv.h>
+#include <modules/mbedtls/nm_mbedtls_random.h>
 #include <modules/dns/unix/nm_unix_dns.h>
 #include <modules/timestamp/unix/nm_unix_timestamp.h>
 #include <modules/select_unix/nm_select_unix.h>
@@ -55,6 +56,7 @@ class TestPlatformSelectUnix : public TestPlatform {
 
         nm_mbedtls_cli_init(&pl_);
         nm_mbedtls_srv_init(&pl_);
+        nm_mbedtls_random_init(&pl_);
 
         nm_unix_dns_resolver_run(&dns_);
         thread_event_queue_run(&eventQueue_);
@@ -64,6 +66,7 @@ class TestPlatformSelectUnix : public TestPlatform {
 
     void deinit()
     {
+        nm_mbedtls_random_deinit(&pl_);
         nm_unix_dns_resolver_deinit(&dns_);
         nm_select_unix_deinit(&selectCtx_);
         thread_event_queue_deinit(&eventQueue_);
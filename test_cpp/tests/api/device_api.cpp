@@ -1,8 +1,11 @@
 #include <boost/test/unit_test.hpp>
 
 #include <nabto/nabto_device.h>
+#include <nabto/nabto_device_experimental.h>
 #include <api/nabto_device_defines.h>
 
+#include <nlohmann/json.hpp>
+
 #include <thread>
 
 namespace nabto {
@@ -93,4 +96,119 @@ BOOST_AUTO_TEST_CASE(fingerprints)
 
 }
 
+BOOST_AUTO_TEST_CASE(copy_client_fingerprint)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    char small[64];
+    char fp[65];
+    BOOST_TEST(nabto_device_connection_copy_client_fingerprint_full_hex(dev, 42, small, sizeof(small)) == NABTO_DEVICE_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nabto_device_connection_copy_client_fingerprint_full_hex(dev, 42, fp, sizeof(fp)) != NABTO_DEVICE_EC_OK);
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(limit_connections)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    BOOST_TEST(nabto_device_limit_connections(dev, 0) == NABTO_DEVICE_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nabto_device_limit_connections(dev, 4096) == NABTO_DEVICE_EC_OK);
+
+    struct nabto_device_context* d = (struct nabto_device_context*)dev;
+    BOOST_TEST(d->core.clientConnect.maxConnections == (size_t)4096);
+
+    BOOST_TEST(nabto_device_start(dev) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(nabto_device_limit_connections(dev, 10) == NABTO_DEVICE_EC_INVALID_STATE);
+    nabto_device_stop(dev);
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(connection_memory_cost)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    size_t cost = 0;
+    BOOST_TEST(nabto_device_get_connection_memory_cost(dev, &cost) == NABTO_DEVICE_EC_OK);
+    // at least the receive buffer and a send buffer.
+    BOOST_TEST(cost > (size_t)(2*1500));
+
+    size_t usage = 0;
+    BOOST_TEST(nabto_device_connection_get_memory_usage(dev, 42, &usage) != NABTO_DEVICE_EC_OK);
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(event_batch_size)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    BOOST_TEST(nabto_device_set_event_batch_size(dev, 0) == NABTO_DEVICE_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nabto_device_set_event_batch_size(dev, 1) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(nabto_device_set_event_batch_size(dev, 64) == NABTO_DEVICE_EC_OK);
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(event_allocations)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    size_t allocations = 42;
+    BOOST_TEST(nabto_device_get_event_allocations(dev, &allocations) == NABTO_DEVICE_EC_OK);
+    // the core only uses events which are embedded in their owners.
+    BOOST_TEST(allocations == (size_t)0);
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(event_queue_stats)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    char* stats = NULL;
+#if NP_EVENT_QUEUE_STATS
+    BOOST_TEST(nabto_device_get_event_queue_stats(dev, &stats) == NABTO_DEVICE_EC_OK);
+    BOOST_REQUIRE(stats != NULL);
+    auto json = nlohmann::json::parse(stats);
+    nabto_device_string_free(stats);
+    BOOST_TEST(json["depth"]["buckets"].size() == (size_t)NP_EVENT_QUEUE_HISTOGRAM_BUCKETS);
+    BOOST_TEST(json["latencyUs"]["count"].get<uint64_t>() == json["durationUs"]["count"].get<uint64_t>());
+    BOOST_TEST(json["callbacks"].is_array());
+#else
+    BOOST_TEST(nabto_device_get_event_queue_stats(dev, &stats) == NABTO_DEVICE_EC_NOT_IMPLEMENTED);
+#endif
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(connection_idle_timeout)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    BOOST_TEST(nabto_device_set_connection_idle_timeout(dev, 60000) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(nabto_device_set_connection_idle_timeout(dev, 10000) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(nabto_device_set_connection_idle_timeout(dev, 0) == NABTO_DEVICE_EC_OK);
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(handshake_admission)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    BOOST_TEST(nabto_device_set_max_concurrent_handshakes(dev, 2) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(nabto_device_set_handshake_rate_limit(dev, 1, 0, 32, 64) == NABTO_DEVICE_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nabto_device_set_handshake_rate_limit(dev, 1, 1, 33, 64) == NABTO_DEVICE_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nabto_device_set_handshake_rate_limit(dev, 1, 2, 24, 48) == NABTO_DEVICE_EC_OK);
+
+    uint64_t accepted = 42;
+    uint64_t deferred = 42;
+    uint64_t dropped = 42;
+    BOOST_TEST(nabto_device_get_handshake_counters(dev, &accepted, &deferred, &dropped) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(accepted == (uint64_t)0);
+    BOOST_TEST(deferred == (uint64_t)0);
+    BOOST_TEST(dropped == (uint64_t)0);
+    nabto_device_free(dev);
+}
+
+BOOST_AUTO_TEST_CASE(handshake_worker_threads)
+{
+    NabtoDevice* dev = nabto::test::createTestDevice();
+    BOOST_TEST(nabto_device_set_handshake_worker_threads(dev, 17) == NABTO_DEVICE_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nabto_device_set_handshake_worker_threads(dev, 4) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(nabto_device_set_handshake_worker_threads(dev, 2) == NABTO_DEVICE_EC_OK);
+
+    BOOST_TEST(nabto_device_start(dev) == NABTO_DEVICE_EC_OK);
+    BOOST_TEST(nabto_device_set_handshake_worker_threads(dev, 0) == NABTO_DEVICE_EC_INVALID_STATE);
+    nabto_device_stop(dev);
+    nabto_device_free(dev);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -100,6 +100,10 @@ class AttachServer : public AttachCoapServer, public std::enable_shared_from_thi
     void initCoapHandlers() {
         auto self = shared_from_this();
         dtlsServer_.addResourceHandler(NABTO_COAP_CODE_POST, "/device/attach-start", [self](DtlsConnectionPtr connection, std::shared_ptr<CoapServerRequest> request, std::shared_ptr<CoapServerResponse> response) {
+                if (self->accessDenied_) {
+                    connection->accessDenied();
+                    return;
+                }
                 if (self->attachCount_ == self->invalidAttach_) {
                     self->handleDeviceAttachWrongResponse(connection, request, response);
                 } else {
@@ -166,6 +170,8 @@ class AttachServer : public AttachCoapServer, public std::enable_shared_from_thi
 
     std::atomic<uint64_t> attachCount_ = { 0 };
     uint64_t invalidAttach_ = 42;
+    // deny the device access instead of attaching it.
+    std::atomic<bool> accessDenied_ = { false };
 };
 
 
@@ -11,7 +11,9 @@
 #include "attach_server.hpp"
 #include <test_platform.hpp>
 
+#include <cstring>
 #include <future>
+#include <vector>
 
 namespace nabto {
 namespace test {
@@ -24,11 +26,14 @@ class AttachTest {
         serverPort_ = port;
         struct np_platform* pl = tp_.getPlatform();
         np_completion_event_init(&pl->eq, &boundCompletionEvent, &AttachTest::udpDispatchCb, this);
+        memset(&device_, 0, sizeof(device_));
+        nc_keep_alive_sweep_init(&device_.keepAliveSweep, pl);
     }
 
     ~AttachTest()
     {
         nc_attacher_deinit(&attach_);
+        nc_keep_alive_sweep_deinit(&device_.keepAliveSweep);
         nc_coap_client_deinit(&coapClient_);
         nc_udp_dispatch_deinit(&udpDispatch_);
         np_completion_event_deinit(&boundCompletionEvent);
@@ -476,6 +481,147 @@ BOOST_AUTO_TEST_CASE(redirect_loop_break, * boost::unit_test::timeout(300))
     ioService->stop();
 }
 
+namespace {
+
+bool endpointEqual(const struct np_udp_endpoint& a, const struct np_udp_endpoint& b)
+{
+    if (a.port != b.port || a.ip.type != b.ip.type) {
+        return false;
+    }
+    if (a.ip.type == NABTO_IPV4) {
+        return memcmp(a.ip.ip.v4, b.ip.ip.v4, sizeof(a.ip.ip.v4)) == 0;
+    }
+    return memcmp(a.ip.ip.v6, b.ip.ip.v6, sizeof(a.ip.ip.v6)) == 0;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_CASE(reattach_to_last_basestation, * boost::unit_test::timeout(300))
+{
+    // The device reattaches to the endpoint it was attached to without
+    // resolving the attach hostname again.
+    auto ioService = nabto::IoService::create("test");
+    auto attachServer = nabto::test::AttachServer::create(ioService->getIoService());
+
+    auto tp = nabto::test::TestPlatform::create();
+    nabto::test::AttachTest at(*tp, attachServer->getPort());
+
+    struct np_udp_endpoint attachedEp;
+    uint64_t dnsResolves = 0;
+    bool reattachedToAttachedEp = false;
+    at.start([&attachServer, &attachedEp](nabto::test::AttachTest& at){
+                 if (at.attachCount_ == 1 && at.detachCount_ == 0) {
+                     BOOST_TEST(at.attach_.hasActiveEp);
+                     attachedEp = at.attach_.activeEp;
+                     attachServer->niceClose();
+                 }
+                 if (at.attachCount_ == 2) {
+                     at.end();
+                 }
+             },[&attachedEp, &dnsResolves, &reattachedToAttachedEp](nabto::test::AttachTest& at){
+                   if (at.attach_.state == NC_ATTACHER_STATE_DNS) {
+                       dnsResolves++;
+                   }
+                   if (at.attach_.state == NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST &&
+                       at.detachCount_ == 1)
+                   {
+                       reattachedToAttachedEp = at.attach_.usingAttachedEps &&
+                           endpointEqual(at.attach_.initialPacket.endpoints[0], attachedEp);
+                   }
+               });
+
+    at.waitForTestEnd();
+    attachServer->stop();
+    BOOST_TEST(attachServer->attachCount_ == (uint64_t)2);
+    BOOST_TEST(dnsResolves == (uint64_t)1);
+    BOOST_TEST(reattachedToAttachedEp);
+    ioService->stop();
+}
+
+BOOST_AUTO_TEST_CASE(reattach_resolves_dns_when_last_basestation_fails, * boost::unit_test::timeout(300))
+{
+    // The basestation from the last attach is gone, the attach hostname
+    // is resolved right after the failed handshake without waiting for
+    // the retry timeout.
+    auto ioService = nabto::IoService::create("test");
+    auto attachServer = nabto::test::AttachServer::create(ioService->getIoService());
+
+    // means device detaches after ~200ms
+    attachServer->setKeepAliveSettings(100, 50, 2);
+
+    auto tp = nabto::test::TestPlatform::create();
+    nabto::test::AttachTest at(*tp, attachServer->getPort());
+
+    std::vector<enum nc_attacher_attach_state> statesAfterDetach;
+    bool reattachedToAttachedEps = false;
+    at.start([&ioService, &attachServer](nabto::test::AttachTest& at){
+            if (at.attachCount_ == 1 && at.detachCount_ == 0) {
+                attachServer->stop();
+                attachServer = nabto::test::AttachServer::create(ioService->getIoService());
+                at.setDtlsPort(attachServer->getPort());
+            }
+            if (at.attachCount_ == 2 &&
+                at.detachCount_ == 1)
+            {
+                at.end();
+            }
+        },[&statesAfterDetach, &reattachedToAttachedEps](nabto::test::AttachTest& at){
+              if (at.detachCount_ == 1 && at.attachCount_ == 1) {
+                  statesAfterDetach.push_back(at.attach_.state);
+                  if (at.attach_.usingAttachedEps) {
+                      reattachedToAttachedEps = true;
+                  }
+              }
+          });
+    at.waitForTestEnd();
+    attachServer->stop();
+    BOOST_TEST(at.attachCount_ == (uint64_t)2);
+    BOOST_TEST(reattachedToAttachedEps);
+
+    std::vector<enum nc_attacher_attach_state> expected = {
+        NC_ATTACHER_STATE_RETRY_WAIT, // detached
+        NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST, // last basestation
+        NC_ATTACHER_STATE_DNS,
+        NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST,
+        NC_ATTACHER_STATE_ATTACHED
+    };
+    BOOST_TEST(statesAfterDetach == expected, boost::test_tools::per_element());
+    ioService->stop();
+}
+
+BOOST_AUTO_TEST_CASE(access_denied_clears_attached_endpoints, * boost::unit_test::timeout(300))
+{
+    auto ioService = nabto::IoService::create("test");
+    auto attachServer = nabto::test::AttachServer::create(ioService->getIoService());
+
+    auto tp = nabto::test::TestPlatform::create();
+    nabto::test::AttachTest at(*tp, attachServer->getPort());
+
+    bool reattachedToAttachedEps = false;
+    at.start([&attachServer](nabto::test::AttachTest& at){
+                 if (at.attachCount_ == 1 && at.detachCount_ == 0) {
+                     BOOST_TEST(at.attach_.attachedEpsSize > (size_t)0);
+                     attachServer->accessDenied_ = true;
+                     attachServer->niceClose();
+                 }
+             }, [&reattachedToAttachedEps](nabto::test::AttachTest& at){
+                    if (at.attach_.state == NC_ATTACHER_STATE_DTLS_ATTACH_REQUEST &&
+                        at.detachCount_ == 1)
+                    {
+                        reattachedToAttachedEps = at.attach_.usingAttachedEps;
+                    }
+                    if (at.attach_.state == NC_ATTACHER_STATE_ACCESS_DENIED_WAIT) {
+                        BOOST_TEST(at.attach_.attachedEpsSize == (size_t)0);
+                        BOOST_TEST(!at.attach_.usingAttachedEps);
+                        at.end();
+                    }
+                });
+    at.waitForTestEnd();
+    attachServer->stop();
+    BOOST_TEST(reattachedToAttachedEps);
+    ioService->stop();
+}
+
 #ifdef __linux__
 BOOST_AUTO_TEST_CASE(attach_ha, * boost::unit_test::timeout(300))
 {
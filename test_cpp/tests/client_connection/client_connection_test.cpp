@@ -0,0 +1,923 @@
+#include <boost/test/unit_test.hpp>
+
+#include <platform/np_platform.h>
+#include <platform/np_completion_event.h>
+#include <platform/np_event_queue_wrapper.h>
+#include <platform/np_udp_wrapper.h>
+#include <platform/np_timestamp_wrapper.h>
+
+#include <core/nc_device.h>
+#include <core/nc_client_connection_dispatch.h>
+#include <core/nc_protocol_defines.h>
+
+#include <fixtures/dtls_server/test_certificates.hpp>
+#include <test_platform.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace nabto {
+namespace test {
+
+/**
+ * A client which connects to a client connection dispatch over UDP
+ * with the DTLS client of the platform. The packets are sent with the
+ * connection header a client uses.
+ */
+class TestClient {
+ public:
+    struct Packet {
+        std::vector<uint8_t> data;
+        np_dtls_cli_send_callback cb;
+        void* cbData;
+    };
+
+    TestClient(struct np_platform* pl, uint16_t devicePort, uint8_t id)
+        : pl_(pl)
+    {
+        header_[0] = NABTO_PROTOCOL_PREFIX_CONNECTION;
+        for (size_t i = 1; i < 15; i++) {
+            header_[i] = (uint8_t)(id + i);
+        }
+        // channel id
+        header_[15] = 0;
+
+        uint8_t addr[] = { 0x7F, 0x00, 0x00, 0x01 };
+        deviceEp_.ip.type = NABTO_IPV4;
+        memcpy(deviceEp_.ip.ip.v4, addr, 4);
+        deviceEp_.port = devicePort;
+
+        np_completion_event_init(&pl_->eq, &boundEvent_, &TestClient::bound, this);
+        np_completion_event_init(&pl_->eq, &sentEvent_, &TestClient::sent, this);
+        np_completion_event_init(&pl_->eq, &recvEvent_, &TestClient::received, this);
+        BOOST_TEST(np_udp_create(&pl_->udp, &socket_) == NABTO_EC_OK);
+        BOOST_TEST(pl_->dtlsC.create(pl_, &dtls_, &TestClient::dtlsSender, &TestClient::dtlsData, &TestClient::dtlsEvent, this) == NABTO_EC_OK);
+        BOOST_TEST(pl_->dtlsC.set_keys(dtls_,
+                                       reinterpret_cast<const unsigned char*>(clientPublicKey.c_str()), clientPublicKey.size(),
+                                       reinterpret_cast<const unsigned char*>(clientPrivateKey.c_str()), clientPrivateKey.size()) == NABTO_EC_OK);
+    }
+
+    /**
+     * Call when the event queue is stopped.
+     */
+    ~TestClient()
+    {
+        pl_->dtlsC.destroy(dtls_);
+        np_udp_destroy(&pl_->udp, socket_);
+        np_completion_event_deinit(&boundEvent_);
+        np_completion_event_deinit(&sentEvent_);
+        np_completion_event_deinit(&recvEvent_);
+    }
+
+    /**
+     * Bind the socket and start the DTLS handshake.
+     */
+    void connect()
+    {
+        np_udp_async_bind_port(&pl_->udp, socket_, 0, &boundEvent_);
+    }
+
+    void close()
+    {
+        pl_->dtlsC.close(dtls_);
+    }
+
+    const uint8_t* connectionId()
+    {
+        return header_ + 1;
+    }
+
+    // called on the event queue with each DTLS record from the device.
+    std::function<void (const uint8_t* buffer, size_t bufferSize)> received_;
+    // called on the event queue with each DTLS record to the device, it
+    // may change the record.
+    std::function<void (std::vector<uint8_t>& record)> sending_;
+    // called on the event queue with the events from the DTLS client.
+    std::function<void (enum np_dtls_cli_event event)> event_;
+
+    struct np_dtls_cli_context* dtls_ = NULL;
+
+ private:
+    static void bound(const np_error_code ec, void* data)
+    {
+        TestClient* self = (TestClient*)data;
+        BOOST_TEST(ec == NABTO_EC_OK);
+        self->startRecv();
+        BOOST_TEST(self->pl_->dtlsC.connect(self->dtls_) == NABTO_EC_OK);
+    }
+
+    void startRecv()
+    {
+        np_udp_async_recv_wait(&pl_->udp, socket_, &recvEvent_);
+    }
+
+    static void received(const np_error_code ec, void* data)
+    {
+        TestClient* self = (TestClient*)data;
+        if (ec != NABTO_EC_OK) {
+            return;
+        }
+        struct np_udp_endpoint ep;
+        uint8_t buffer[1500];
+        size_t recvSize;
+        if (np_udp_recv_from(&self->pl_->udp, self->socket_, &ep, buffer, sizeof(buffer), &recvSize) == NABTO_EC_OK &&
+            recvSize > 16)
+        {
+            if (self->received_) {
+                self->received_(buffer + 16, recvSize - 16);
+            }
+            self->pl_->dtlsC.handle_packet(self->dtls_, buffer + 16, (uint16_t)(recvSize - 16));
+        }
+        self->startRecv();
+    }
+
+    static np_error_code dtlsSender(uint8_t* buffer, uint16_t bufferSize,
+                                    np_dtls_cli_send_callback cb, void* data,
+                                    void* senderData)
+    {
+        TestClient* self = (TestClient*)senderData;
+        std::vector<uint8_t> record(buffer, buffer + bufferSize);
+        if (self->sending_) {
+            self->sending_(record);
+        }
+        Packet packet;
+        packet.data.insert(packet.data.end(), self->header_, self->header_ + 16);
+        packet.data.insert(packet.data.end(), record.begin(), record.end());
+        packet.cb = cb;
+        packet.cbData = data;
+        self->sendQueue_.push_back(packet);
+        if (self->sendQueue_.size() == 1) {
+            self->sendFirst();
+        }
+        return NABTO_EC_OK;
+    }
+
+    void sendFirst()
+    {
+        Packet& p = sendQueue_.front();
+        np_udp_async_send_to(&pl_->udp, socket_, &deviceEp_, p.data.data(), (uint16_t)p.data.size(), &sentEvent_);
+    }
+
+    static void sent(const np_error_code ec, void* data)
+    {
+        TestClient* self = (TestClient*)data;
+        Packet p = self->sendQueue_.front();
+        self->sendQueue_.pop_front();
+        if (!self->sendQueue_.empty()) {
+            self->sendFirst();
+        }
+        p.cb(ec, p.cbData);
+    }
+
+    static void dtlsData(uint8_t* buffer, uint16_t bufferSize, void* data)
+    {
+        (void)buffer; (void)bufferSize; (void)data;
+    }
+
+    static void dtlsEvent(enum np_dtls_cli_event event, void* data)
+    {
+        TestClient* self = (TestClient*)data;
+        if (self->event_) {
+            self->event_(event);
+        }
+    }
+
+    struct np_platform* pl_;
+    uint8_t header_[16];
+    struct np_udp_endpoint deviceEp_;
+    struct np_udp_socket* socket_ = NULL;
+    struct np_completion_event boundEvent_;
+    struct np_completion_event sentEvent_;
+    struct np_completion_event recvEvent_;
+    std::deque<Packet> sendQueue_;
+};
+
+/**
+ * The parts of a device which the client connection dispatch uses,
+ * with the dispatch listening on a local UDP socket.
+ */
+class ClientConnectionTest {
+ public:
+    ClientConnectionTest(TestPlatform& tp)
+        : pl_(tp.getPlatform())
+    {
+        memset(&device_, 0, sizeof(device_));
+        device_.pl = pl_;
+        nn_llist_init(&device_.eventsListeners);
+        nn_llist_init(&device_.deviceEvents);
+        BOOST_TEST(nc_keep_alive_sweep_init(&device_.keepAliveSweep, pl_) == NABTO_EC_OK);
+        nc_stream_manager_init(&device_.streamManager, pl_);
+        BOOST_TEST(nc_coap_server_init(pl_, &device_.coapServer) == NABTO_EC_OK);
+        BOOST_TEST(pl_->dtlsS.create(pl_, &device_.dtlsServer) == NABTO_EC_OK);
+        BOOST_TEST(pl_->dtlsS.set_keys(device_.dtlsServer,
+                                       reinterpret_cast<const unsigned char*>(devicePublicKey.c_str()), devicePublicKey.size(),
+                                       reinterpret_cast<const unsigned char*>(devicePrivateKey.c_str()), devicePrivateKey.size()) == NABTO_EC_OK);
+        BOOST_TEST(nc_client_connection_dispatch_init(&device_.clientConnect, pl_, &device_) == NABTO_EC_OK);
+        nc_device_add_connection_events_listener(&device_, &listener_, &ClientConnectionTest::connectionEvent, this);
+        np_completion_event_init(&pl_->eq, &boundEvent_, &ClientConnectionTest::bound, this);
+        np_event_queue_init_event(&pl_->eq, &executeEvent_, &ClientConnectionTest::executeEvent, this);
+    }
+
+    /**
+     * Call when the event queue is stopped.
+     */
+    ~ClientConnectionTest()
+    {
+        nc_client_connection_dispatch_deinit(&device_.clientConnect);
+        nc_stream_manager_deinit(&device_.streamManager);
+        nc_coap_server_deinit(&device_.coapServer);
+        pl_->dtlsS.destroy(device_.dtlsServer);
+        nc_udp_dispatch_deinit(&device_.localUdp);
+        nc_keep_alive_sweep_deinit(&device_.keepAliveSweep);
+        np_completion_event_deinit(&boundEvent_);
+        np_event_queue_deinit_event(&pl_->eq, &executeEvent_);
+    }
+
+    /**
+     * Bind the local socket, started is called on the event queue
+     * when the dispatch receives packets.
+     */
+    void start(std::function<void (ClientConnectionTest& t)> started)
+    {
+        started_ = started;
+        BOOST_TEST(nc_udp_dispatch_init(&device_.localUdp, pl_) == NABTO_EC_OK);
+        nc_udp_dispatch_async_bind(&device_.localUdp, pl_, 0, &boundEvent_);
+    }
+
+    /**
+     * Run f on the event queue and wait for it to return.
+     */
+    void execute(std::function<void ()> f)
+    {
+        std::promise<void> done;
+        execute_ = [&f, &done]() {
+            f();
+            done.set_value();
+        };
+        np_event_queue_post(&pl_->eq, &executeEvent_);
+        done.get_future().get();
+    }
+
+    uint16_t port()
+    {
+        return nc_udp_dispatch_get_local_port(&device_.localUdp);
+    }
+
+    struct nc_client_connection_dispatch_context* dispatch()
+    {
+        return &device_.clientConnect;
+    }
+
+    // called on the event queue with the connection events of the device.
+    std::function<void (uint64_t connectionRef, enum nc_connection_event event)> event_;
+
+    struct np_platform* pl_;
+    struct nc_device_context device_;
+
+ private:
+    static void bound(const np_error_code ec, void* data)
+    {
+        ClientConnectionTest* self = (ClientConnectionTest*)data;
+        BOOST_TEST(ec == NABTO_EC_OK);
+        nc_udp_dispatch_set_client_connection_context(&self->device_.localUdp, &self->device_.clientConnect);
+        nc_udp_dispatch_start_recv(&self->device_.localUdp);
+        self->started_(*self);
+    }
+
+    static void connectionEvent(uint64_t connectionRef, enum nc_connection_event event, void* data)
+    {
+        ClientConnectionTest* self = (ClientConnectionTest*)data;
+        if (self->event_) {
+            self->event_(connectionRef, event);
+        }
+    }
+
+    static void executeEvent(void* data)
+    {
+        ClientConnectionTest* self = (ClientConnectionTest*)data;
+        self->execute_();
+    }
+
+    struct nc_connection_events_listener listener_;
+    struct np_completion_event boundEvent_;
+    struct np_event executeEvent_;
+    std::function<void (ClientConnectionTest& t)> started_;
+    std::function<void ()> execute_;
+};
+
+/**
+ * Holds the UDP sends on a socket until the test resolves them, such
+ * that sends can be completed in any order. Sends on other sockets
+ * are passed to the platform. Install and remove it on the event
+ * queue.
+ */
+class HeldUdpSends {
+ public:
+    struct Send {
+        struct np_completion_event* completionEvent;
+        std::vector<struct np_udp_send_entry> entries;
+    };
+
+    HeldUdpSends(struct np_platform* pl, struct np_udp_socket* sock)
+        : pl_(pl), udp_(pl->udp), sock_(sock)
+    {
+        functions_ = *udp_.mptr;
+        functions_.async_send_to = &HeldUdpSends::sendTo;
+        functions_.async_send_batch = &HeldUdpSends::sendBatch;
+        instance_ = this;
+        pl_->udp.mptr = &functions_;
+    }
+
+    ~HeldUdpSends()
+    {
+        pl_->udp = udp_;
+        instance_ = NULL;
+    }
+
+    std::vector<Send> sends_;
+
+ private:
+    static void sendTo(struct np_udp_socket* sock, struct np_udp_endpoint* ep,
+                       uint8_t* buffer, uint16_t bufferSize,
+                       struct np_completion_event* completionEvent)
+    {
+        struct np_udp_send_entry entry;
+        entry.ep = *ep;
+        entry.buffer = buffer;
+        entry.bufferSize = bufferSize;
+        sendBatch(sock, &entry, 1, completionEvent);
+    }
+
+    static void sendBatch(struct np_udp_socket* sock, struct np_udp_send_entry* entries, size_t entriesSize,
+                          struct np_completion_event* completionEvent)
+    {
+        HeldUdpSends* self = instance_;
+        if (sock != self->sock_) {
+            if (entriesSize == 1) {
+                self->udp_.mptr->async_send_to(sock, &entries[0].ep, entries[0].buffer, entries[0].bufferSize, completionEvent);
+            } else {
+                self->udp_.mptr->async_send_batch(sock, entries, entriesSize, completionEvent);
+            }
+            return;
+        }
+        Send send;
+        send.completionEvent = completionEvent;
+        send.entries.assign(entries, entries + entriesSize);
+        self->sends_.push_back(send);
+    }
+
+    static HeldUdpSends* instance_;
+
+    struct np_platform* pl_;
+    struct np_udp udp_;
+    struct np_udp_socket* sock_;
+    struct np_udp_functions functions_;
+};
+
+HeldUdpSends* HeldUdpSends::instance_ = NULL;
+
+} } // namespace
+
+namespace {
+
+// DTLS record header and handshake header sizes.
+const size_t recordHeaderSize = 13;
+const size_t handshakeHeaderSize = 12;
+
+bool isHandshake(const uint8_t* record, size_t recordSize, uint8_t type)
+{
+    return recordSize > recordHeaderSize && record[0] == 22 &&
+        record[3] == 0 && record[4] == 0 && record[recordHeaderSize] == type;
+}
+
+bool isHelloVerifyRequest(const uint8_t* record, size_t recordSize)
+{
+    return isHandshake(record, recordSize, 3);
+}
+
+/**
+ * Get the offset of the cookie of a ClientHello record, 0 if the
+ * record is not a ClientHello with a cookie.
+ */
+size_t cookieOffset(const std::vector<uint8_t>& record)
+{
+    if (!isHandshake(record.data(), record.size(), 1)) {
+        return 0;
+    }
+    // version, random
+    size_t offset = recordHeaderSize + handshakeHeaderSize + 2 + 32;
+    if (record.size() <= offset) {
+        return 0;
+    }
+    // session id
+    offset += 1 + record[offset];
+    if (record.size() <= offset || record[offset] == 0 || record.size() <= offset + record[offset]) {
+        return 0;
+    }
+    return offset + 1;
+}
+
+/**
+ * A burst of records given to the sender of a client connection, the
+ * records have room for the connection header in front of them.
+ */
+struct Burst {
+    Burst(size_t id, size_t recordsSize, std::vector<std::pair<size_t, np_error_code> >& completed)
+        : id(id), buffers(recordsSize, std::vector<uint8_t>(16 + 100, (uint8_t)id)), records(recordsSize), completed(completed)
+    {
+        for (size_t i = 0; i < recordsSize; i++) {
+            records[i].buffer = buffers[i].data() + 16;
+            records[i].bufferSize = 100;
+        }
+    }
+
+    np_error_code send(struct nc_client_connection* conn)
+    {
+        return nc_client_connection_async_send_to_udp(NP_DTLS_SRV_DEFAULT_CHANNEL_ID, records.data(), records.size(),
+                                                      &Burst::sent, this, conn);
+    }
+
+    static void sent(const np_error_code ec, void* data)
+    {
+        Burst* self = (Burst*)data;
+        self->completed.push_back(std::make_pair(self->id, ec));
+    }
+
+    size_t id;
+    std::vector<std::vector<uint8_t> > buffers;
+    std::vector<struct np_dtls_srv_record> records;
+    std::vector<std::pair<size_t, np_error_code> >& completed;
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(client_connection)
+
+BOOST_AUTO_TEST_CASE(connections_are_found_by_id_and_ref, * boost::unit_test::timeout(120))
+{
+    const size_t clientsSize = 3;
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::ClientConnectionTest t(*tp);
+
+    std::vector<std::unique_ptr<nabto::test::TestClient> > clients;
+    std::vector<uint64_t> refs;
+    uint64_t closedRef = 0;
+    std::promise<void> opened;
+    std::promise<void> closed;
+    std::promise<void> reopened;
+    t.event_ = [&](uint64_t ref, enum nc_connection_event event) {
+        if (event == NC_CONNECTION_EVENT_OPENED) {
+            refs.push_back(ref);
+            if (refs.size() == clientsSize) {
+                opened.set_value();
+            } else if (refs.size() == clientsSize + 1) {
+                reopened.set_value();
+            }
+        } else if (event == NC_CONNECTION_EVENT_CLOSED) {
+            closedRef = ref;
+            closed.set_value();
+        }
+    };
+    t.start([&](nabto::test::ClientConnectionTest& t) {
+                for (size_t i = 0; i < clientsSize; i++) {
+                    clients.push_back(std::make_unique<nabto::test::TestClient>(pl, t.port(), (uint8_t)(i * 16)));
+                    clients.back()->connect();
+                }
+            });
+    opened.get_future().get();
+
+    t.execute([&]() {
+                  struct nc_client_connection_dispatch_context* dispatch = t.dispatch();
+                  BOOST_TEST(dispatch->activeConnections == clientsSize);
+                  // each client has exactly one connection which is found by its ref.
+                  for (auto& c : clients) {
+                      size_t found = 0;
+                      for (auto ref : refs) {
+                          struct nc_client_connection* conn = nc_client_connection_dispatch_connection_from_ref(dispatch, ref);
+                          BOOST_REQUIRE(conn != NULL);
+                          BOOST_TEST(conn->connectionRef == ref);
+                          if (memcmp(conn->id.id + 1, c->connectionId(), 14) == 0) {
+                              found++;
+                          }
+                      }
+                      BOOST_TEST(found == (size_t)1);
+                  }
+                  BOOST_TEST(nc_client_connection_dispatch_connection_from_ref(dispatch, 4242) == (struct nc_client_connection*)NULL);
+                  // the client sends a close notify which is routed by its connection id.
+                  clients[1]->close();
+              });
+    closed.get_future().get();
+
+    t.execute([&]() {
+                  struct nc_client_connection_dispatch_context* dispatch = t.dispatch();
+                  BOOST_TEST(dispatch->activeConnections == clientsSize - 1);
+                  BOOST_TEST(nc_client_connection_dispatch_connection_from_ref(dispatch, closedRef) == (struct nc_client_connection*)NULL);
+                  for (auto ref : refs) {
+                      if (ref != closedRef) {
+                          BOOST_TEST(nc_client_connection_dispatch_connection_from_ref(dispatch, ref) != (struct nc_client_connection*)NULL);
+                      }
+                  }
+                  // the freed slot is used by a new connection.
+                  clients.push_back(std::make_unique<nabto::test::TestClient>(pl, t.port(), (uint8_t)(clientsSize * 16)));
+                  clients.back()->connect();
+              });
+    reopened.get_future().get();
+
+    t.execute([&]() {
+                  BOOST_TEST(t.dispatch()->activeConnections == clientsSize);
+                  BOOST_TEST(nc_client_connection_dispatch_connection_from_ref(t.dispatch(), refs.back()) != (struct nc_client_connection*)NULL);
+              });
+
+    tp->stop();
+}
+
+BOOST_AUTO_TEST_CASE(connection_limit, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::ClientConnectionTest t(*tp);
+    BOOST_TEST(nc_client_connection_dispatch_set_max_connections(t.dispatch(), 1) == NABTO_EC_OK);
+
+    std::unique_ptr<nabto::test::TestClient> first;
+    std::unique_ptr<nabto::test::TestClient> second;
+    std::promise<void> opened;
+    std::promise<void> rejected;
+    size_t openedCount = 0;
+    t.event_ = [&](uint64_t ref, enum nc_connection_event event) {
+        (void)ref;
+        if (event == NC_CONNECTION_EVENT_OPENED) {
+            openedCount++;
+            if (openedCount == 1) {
+                opened.set_value();
+            }
+        }
+    };
+    t.start([&](nabto::test::ClientConnectionTest& t) {
+                first = std::make_unique<nabto::test::TestClient>(pl, t.port(), 0);
+                first->connect();
+            });
+    opened.get_future().get();
+
+    t.execute([&]() {
+                  BOOST_TEST(nc_client_connection_dispatch_set_max_connections(t.dispatch(), 2) == NABTO_EC_INVALID_STATE);
+                  // the ClientHellos of the second client are dropped
+                  // until its handshake times out.
+                  second = std::make_unique<nabto::test::TestClient>(pl, t.port(), 16);
+                  second->event_ = [&](enum np_dtls_cli_event event) {
+                      BOOST_TEST(event != NP_DTLS_CLI_EVENT_HANDSHAKE_COMPLETE);
+                      rejected.set_value();
+                  };
+                  pl->dtlsC.set_handshake_timeout(second->dtls_, 50, 400);
+                  second->connect();
+              });
+    rejected.get_future().get();
+
+    t.execute([&]() {
+                  BOOST_TEST(t.dispatch()->activeConnections == (size_t)1);
+                  BOOST_TEST(openedCount == (size_t)1);
+              });
+
+    tp->stop();
+}
+
+BOOST_AUTO_TEST_CASE(cookie_is_verified_before_a_connection_is_created, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::ClientConnectionTest t(*tp);
+
+    std::unique_ptr<nabto::test::TestClient> client;
+    std::promise<void> opened;
+    size_t helloVerifyRequests = 0;
+    t.event_ = [&](uint64_t ref, enum nc_connection_event event) {
+        (void)ref;
+        if (event == NC_CONNECTION_EVENT_OPENED) {
+            opened.set_value();
+        }
+    };
+    t.start([&](nabto::test::ClientConnectionTest& t) {
+                client = std::make_unique<nabto::test::TestClient>(pl, t.port(), 0);
+                client->received_ = [&](const uint8_t* record, size_t recordSize) {
+                    if (isHelloVerifyRequest(record, recordSize)) {
+                        helloVerifyRequests++;
+                        // the ClientHello without a cookie did not take a connection slot.
+                        BOOST_TEST(t.dispatch()->activeConnections == (size_t)0);
+                        BOOST_TEST(t.dispatch()->freeSlotsSize == t.dispatch()->maxConnections);
+                    }
+                };
+                client->connect();
+            });
+    opened.get_future().get();
+
+    t.execute([&]() {
+                  BOOST_TEST(helloVerifyRequests == (size_t)1);
+                  BOOST_TEST(t.dispatch()->activeConnections == (size_t)1);
+              });
+
+    tp->stop();
+}
+
+BOOST_AUTO_TEST_CASE(forged_cookie_is_dropped, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::ClientConnectionTest t(*tp);
+
+    std::unique_ptr<nabto::test::TestClient> client;
+    std::promise<void> rejected;
+    size_t helloVerifyRequests = 0;
+    size_t openedCount = 0;
+    t.event_ = [&](uint64_t ref, enum nc_connection_event event) {
+        (void)ref;
+        if (event == NC_CONNECTION_EVENT_OPENED) {
+            openedCount++;
+        }
+    };
+    t.start([&](nabto::test::ClientConnectionTest& t) {
+                client = std::make_unique<nabto::test::TestClient>(pl, t.port(), 0);
+                client->sending_ = [&](std::vector<uint8_t>& record) {
+                    size_t offset = cookieOffset(record);
+                    if (offset > 0) {
+                        record[offset] ^= 0x01;
+                    }
+                };
+                client->received_ = [&](const uint8_t* record, size_t recordSize) {
+                    if (isHelloVerifyRequest(record, recordSize)) {
+                        helloVerifyRequests++;
+                        // each ClientHello with the forged cookie is answered with a new cookie.
+                        if (helloVerifyRequests == 3) {
+                            rejected.set_value();
+                        }
+                    }
+                };
+                client->connect();
+            });
+    rejected.get_future().get();
+
+    t.execute([&]() {
+                  BOOST_TEST(openedCount == (size_t)0);
+                  BOOST_TEST(t.dispatch()->activeConnections == (size_t)0);
+                  BOOST_TEST(t.dispatch()->freeSlotsSize == t.dispatch()->maxConnections);
+              });
+
+    tp->stop();
+}
+
+BOOST_AUTO_TEST_CASE(cookie_of_another_client_is_dropped, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::ClientConnectionTest t(*tp);
+
+    std::unique_ptr<nabto::test::TestClient> first;
+    std::unique_ptr<nabto::test::TestClient> second;
+    std::vector<uint8_t> firstCookie;
+    std::promise<void> opened;
+    std::promise<void> rejected;
+    size_t helloVerifyRequests = 0;
+    size_t openedCount = 0;
+    t.event_ = [&](uint64_t ref, enum nc_connection_event event) {
+        (void)ref;
+        if (event == NC_CONNECTION_EVENT_OPENED) {
+            openedCount++;
+            if (openedCount == 1) {
+                opened.set_value();
+            }
+        }
+    };
+    t.start([&](nabto::test::ClientConnectionTest& t) {
+                first = std::make_unique<nabto::test::TestClient>(pl, t.port(), 0);
+                first->sending_ = [&](std::vector<uint8_t>& record) {
+                    size_t offset = cookieOffset(record);
+                    if (offset > 0) {
+                        firstCookie.assign(record.begin() + offset, record.begin() + offset + record[offset - 1]);
+                    }
+                };
+                first->connect();
+            });
+    opened.get_future().get();
+
+    t.execute([&]() {
+                  BOOST_REQUIRE(!firstCookie.empty());
+                  // the second client replays the cookie the device gave the first client.
+                  second = std::make_unique<nabto::test::TestClient>(pl, t.port(), 16);
+                  second->sending_ = [&](std::vector<uint8_t>& record) {
+                      size_t offset = cookieOffset(record);
+                      if (offset > 0 && record[offset - 1] == firstCookie.size()) {
+                          std::copy(firstCookie.begin(), firstCookie.end(), record.begin() + offset);
+                      }
+                  };
+                  second->received_ = [&](const uint8_t* record, size_t recordSize) {
+                      if (isHelloVerifyRequest(record, recordSize)) {
+                          helloVerifyRequests++;
+                          if (helloVerifyRequests == 3) {
+                              rejected.set_value();
+                          }
+                      }
+                  };
+                  second->connect();
+              });
+    rejected.get_future().get();
+
+    t.execute([&]() {
+                  BOOST_TEST(openedCount == (size_t)1);
+                  BOOST_TEST(t.dispatch()->activeConnections == (size_t)1);
+              });
+
+    tp->stop();
+}
+
+BOOST_AUTO_TEST_CASE(busy_connection_is_not_hibernated, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::ClientConnectionTest t(*tp);
+
+    std::unique_ptr<nabto::test::TestClient> client;
+    std::promise<void> opened;
+    uint64_t ref = 0;
+    t.event_ = [&](uint64_t connectionRef, enum nc_connection_event event) {
+        if (event == NC_CONNECTION_EVENT_OPENED) {
+            ref = connectionRef;
+            opened.set_value();
+        }
+    };
+    t.start([&](nabto::test::ClientConnectionTest& t) {
+                client = std::make_unique<nabto::test::TestClient>(pl, t.port(), 0);
+                client->connect();
+            });
+    opened.get_future().get();
+
+    t.execute([&]() {
+                  const uint32_t idleTimeout = 1000;
+                  struct nc_client_connection* conn = nc_client_connection_dispatch_connection_from_ref(t.dispatch(), ref);
+                  BOOST_REQUIRE(conn != NULL);
+                  conn->lastActivity = np_timestamp_now_ms(&pl->timestamp) - 2 * idleTimeout;
+
+                  // a pending coap request
+                  nc_client_connection_coap_request_begin(conn);
+                  nc_client_connection_idle_sweep(conn, idleTimeout);
+                  BOOST_TEST(!conn->hibernated);
+                  nc_client_connection_coap_request_end(conn);
+                  BOOST_TEST(conn->coapRequests == (size_t)0);
+
+                  // the end of the request is activity.
+                  nc_client_connection_idle_sweep(conn, idleTimeout);
+                  BOOST_TEST(!conn->hibernated);
+                  conn->lastActivity = np_timestamp_now_ms(&pl->timestamp) - 2 * idleTimeout;
+
+                  // an open stream
+                  t.device_.streamManager.streamConns[0] = conn;
+                  nc_client_connection_idle_sweep(conn, idleTimeout);
+                  BOOST_TEST(!conn->hibernated);
+                  t.device_.streamManager.streamConns[0] = NULL;
+
+                  nc_client_connection_idle_sweep(conn, idleTimeout);
+                  if (!conn->hibernated) {
+                      // mbedtls is built without context serialization.
+                      BOOST_TEST(pl->dtlsS.hibernate(conn->dtls) == NABTO_EC_NOT_SUPPORTED);
+                  }
+              });
+
+    tp->stop();
+}
+
+BOOST_AUTO_TEST_CASE(send_slots_complete_out_of_order, * boost::unit_test::timeout(120))
+{
+    const size_t depth = NC_CLIENT_CONNECTION_SEND_QUEUE_DEPTH;
+    const size_t recordsSize = 3;
+    BOOST_REQUIRE(depth >= 2);
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::ClientConnectionTest t(*tp);
+
+    std::unique_ptr<nabto::test::TestClient> client;
+    std::promise<void> opened;
+    uint64_t ref = 0;
+    t.event_ = [&](uint64_t connectionRef, enum nc_connection_event event) {
+        if (event == NC_CONNECTION_EVENT_OPENED) {
+            ref = connectionRef;
+            opened.set_value();
+        }
+    };
+    t.start([&](nabto::test::ClientConnectionTest& t) {
+                client = std::make_unique<nabto::test::TestClient>(pl, t.port(), 0);
+                client->connect();
+            });
+    opened.get_future().get();
+
+    std::vector<std::pair<size_t, np_error_code> > completed;
+    std::vector<std::unique_ptr<Burst> > bursts;
+    for (size_t i = 0; i < depth + 2; i++) {
+        bursts.push_back(std::make_unique<Burst>(i, recordsSize, completed));
+    }
+    std::unique_ptr<nabto::test::HeldUdpSends> held;
+    struct nc_client_connection* conn = NULL;
+
+    // Wait for the sends of the handshake to complete, then hold the
+    // sends of the connection.
+    for (size_t i = 0; i < 100 && !held; i++) {
+        t.execute([&]() {
+                      conn = nc_client_connection_dispatch_connection_from_ref(t.dispatch(), ref);
+                      BOOST_REQUIRE(conn != NULL);
+                      for (size_t s = 0; s < depth; s++) {
+                          if (conn->sendSlots[s].inUse) {
+                              return;
+                          }
+                      }
+                      held = std::make_unique<nabto::test::HeldUdpSends>(pl, conn->currentChannel.sock->sock);
+                  });
+        if (!held) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    BOOST_REQUIRE(held);
+
+    t.execute([&]() {
+                  // a burst per slot, the next burst has to wait for a free slot.
+                  for (size_t i = 0; i < depth; i++) {
+                      BOOST_TEST(bursts[i]->send(conn) == NABTO_EC_OK);
+                  }
+                  BOOST_TEST(bursts[depth]->send(conn) == NABTO_EC_OPERATION_IN_PROGRESS);
+
+                  BOOST_REQUIRE(held->sends_.size() == depth);
+                  std::set<struct np_completion_event*> events;
+                  for (size_t i = 0; i < depth; i++) {
+                      auto& send = held->sends_[i];
+                      events.insert(send.completionEvent);
+                      BOOST_REQUIRE(send.entries.size() == recordsSize);
+                      for (size_t r = 0; r < recordsSize; r++) {
+                          struct np_udp_send_entry* entry = &send.entries[r];
+                          // the connection header is written in front of the record.
+                          BOOST_TEST((entry->buffer == bursts[i]->records[r].buffer - 16));
+                          BOOST_TEST(entry->bufferSize == 116);
+                          BOOST_TEST(memcmp(entry->buffer, conn->id.id, 15) == 0);
+                          BOOST_TEST(entry->buffer[15] == conn->currentChannel.channelId);
+                          BOOST_TEST(entry->ep.port == conn->currentChannel.ep.port);
+                      }
+                  }
+                  BOOST_TEST(events.size() == depth);
+                  BOOST_TEST(completed.empty());
+
+                  // the last slot completes first.
+                  np_completion_event_resolve(held->sends_[depth - 1].completionEvent, NABTO_EC_OK);
+              });
+
+    t.execute([&]() {
+                  BOOST_REQUIRE(completed.size() == (size_t)1);
+                  BOOST_TEST(completed[0].first == depth - 1);
+                  BOOST_TEST(completed[0].second == NABTO_EC_OK);
+
+                  // the freed slot takes the waiting burst.
+                  BOOST_TEST(bursts[depth]->send(conn) == NABTO_EC_OK);
+                  BOOST_TEST(bursts[depth + 1]->send(conn) == NABTO_EC_OPERATION_IN_PROGRESS);
+                  BOOST_REQUIRE(held->sends_.size() == depth + 1);
+                  BOOST_TEST(held->sends_[depth].completionEvent == held->sends_[depth - 1].completionEvent);
+
+                  // The rest completes in neither the order they were
+                  // sent nor the order of the slots, the first with an
+                  // error.
+                  std::vector<size_t> order;
+                  order.push_back(0);
+                  for (size_t i = depth - 2; i > 0; i--) {
+                      order.push_back(i);
+                  }
+                  order.push_back(depth);
+                  for (size_t i : order) {
+                      np_completion_event_resolve(held->sends_[i].completionEvent, (i == 0) ? NABTO_EC_FAILED_TO_SEND_PACKET : NABTO_EC_OK);
+                  }
+              });
+
+    t.execute([&]() {
+                  // each burst completes once, in the order its send completed.
+                  std::vector<size_t> expected;
+                  expected.push_back(depth - 1);
+                  expected.push_back(0);
+                  for (size_t i = depth - 2; i > 0; i--) {
+                      expected.push_back(i);
+                  }
+                  expected.push_back(depth);
+                  BOOST_REQUIRE(completed.size() == expected.size());
+                  for (size_t i = 0; i < expected.size(); i++) {
+                      BOOST_TEST(completed[i].first == expected[i]);
+                      BOOST_TEST(completed[i].second == ((expected[i] == 0) ? NABTO_EC_FAILED_TO_SEND_PACKET : NABTO_EC_OK));
+                  }
+                  for (size_t s = 0; s < depth; s++) {
+                      BOOST_TEST(!conn->sendSlots[s].inUse);
+                  }
+                  held.reset();
+              });
+
+    tp->stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
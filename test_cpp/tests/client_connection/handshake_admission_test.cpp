@@ -0,0 +1,126 @@
+#include <boost/test/unit_test.hpp>
+
+#include <core/nc_handshake_admission.h>
+
+#include <cstring>
+
+namespace {
+
+/**
+ * A platform with a timestamp which is moved by the test.
+ */
+class AdmissionTest {
+ public:
+    AdmissionTest()
+    {
+        memset(&pl_, 0, sizeof(pl_));
+        pl_.timestamp.mptr = &timestampFunctions_;
+        pl_.timestamp.data = this;
+        nc_handshake_admission_init(&admission_, &pl_);
+    }
+
+    static uint32_t nowMs(struct np_timestamp* obj)
+    {
+        AdmissionTest* self = (AdmissionTest*)obj->data;
+        return self->now_;
+    }
+
+    enum nc_handshake_admission_result begin(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        struct np_udp_endpoint ep;
+        memset(&ep, 0, sizeof(ep));
+        ep.ip.type = NABTO_IPV4;
+        ep.ip.ip.v4[0] = a;
+        ep.ip.ip.v4[1] = b;
+        ep.ip.ip.v4[2] = c;
+        ep.ip.ip.v4[3] = d;
+        ep.port = 4242;
+        return nc_handshake_admission_begin(&admission_, &ep);
+    }
+
+    struct np_platform pl_;
+    struct nc_handshake_admission_context admission_;
+    // starts close to the wrap around of the timestamp.
+    uint32_t now_ = 0xFFFFFF00;
+
+    static const struct np_timestamp_functions timestampFunctions_;
+};
+
+const struct np_timestamp_functions AdmissionTest::timestampFunctions_ = { &AdmissionTest::nowMs, NULL };
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(handshake_admission)
+
+BOOST_AUTO_TEST_CASE(defer_when_max_concurrent_is_reached)
+{
+    AdmissionTest t;
+    nc_handshake_admission_set_max_concurrent(&t.admission_, 2);
+    BOOST_TEST(nc_handshake_admission_set_rate_limit(&t.admission_, 0, 0, 32, 64) == NABTO_EC_OK);
+
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    BOOST_TEST(t.begin(10, 0, 0, 2) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    BOOST_TEST(t.begin(10, 0, 0, 3) == NC_HANDSHAKE_ADMISSION_DEFER);
+    BOOST_TEST(t.admission_.inProgress == (size_t)2);
+
+    // a completed handshake makes room for the next.
+    nc_handshake_admission_end(&t.admission_);
+    BOOST_TEST(t.begin(10, 0, 0, 3) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+
+    BOOST_TEST(t.admission_.counters.accepted == (uint64_t)3);
+    BOOST_TEST(t.admission_.counters.deferred == (uint64_t)1);
+    BOOST_TEST(t.admission_.counters.dropped == (uint64_t)0);
+}
+
+BOOST_AUTO_TEST_CASE(drop_when_the_bucket_is_empty_and_refill_over_time)
+{
+    AdmissionTest t;
+    nc_handshake_admission_set_max_concurrent(&t.admission_, 0);
+    // 5 handshakes per second with a burst of 2.
+    BOOST_TEST(nc_handshake_admission_set_rate_limit(&t.admission_, 5, 2, 32, 64) == NABTO_EC_OK);
+
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_DROP);
+    // the rate is per source.
+    BOOST_TEST(t.begin(10, 0, 0, 2) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+
+    // a token is added every 200ms.
+    t.now_ += 199;
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_DROP);
+    t.now_ += 1;
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_DROP);
+
+    // the bucket does not fill above the burst, the timestamp wraps meanwhile.
+    t.now_ += 10000;
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    BOOST_TEST(t.begin(10, 0, 0, 1) == NC_HANDSHAKE_ADMISSION_DROP);
+
+    BOOST_TEST(t.admission_.counters.dropped == (uint64_t)4);
+}
+
+BOOST_AUTO_TEST_CASE(sources_in_a_prefix_share_a_bucket)
+{
+    AdmissionTest t;
+    nc_handshake_admission_set_max_concurrent(&t.admission_, 0);
+    BOOST_TEST(nc_handshake_admission_set_rate_limit(&t.admission_, 5, 1, 24, 64) == NABTO_EC_OK);
+
+    BOOST_TEST(t.begin(192, 168, 1, 10) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+    // same /24
+    BOOST_TEST(t.begin(192, 168, 1, 20) == NC_HANDSHAKE_ADMISSION_DROP);
+    // another /24
+    BOOST_TEST(t.begin(192, 168, 2, 10) == NC_HANDSHAKE_ADMISSION_ACCEPT);
+}
+
+BOOST_AUTO_TEST_CASE(invalid_rate_limit)
+{
+    AdmissionTest t;
+    BOOST_TEST(nc_handshake_admission_set_rate_limit(&t.admission_, 5, 0, 32, 64) == NABTO_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nc_handshake_admission_set_rate_limit(&t.admission_, 5, 1000001, 32, 64) == NABTO_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nc_handshake_admission_set_rate_limit(&t.admission_, 5, 1, 33, 64) == NABTO_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nc_handshake_admission_set_rate_limit(&t.admission_, 5, 1, 32, 129) == NABTO_EC_INVALID_ARGUMENT);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
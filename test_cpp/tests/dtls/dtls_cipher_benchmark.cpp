@@ -0,0 +1,78 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/test/data/test_case.hpp>
+
+#include <mbedtls/cipher.h>
+
+#include <array>
+#include <chrono>
+#include <vector>
+
+namespace {
+
+struct Suite {
+    const char* name;
+    mbedtls_cipher_type_t type;
+    size_t ivSize;
+};
+
+std::ostream& operator<<(std::ostream& os, const Suite& suite)
+{
+    return os << suite.name;
+}
+
+// The AEADs of the DTLS ciphersuites. The record layer uses a 12 byte
+// nonce and a 16 byte tag for all of them.
+const std::array<Suite, 3> suites = {{
+    { "AES-128-CCM", MBEDTLS_CIPHER_AES_128_CCM, 12 },
+    { "AES-128-GCM", MBEDTLS_CIPHER_AES_128_GCM, 12 },
+    { "CHACHA20-POLY1305", MBEDTLS_CIPHER_CHACHA20_POLY1305, 12 }
+}};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(dtls)
+
+BOOST_DATA_TEST_CASE(cipher_encrypt_bytes_per_second, boost::unit_test::data::make(suites), suite)
+{
+    const size_t recordSize = 1000;
+    const size_t records = 20000;
+
+    const mbedtls_cipher_info_t* info = mbedtls_cipher_info_from_type(suite.type);
+    BOOST_REQUIRE(info != NULL);
+
+    mbedtls_cipher_context_t ctx;
+    mbedtls_cipher_init(&ctx);
+    BOOST_TEST(mbedtls_cipher_setup(&ctx, info) == 0);
+
+    std::vector<uint8_t> key(info->key_bitlen / 8, 0x2a);
+    BOOST_TEST(mbedtls_cipher_setkey(&ctx, key.data(), (int)info->key_bitlen, MBEDTLS_ENCRYPT) == 0);
+
+    std::vector<uint8_t> iv(suite.ivSize, 0);
+    // the additional data of a DTLS record: sequence number, type, version and length.
+    std::array<uint8_t, 13> ad;
+    ad.fill(0x17);
+    std::vector<uint8_t> input(recordSize, 0x42);
+    std::vector<uint8_t> output(recordSize);
+    std::array<uint8_t, 16> tag;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < records; i++) {
+        // a new nonce for each record like the explicit nonce of the record layer.
+        iv[iv.size() - 1] = (uint8_t)i;
+        iv[iv.size() - 2] = (uint8_t)(i >> 8);
+        size_t outputSize = 0;
+        int ret = mbedtls_cipher_auth_encrypt(&ctx, iv.data(), iv.size(), ad.data(), ad.size(),
+                                              input.data(), input.size(), output.data(), &outputSize,
+                                              tag.data(), tag.size());
+        if (ret != 0 || outputSize != recordSize) {
+            BOOST_TEST(ret == 0);
+            break;
+        }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    BOOST_TEST_MESSAGE(suite.name << ": " << (double)(records * recordSize) / elapsed.count() / (1024*1024) << " MiB/s");
+
+    mbedtls_cipher_free(&ctx);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,168 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/test/data/test_case.hpp>
+
+#include <test_platform.hpp>
+
+#include <platform/np_platform.h>
+#include <platform/np_dtls_srv.h>
+
+#include <fixtures/dtls_loopback.hpp>
+#include <fixtures/dtls_server/test_certificates.hpp>
+
+#include <array>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
+
+namespace nabto {
+namespace test {
+
+/**
+ * Sends records from the server connection of a DTLS loopback as fast
+ * as they are sent, such that the benchmark measures the cost of
+ * encrypting and sending records.
+ */
+class DtlsSendBenchmark {
+ public:
+    // number of records queued on the server connection at a time, like a stream window.
+    static const size_t window = 30;
+
+    struct Segment {
+        struct np_dtls_srv_send_context sendCtx;
+        DtlsSendBenchmark* benchmark;
+    };
+
+    DtlsSendBenchmark(struct np_platform* pl, struct np_dtls_srv* server, uint8_t clientId, size_t records)
+        : loopback_(pl, server, clientId), records_(records)
+    {
+        payload_.resize(1000, 0x42);
+        for (auto& s : segments_) {
+            s.sendCtx.buffer = payload_.data();
+            s.sendCtx.bufferSize = (uint16_t)payload_.size();
+            s.sendCtx.channelId = 0;
+            s.sendCtx.cb = &DtlsSendBenchmark::segmentSent;
+            s.sendCtx.data = &s;
+            s.benchmark = this;
+        }
+        loopback_.serverEvent_ = [this](enum np_dtls_srv_event event) {
+            if (event == NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE) {
+                start_ = std::chrono::steady_clock::now();
+                for (auto& s : segments_) {
+                    sendSegment(&s);
+                }
+            }
+        };
+        loopback_.clientEvent_ = [](enum np_dtls_cli_event event) {
+            BOOST_TEST(event == NP_DTLS_CLI_EVENT_HANDSHAKE_COMPLETE);
+        };
+        loopback_.clientData_ = [this](uint8_t* buffer, uint16_t bufferSize) {
+            (void)buffer;
+            BOOST_TEST(bufferSize == payload_.size());
+            received_++;
+            if (received_ == records_) {
+                ended_.set_value(std::chrono::steady_clock::now() - start_);
+            }
+        };
+    }
+
+    /**
+     * Call when the event queue is stopped.
+     */
+    void destroy()
+    {
+        loopback_.destroy();
+    }
+
+    void start()
+    {
+        loopback_.start();
+    }
+
+    /**
+     * @return false if the records has not been received within the timeout.
+     */
+    bool waitForEnd(std::chrono::seconds timeout, std::chrono::duration<double>& elapsed)
+    {
+        std::future<std::chrono::duration<double> > ended = ended_.get_future();
+        if (ended.wait_for(timeout) != std::future_status::ready) {
+            return false;
+        }
+        elapsed = ended.get();
+        return true;
+    }
+
+ private:
+    void sendSegment(Segment* segment)
+    {
+        if (queued_ == records_) {
+            return;
+        }
+        queued_++;
+        struct np_platform* pl = loopback_.pl_;
+        BOOST_TEST(pl->dtlsS.async_send_data(pl, loopback_.connection_, &segment->sendCtx) == NABTO_EC_OK);
+    }
+
+    static void segmentSent(const np_error_code ec, void* data)
+    {
+        Segment* segment = (Segment*)data;
+        BOOST_TEST(ec == NABTO_EC_OK);
+        segment->benchmark->sendSegment(segment);
+    }
+
+    DtlsLoopback loopback_;
+    size_t records_;
+
+    std::vector<uint8_t> payload_;
+    std::array<Segment, window> segments_;
+    size_t queued_ = 0;
+    size_t received_ = 0;
+
+    std::chrono::steady_clock::time_point start_;
+    std::promise<std::chrono::duration<double> > ended_;
+};
+
+} } // namespace
+
+BOOST_AUTO_TEST_SUITE(dtls)
+
+BOOST_DATA_TEST_CASE(srv_send_records_per_second, boost::unit_test::data::make({1, 4}), connections)
+{
+    const size_t records = 20000;
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+
+    struct np_dtls_srv* server;
+    BOOST_TEST(pl->dtlsS.create(pl, &server) == NABTO_EC_OK);
+    BOOST_TEST(pl->dtlsS.set_keys(server,
+                                  reinterpret_cast<const unsigned char*>(nabto::test::devicePublicKey.c_str()), nabto::test::devicePublicKey.size(),
+                                  reinterpret_cast<const unsigned char*>(nabto::test::devicePrivateKey.c_str()), nabto::test::devicePrivateKey.size()) == NABTO_EC_OK);
+
+    std::vector<std::unique_ptr<nabto::test::DtlsSendBenchmark> > benchmarks;
+    for (int i = 0; i < connections; i++) {
+        benchmarks.push_back(std::make_unique<nabto::test::DtlsSendBenchmark>(pl, server, (uint8_t)i, records));
+    }
+    for (auto& l : benchmarks) {
+        l->start();
+    }
+    bool ended = true;
+    for (auto& l : benchmarks) {
+        std::chrono::duration<double> elapsed;
+        if (!l->waitForEnd(std::chrono::seconds(60), elapsed)) {
+            ended = false;
+            break;
+        }
+        BOOST_TEST_MESSAGE("connections: " << connections << ", records per second per connection: " << (double)records / elapsed.count());
+    }
+
+    // the loopbacks are destroyed with the event queue stopped, also
+    // when the benchmark did not end.
+    tp->stop();
+    for (auto& l : benchmarks) {
+        l->destroy();
+    }
+    pl->dtlsS.destroy(server);
+    BOOST_REQUIRE(ended);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,561 @@
+#include <boost/test/unit_test.hpp>
+
+#include <test_platform.hpp>
+
+#include <platform/np_platform.h>
+#include <platform/np_dtls_srv.h>
+#include <modules/mbedtls/nm_mbedtls_srv.h>
+#include <modules/mbedtls/nm_mbedtls_async_pk.h>
+
+#include <fixtures/dtls_loopback.hpp>
+#include <fixtures/dtls_server/test_certificates.hpp>
+
+#include <array>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The thread primitives of the worker pool implemented with the
+// standard library.
+struct nm_mbedtls_async_pk_thread {
+    std::thread thread;
+};
+
+struct nm_mbedtls_async_pk_mutex {
+    std::mutex mutex;
+};
+
+struct nm_mbedtls_async_pk_condition {
+    std::condition_variable_any condition;
+};
+
+namespace {
+
+np_error_code createThread(void* (*routine)(void*), void* data, struct nm_mbedtls_async_pk_thread** thread)
+{
+    *thread = new nm_mbedtls_async_pk_thread;
+    (*thread)->thread = std::thread(routine, data);
+    return NABTO_EC_OK;
+}
+
+void joinThread(struct nm_mbedtls_async_pk_thread* thread)
+{
+    thread->thread.join();
+    delete thread;
+}
+
+struct nm_mbedtls_async_pk_mutex* createMutex()
+{
+    return new nm_mbedtls_async_pk_mutex;
+}
+
+void freeMutex(struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    delete mutex;
+}
+
+void mutexLock(struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    mutex->mutex.lock();
+}
+
+void mutexUnlock(struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    mutex->mutex.unlock();
+}
+
+struct nm_mbedtls_async_pk_condition* createCondition()
+{
+    return new nm_mbedtls_async_pk_condition;
+}
+
+void freeCondition(struct nm_mbedtls_async_pk_condition* condition)
+{
+    delete condition;
+}
+
+void condSignal(struct nm_mbedtls_async_pk_condition* condition)
+{
+    condition->condition.notify_one();
+}
+
+void condWait(struct nm_mbedtls_async_pk_condition* condition, struct nm_mbedtls_async_pk_mutex* mutex)
+{
+    condition->condition.wait(mutex->mutex);
+}
+
+const struct nm_mbedtls_async_pk_threads stdThreads = {
+    &createThread,
+    &joinThread,
+    &createMutex,
+    &freeMutex,
+    &mutexLock,
+    &mutexUnlock,
+    &createCondition,
+    &freeCondition,
+    &condSignal,
+    &condWait
+};
+
+np_error_code sender(uint8_t channelId,
+                     struct np_dtls_srv_record* records, size_t recordsSize,
+                     np_dtls_srv_send_callback cb, void* data,
+                     void* senderData)
+{
+    (void)channelId; (void)records; (void)recordsSize; (void)cb; (void)data; (void)senderData;
+    return NABTO_EC_OK;
+}
+
+void dataHandler(uint8_t channelId, uint64_t sequence,
+                 uint8_t* buffer, uint16_t bufferSize, void* data)
+{
+    (void)channelId; (void)sequence; (void)buffer; (void)bufferSize; (void)data;
+}
+
+void eventHandler(enum np_dtls_srv_event event, void* data)
+{
+    (void)event; (void)data;
+}
+
+struct np_dtls_srv* createServer(struct np_platform* pl)
+{
+    struct np_dtls_srv* server = NULL;
+    BOOST_TEST(pl->dtlsS.create(pl, &server) == NABTO_EC_OK);
+    BOOST_TEST(pl->dtlsS.set_keys(server,
+                                  reinterpret_cast<const unsigned char*>(nabto::test::devicePublicKey.c_str()), nabto::test::devicePublicKey.size(),
+                                  reinterpret_cast<const unsigned char*>(nabto::test::devicePrivateKey.c_str()), nabto::test::devicePrivateKey.size()) == NABTO_EC_OK);
+    return server;
+}
+
+np_error_code createConnection(struct np_platform* pl, struct np_dtls_srv* server, struct np_dtls_srv_connection** connection)
+{
+    return pl->dtlsS.create_connection(server, connection, &sender, &dataHandler, &eventHandler, NULL);
+}
+
+/**
+ * Forwards the signatures to the worker pool and counts the jobs which
+ * are completed by the pool.
+ */
+class CountingAsyncPk {
+ public:
+    CountingAsyncPk(struct nm_mbedtls_async_pk pool)
+        : pool_(pool)
+    {
+        functions_.sign = &CountingAsyncPk::sign;
+        functions_.result = pool_.mptr->result;
+        functions_.release = pool_.mptr->release;
+    }
+
+    struct nm_mbedtls_async_pk get()
+    {
+        struct nm_mbedtls_async_pk asyncPk;
+        asyncPk.mptr = &functions_;
+        asyncPk.data = this;
+        return asyncPk;
+    }
+
+    size_t signs_ = 0;
+    size_t completed_ = 0;
+
+ private:
+    struct Job {
+        CountingAsyncPk* self;
+        nm_mbedtls_async_pk_callback cb;
+        void* cbData;
+    };
+
+    static np_error_code sign(void* data, const uint8_t* key, size_t keySize,
+                              mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLen,
+                              nm_mbedtls_async_pk_callback cb, void* cbData,
+                              struct nm_mbedtls_async_pk_job** job)
+    {
+        CountingAsyncPk* self = (CountingAsyncPk*)data;
+        self->signs_++;
+        self->jobs_.push_back(Job{self, cb, cbData});
+        return self->pool_.mptr->sign(self->pool_.data, key, keySize, mdAlg, hash, hashLen,
+                                      &CountingAsyncPk::done, &self->jobs_.back(), job);
+    }
+
+    static void done(void* data)
+    {
+        Job* job = (Job*)data;
+        job->self->completed_++;
+        job->cb(job->cbData);
+    }
+
+    struct nm_mbedtls_async_pk pool_;
+    struct nm_mbedtls_async_pk_functions functions_;
+    std::list<Job> jobs_;
+};
+
+/**
+ * An async pk which never completes its signature.
+ */
+class PendingAsyncPk {
+ public:
+    PendingAsyncPk()
+    {
+        functions_.sign = &PendingAsyncPk::sign;
+        functions_.result = &PendingAsyncPk::result;
+        functions_.release = &PendingAsyncPk::release;
+    }
+
+    struct nm_mbedtls_async_pk get()
+    {
+        struct nm_mbedtls_async_pk asyncPk;
+        asyncPk.mptr = &functions_;
+        asyncPk.data = this;
+        return asyncPk;
+    }
+
+    std::promise<void> signing_;
+    size_t released_ = 0;
+
+ private:
+    static np_error_code sign(void* data, const uint8_t* key, size_t keySize,
+                              mbedtls_md_type_t mdAlg, const unsigned char* hash, size_t hashLen,
+                              nm_mbedtls_async_pk_callback cb, void* cbData,
+                              struct nm_mbedtls_async_pk_job** job)
+    {
+        (void)key; (void)keySize; (void)mdAlg; (void)hash; (void)hashLen; (void)cb; (void)cbData;
+        PendingAsyncPk* self = (PendingAsyncPk*)data;
+        // The job is opaque to the server, it is only passed back to
+        // the functions below.
+        *job = (struct nm_mbedtls_async_pk_job*)self;
+        self->signing_.set_value();
+        return NABTO_EC_OK;
+    }
+
+    static bool result(struct nm_mbedtls_async_pk_job* job, int* ret,
+                       unsigned char* output, size_t* outputLen, size_t outputSize)
+    {
+        (void)job; (void)ret; (void)output; (void)outputLen; (void)outputSize;
+        return false;
+    }
+
+    static void release(struct nm_mbedtls_async_pk_job* job)
+    {
+        PendingAsyncPk* self = (PendingAsyncPk*)job;
+        self->released_++;
+    }
+
+    struct nm_mbedtls_async_pk_functions functions_;
+};
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(dtls)
+
+BOOST_AUTO_TEST_CASE(srv_connection_pool)
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    struct np_dtls_srv* server = createServer(pl);
+
+    BOOST_TEST(pl->dtlsS.set_max_connections(server, 0) == NABTO_EC_INVALID_ARGUMENT);
+    BOOST_TEST(pl->dtlsS.set_max_connections(server, 2) == NABTO_EC_OK);
+
+    struct np_dtls_srv_connection* first;
+    struct np_dtls_srv_connection* second;
+    struct np_dtls_srv_connection* third;
+    BOOST_TEST(createConnection(pl, server, &first) == NABTO_EC_OK);
+    BOOST_TEST(createConnection(pl, server, &second) == NABTO_EC_OK);
+    BOOST_TEST(first != second);
+    BOOST_TEST(createConnection(pl, server, &third) == NABTO_EC_OUT_OF_CONNECTIONS);
+
+    // the pool cannot be resized while connections are in use.
+    BOOST_TEST(pl->dtlsS.set_max_connections(server, 3) == NABTO_EC_INVALID_STATE);
+
+    // a connection which is destroyed is reused.
+    pl->dtlsS.destroy_connection(second);
+    BOOST_TEST(createConnection(pl, server, &third) == NABTO_EC_OK);
+    BOOST_TEST(third == second);
+
+    pl->dtlsS.destroy_connection(first);
+    pl->dtlsS.destroy_connection(third);
+    BOOST_TEST(pl->dtlsS.set_max_connections(server, 3) == NABTO_EC_OK);
+
+    std::vector<struct np_dtls_srv_connection*> connections(3);
+    for (auto& c : connections) {
+        BOOST_TEST(createConnection(pl, server, &c) == NABTO_EC_OK);
+    }
+    BOOST_TEST(createConnection(pl, server, &first) == NABTO_EC_OUT_OF_CONNECTIONS);
+    for (auto c : connections) {
+        pl->dtlsS.destroy_connection(c);
+    }
+
+    tp->stop();
+    pl->dtlsS.destroy(server);
+}
+
+BOOST_AUTO_TEST_CASE(srv_resume_cached_session, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    struct np_dtls_srv* server = createServer(pl);
+
+    nabto::test::DtlsLoopback loopback(pl, server, 0);
+    std::promise<void> handshakes[3];
+    size_t handshakeCount = 0;
+    loopback.serverEvent_ = [&](enum np_dtls_srv_event event) {
+        if (event == NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE) {
+            handshakes[handshakeCount].set_value();
+            handshakeCount++;
+        }
+    };
+
+    std::array<uint8_t, 32> fullFingerprint;
+    loopback.start();
+    handshakes[0].get_future().get();
+    loopback.execute([&]() {
+                         // a full handshake
+                         BOOST_TEST(loopback.serverCertificateRecords_ > (size_t)0);
+                         BOOST_TEST(pl->dtlsS.get_fingerprint(pl, loopback.connection_, fullFingerprint.data()) == NABTO_EC_OK);
+                         loopback.serverCertificateRecords_ = 0;
+                         loopback.reconnect();
+                     });
+
+    handshakes[1].get_future().get();
+    loopback.execute([&]() {
+                         // the session is resumed without certificates,
+                         // the client fingerprint is found in the cache.
+                         BOOST_TEST(loopback.serverCertificateRecords_ == (size_t)0);
+                         std::array<uint8_t, 32> fingerprint;
+                         BOOST_TEST(pl->dtlsS.get_fingerprint(pl, loopback.connection_, fingerprint.data()) == NABTO_EC_OK);
+                         BOOST_TEST(fingerprint == fullFingerprint);
+
+                         // new keys clears the session cache.
+                         BOOST_TEST(pl->dtlsS.set_keys(server,
+                                                       reinterpret_cast<const unsigned char*>(nabto::test::devicePublicKey.c_str()), nabto::test::devicePublicKey.size(),
+                                                       reinterpret_cast<const unsigned char*>(nabto::test::devicePrivateKey.c_str()), nabto::test::devicePrivateKey.size()) == NABTO_EC_OK);
+                         loopback.reconnect();
+                     });
+
+    handshakes[2].get_future().get();
+    loopback.execute([&]() {
+                         BOOST_TEST(loopback.serverCertificateRecords_ > (size_t)0);
+                         std::array<uint8_t, 32> fingerprint;
+                         BOOST_TEST(pl->dtlsS.get_fingerprint(pl, loopback.connection_, fingerprint.data()) == NABTO_EC_OK);
+                         BOOST_TEST(fingerprint == fullFingerprint);
+                     });
+
+    tp->stop();
+    loopback.destroy();
+    pl->dtlsS.destroy(server);
+}
+
+BOOST_AUTO_TEST_CASE(srv_handshakes_signed_by_worker_pool, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    struct np_dtls_srv* server = createServer(pl);
+
+    struct nm_mbedtls_async_pk_pool* pool;
+    BOOST_TEST(nm_mbedtls_async_pk_pool_create(pl, &stdThreads, 0, &pool) == NABTO_EC_INVALID_ARGUMENT);
+    BOOST_TEST(nm_mbedtls_async_pk_pool_create(pl, &stdThreads, 2, &pool) == NABTO_EC_OK);
+    CountingAsyncPk asyncPk(nm_mbedtls_async_pk_pool_get_impl(pool));
+    struct nm_mbedtls_async_pk impl = asyncPk.get();
+    BOOST_TEST(nm_mbedtls_srv_set_async_pk(server, &impl) == NABTO_EC_OK);
+
+    // more handshakes than workers.
+    const size_t handshakes = 4;
+    std::vector<std::unique_ptr<nabto::test::DtlsLoopback> > loopbacks;
+    std::vector<std::promise<void> > completed(handshakes);
+    for (size_t i = 0; i < handshakes; i++) {
+        loopbacks.push_back(std::unique_ptr<nabto::test::DtlsLoopback>(new nabto::test::DtlsLoopback(pl, server, (uint8_t)i)));
+        std::promise<void>& c = completed[i];
+        loopbacks[i]->serverEvent_ = [&c](enum np_dtls_srv_event event) {
+            if (event == NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE) {
+                c.set_value();
+            }
+        };
+        loopbacks[i]->start();
+    }
+    for (auto& c : completed) {
+        c.get_future().get();
+    }
+
+    loopbacks[0]->execute([&]() {
+                              // each handshake was suspended while a worker made its signature.
+                              BOOST_TEST(asyncPk.signs_ == handshakes);
+                              BOOST_TEST(asyncPk.completed_ == handshakes);
+                              for (auto& l : loopbacks) {
+                                  std::array<uint8_t, 32> fingerprint;
+                                  BOOST_TEST(pl->dtlsS.get_fingerprint(pl, l->connection_, fingerprint.data()) == NABTO_EC_OK);
+                              }
+                          });
+
+    tp->stop();
+    for (auto& l : loopbacks) {
+        l->destroy();
+    }
+    pl->dtlsS.destroy(server);
+    nm_mbedtls_async_pk_pool_destroy(pool);
+}
+
+BOOST_AUTO_TEST_CASE(srv_pending_signature_is_released_with_the_connection, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    struct np_dtls_srv* server = createServer(pl);
+
+    PendingAsyncPk asyncPk;
+    struct nm_mbedtls_async_pk impl = asyncPk.get();
+    BOOST_TEST(nm_mbedtls_srv_set_async_pk(server, &impl) == NABTO_EC_OK);
+
+    nabto::test::DtlsLoopback loopback(pl, server, 0);
+    bool handshakeCompleted = false;
+    loopback.serverEvent_ = [&](enum np_dtls_srv_event event) {
+        if (event == NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE) {
+            handshakeCompleted = true;
+        }
+    };
+    loopback.start();
+    asyncPk.signing_.get_future().get();
+
+    loopback.execute([&]() {
+                         BOOST_TEST(asyncPk.released_ == (size_t)0);
+                         pl->dtlsS.destroy_connection(loopback.connection_);
+                         loopback.connection_ = NULL;
+                         // the server cancels the signature of a destroyed connection.
+                         BOOST_TEST(asyncPk.released_ == (size_t)1);
+                         BOOST_TEST(!handshakeCompleted);
+                     });
+
+    tp->stop();
+    loopback.destroy();
+    pl->dtlsS.destroy(server);
+}
+
+BOOST_AUTO_TEST_CASE(srv_connection_memory_usage_after_handshake, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    struct np_dtls_srv* server = createServer(pl);
+
+    nabto::test::DtlsLoopback loopback(pl, server, 0);
+    std::promise<void> handshake;
+    std::promise<void> clientReceived;
+    std::promise<void> serverReceived;
+    loopback.serverEvent_ = [&](enum np_dtls_srv_event event) {
+        if (event == NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE) {
+            handshake.set_value();
+        }
+    };
+    loopback.clientData_ = [&](uint8_t* buffer, uint16_t bufferSize) {
+        BOOST_TEST(std::vector<uint8_t>(buffer, buffer + bufferSize) == std::vector<uint8_t>({1, 2, 3}), boost::test_tools::per_element());
+        clientReceived.set_value();
+    };
+    loopback.serverData_ = [&](uint8_t* buffer, uint16_t bufferSize) {
+        BOOST_TEST(std::vector<uint8_t>(buffer, buffer + bufferSize) == std::vector<uint8_t>({4, 5, 6}), boost::test_tools::per_element());
+        serverReceived.set_value();
+    };
+
+    loopback.start();
+    handshake.get_future().get();
+    loopback.execute([&]() {
+                         // the handshake state and the peer certificate
+                         // are released, the connection is within the
+                         // memory cost announced by the server.
+                         size_t usage = pl->dtlsS.get_connection_memory_usage(loopback.connection_);
+                         BOOST_TEST(usage > (size_t)0);
+                         BOOST_TEST(usage <= pl->dtlsS.get_connection_memory_cost(server));
+
+                         std::array<uint8_t, 32> fingerprint;
+                         BOOST_TEST(pl->dtlsS.get_fingerprint(pl, loopback.connection_, fingerprint.data()) == NABTO_EC_OK);
+
+                         BOOST_TEST(loopback.serverSend({1, 2, 3}) == NABTO_EC_OK);
+                         BOOST_TEST(loopback.clientSend({4, 5, 6}) == NABTO_EC_OK);
+                     });
+    clientReceived.get_future().get();
+    serverReceived.get_future().get();
+
+    tp->stop();
+    loopback.destroy();
+    pl->dtlsS.destroy(server);
+}
+
+BOOST_AUTO_TEST_CASE(srv_hibernated_connection_is_woken, * boost::unit_test::timeout(120))
+{
+    auto tp = nabto::test::TestPlatform::create();
+    struct np_platform* pl = tp->getPlatform();
+    struct np_dtls_srv* server = createServer(pl);
+
+    nabto::test::DtlsLoopback loopback(pl, server, 0);
+    std::promise<void> handshake;
+    std::promise<void> serverReceived;
+    std::promise<void> clientReceived;
+    loopback.serverEvent_ = [&](enum np_dtls_srv_event event) {
+        if (event == NP_DTLS_SRV_EVENT_HANDSHAKE_COMPLETE) {
+            handshake.set_value();
+        }
+    };
+    loopback.serverData_ = [&](uint8_t* buffer, uint16_t bufferSize) {
+        BOOST_TEST(std::vector<uint8_t>(buffer, buffer + bufferSize) == std::vector<uint8_t>({4, 5, 6}), boost::test_tools::per_element());
+        serverReceived.set_value();
+    };
+    loopback.clientData_ = [&](uint8_t* buffer, uint16_t bufferSize) {
+        BOOST_TEST(std::vector<uint8_t>(buffer, buffer + bufferSize) == std::vector<uint8_t>({1, 2, 3}), boost::test_tools::per_element());
+        clientReceived.set_value();
+    };
+
+    loopback.start();
+    handshake.get_future().get();
+
+    std::array<uint8_t, 32> fingerprint;
+    size_t usage = 0;
+    np_error_code ec = NABTO_EC_OK;
+    // the last flight of the handshake can still be in the send list.
+    do {
+        loopback.execute([&]() {
+                             BOOST_TEST(pl->dtlsS.get_fingerprint(pl, loopback.connection_, fingerprint.data()) == NABTO_EC_OK);
+                             usage = pl->dtlsS.get_connection_memory_usage(loopback.connection_);
+                             ec = pl->dtlsS.hibernate(loopback.connection_);
+                         });
+    } while (ec == NABTO_EC_OPERATION_IN_PROGRESS);
+
+    if (ec == NABTO_EC_NOT_SUPPORTED) {
+        BOOST_TEST_MESSAGE("mbedtls is built without context serialization");
+    } else {
+        BOOST_TEST(ec == NABTO_EC_OK);
+        loopback.execute([&]() {
+                             BOOST_TEST(pl->dtlsS.get_connection_memory_usage(loopback.connection_) < usage);
+                             // a hibernated connection is hibernated again.
+                             BOOST_TEST(pl->dtlsS.hibernate(loopback.connection_) == NABTO_EC_OK);
+                             // the connection is woken by a packet.
+                             BOOST_TEST(loopback.clientSend({4, 5, 6}) == NABTO_EC_OK);
+                         });
+        serverReceived.get_future().get();
+
+        do {
+            loopback.execute([&]() {
+                                 ec = pl->dtlsS.hibernate(loopback.connection_);
+                             });
+        } while (ec == NABTO_EC_OPERATION_IN_PROGRESS);
+        BOOST_TEST(ec == NABTO_EC_OK);
+
+        loopback.execute([&]() {
+                             // the connection is woken by a send.
+                             BOOST_TEST(loopback.serverSend({1, 2, 3}) == NABTO_EC_OK);
+                         });
+        clientReceived.get_future().get();
+
+        loopback.execute([&]() {
+                             // the restored context has the keys and the peer of the handshake.
+                             std::array<uint8_t, 32> restored;
+                             BOOST_TEST(pl->dtlsS.get_fingerprint(pl, loopback.connection_, restored.data()) == NABTO_EC_OK);
+                             BOOST_TEST(restored == fingerprint);
+                             BOOST_TEST(pl->dtlsS.get_connection_memory_usage(loopback.connection_) <= pl->dtlsS.get_connection_memory_cost(server));
+                         });
+    }
+
+    tp->stop();
+    loopback.destroy();
+    pl->dtlsS.destroy(server);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
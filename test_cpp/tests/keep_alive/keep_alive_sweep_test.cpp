@@ -0,0 +1,351 @@
+#include <boost/test/unit_test.hpp>
+
+#include <core/nc_keep_alive.h>
+#include <platform/np_timestamp_wrapper.h>
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <set>
+#include <vector>
+
+namespace {
+
+/**
+ * A platform with a timestamp which is moved by the test and an event
+ * queue which only holds the timed event of the sweep. The test runs
+ * the event when it is due, or late to simulate a stalled core.
+ */
+class SweepTest {
+ public:
+    SweepTest()
+    {
+        memset(&pl_, 0, sizeof(pl_));
+        pl_.timestamp.mptr = &timestampFunctions_;
+        pl_.timestamp.data = this;
+        pl_.eq.mptr = &eventQueueFunctions_;
+        pl_.eq.data = this;
+        pl_.random.random = &random;
+        pl_.randomData = this;
+        BOOST_TEST(nc_keep_alive_sweep_init(&sweep_, &pl_) == NABTO_EC_OK);
+    }
+
+    ~SweepTest()
+    {
+        nc_keep_alive_sweep_deinit(&sweep_);
+    }
+
+    /**
+     * Move the time forward ms milliseconds and run the sweep event on
+     * time.
+     */
+    void run(uint32_t ms)
+    {
+        uint32_t i;
+        for (i = 0; i < ms; i++) {
+            now_++;
+            runDue();
+        }
+    }
+
+    /**
+     * Move the time forward ms milliseconds without running the sweep
+     * event, as if the core thread is blocked.
+     */
+    void stall(uint32_t ms)
+    {
+        now_ += ms;
+    }
+
+    void runDue()
+    {
+        if (posted_ && np_timestamp_less_or_equal(due_, now_)) {
+            posted_ = false;
+            cb_(cbData_);
+        }
+    }
+
+    static uint32_t nowMs(struct np_timestamp* obj)
+    {
+        SweepTest* self = (SweepTest*)obj->data;
+        return self->now_;
+    }
+
+    static np_error_code random(struct np_platform* pl, void* buffer, size_t bufferLength)
+    {
+        (void)pl;
+        uint32_t seed = 0x9e3779b9;
+        memcpy(buffer, &seed, bufferLength < sizeof(seed) ? bufferLength : sizeof(seed));
+        return NABTO_EC_OK;
+    }
+
+    static void initEvent(struct np_event_queue* obj, struct np_event* event, np_event_callback cb, void* cbData)
+    {
+        SweepTest* self = (SweepTest*)obj->data;
+        event->storage[0].ptr = self;
+        self->cb_ = cb;
+        self->cbData_ = cbData;
+    }
+
+    static void deinitEvent(struct np_event* event)
+    {
+        SweepTest* self = (SweepTest*)event->storage[0].ptr;
+        self->posted_ = false;
+    }
+
+    static void postTimedEvent(struct np_event* event, uint32_t milliseconds)
+    {
+        SweepTest* self = (SweepTest*)event->storage[0].ptr;
+        self->posted_ = true;
+        self->due_ = self->now_ + milliseconds;
+    }
+
+    struct np_platform pl_;
+    struct nc_keep_alive_sweep sweep_;
+    // starts close to the wrap around of the timestamp.
+    uint32_t now_ = 0xFFFF0000;
+
+    np_event_callback cb_ = NULL;
+    void* cbData_ = NULL;
+    bool posted_ = false;
+    uint32_t due_ = 0;
+
+    static const struct np_timestamp_functions timestampFunctions_;
+    static const struct np_event_queue_functions eventQueueFunctions_;
+};
+
+const struct np_timestamp_functions SweepTest::timestampFunctions_ = { &SweepTest::nowMs, NULL };
+const struct np_event_queue_functions SweepTest::eventQueueFunctions_ = {
+    &SweepTest::initEvent,
+    &SweepTest::deinitEvent,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    &SweepTest::deinitEvent,
+    &SweepTest::postTimedEvent,
+    NULL,
+    NULL,
+    NULL
+};
+
+/**
+ * A keep alive which records when it is called and waits again.
+ */
+class KeepAlive {
+ public:
+    KeepAlive(SweepTest& t, uint32_t retryInterval)
+        : t_(t)
+    {
+        BOOST_TEST(nc_keep_alive_init(&ctx_, &t.sweep_, &called, this) == NABTO_EC_OK);
+        nc_keep_alive_set_settings(&ctx_, NC_KEEP_ALIVE_DEFAULT_INTERVAL, retryInterval, NC_KEEP_ALIVE_DEFAULT_MAX_RETRIES);
+    }
+
+    ~KeepAlive()
+    {
+        nc_keep_alive_deinit(&ctx_);
+    }
+
+    /**
+     * Wait the full retry interval, the first wait after init is
+     * jittered so it is replaced by a second wait.
+     */
+    void waitFull()
+    {
+        nc_keep_alive_wait(&ctx_);
+        nc_keep_alive_wait(&ctx_);
+        waited_ = t_.now_;
+    }
+
+    static void called(void* data)
+    {
+        KeepAlive* self = (KeepAlive*)data;
+        self->calls_.push_back(self->t_.now_);
+        if (self->onCall_) {
+            self->onCall_();
+        }
+        if (self->rewait_) {
+            nc_keep_alive_wait(&self->ctx_);
+        }
+    }
+
+    SweepTest& t_;
+    struct nc_keep_alive_context ctx_;
+    std::vector<uint32_t> calls_;
+    uint32_t waited_ = 0;
+    bool rewait_ = true;
+    std::function<void()> onCall_;
+};
+
+const uint32_t retryInterval = NC_KEEP_ALIVE_DEFAULT_RETRY_INTERVAL;
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(keep_alive_sweep)
+
+BOOST_AUTO_TEST_CASE(late_sweep_calls_each_keep_alive_once)
+{
+    SweepTest t;
+    std::vector<std::unique_ptr<KeepAlive> > keepAlives;
+    size_t i;
+    for (i = 0; i < 50; i++) {
+        keepAlives.push_back(std::unique_ptr<KeepAlive>(new KeepAlive(t, retryInterval)));
+        nc_keep_alive_wait(&keepAlives.back()->ctx_);
+    }
+    t.run(10000);
+
+    std::vector<size_t> before;
+    for (auto& ka : keepAlives) {
+        before.push_back(ka->calls_.size());
+    }
+
+    // The core is blocked for 45 seconds, the late sweep calls each
+    // keep alive once and the new waits starts from now.
+    t.stall(45000);
+    uint32_t stalled = t.now_;
+    t.runDue();
+    for (i = 0; i < keepAlives.size(); i++) {
+        BOOST_TEST(keepAlives[i]->calls_.size() == before[i] + 1);
+        BOOST_TEST(keepAlives[i]->calls_.back() == stalled);
+    }
+
+    t.run(retryInterval - 1);
+    for (i = 0; i < keepAlives.size(); i++) {
+        BOOST_TEST(keepAlives[i]->calls_.size() == before[i] + 1);
+    }
+    t.run(NC_KEEP_ALIVE_SWEEP_TICK + 1);
+    for (i = 0; i < keepAlives.size(); i++) {
+        BOOST_TEST(keepAlives[i]->calls_.size() == before[i] + 2);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(wait_longer_than_the_buckets_wraps)
+{
+    SweepTest t;
+    // more ticks than there are buckets.
+    uint32_t interval = NC_KEEP_ALIVE_SWEEP_TICK * (NC_KEEP_ALIVE_SWEEP_BUCKETS * 2 + 5);
+    KeepAlive ka(t, interval);
+    size_t i;
+    // an other keep alive which keeps the sweep ticking.
+    KeepAlive other(t, retryInterval);
+    nc_keep_alive_wait(&other.ctx_);
+    ka.waitFull();
+
+    t.run(interval - 1);
+    BOOST_TEST(ka.calls_.size() == (size_t)0);
+    t.run(NC_KEEP_ALIVE_SWEEP_TICK + 1);
+    BOOST_REQUIRE(ka.calls_.size() == (size_t)1);
+    t.run((interval + NC_KEEP_ALIVE_SWEEP_TICK) * 2);
+    BOOST_REQUIRE(ka.calls_.size() == (size_t)3);
+    for (i = 1; i < ka.calls_.size(); i++) {
+        uint32_t waited = (uint32_t)np_timestamp_difference(ka.calls_[i], ka.calls_[i-1]);
+        BOOST_TEST(waited >= interval);
+        BOOST_TEST(waited <= interval + NC_KEEP_ALIVE_SWEEP_TICK);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(due_time_is_never_earlier_than_the_retry_interval)
+{
+    SweepTest t;
+    KeepAlive other(t, retryInterval);
+    nc_keep_alive_wait(&other.ctx_);
+
+    uint32_t offset;
+    for (offset = 0; offset < NC_KEEP_ALIVE_SWEEP_TICK * 2; offset += 7) {
+        KeepAlive ka(t, retryInterval);
+        ka.rewait_ = false;
+        t.run(offset);
+        ka.waitFull();
+        t.run(retryInterval + NC_KEEP_ALIVE_SWEEP_TICK);
+        BOOST_REQUIRE(ka.calls_.size() == (size_t)1);
+        uint32_t waited = (uint32_t)np_timestamp_difference(ka.calls_[0], ka.waited_);
+        BOOST_TEST(waited >= retryInterval);
+        BOOST_TEST(waited <= retryInterval + NC_KEEP_ALIVE_SWEEP_TICK);
+    }
+
+    // A wait taken while the sweep event is late does not count the
+    // ticks which has passed.
+    KeepAlive ka(t, retryInterval);
+    ka.rewait_ = false;
+    t.stall(retryInterval * 3);
+    ka.waitFull();
+    t.runDue();
+    BOOST_TEST(ka.calls_.size() == (size_t)0);
+    t.run(retryInterval - 1);
+    BOOST_TEST(ka.calls_.size() == (size_t)0);
+    t.run(NC_KEEP_ALIVE_SWEEP_TICK + 1);
+    BOOST_TEST(ka.calls_.size() == (size_t)1);
+}
+
+BOOST_AUTO_TEST_CASE(first_wait_is_jittered_within_the_retry_interval)
+{
+    SweepTest t;
+    std::vector<std::unique_ptr<KeepAlive> > keepAlives;
+    uint32_t start = t.now_;
+    size_t i;
+    for (i = 0; i < 100; i++) {
+        keepAlives.push_back(std::unique_ptr<KeepAlive>(new KeepAlive(t, retryInterval)));
+        keepAlives.back()->rewait_ = false;
+        nc_keep_alive_wait(&keepAlives.back()->ctx_);
+    }
+    t.run(retryInterval + NC_KEEP_ALIVE_SWEEP_TICK);
+
+    std::set<uint32_t> times;
+    for (auto& ka : keepAlives) {
+        BOOST_REQUIRE(ka->calls_.size() == (size_t)1);
+        uint32_t waited = (uint32_t)np_timestamp_difference(ka->calls_[0], start);
+        BOOST_TEST(waited >= (uint32_t)NC_KEEP_ALIVE_SWEEP_TICK);
+        BOOST_TEST(waited <= retryInterval + NC_KEEP_ALIVE_SWEEP_TICK);
+        times.insert(waited);
+    }
+    // the keep alives are spread over the ticks of the interval.
+    BOOST_TEST(times.size() >= (size_t)(retryInterval / NC_KEEP_ALIVE_SWEEP_TICK / 2));
+}
+
+BOOST_AUTO_TEST_CASE(stop_while_waiting)
+{
+    SweepTest t;
+    KeepAlive ka(t, retryInterval);
+    ka.waitFull();
+    t.run(retryInterval / 2);
+    nc_keep_alive_stop(&ka.ctx_);
+    BOOST_TEST(t.sweep_.armed == (size_t)0);
+    t.run(retryInterval * 2);
+    BOOST_TEST(ka.calls_.size() == (size_t)0);
+
+    // the keep alive can wait again after a stop.
+    ka.waitFull();
+    t.run(retryInterval + NC_KEEP_ALIVE_SWEEP_TICK);
+    BOOST_TEST(ka.calls_.size() == (size_t)1);
+}
+
+BOOST_AUTO_TEST_CASE(stop_inside_a_sweep)
+{
+    SweepTest t;
+    KeepAlive first(t, retryInterval);
+    KeepAlive second(t, retryInterval);
+    KeepAlive third(t, retryInterval);
+    first.waitFull();
+    second.waitFull();
+    third.waitFull();
+
+    // The first keep alive stops itself and the second which is due in
+    // the same sweep.
+    first.rewait_ = false;
+    first.onCall_ = [&]() {
+        nc_keep_alive_stop(&first.ctx_);
+        nc_keep_alive_stop(&second.ctx_);
+    };
+    t.run(retryInterval + NC_KEEP_ALIVE_SWEEP_TICK);
+    BOOST_TEST(first.calls_.size() == (size_t)1);
+    BOOST_TEST(second.calls_.size() == (size_t)0);
+    BOOST_TEST(third.calls_.size() == (size_t)1);
+    BOOST_TEST(t.sweep_.armed == (size_t)1);
+
+    t.run((retryInterval + NC_KEEP_ALIVE_SWEEP_TICK) * 2);
+    BOOST_TEST(first.calls_.size() == (size_t)1);
+    BOOST_TEST(second.calls_.size() == (size_t)0);
+    BOOST_TEST(third.calls_.size() == (size_t)3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -113,6 +113,38 @@ class UdpEchoClientTest {
 
 };
 
+class UdpSharedBindTest {
+ public:
+    UdpSharedBindTest(TestPlatform& tp)
+        : pl_(tp.getPlatform()), eq_(pl_->eq)
+    {
+        np_completion_event_init(&eq_, &completionEvent_, NULL, NULL);
+    }
+
+    ~UdpSharedBindTest()
+    {
+        np_completion_event_deinit(&completionEvent_);
+    }
+
+    np_error_code bind(struct np_udp_socket* sock, uint16_t port)
+    {
+        std::promise<np_error_code> promise;
+        np_completion_event_reinit(&completionEvent_, &UdpSharedBindTest::bound, &promise);
+        np_udp_async_bind_port_shared(&pl_->udp, sock, port, &completionEvent_);
+        return promise.get_future().get();
+    }
+
+    static void bound(const np_error_code ec, void* data)
+    {
+        std::promise<np_error_code>* promise = (std::promise<np_error_code>*)data;
+        promise->set_value(ec);
+    }
+
+    struct np_platform* pl_;
+    struct np_event_queue eq_;
+    struct np_completion_event completionEvent_;
+};
+
 } } // namespace
 
 
@@ -135,5 +167,34 @@ BOOST_DATA_TEST_CASE(echo, nabto::test::TestPlatformFactory::multi(), tpf)
     udpServer->stop();
 }
 
+BOOST_TEST_DECORATOR(* boost::unit_test::timeout(120))
+BOOST_DATA_TEST_CASE(bind_shared, nabto::test::TestPlatformFactory::multi(), tpf)
+{
+    auto tp = tpf->create();
+    struct np_platform* pl = tp->getPlatform();
+    nabto::test::UdpSharedBindTest test(*tp);
+
+    struct np_udp_socket* first;
+    struct np_udp_socket* second;
+    BOOST_TEST(np_udp_create(&pl->udp, &first) == NABTO_EC_OK);
+    BOOST_TEST(np_udp_create(&pl->udp, &second) == NABTO_EC_OK);
+
+    np_error_code ec = test.bind(first, 0);
+    if (ec == NABTO_EC_NOT_SUPPORTED) {
+        // the platform cannot share ports.
+        np_udp_destroy(&pl->udp, first);
+        np_udp_destroy(&pl->udp, second);
+        return;
+    }
+    BOOST_TEST(ec == NABTO_EC_OK);
+    uint16_t port = np_udp_get_local_port(&pl->udp, first);
+    BOOST_TEST(port != 0);
+
+    BOOST_TEST(test.bind(second, port) == NABTO_EC_OK);
+    BOOST_TEST(np_udp_get_local_port(&pl->udp, second) == port);
+
+    np_udp_destroy(&pl->udp, first);
+    np_udp_destroy(&pl->udp, second);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,88 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/test/data/test_case.hpp>
+
+#include <modules/event_queue/nm_event_queue.h>
+#include <platform/np_timestamp_wrapper.h>
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+namespace {
+
+void noop(void* data)
+{
+    (void)data;
+}
+
+double nsPerOperation(std::chrono::steady_clock::time_point start, size_t operations)
+{
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (double)operations;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(event_queue)
+
+BOOST_DATA_TEST_CASE(timed_events_insert_cancel_expire, boost::unit_test::data::make({10000, 100000}), armed)
+{
+    // timeouts like the keep alive, stream and retransmission timers of many connections.
+    const uint32_t maxTimeout = 60000;
+    // start close to the wrap around of the timestamps.
+    const uint32_t now = 0xffff0000;
+
+    struct nm_event_queue queue;
+    nm_event_queue_init(&queue);
+    std::vector<struct nm_event_queue_event> events(armed);
+    for (auto& e : events) {
+        nm_event_queue_event_init(&e, &noop, NULL);
+    }
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint32_t> timeout(1, maxTimeout);
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto& e : events) {
+        nm_event_queue_post_timed_event(&queue, &e, now + timeout(rng));
+    }
+    BOOST_TEST_MESSAGE("armed: " << armed << ", insert: " << nsPerOperation(start, events.size()) << " ns");
+
+    // cancel every other timer and rearm every fourth, like timers
+    // which are reset by traffic before they expire.
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < events.size(); i += 2) {
+        nm_event_queue_cancel_event(&events[i]);
+    }
+    BOOST_TEST_MESSAGE("armed: " << armed << ", cancel: " << nsPerOperation(start, events.size() / 2) << " ns");
+
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < events.size(); i += 4) {
+        nm_event_queue_post_timed_event(&queue, &events[i], now + timeout(rng));
+    }
+    BOOST_TEST_MESSAGE("armed: " << armed << ", rearm: " << nsPerOperation(start, events.size() / 4) << " ns");
+
+    size_t expected = events.size() / 2 + events.size() / 4;
+    BOOST_TEST(queue.timedEventsSize == expected);
+
+    start = std::chrono::steady_clock::now();
+    struct nm_event_queue_event* event;
+    size_t expired = 0;
+    uint32_t previous = now;
+    bool ordered = true;
+    while (nm_event_queue_take_timed_event(&queue, now + maxTimeout, &event)) {
+        ordered = ordered && np_timestamp_less_or_equal(previous, event->expireTimestamp);
+        previous = event->expireTimestamp;
+        expired++;
+    }
+    BOOST_TEST_MESSAGE("armed: " << armed << ", expire: " << nsPerOperation(start, expired) << " ns");
+
+    BOOST_TEST(ordered);
+    BOOST_TEST(expired == expected);
+    BOOST_TEST(queue.timedEventsSize == (size_t)0);
+
+    for (auto& e : events) {
+        nm_event_queue_event_deinit(&e);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
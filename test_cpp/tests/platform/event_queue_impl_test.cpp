@@ -0,0 +1,370 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/test/data/test_case.hpp>
+
+#include <platform/np_platform.h>
+#include <platform/np_event_queue_wrapper.h>
+#include <modules/event_queue/thread_event_queue.h>
+#include <modules/libevent/nm_libevent.h>
+#include <nabto_device_libevent/libevent_event_queue.h>
+#include <api/nabto_device_threads.h>
+
+#include <event2/event.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+namespace nabto {
+namespace test {
+
+/**
+ * An event queue implementation running on its own thread, with the
+ * core mutex the queue takes while it executes events.
+ */
+class EventQueueImpl {
+ public:
+    EventQueueImpl()
+    {
+        coreMutex_ = nabto_device_threads_create_mutex();
+        ts_.mptr = &timestampFunctions_;
+        ts_.data = this;
+    }
+    virtual ~EventQueueImpl()
+    {
+        nabto_device_threads_free_mutex(coreMutex_);
+    }
+
+    /**
+     * Stop the thread executing the events.
+     */
+    virtual void stop() = 0;
+
+    struct np_event_queue* eq()
+    {
+        return &eq_;
+    }
+
+    struct nabto_device_mutex* coreMutex()
+    {
+        return coreMutex_;
+    }
+
+    /**
+     * Stop the microsecond clock, such that a batch of ready events
+     * never ends on the batch time limit.
+     */
+    void stopMicrosecondClock()
+    {
+        stoppedUs_ = nowUs(&ts_);
+        microsecondClockStopped_ = true;
+    }
+
+ protected:
+    static uint32_t nowMs(struct np_timestamp* obj)
+    {
+        (void)obj;
+        return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static uint32_t nowUs(struct np_timestamp* obj)
+    {
+        EventQueueImpl* self = (EventQueueImpl*)obj->data;
+        if (self->microsecondClockStopped_) {
+            return self->stoppedUs_;
+        }
+        return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct np_event_queue eq_;
+    struct nabto_device_mutex* coreMutex_;
+    struct np_timestamp ts_;
+    std::atomic<bool> microsecondClockStopped_ = { false };
+    std::atomic<uint32_t> stoppedUs_ = { 0 };
+    static const struct np_timestamp_functions timestampFunctions_;
+};
+
+const struct np_timestamp_functions EventQueueImpl::timestampFunctions_ = { &EventQueueImpl::nowMs, &EventQueueImpl::nowUs };
+
+class ThreadEventQueueImpl : public EventQueueImpl {
+ public:
+    ThreadEventQueueImpl()
+    {
+        thread_event_queue_init(&queue_, coreMutex_, &ts_);
+        eq_ = thread_event_queue_get_impl(&queue_);
+        thread_event_queue_run(&queue_);
+    }
+
+    ~ThreadEventQueueImpl()
+    {
+        stop();
+        thread_event_queue_deinit(&queue_);
+    }
+
+    void stop()
+    {
+        if (stopped_) {
+            return;
+        }
+        stopped_ = true;
+        thread_event_queue_stop_blocking(&queue_);
+    }
+
+ private:
+    struct thread_event_queue queue_;
+    bool stopped_ = false;
+};
+
+class LibeventEventQueueImpl : public EventQueueImpl {
+ public:
+    LibeventEventQueueImpl()
+    {
+        nm_libevent_global_init();
+        eventBase_ = event_base_new();
+        eq_ = libevent_event_queue_create(eventBase_, coreMutex_, &ts_);
+        thread_ = std::thread([this]() {
+                                  event_base_loop(eventBase_, EVLOOP_NO_EXIT_ON_EMPTY);
+                              });
+    }
+
+    ~LibeventEventQueueImpl()
+    {
+        stop();
+        libevent_event_queue_destroy(&eq_);
+        event_base_free(eventBase_);
+        nm_libevent_global_deinit();
+    }
+
+    void stop()
+    {
+        if (thread_.joinable()) {
+            event_base_loopbreak(eventBase_);
+            thread_.join();
+        }
+    }
+
+ private:
+    struct event_base* eventBase_;
+    std::thread thread_;
+};
+
+class EventQueueImplFactory {
+ public:
+    virtual ~EventQueueImplFactory() {}
+    virtual std::unique_ptr<EventQueueImpl> create() = 0;
+    virtual const char* name() const = 0;
+
+    static std::vector<std::shared_ptr<EventQueueImplFactory> > all();
+};
+
+class ThreadEventQueueImplFactory : public EventQueueImplFactory {
+ public:
+    std::unique_ptr<EventQueueImpl> create()
+    {
+        return std::unique_ptr<EventQueueImpl>(new ThreadEventQueueImpl());
+    }
+    const char* name() const
+    {
+        return "thread_event_queue";
+    }
+};
+
+class LibeventEventQueueImplFactory : public EventQueueImplFactory {
+ public:
+    std::unique_ptr<EventQueueImpl> create()
+    {
+        return std::unique_ptr<EventQueueImpl>(new LibeventEventQueueImpl());
+    }
+    const char* name() const
+    {
+        return "libevent_event_queue";
+    }
+};
+
+std::vector<std::shared_ptr<EventQueueImplFactory> > EventQueueImplFactory::all()
+{
+    return { std::make_shared<ThreadEventQueueImplFactory>(),
+             std::make_shared<LibeventEventQueueImplFactory>() };
+}
+
+std::ostream& operator<<(std::ostream& os, const std::shared_ptr<EventQueueImplFactory>& factory)
+{
+    return os << factory->name();
+}
+
+} } // namespace
+
+namespace {
+
+/**
+ * Events which record the number of events executed when another
+ * thread gets the core mutex. The other thread is started by the
+ * first event, while the queue holds the core mutex.
+ */
+struct BatchTest {
+    struct nabto_device_mutex* coreMutex;
+    std::vector<struct np_event> events;
+    std::atomic<size_t> executed = { 0 };
+    size_t executedWhenLocked = 0;
+    std::thread locker;
+    std::promise<void> done;
+};
+
+void batchEvent(void* data)
+{
+    BatchTest* t = (BatchTest*)data;
+    if (t->executed == 0) {
+        t->locker = std::thread([t]() {
+                                    nabto_device_threads_mutex_lock(t->coreMutex);
+                                    t->executedWhenLocked = t->executed;
+                                    nabto_device_threads_mutex_unlock(t->coreMutex);
+                                });
+    }
+    t->executed++;
+    if (t->executed == t->events.size()) {
+        t->done.set_value();
+    }
+}
+
+struct CountingEvent {
+    std::atomic<size_t> executed = { 0 };
+};
+
+void countingEvent(void* data)
+{
+    CountingEvent* t = (CountingEvent*)data;
+    t->executed++;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(event_queue_impl)
+
+BOOST_TEST_DECORATOR(* boost::unit_test::timeout(120))
+BOOST_DATA_TEST_CASE(ready_events_run_in_batches, nabto::test::EventQueueImplFactory::all(), factory)
+{
+    const size_t batchSize = 4;
+    auto q = factory->create();
+    struct np_event_queue* eq = q->eq();
+    BOOST_TEST(np_event_queue_set_batch_size(eq, 0) == NABTO_EC_INVALID_ARGUMENT);
+    BOOST_TEST(np_event_queue_set_batch_size(eq, batchSize) == NABTO_EC_OK);
+    // Starting the locker thread can take longer than the batch time
+    // limit on a loaded machine.
+    q->stopMicrosecondClock();
+
+    BatchTest t;
+    t.coreMutex = q->coreMutex();
+    t.events.resize(2 * batchSize);
+    for (auto& e : t.events) {
+        np_event_queue_init_event(eq, &e, &batchEvent, &t);
+    }
+
+    // all the events are ready before the first is executed.
+    nabto_device_threads_mutex_lock(q->coreMutex());
+    for (auto& e : t.events) {
+        np_event_queue_post(eq, &e);
+    }
+    nabto_device_threads_mutex_unlock(q->coreMutex());
+
+    t.done.get_future().get();
+    t.locker.join();
+    // The core mutex is only released between batches.
+    BOOST_TEST(t.executedWhenLocked >= batchSize);
+    BOOST_TEST(t.executedWhenLocked % batchSize == (size_t)0);
+
+    q->stop();
+    for (auto& e : t.events) {
+        np_event_queue_deinit_event(eq, &e);
+    }
+}
+
+BOOST_TEST_DECORATOR(* boost::unit_test::timeout(120))
+BOOST_DATA_TEST_CASE(post_of_timed_event_is_ignored, nabto::test::EventQueueImplFactory::all(), factory)
+{
+    auto q = factory->create();
+    struct np_event_queue* eq = q->eq();
+
+    CountingEvent t;
+    struct np_event event;
+    np_event_queue_init_event(eq, &event, &countingEvent, &t);
+
+    nabto_device_threads_mutex_lock(q->coreMutex());
+    np_event_queue_post_timed_event(eq, &event, 200);
+    // The event stays a timed event, the strict post logs an error.
+    np_event_queue_post(eq, &event);
+    np_event_queue_post_maybe_double(eq, &event);
+    nabto_device_threads_mutex_unlock(q->coreMutex());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_TEST(t.executed == (size_t)0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    BOOST_TEST(t.executed == (size_t)1);
+
+    q->stop();
+    np_event_queue_deinit_event(eq, &event);
+}
+
+BOOST_TEST_DECORATOR(* boost::unit_test::timeout(120))
+BOOST_DATA_TEST_CASE(posted_event_is_rearmed_as_timed_event, nabto::test::EventQueueImplFactory::all(), factory)
+{
+    auto q = factory->create();
+    struct np_event_queue* eq = q->eq();
+
+    CountingEvent t;
+    struct np_event event;
+    np_event_queue_init_event(eq, &event, &countingEvent, &t);
+
+    nabto_device_threads_mutex_lock(q->coreMutex());
+    np_event_queue_post(eq, &event);
+    np_event_queue_post_timed_event(eq, &event, 200);
+    nabto_device_threads_mutex_unlock(q->coreMutex());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BOOST_TEST(t.executed == (size_t)0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(400));
+    BOOST_TEST(t.executed == (size_t)1);
+
+    q->stop();
+    np_event_queue_deinit_event(eq, &event);
+}
+
+BOOST_TEST_DECORATOR(* boost::unit_test::timeout(120))
+BOOST_DATA_TEST_CASE(embedded_events_are_not_allocated, nabto::test::EventQueueImplFactory::all(), factory)
+{
+    auto q = factory->create();
+    struct np_event_queue* eq = q->eq();
+    size_t allocations = 42;
+
+    CountingEvent t;
+    std::vector<struct np_event> events(8);
+    for (auto& e : events) {
+        np_event_queue_init_event(eq, &e, &countingEvent, &t);
+    }
+    for (auto& e : events) {
+        np_event_queue_post(eq, &e);
+    }
+    while (t.executed < events.size()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    BOOST_TEST(np_event_queue_get_event_allocations(eq, &allocations) == NABTO_EC_OK);
+    BOOST_TEST(allocations == (size_t)0);
+
+    // only events created by the queue are allocated.
+    struct np_event* created = NULL;
+    BOOST_TEST(np_event_queue_create_event(eq, &countingEvent, &t, &created) == NABTO_EC_OK);
+    BOOST_TEST(np_event_queue_get_event_allocations(eq, &allocations) == NABTO_EC_OK);
+    BOOST_TEST(allocations == (size_t)1);
+
+    q->stop();
+    np_event_queue_destroy_event(eq, created);
+    for (auto& e : events) {
+        np_event_queue_deinit_event(eq, &e);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
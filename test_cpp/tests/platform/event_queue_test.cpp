@@ -1,257 +1,159 @@
 #include <boost/test/unit_test.hpp>
 
-#include <platform/np_platform.h>
+#include <modules/event_queue/nm_event_queue.h>
+#include <modules/event_queue/nm_event_queue_stats.h>
 
-namespace
-{
-
-struct test_state {
-    bool called;
-};
-
-static void np_test_callback(void* data)
-{
-    struct test_state* state = (struct test_state*)data;
-    state->called = true;
-}
+#include <cstring>
+#include <vector>
 
-static void np_timed_event_test_callback(const np_error_code ec, void* data)
-{
-    struct test_state* state = (struct test_state*)data;
-    state->called = true;
-}
+namespace {
 
-uint32_t time_;
-bool np_platform_test_ts_passed_or_now(uint32_t* timestamp)
+void noop(void* data)
 {
-    return (time_ >= *timestamp);
+    (void)data;
 }
 
-void np_platform_test_ts_now(uint32_t* ts)
-{
-    *ts = time_;
-}
-bool np_platform_test_ts_less_or_equal(uint32_t* t1, uint32_t* t2)
-{
-    return (*t1 <= *t2);
-}
-
-void np_platform_test_ts_set_future_timestamp(uint32_t* ts, uint32_t milliseconds)
-{
-    *ts = time_ + milliseconds;
-}
-
-}
+} // namespace
 
 BOOST_AUTO_TEST_SUITE(event_queue)
 
-
-BOOST_AUTO_TEST_CASE(test_post_event)
+BOOST_AUTO_TEST_CASE(events_in_post_order)
 {
-    struct np_platform pl;
-
-    np_event_queue_init(&pl, NULL, NULL);
-
-    BOOST_TEST(np_event_queue_is_event_queue_empty(&pl));
-
-    struct test_state state;
-    state.called = false;
-
-    struct np_event event;
-
-    np_event_queue_post(&pl, &event, &np_test_callback, &state);
-
-    BOOST_TEST(!np_event_queue_is_event_queue_empty(&pl));
-
-    np_event_queue_poll_one(&pl);
-
-    BOOST_TEST(np_event_queue_is_event_queue_empty(&pl));
-
-    BOOST_TEST(state.called);
-}
-
-BOOST_AUTO_TEST_CASE(test_post_many_event)
-{
-    struct np_platform pl;
-    int i;
-
-    np_event_queue_init(&pl, NULL, NULL);
-
-    BOOST_TEST(np_event_queue_is_event_queue_empty(&pl));
-
-    struct test_state state[100];
-    for (i = 0; i < 100; i++) {
-        state[i].called = false;
-    }
-
-    struct np_event event[100];
-
-    for(i = 0; i < 100; i++) {
-        np_event_queue_post(&pl, &event[i], &np_test_callback, &state[i]);
+    struct nm_event_queue queue;
+    nm_event_queue_init(&queue);
+    std::vector<struct nm_event_queue_event> events(100);
+    for (auto& e : events) {
+        nm_event_queue_event_init(&e, &noop, NULL);
+        nm_event_queue_post_event(&queue, &e);
     }
-
-    for (int i = 0; i < 100; i++) {
-        BOOST_TEST(!np_event_queue_is_event_queue_empty(&pl));
-        np_event_queue_poll_one(&pl);
+    struct nm_event_queue_event* event;
+    for (auto& e : events) {
+        BOOST_TEST(nm_event_queue_take_event(&queue, &event));
+        BOOST_TEST(event == &e);
     }
-
-    BOOST_TEST(np_event_queue_is_event_queue_empty(&pl));
-
-    for (int i = 0; i < 100; i++) {
-        BOOST_TEST(state[i].called);
+    BOOST_TEST(!nm_event_queue_take_event(&queue, &event));
+    for (auto& e : events) {
+        nm_event_queue_event_deinit(&e);
     }
 }
 
-BOOST_AUTO_TEST_CASE(test_post_timed_event)
+BOOST_AUTO_TEST_CASE(cancel_timed_event)
 {
-    struct np_platform pl;
-    np_event_queue_init(&pl, NULL, NULL);
-
-    time_ = 0;
-    pl.ts.passed_or_now = &np_platform_test_ts_passed_or_now;
-    pl.ts.less_or_equal = &np_platform_test_ts_less_or_equal;
-    pl.ts.now = &np_platform_test_ts_now;
-    pl.ts.set_future_timestamp = &np_platform_test_ts_set_future_timestamp;
-
-    BOOST_TEST(!np_event_queue_has_timed_event(&pl));
-
-    struct np_timed_event event;
-    struct test_state state;
-    state.called = false;
-
-    np_event_queue_post_timed_event(&pl, &event, 50, &np_timed_event_test_callback, &state);
-
-    BOOST_TEST(np_event_queue_has_timed_event(&pl));
-
-    BOOST_TEST(!np_event_queue_has_ready_timed_event(&pl));
-
-    time_ += 100;
-
-    BOOST_TEST(np_event_queue_has_ready_timed_event(&pl));
-
-    np_event_queue_poll_one_timed_event(&pl);
-
-    BOOST_TEST(!np_event_queue_has_ready_timed_event(&pl));
-    BOOST_TEST(!np_event_queue_has_timed_event(&pl));
-
-    BOOST_TEST(state.called == true);
+    struct nm_event_queue queue;
+    nm_event_queue_init(&queue);
+    struct nm_event_queue_event first;
+    struct nm_event_queue_event second;
+    struct nm_event_queue_event third;
+    nm_event_queue_event_init(&first, &noop, NULL);
+    nm_event_queue_event_init(&second, &noop, NULL);
+    nm_event_queue_event_init(&third, &noop, NULL);
+    nm_event_queue_post_timed_event(&queue, &first, 50);
+    nm_event_queue_post_timed_event(&queue, &second, 50);
+    nm_event_queue_post_timed_event(&queue, &third, 50);
+
+    nm_event_queue_cancel_event(&second);
+
+    struct nm_event_queue_event* event;
+    BOOST_TEST(nm_event_queue_take_timed_event(&queue, 100, &event));
+    BOOST_TEST(event == &first);
+    BOOST_TEST(nm_event_queue_take_timed_event(&queue, 100, &event));
+    BOOST_TEST(event == &third);
+    BOOST_TEST(!nm_event_queue_take_timed_event(&queue, 100, &event));
+
+    nm_event_queue_event_deinit(&first);
+    nm_event_queue_event_deinit(&second);
+    nm_event_queue_event_deinit(&third);
 }
 
-BOOST_AUTO_TEST_CASE(cancel_timed_event)
+BOOST_AUTO_TEST_CASE(timed_events_in_timestamp_order)
 {
-    struct np_platform pl;
-    np_event_queue_init(&pl, NULL, NULL);
-
-    time_ = 0;
-    pl.ts.passed_or_now = &np_platform_test_ts_passed_or_now;
-    pl.ts.less_or_equal = &np_platform_test_ts_less_or_equal;
-    pl.ts.now = &np_platform_test_ts_now;
-    pl.ts.set_future_timestamp = &np_platform_test_ts_set_future_timestamp;
-
-    BOOST_TEST(!np_event_queue_has_timed_event(&pl));
-
-    struct np_timed_event event;
-    struct test_state state;
-    state.called = false;
-
-    np_event_queue_post_timed_event(&pl, &event, 50, &np_timed_event_test_callback, &state);
-
-    BOOST_TEST(np_event_queue_has_timed_event(&pl));
-
-    np_event_queue_cancel_event(&pl, &event);
-
-    BOOST_TEST(!np_event_queue_has_timed_event(&pl));
-
-    time_ += 100;
-
-    np_event_queue_poll_one_timed_event(&pl);
-
-    BOOST_TEST(state.called == false);
+    struct nm_event_queue queue;
+    nm_event_queue_init(&queue);
+    struct nm_event_queue_event late;
+    struct nm_event_queue_event early;
+    nm_event_queue_event_init(&late, &noop, NULL);
+    nm_event_queue_event_init(&early, &noop, NULL);
+    // the timestamps wrap around.
+    nm_event_queue_post_timed_event(&queue, &late, 5000);
+    nm_event_queue_post_timed_event(&queue, &early, 0xfffffff0);
+
+    uint32_t next;
+    BOOST_TEST(nm_event_queue_next_timed_event(&queue, &next));
+    BOOST_TEST(next == 0xfffffff0u);
+
+    struct nm_event_queue_event* event;
+    BOOST_TEST(nm_event_queue_take_timed_event(&queue, 100, &event));
+    BOOST_TEST(event == &early);
+    BOOST_TEST(!nm_event_queue_take_timed_event(&queue, 100, &event));
+    BOOST_TEST(nm_event_queue_take_timed_event(&queue, 5000, &event));
+    BOOST_TEST(event == &late);
+
+    nm_event_queue_event_deinit(&late);
+    nm_event_queue_event_deinit(&early);
 }
 
-BOOST_AUTO_TEST_CASE(test_cancel_timed_event_for_non_empty_q)
+BOOST_AUTO_TEST_CASE(timed_events_same_timestamp_in_post_order)
 {
-    struct np_platform pl;
-    np_event_queue_init(&pl, NULL, NULL);
-
-    time_ = 0;
-    pl.ts.passed_or_now = &np_platform_test_ts_passed_or_now;
-    pl.ts.less_or_equal = &np_platform_test_ts_less_or_equal;
-    pl.ts.now = &np_platform_test_ts_now;
-    pl.ts.set_future_timestamp = &np_platform_test_ts_set_future_timestamp;
-
-    BOOST_TEST(!np_event_queue_has_timed_event(&pl));
-
-    struct np_timed_event event;
-    struct np_timed_event event2;
-    struct np_timed_event event3;
-    struct test_state state;
-    struct test_state state2;
-    struct test_state state3;
-    state.called = false;
-
-    np_event_queue_post_timed_event(&pl, &event2, 50, &np_timed_event_test_callback, &state2);
-    np_event_queue_post_timed_event(&pl, &event, 50, &np_timed_event_test_callback, &state);
-    np_event_queue_post_timed_event(&pl, &event3, 50, &np_timed_event_test_callback, &state3);
-
-    BOOST_TEST(np_event_queue_has_timed_event(&pl));
-
-    np_event_queue_cancel_event(&pl, &event);
-
-    time_ += 100;
-
-    np_event_queue_poll_one_timed_event(&pl);
-    np_event_queue_poll_one_timed_event(&pl);
-    np_event_queue_poll_one_timed_event(&pl);
-
-    BOOST_TEST(state.called == false);
+    struct nm_event_queue queue;
+    nm_event_queue_init(&queue);
+    std::vector<struct nm_event_queue_event> events(8);
+    for (auto& e : events) {
+        nm_event_queue_event_init(&e, &noop, NULL);
+        nm_event_queue_post_timed_event(&queue, &e, 1000);
+    }
+    struct nm_event_queue_event* event;
+    BOOST_TEST(!nm_event_queue_take_timed_event(&queue, 999, &event));
+    for (auto& e : events) {
+        BOOST_TEST(nm_event_queue_take_timed_event(&queue, 1000, &event));
+        BOOST_TEST(event == &e);
+    }
+    BOOST_TEST(!nm_event_queue_take_timed_event(&queue, 1000, &event));
 }
 
-
-BOOST_AUTO_TEST_CASE(test_post_timed_event_sorting)
+BOOST_AUTO_TEST_CASE(stats_histogram_log2_buckets)
 {
-    struct np_platform pl;
-    np_event_queue_init(&pl, NULL, NULL);
-
-    time_ = 0;
-    pl.ts.passed_or_now = &np_platform_test_ts_passed_or_now;
-    pl.ts.less_or_equal = &np_platform_test_ts_less_or_equal;
-    pl.ts.now = &np_platform_test_ts_now;
-    pl.ts.set_future_timestamp = &np_platform_test_ts_set_future_timestamp;
-
-    BOOST_TEST(!np_event_queue_has_timed_event(&pl));
-
-    struct np_timed_event event1;
-    struct np_timed_event event2;
-    struct test_state state1;
-    struct test_state state2;
-    state1.called = false;
-    state2.called = false;
-
-    np_event_queue_post_timed_event(&pl, &event1, 5000, &np_timed_event_test_callback, &state1);
-
-    BOOST_TEST(np_event_queue_has_timed_event(&pl));
-
-    BOOST_TEST(!np_event_queue_has_ready_timed_event(&pl));
-
-    time_ += 100;
-
-    BOOST_TEST(!np_event_queue_has_ready_timed_event(&pl));
-
-    np_event_queue_post_timed_event(&pl, &event2, 50, &np_timed_event_test_callback, &state2);
-
-    time_ += 100;
-
-    BOOST_TEST(np_event_queue_has_ready_timed_event(&pl));
-
-    np_event_queue_poll_one_timed_event(&pl);
-
-    BOOST_TEST(!np_event_queue_has_ready_timed_event(&pl));
-    BOOST_TEST(np_event_queue_has_timed_event(&pl));
-
-    BOOST_TEST(state2.called == true);
-    BOOST_TEST(state1.called == false);
+    struct np_event_queue_histogram histogram;
+    memset(&histogram, 0, sizeof(histogram));
+    nm_event_queue_stats_histogram_add(&histogram, 0);
+    nm_event_queue_stats_histogram_add(&histogram, 1);
+    nm_event_queue_stats_histogram_add(&histogram, 2);
+    nm_event_queue_stats_histogram_add(&histogram, 3);
+    nm_event_queue_stats_histogram_add(&histogram, 1000);
+    nm_event_queue_stats_histogram_add(&histogram, UINT32_MAX);
+
+    BOOST_TEST(histogram.buckets[0] == 1u);
+    BOOST_TEST(histogram.buckets[1] == 1u);
+    BOOST_TEST(histogram.buckets[2] == 2u);
+    // 512 <= 1000 < 1024
+    BOOST_TEST(histogram.buckets[10] == 1u);
+    BOOST_TEST(histogram.buckets[NP_EVENT_QUEUE_HISTOGRAM_BUCKETS - 1] == 1u);
+    BOOST_TEST(histogram.count == 6u);
+    BOOST_TEST(histogram.sum == (uint64_t)1006 + UINT32_MAX);
+    BOOST_TEST(histogram.max == UINT32_MAX);
 }
 
+BOOST_AUTO_TEST_CASE(stats_callbacks_by_function)
+{
+    struct np_event_queue_stats stats;
+    nm_event_queue_stats_init(&stats);
+    nm_event_queue_stats_add_event(&stats, &noop, 0, 10, 5);
+    nm_event_queue_stats_add_event(&stats, &noop, 3, 20, 7);
+
+    BOOST_TEST(stats.duration.count == 2u);
+    BOOST_TEST(stats.latency.sum == 30u);
+    BOOST_TEST(stats.depth.max == 3u);
+    size_t found = 0;
+    for (auto& c : stats.callbacks) {
+        if (c.cb == &noop) {
+            found++;
+            BOOST_TEST(c.duration.count == 2u);
+            BOOST_TEST(c.duration.sum == 12u);
+        } else {
+            BOOST_TEST(c.cb == (np_event_callback)NULL);
+        }
+    }
+    BOOST_TEST(found == 1u);
+    BOOST_TEST(stats.otherCallbacks.count == 0u);
+}
 
 BOOST_AUTO_TEST_SUITE_END()
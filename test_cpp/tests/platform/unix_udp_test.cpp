@@ -0,0 +1,330 @@
+#include <boost/test/unit_test.hpp>
+
+#include <modules/unix/nm_unix_udp.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <string.h>
+
+#include <vector>
+
+namespace {
+
+/**
+ * A nonblocking ipv4 udp socket bound to a random port on loopback.
+ */
+class LoopbackSocket {
+ public:
+    LoopbackSocket()
+    {
+        sock_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        BOOST_REQUIRE(sock_ >= 0);
+        int flags = fcntl(sock_, F_GETFL, 0);
+        fcntl(sock_, F_SETFL, flags | O_NONBLOCK);
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        BOOST_REQUIRE(::bind(sock_, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+
+        socklen_t addrLen = sizeof(addr);
+        BOOST_REQUIRE(getsockname(sock_, (struct sockaddr*)&addr, &addrLen) == 0);
+        port_ = ntohs(addr.sin_port);
+    }
+
+    ~LoopbackSocket()
+    {
+        ::close(sock_);
+    }
+
+    int sock() { return sock_; }
+
+    struct np_udp_endpoint endpoint()
+    {
+        return loopback(port_);
+    }
+
+    static struct np_udp_endpoint loopback(uint16_t port)
+    {
+        struct np_udp_endpoint ep;
+        memset(&ep, 0, sizeof(ep));
+        uint8_t addr[] = { 0x7F, 0x00, 0x00, 0x01 };
+        ep.ip.type = NABTO_IPV4;
+        memcpy(ep.ip.ip.v4, addr, 4);
+        ep.port = port;
+        return ep;
+    }
+
+    bool waitReadable()
+    {
+        struct pollfd pfd;
+        pfd.fd = sock_;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        return poll(&pfd, 1, 1000) == 1;
+    }
+
+    /**
+     * Read single datagrams until count is read or nothing arrives
+     * within a second.
+     */
+    std::vector<std::vector<uint8_t> > readPackets(size_t count)
+    {
+        std::vector<std::vector<uint8_t> > packets;
+        while (packets.size() < count && waitReadable()) {
+            uint8_t buffer[1500];
+            size_t readLength;
+            struct np_udp_endpoint ep;
+            while (packets.size() < count &&
+                   nm_unix_udp_recv_from(sock_, NABTO_IPV4, &ep, buffer, sizeof(buffer), &readLength) == NABTO_EC_OK)
+            {
+                packets.push_back(std::vector<uint8_t>(buffer, buffer + readLength));
+            }
+        }
+        return packets;
+    }
+
+    void sendTo(struct np_udp_endpoint ep, const std::vector<uint8_t>& packet)
+    {
+        BOOST_REQUIRE(nm_unix_udp_send_to(sock_, NABTO_IPV4, &ep, packet.data(), (uint16_t)packet.size()) == NABTO_EC_OK);
+    }
+
+ private:
+    int sock_;
+    uint16_t port_;
+};
+
+/**
+ * Packet number i has the size given and is filled with the byte i,
+ * such that the order and the segmentation can be checked on the
+ * receiving side.
+ */
+std::vector<uint8_t> makePacket(size_t i, size_t size)
+{
+    return std::vector<uint8_t>(size, (uint8_t)i);
+}
+
+std::vector<struct np_udp_send_entry> makeEntries(std::vector<std::vector<uint8_t> >& packets, struct np_udp_endpoint ep)
+{
+    std::vector<struct np_udp_send_entry> entries(packets.size());
+    for (size_t i = 0; i < packets.size(); i++) {
+        entries[i].ep = ep;
+        entries[i].buffer = packets[i].data();
+        entries[i].bufferSize = (uint16_t)packets[i].size();
+    }
+    return entries;
+}
+
+} // namespace
+
+BOOST_AUTO_TEST_SUITE(unix_udp)
+
+BOOST_AUTO_TEST_CASE(recv_batch)
+{
+    LoopbackSocket sender;
+    LoopbackSocket receiver;
+
+    size_t count = 8;
+    for (size_t i = 0; i < count; i++) {
+        sender.sendTo(receiver.endpoint(), makePacket(i, 100 + i));
+    }
+    BOOST_REQUIRE(receiver.waitReadable());
+
+    std::vector<std::vector<uint8_t> > buffers(count, std::vector<uint8_t>(1500));
+    std::vector<struct np_udp_recv_entry> entries(count);
+    for (size_t i = 0; i < count; i++) {
+        entries[i].buffer = buffers[i].data();
+        entries[i].bufferSize = buffers[i].size();
+    }
+
+    size_t received = 0;
+    size_t total = 0;
+    while (total < count && receiver.waitReadable()) {
+        BOOST_TEST(nm_unix_udp_recv_batch(receiver.sock(), NABTO_IPV4, entries.data() + total, count - total, &received) == NABTO_EC_OK);
+        total += received;
+    }
+    BOOST_TEST(total == count);
+
+    struct np_udp_endpoint senderEp = sender.endpoint();
+    for (size_t i = 0; i < total; i++) {
+        BOOST_TEST(entries[i].recvSize == 100 + i);
+        BOOST_TEST(entries[i].buffer[0] == (uint8_t)i);
+        BOOST_TEST(entries[i].ep.ip.type == NABTO_IPV4);
+        BOOST_TEST(memcmp(entries[i].ep.ip.ip.v4, senderEp.ip.ip.v4, 4) == 0);
+        BOOST_TEST(entries[i].ep.port == senderEp.port);
+    }
+
+    BOOST_TEST(nm_unix_udp_recv_batch(receiver.sock(), NABTO_IPV4, entries.data(), count, &received) == NABTO_EC_AGAIN);
+}
+
+BOOST_AUTO_TEST_CASE(recv_batch_larger_than_the_vector_size)
+{
+    LoopbackSocket sender;
+    LoopbackSocket receiver;
+
+    size_t count = NM_UNIX_UDP_MAX_RECV_BATCH + 5;
+    for (size_t i = 0; i < count; i++) {
+        sender.sendTo(receiver.endpoint(), makePacket(i, 10));
+    }
+
+    std::vector<std::vector<uint8_t> > buffers(count, std::vector<uint8_t>(1500));
+    std::vector<struct np_udp_recv_entry> entries(count);
+    for (size_t i = 0; i < count; i++) {
+        entries[i].buffer = buffers[i].data();
+        entries[i].bufferSize = buffers[i].size();
+    }
+
+    size_t total = 0;
+    while (total < count && receiver.waitReadable()) {
+        size_t received = 0;
+        BOOST_TEST(nm_unix_udp_recv_batch(receiver.sock(), NABTO_IPV4, entries.data() + total, count - total, &received) == NABTO_EC_OK);
+#if defined(HAVE_RECVMMSG)
+        BOOST_TEST(received <= (size_t)NM_UNIX_UDP_MAX_RECV_BATCH);
+#endif
+        total += received;
+    }
+    BOOST_TEST(total == count);
+    for (size_t i = 0; i < total; i++) {
+        BOOST_TEST(entries[i].recvSize == 10u);
+        BOOST_TEST(entries[i].buffer[0] == (uint8_t)i);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(send_batch)
+{
+    LoopbackSocket sender;
+    LoopbackSocket receiver;
+
+    // Different sizes such that the batch is not sent with GSO.
+    std::vector<std::vector<uint8_t> > packets;
+    for (size_t i = 0; i < 8; i++) {
+        packets.push_back(makePacket(i, 200 - i * 10));
+    }
+    std::vector<struct np_udp_send_entry> entries = makeEntries(packets, receiver.endpoint());
+
+    bool gsoDisabled = false;
+    BOOST_TEST(nm_unix_udp_send_batch(sender.sock(), NABTO_IPV4, &gsoDisabled, entries.data(), entries.size()) == NABTO_EC_OK);
+
+    std::vector<std::vector<uint8_t> > received = receiver.readPackets(packets.size());
+    BOOST_TEST(received.size() == packets.size());
+    for (size_t i = 0; i < received.size(); i++) {
+        BOOST_TEST((received[i] == packets[i]));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(send_batch_segmented)
+{
+    LoopbackSocket sender;
+    LoopbackSocket receiver;
+
+    // Same size packets to the same endpoint, the last packet is
+    // shorter. This is sent as one GSO datagram if the kernel
+    // supports it, else with sendmmsg, in both cases the receiver
+    // gets the original datagrams.
+    std::vector<std::vector<uint8_t> > packets;
+    for (size_t i = 0; i < 9; i++) {
+        packets.push_back(makePacket(i, 1000));
+    }
+    packets.push_back(makePacket(9, 123));
+    std::vector<struct np_udp_send_entry> entries = makeEntries(packets, receiver.endpoint());
+
+    bool gsoDisabled = false;
+    BOOST_TEST(nm_unix_udp_send_batch(sender.sock(), NABTO_IPV4, &gsoDisabled, entries.data(), entries.size()) == NABTO_EC_OK);
+
+    std::vector<std::vector<uint8_t> > received = receiver.readPackets(packets.size() + 1);
+    BOOST_TEST(received.size() == packets.size());
+    for (size_t i = 0; i < received.size() && i < packets.size(); i++) {
+        BOOST_TEST((received[i] == packets[i]));
+    }
+
+    // A second batch is sent the same way, with or without GSO.
+    BOOST_TEST(nm_unix_udp_send_batch(sender.sock(), NABTO_IPV4, &gsoDisabled, entries.data(), entries.size()) == NABTO_EC_OK);
+    received = receiver.readPackets(packets.size());
+    BOOST_TEST(received.size() == packets.size());
+}
+
+BOOST_AUTO_TEST_CASE(partial_send_continues_with_the_rest)
+{
+    LoopbackSocket sender;
+    LoopbackSocket receiver;
+
+    // The kernel rejects the third packet as port 0 is not a valid
+    // destination, sendmmsg then returns after the first two
+    // packets and the remaining packets has to be sent by new calls.
+    std::vector<std::vector<uint8_t> > packets;
+    for (size_t i = 0; i < 6; i++) {
+        packets.push_back(makePacket(i, 50 + i));
+    }
+    std::vector<struct np_udp_send_entry> entries = makeEntries(packets, receiver.endpoint());
+    entries[2].ep = LoopbackSocket::loopback(0);
+
+    bool gsoDisabled = false;
+    BOOST_TEST(nm_unix_udp_send_batch(sender.sock(), NABTO_IPV4, &gsoDisabled, entries.data(), entries.size()) == NABTO_EC_FAILED_TO_SEND_PACKET);
+
+    std::vector<std::vector<uint8_t> > received = receiver.readPackets(packets.size());
+    BOOST_REQUIRE(received.size() == 5u);
+    BOOST_TEST((received[0] == packets[0]));
+    BOOST_TEST((received[1] == packets[1]));
+    BOOST_TEST((received[2] == packets[3]));
+    BOOST_TEST((received[3] == packets[4]));
+    BOOST_TEST((received[4] == packets[5]));
+}
+
+BOOST_AUTO_TEST_CASE(failed_message_in_the_middle_of_a_batch)
+{
+    LoopbackSocket sender;
+    LoopbackSocket receiver;
+
+    // An ipv6 endpoint cannot be reached from an ipv4 socket, the
+    // packet fails before it is given to the kernel.
+    std::vector<std::vector<uint8_t> > packets;
+    for (size_t i = 0; i < 5; i++) {
+        packets.push_back(makePacket(i, 100));
+    }
+    std::vector<struct np_udp_send_entry> entries = makeEntries(packets, receiver.endpoint());
+    entries[2].ep.ip.type = NABTO_IPV6;
+    memset(entries[2].ep.ip.ip.v6, 0, 16);
+    entries[2].ep.ip.ip.v6[15] = 1;
+
+    bool gsoDisabled = false;
+    BOOST_TEST(nm_unix_udp_send_batch(sender.sock(), NABTO_IPV4, &gsoDisabled, entries.data(), entries.size()) == NABTO_EC_FAILED_TO_SEND_PACKET);
+
+    std::vector<std::vector<uint8_t> > received = receiver.readPackets(packets.size());
+    BOOST_REQUIRE(received.size() == 4u);
+    BOOST_TEST(received[0][0] == 0);
+    BOOST_TEST(received[1][0] == 1);
+    BOOST_TEST(received[2][0] == 3);
+    BOOST_TEST(received[3][0] == 4);
+}
+
+BOOST_AUTO_TEST_CASE(send_batch_larger_than_the_vector_size)
+{
+    LoopbackSocket sender;
+    LoopbackSocket receiver;
+
+    size_t count = NM_UNIX_UDP_MAX_SEND_BATCH * 2 + 3;
+    std::vector<std::vector<uint8_t> > packets;
+    for (size_t i = 0; i < count; i++) {
+        // alternate the size such that no chunk is sent with GSO.
+        packets.push_back(makePacket(i, 64 + (i % 2)));
+    }
+    std::vector<struct np_udp_send_entry> entries = makeEntries(packets, receiver.endpoint());
+
+    bool gsoDisabled = false;
+    BOOST_TEST(nm_unix_udp_send_batch(sender.sock(), NABTO_IPV4, &gsoDisabled, entries.data(), entries.size()) == NABTO_EC_OK);
+
+    std::vector<std::vector<uint8_t> > received = receiver.readPackets(count);
+    BOOST_TEST(received.size() == count);
+    for (size_t i = 0; i < received.size(); i++) {
+        BOOST_TEST((received[i] == packets[i]));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()